@@ -0,0 +1,449 @@
+﻿#include "pch.h"
+#include "ToolCommands.h"
+#include "Iec104Master.h"
+#include "Iec104Outstation.h"
+#include <algorithm>
+#include <memory>
+
+namespace
+{
+    constexpr size_t SEND_RING_SIZE = 4096;        // 每站在途ASDU发送时刻（受k窗口限制，远小于此值）
+    constexpr DWORD START_TIMEOUT_MS = 10000;
+    constexpr DWORD ROUND_TIMEOUT_MS = 30000;
+
+    INT64 QpcNow()
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        return now.QuadPart;
+    }
+
+    UINT64 FileTimeTo100ns(const FILETIME &ft)
+    {
+        return ((UINT64)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    }
+
+    UINT64 ProcessCpu100ns()
+    {
+        FILETIME creation, exitTime, kernel, user;
+        GetProcessTimes(GetCurrentProcess(), &creation, &exitTime, &kernel, &user);
+        return FileTimeTo100ns(kernel) + FileTimeTo100ns(user);
+    }
+
+    UINT64 ThreadCpu100ns()
+    {
+        FILETIME creation, exitTime, kernel, user;
+        GetThreadTimes(GetCurrentThread(), &creation, &exitTime, &kernel, &user);
+        return FileTimeTo100ns(kernel) + FileTimeTo100ns(user);
+    }
+
+    // 每个子站对应一个主站连接
+    // - 仿真子站工作线程在生成突发ASDU时写入发送时刻（单生产者）
+    // - 主站I/O线程在数据回调中按顺序取出并计算时延（单消费者）
+    struct BenchStation
+    {
+        std::unique_ptr<CIec104Master> master;
+        INT64 sendTicks[SEND_RING_SIZE];
+        std::atomic<UINT64> sendHead{ 0 };
+        std::atomic<UINT64> sendTail{ 0 };
+        std::vector<float> latencyUs;          // 仅I/O线程写入，回合结束后由主线程读取
+        std::atomic<UINT64> roundTarget{ 0 };
+        std::atomic<bool> roundFirst{ true };
+        UINT64 roundCpuStart = 0;
+        UINT64 masterCpu100ns = 0;
+        std::atomic<UINT64> asdus{ 0 };
+        std::atomic<UINT64> points{ 0 };
+    };
+
+    struct BenchCase
+    {
+        int stations;
+        int burst;
+        BYTE type;
+        bool tls;
+        Iec104LinkProfile profile;
+    };
+
+    // TLS基准共用的凭据：服务端（仿真子站）与客户端（主站，不校验自签名证书）
+    struct BenchTls
+    {
+        std::shared_ptr<CIec104TlsCredentials> server;
+        std::shared_ptr<CIec104TlsCredentials> client;
+    };
+
+    struct BenchResult
+    {
+        UINT64 asdus = 0;
+        UINT64 points = 0;
+        double elapsedSec = 0.0;
+        UINT64 cpu100ns = 0;
+        UINT64 masterCpu100ns = 0;
+        std::vector<float> latencyUs;
+        UINT64 seqErrors = 0;          // 各站序号缺口、重复与非法确认之和，正常应为0
+        bool complete = true;
+    };
+
+    bool RunBenchCase(const BenchCase &bench, const BenchTls &tls, int rounds, int basePort, int pointsPerStation, int k, BenchResult &result,
+                      std::wstring &err)
+    {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        double usPerTick = 1e6 / freq.QuadPart;
+
+        // 仿真子站：每站点数不少于突发点数，保证每轮每点只变化一次（不合并）
+        // 子站回调引用 BenchStation，服务需先于其析构
+        std::vector<std::unique_ptr<BenchStation>> stations;
+        CIec104SimServer server;
+        Iec104OutstationConfig config;
+        config.k = k;
+        if (bench.tls)
+            config.tls = tls.server;
+        config.profile = bench.profile;
+        Iec104SimPointGroup group = { bench.type, 1, (DWORD)(std::max)(pointsPerStation, bench.burst) };
+        config.groups.push_back(group);
+
+        for (int i = 0; i < bench.stations; ++i)
+        {
+            stations.emplace_back(new BenchStation());
+            BenchStation *station = stations.back().get();
+            station->latencyUs.reserve((size_t)rounds * bench.burst);
+
+            config.port = (WORD)(basePort + i);
+            config.commonAddr = (WORD)(i + 1);
+            CIec104Outstation &outstation = server.AddStation(config);
+            outstation.SetSendHook([station](BYTE, int) {
+                UINT64 head = station->sendHead.load(std::memory_order_relaxed);
+                station->sendTicks[head % SEND_RING_SIZE] = QpcNow();
+                station->sendHead.store(head + 1, std::memory_order_release);
+            });
+        }
+
+        int threads = (std::min)(bench.stations, (int)(std::max)(1u, std::thread::hardware_concurrency() / 2));
+        if (!server.Start(threads, &err))
+            return false;
+
+        // 主站：回调中计算时延并累计点数
+        for (int i = 0; i < bench.stations; ++i)
+        {
+            BenchStation *station = stations[i].get();
+            station->master.reset(new CIec104Master());
+            CIec104Master &master = *station->master;
+            master.SetLogLevel(Iec104LogLevel::LOG_ERROR);
+            master.SetFrameRecording(false);
+            master.SetLinkProfile(bench.profile);
+            master.SetDataCallback([station, usPerTick](const CIec104PointBatch &batch) {
+                INT64 now = QpcNow();
+                if (station->roundFirst.exchange(false))
+                {
+                    station->roundCpuStart = ThreadCpu100ns();
+                }
+
+                UINT64 tail = station->sendTail.load(std::memory_order_relaxed);
+                if (tail < station->sendHead.load(std::memory_order_acquire))
+                {
+                    station->latencyUs.push_back((float)((now - station->sendTicks[tail % SEND_RING_SIZE]) * usPerTick));
+                    station->sendTail.store(tail + 1, std::memory_order_relaxed);
+                }
+
+                UINT64 points = station->points.load(std::memory_order_relaxed) + batch.size();
+                if (points >= station->roundTarget)
+                {
+                    station->masterCpu100ns += ThreadCpu100ns() - station->roundCpuStart;
+                }
+                station->asdus.fetch_add(1, std::memory_order_relaxed);
+                station->points.store(points, std::memory_order_release);
+            });
+
+            // 各主站并行建立连接
+            if (bench.tls)
+                master.SetTls(tls.client, L"bench");
+            if (!master.ConnectAsync(L"127.0.0.1", (WORD)(basePort + i)))
+            {
+                err = L"主站连接仿真子站失败，端口 " + std::to_wstring(basePort + i);
+                return false;
+            }
+        }
+
+        ULONGLONG deadline = GetTickCount64() + START_TIMEOUT_MS;
+        for (size_t i = 0; i < stations.size(); ++i)
+        {
+            CIec104Master &master = *stations[i]->master;
+            while (master.GetState() == Iec104State::CONNECTING && GetTickCount64() < deadline)
+                Sleep(1);
+            if (!master.IsConnected() || !master.StartDataTransfer())
+            {
+                err = L"主站连接仿真子站失败，端口 " + std::to_wstring(basePort + i);
+                return false;
+            }
+        }
+
+        for (auto &station : stations)
+        {
+            while (!station->master->IsStarted() && GetTickCount64() < deadline)
+                Sleep(1);
+            if (!station->master->IsStarted())
+            {
+                err = L"等待STARTDT_CON超时";
+                return false;
+            }
+        }
+
+        // 逐轮注入突发，等待所有主站收齐后再进入下一轮
+        UINT64 cpuStart = ProcessCpu100ns();
+        INT64 elapsedTicks = 0;
+        for (int round = 1; round <= rounds && result.complete; ++round)
+        {
+            for (auto &station : stations)
+            {
+                station->roundTarget = (UINT64)round * bench.burst;
+                station->roundFirst = true;
+            }
+
+            INT64 roundStart = QpcNow();
+            for (size_t i = 0; i < stations.size(); ++i)
+                server.GetStation(i).RequestBurst(bench.burst);
+
+            ULONGLONG roundDeadline = GetTickCount64() + ROUND_TIMEOUT_MS;
+            for (auto &station : stations)
+            {
+                while (station->points.load(std::memory_order_acquire) < station->roundTarget && GetTickCount64() < roundDeadline)
+                    Sleep(0);
+                if (station->points.load(std::memory_order_acquire) < station->roundTarget)
+                    result.complete = false;
+            }
+            elapsedTicks += QpcNow() - roundStart;
+        }
+        result.cpu100ns = ProcessCpu100ns() - cpuStart;
+        result.elapsedSec = elapsedTicks / (double)freq.QuadPart;
+
+        for (auto &station : stations)
+        {
+            station->master->Disconnect();
+            Iec104SequenceStats seq = station->master->GetSequenceStats();
+            result.seqErrors += seq.gaps + seq.duplicates + seq.invalidAcks;
+            result.asdus += station->asdus;
+            result.points += station->points;
+            result.masterCpu100ns += station->masterCpu100ns;
+            result.latencyUs.insert(result.latencyUs.end(), station->latencyUs.begin(), station->latencyUs.end());
+        }
+        server.Stop();
+        return true;
+    }
+
+    struct HandshakeResult
+    {
+        int connections = 0;
+        UINT64 resumed = 0;
+        double connectSec = 0.0;
+        UINT64 cpu100ns = 0;
+        std::vector<float> connectUs;
+    };
+
+    // 逐个建立连接（TCP + 可选TLS握手）再断开，只统计建立连接的时间
+    // mode：0 明文TCP，1 TLS完整握手（每次使用不同的服务器名，不命中会话缓存），2 TLS会话恢复
+    bool RunHandshakeCase(int mode, const BenchTls &tls, int connections, int port, HandshakeResult &result, std::wstring &err)
+    {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+
+        CIec104SimServer server;
+        Iec104OutstationConfig config;
+        config.port = (WORD)port;
+        if (mode != 0)
+            config.tls = tls.server;
+        Iec104SimPointGroup group = { (BYTE)Iec104TypeId::M_ME_NC_1, 1, 1 };
+        config.groups.push_back(group);
+        server.AddStation(config);
+        if (!server.Start(1, &err))
+            return false;
+
+        CIec104Master master;
+        master.SetLogLevel(Iec104LogLevel::LOG_ERROR);
+        if (mode == 2)
+        {
+            // 预热：首次完整握手建立缓存的会话
+            master.SetTls(tls.client, L"bench-resume");
+            master.Connect(L"127.0.0.1", (WORD)port);
+            master.Disconnect();
+        }
+
+        result.connections = connections;
+        result.connectUs.reserve(connections);
+        UINT64 cpuStart = ProcessCpu100ns();
+        INT64 totalTicks = 0;
+        for (int i = 0; i < connections; ++i)
+        {
+            if (mode == 1)
+                master.SetTls(tls.client, L"bench-full-" + std::to_wstring(i));
+
+            INT64 start = QpcNow();
+            bool connected = master.Connect(L"127.0.0.1", (WORD)port);
+            INT64 ticks = QpcNow() - start;
+            if (!connected)
+            {
+                err = L"第 " + std::to_wstring(i + 1) + L" 次连接失败";
+                master.Disconnect();
+                server.Stop();
+                return false;
+            }
+
+            totalTicks += ticks;
+            result.connectUs.push_back((float)(ticks * 1e6 / freq.QuadPart));
+            if (master.IsTlsResumed())
+                ++result.resumed;
+            master.Disconnect();
+        }
+        result.cpu100ns = ProcessCpu100ns() - cpuStart;
+        result.connectSec = totalTicks / (double)freq.QuadPart;
+        server.Stop();
+        return true;
+    }
+
+    double Percentile(const std::vector<float> &sorted, double p)
+    {
+        if (sorted.empty())
+            return 0.0;
+        return sorted[(std::min)(sorted.size() - 1, (size_t)(sorted.size() * p))];
+    }
+}
+
+// bench [--stations 1,10] [--bursts 100,1000] [--types 13,1] [--rounds N] [--points N] [--port P] [--k 12] [--tls 0,1]
+//       [--handshakes N] [--tls-cert 主题] [--profile 2/2/3]
+int RunBenchCommand(const CToolArgs &args)
+{
+    std::vector<int> tlsModes = args.GetIntList(L"--tls", { 0 });
+    int handshakes = args.GetInt(L"--handshakes", 0);
+
+    BenchTls tls;
+    if (handshakes > 0 || std::find(tlsModes.begin(), tlsModes.end(), 1) != tlsModes.end())
+    {
+        std::wstring err;
+        tls.server = CreateSimTlsCredentials(args, err);
+        Iec104TlsConfig clientConfig;
+        clientConfig.verifyPeer = false;
+        tls.client = std::make_shared<CIec104TlsCredentials>();
+        if (!tls.server || !tls.client->InitClient(clientConfig, &err))
+        {
+            PrintError(err);
+            return 1;
+        }
+    }
+
+    std::vector<int> stationCounts = args.GetIntList(L"--stations", { 1, 10 });
+    std::vector<int> bursts = args.GetIntList(L"--bursts", { 100, 1000, 10000 });
+    std::vector<int> types = args.GetIntList(L"--types", { (int)Iec104TypeId::M_ME_NC_1, (int)Iec104TypeId::M_SP_TB_1 });
+    int rounds = args.GetInt(L"--rounds", 20);
+    int points = args.GetInt(L"--points", 10000);
+    int basePort = args.GetInt(L"--port", 24040);
+    int k = args.GetInt(L"--k", 12);
+
+    // 子站点数不少于突发点数，IOA从1开始
+    Iec104LinkProfile profile;
+    int maxBurst = bursts.empty() ? 0 : *std::max_element(bursts.begin(), bursts.end());
+    if (!GetProfileOption(args, (DWORD)(std::max)(points, maxBurst), profile))
+    {
+        return 2;
+    }
+
+    for (int type : types)
+    {
+        int elemLen = 0;
+        bool hasTime = false;
+        if (!Iec104GetMonitorLayout((BYTE)type, elemLen, hasTime))
+        {
+            PrintError(L"不支持的ASDU类型: " + std::to_wstring(type));
+            return 2;
+        }
+    }
+
+    // 每个组合输出一行JSON
+    int failures = 0;
+
+    // 握手基准：明文TCP、TLS完整握手、TLS会话恢复
+    if (handshakes > 0)
+    {
+        static const char *const modeNames[] = { "tcp", "tls_full", "tls_resumed" };
+        for (int mode = 0; mode < 3; ++mode)
+        {
+            HandshakeResult result;
+            std::wstring err;
+            if (!RunHandshakeCase(mode, tls, handshakes, basePort, result, err))
+            {
+                PrintError(err);
+                ++failures;
+                continue;
+            }
+
+            std::sort(result.connectUs.begin(), result.connectUs.end());
+            double seconds = result.connectSec > 0 ? result.connectSec : 1e-9;
+            CJsonLine()
+                .Add("command", "bench-handshake")
+                .Add("mode", modeNames[mode])
+                .Add("connections", result.connections)
+                .Add("resumed", result.resumed)
+                .Add("handshakes_per_s", result.connections / seconds)
+                .Add("cpu_us_per_connect", result.cpu100ns / 10.0 / result.connections)
+                .Add("connect_p50_us", Percentile(result.connectUs, 0.50))
+                .Add("connect_p99_us", Percentile(result.connectUs, 0.99))
+                .Print();
+        }
+        return failures == 0 ? 0 : 1;
+    }
+
+    for (int tlsMode : tlsModes)
+    {
+        for (int stations : stationCounts)
+        {
+            for (int burst : bursts)
+            {
+                for (int type : types)
+                {
+                    if (stations <= 0 || burst <= 0 || rounds <= 0 || basePort + stations - 1 > 65535)
+                    {
+                        PrintError(L"参数无效");
+                        return 2;
+                    }
+
+                    BenchCase bench = { stations, burst, (BYTE)type, tlsMode != 0, profile };
+                    BenchResult result;
+                    std::wstring err;
+                    if (!RunBenchCase(bench, tls, rounds, basePort, points, k, result, err))
+                    {
+                        PrintError(err);
+                        ++failures;
+                        continue;
+                    }
+
+                    std::sort(result.latencyUs.begin(), result.latencyUs.end());
+                    double seconds = result.elapsedSec > 0 ? result.elapsedSec : 1e-9;
+                    double pointCount = result.points > 0 ? (double)result.points : 1.0;
+                    CJsonLine()
+                        .Add("command", "bench")
+                        .Add("stations", stations)
+                        .Add("burst", burst)
+                        .Add("type", type)
+                        .Add("tls", bench.tls)
+                        .Add("profile", Iec104FormatProfile(profile))
+                        .Add("rounds", rounds)
+                        .Add("complete", result.complete)
+                        .Add("asdus", result.asdus)
+                        .Add("points", result.points)
+                        .Add("elapsed_s", result.elapsedSec)
+                        .Add("frames_per_s", result.asdus / seconds)
+                        .Add("points_per_s", result.points / seconds)
+                        .Add("cpu_us_per_point", result.cpu100ns / 10.0 / pointCount)
+                        .Add("master_cpu_us_per_point", result.masterCpu100ns / 10.0 / pointCount)
+                        .Add("latency_samples", (UINT64)result.latencyUs.size())
+                        .Add("latency_p50_us", Percentile(result.latencyUs, 0.50))
+                        .Add("latency_p99_us", Percentile(result.latencyUs, 0.99))
+                        .Add("latency_p999_us", Percentile(result.latencyUs, 0.999))
+                        .Add("latency_max_us", result.latencyUs.empty() ? 0.0 : (double)result.latencyUs.back())
+                        .Add("seq_errors", result.seqErrors)
+                        .Print();
+                }
+            }
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
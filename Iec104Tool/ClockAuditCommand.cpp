@@ -0,0 +1,315 @@
+﻿#include "pch.h"
+#include "ToolCommands.h"
+#include "Iec104ClockAudit.h"
+#include "Ntp.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    std::atomic<CIec104ClockAudit *> g_audit(nullptr);
+
+    BOOL WINAPI AuditCtrlHandler(DWORD ctrlType)
+    {
+        if (ctrlType == CTRL_C_EVENT || ctrlType == CTRL_BREAK_EVENT || ctrlType == CTRL_CLOSE_EVENT)
+        {
+            CIec104ClockAudit *audit = g_audit.load();
+            if (audit)
+                audit->Cancel();
+            return TRUE;
+        }
+        return FALSE;
+    }
+
+    const char *StatusName(Iec104ClockAuditStatus status)
+    {
+        switch (status)
+        {
+        case Iec104ClockAuditStatus::OK:
+            return "ok";
+        case Iec104ClockAuditStatus::DRIFTED:
+            return "drifted";
+        case Iec104ClockAuditStatus::CORRECTED:
+            return "corrected";
+        case Iec104ClockAuditStatus::CORRECT_FAILED:
+            return "correct_failed";
+        case Iec104ClockAuditStatus::READ_FAILED:
+            return "read_failed";
+        case Iec104ClockAuditStatus::CONNECT_FAILED:
+            return "connect_failed";
+        case Iec104ClockAuditStatus::TIMEOUT:
+            return "timeout";
+        default:
+            return "cancelled";
+        }
+    }
+
+    // 站列表文件：每行一个 地址[:端口][/公共地址]，# 之后为注释，UTF-8
+    bool LoadStationList(const std::wstring &path, std::vector<Iec104ClockAuditStation> &stations, std::wstring &err)
+    {
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            err = L"打开站列表失败: " + path;
+            return false;
+        }
+        LARGE_INTEGER size = {};
+        GetFileSizeEx(file, &size);
+        std::string content((size_t)size.QuadPart, '\0');
+        DWORD read = 0;
+        bool ok = content.empty() || (ReadFile(file, &content[0], (DWORD)content.size(), &read, nullptr) && read == content.size());
+        CloseHandle(file);
+        if (!ok)
+        {
+            err = L"读取站列表失败: " + path;
+            return false;
+        }
+        if (content.compare(0, 3, "\xEF\xBB\xBF") == 0)
+            content.erase(0, 3);
+
+        std::wstring text;
+        if (!content.empty())
+        {
+            int len = MultiByteToWideChar(CP_UTF8, 0, content.c_str(), (int)content.size(), nullptr, 0);
+            text.resize(len);
+            MultiByteToWideChar(CP_UTF8, 0, content.c_str(), (int)content.size(), &text[0], len);
+        }
+
+        size_t start = 0;
+        int lineNo = 0;
+        while (start < text.size())
+        {
+            size_t end = text.find(L'\n', start);
+            if (end == std::wstring::npos)
+                end = text.size();
+            std::wstring line = text.substr(start, end - start);
+            start = end + 1;
+            ++lineNo;
+
+            size_t hash = line.find(L'#');
+            if (hash != std::wstring::npos)
+                line.erase(hash);
+            size_t first = line.find_first_not_of(L" \t\r");
+            if (first == std::wstring::npos)
+                continue;
+            line = line.substr(first, line.find_last_not_of(L" \t\r") - first + 1);
+
+            ToolStationAddress address;
+            if (!ParseStationAddress(line, address))
+            {
+                err = L"站列表第 " + std::to_wstring(lineNo) + L" 行地址无效: " + line;
+                return false;
+            }
+            stations.push_back(Iec104ClockAuditStation{ address.host, address.port, address.commonAddr });
+        }
+        return true;
+    }
+
+    std::string FormatClock(const SYSTEMTIME &time)
+    {
+        char buf[32];
+        sprintf_s(buf, "%04u-%02u-%02u %02u:%02u:%02u.%03u", time.wYear, time.wMonth, time.wDay, time.wHour, time.wMinute, time.wSecond,
+                  time.wMilliseconds);
+        return buf;
+    }
+
+    CJsonLine StationLine(const Iec104ClockAuditResult &result)
+    {
+        CJsonLine line;
+        line.Add("command", "clockaudit")
+            .Add("event", "station")
+            .Add("index", (UINT64)result.index)
+            .Add("host", result.station.host)
+            .Add("port", (UINT64)result.station.port)
+            .Add("ca", (UINT64)result.station.commonAddr)
+            .Add("status", StatusName(result.status))
+            .Add("connect_ms", result.connectMs)
+            .Add("elapsed_ms", result.elapsedMs);
+        if (result.before.valid)
+        {
+            line.Add("clock", FormatClock(result.before.clock).c_str())
+                .Add("offset_ms", result.before.offsetUs / 1000.0)
+                .Add("uncertainty_ms", result.before.uncertaintyUs / 1000.0)
+                .Add("samples", result.before.samples)
+                .Add("rtt_min_ms", result.before.minRttUs / 1000.0)
+                .Add("rtt_max_ms", result.before.maxRttUs / 1000.0);
+        }
+        if (result.status == Iec104ClockAuditStatus::CORRECTED)
+        {
+            line.Add("correction_delay_ms", result.correctionDelayUs / 1000.0);
+            if (result.after.valid)
+            {
+                line.Add("offset_after_ms", result.after.offsetUs / 1000.0)
+                    .Add("uncertainty_after_ms", result.after.uncertaintyUs / 1000.0);
+            }
+        }
+        return line;
+    }
+}
+
+// clockaudit <地址[:端口][/公共地址]>... [--list 文件] [--count N] [--parallel 128] [--samples 5] [--ntp 服务器]
+//            [--correct] [--threshold ms] [--max-rtt ms] [--verify N] [--connect-timeout ms] [--timeout s]
+//            [--out 文件] [--profile 2/2/3] [--verbose]
+// 并行审计各站的时钟：每站多次读取时钟，取往返最短的样本按往返中点补偿，得到 偏差±不确定度；
+// --correct 时对偏差超过 --threshold 的站下发校正（参考时间 + 往返/2）并复测。参考时间为 --ntp 服务器的时间，未指定时为本机时钟。
+// 每站一行JSON（写入 --out 文件，未指定时输出到标准输出），最后输出汇总行；
+// --count N 把唯一的站地址展开为端口与公共地址依次加一的N个站（与 sim --stations N 的布局相同）
+int RunClockAuditCommand(const CToolArgs &args)
+{
+    std::vector<Iec104ClockAuditStation> stations;
+    std::wstring err;
+    for (const std::wstring &text : args.Positional())
+    {
+        ToolStationAddress address;
+        if (!ParseStationAddress(text, address))
+        {
+            PrintError(L"站地址无效: " + text);
+            return 2;
+        }
+        stations.push_back(Iec104ClockAuditStation{ address.host, address.port, address.commonAddr });
+    }
+    std::wstring listPath = args.Get(L"--list");
+    if (!listPath.empty() && !LoadStationList(listPath, stations, err))
+    {
+        PrintError(err);
+        return 1;
+    }
+    int count = args.GetInt(L"--count", 0);
+    if (count > 0)
+    {
+        if (stations.size() != 1 || stations[0].port + count - 1 > 65535 || stations[0].commonAddr + count - 1 > 65535)
+        {
+            PrintError(L"--count 需要且只能有一个站地址，展开后的端口与公共地址不能超过 65535");
+            return 2;
+        }
+        Iec104ClockAuditStation first = stations[0];
+        stations.clear();
+        for (int i = 0; i < count; ++i)
+        {
+            stations.push_back(Iec104ClockAuditStation{ first.host, (WORD)(first.port + i), (WORD)(first.commonAddr + i) });
+        }
+    }
+    if (stations.empty())
+    {
+        PrintError(L"用法: Iec104Tool clockaudit <地址[:端口][/公共地址]>... [--list 文件] [--count N] [--parallel N] [--samples N] "
+                   L"[--ntp 服务器] [--correct] [--threshold ms] [--max-rtt ms] [--verify N] [--connect-timeout ms] [--timeout s] [--out 文件]");
+        return 2;
+    }
+
+    Iec104ClockAuditConfig config;
+    config.maxConnections = (size_t)(std::max)(args.GetInt(L"--parallel", (int)config.maxConnections), 1);
+    config.samples = args.GetInt(L"--samples", config.samples);
+    config.correct = args.Has(L"--correct");
+    config.thresholdUs = (INT64)(args.GetDouble(L"--threshold", config.thresholdUs / 1000.0) * 1000);
+    config.maxCorrectRttMs = (DWORD)args.GetInt(L"--max-rtt", (int)config.maxCorrectRttMs);
+    config.verifySamples = args.GetInt(L"--verify", config.verifySamples);
+    config.connectTimeoutMs = (DWORD)args.GetInt(L"--connect-timeout", (int)config.connectTimeoutMs);
+    config.stationTimeoutMs = (DWORD)(args.GetDouble(L"--timeout", config.stationTimeoutMs / 1000.0) * 1000);
+    if (!GetProfileOption(args, 0, config.profile))
+    {
+        return 2;
+    }
+
+    // 参考时钟：NTP查询一次，整个审计期间使用同一个偏差
+    std::wstring ntpServer = args.Get(L"--ntp");
+    if (!ntpServer.empty())
+    {
+        CNtpClient ntp;
+        CNtpResult ntpResult{};
+        if (!ntp.Query(ntpServer, 123, 4, ntpResult))
+        {
+            PrintError(L"NTP查询失败: " + ntpResult.Error);
+            return 1;
+        }
+        config.referenceOffsetUs = (INT64)(ntpResult.OffsetMs * 1000.0);
+        PrintError(L"参考时钟 " + ntpServer + L"，本机偏差 " + std::to_wstring(ntpResult.OffsetMs) + L" ms");
+    }
+
+    HANDLE out = INVALID_HANDLE_VALUE;
+    std::wstring outPath = args.Get(L"--out");
+    if (!outPath.empty())
+    {
+        out = CreateFileW(outPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (out == INVALID_HANDLE_VALUE)
+        {
+            PrintError(L"创建报告文件失败: " + outPath);
+            return 1;
+        }
+    }
+
+    CIec104ClockAudit audit(config);
+    audit.SetLogLevel(args.Has(L"--verbose") ? Iec104LogLevel::LOG_DEBUG : Iec104LogLevel::LOG_ERROR);
+    audit.SetEventCallback([](const std::wstring &message) { PrintError(message); });
+    g_audit = &audit;
+    SetConsoleCtrlHandler(AuditCtrlHandler, TRUE);
+
+    // 每站结束时立即写出一行，审计中途停止时报告仍包含已完成的站
+    INT64 startUs = Iec104MonotonicUs();
+    std::vector<Iec104ClockAuditResult> results = audit.Run(stations, [out](const Iec104ClockAuditResult &result) {
+        std::string line = StationLine(result).ToString() + "\n";
+        if (out != INVALID_HANDLE_VALUE)
+        {
+            DWORD written = 0;
+            WriteFile(out, line.data(), (DWORD)line.size(), &written, nullptr);
+        }
+        else
+        {
+            fputs(line.c_str(), stdout);
+        }
+    });
+    double elapsedSec = (Iec104MonotonicUs() - startUs) / 1e6;
+
+    SetConsoleCtrlHandler(AuditCtrlHandler, FALSE);
+    g_audit = nullptr;
+
+    // 汇总：各状态的站数与偏差分布（只计测量成功的站）
+    UINT64 byStatus[(int)Iec104ClockAuditStatus::CANCELLED + 1] = {};
+    std::vector<INT64> absOffsets;
+    double totalConnectMs = 0.0;
+    UINT64 connected = 0;
+    for (const Iec104ClockAuditResult &result : results)
+    {
+        byStatus[(int)result.status]++;
+        if (result.before.valid)
+            absOffsets.push_back(result.before.offsetUs < 0 ? -result.before.offsetUs : result.before.offsetUs);
+        if (result.connectMs > 0)
+        {
+            totalConnectMs += result.connectMs;
+            ++connected;
+        }
+    }
+    std::sort(absOffsets.begin(), absOffsets.end());
+    auto percentileMs = [&absOffsets](double p) {
+        return absOffsets.empty() ? 0.0 : absOffsets[(size_t)std::ceil(p * (absOffsets.size() - 1))] / 1000.0;
+    };
+
+    CJsonLine summary;
+    summary.Add("command", "clockaudit")
+        .Add("event", "summary")
+        .Add("stations", (UINT64)results.size())
+        .Add("measured", (UINT64)absOffsets.size())
+        .Add("ok", byStatus[(int)Iec104ClockAuditStatus::OK])
+        .Add("drifted", byStatus[(int)Iec104ClockAuditStatus::DRIFTED])
+        .Add("corrected", byStatus[(int)Iec104ClockAuditStatus::CORRECTED])
+        .Add("correct_failed", byStatus[(int)Iec104ClockAuditStatus::CORRECT_FAILED])
+        .Add("read_failed", byStatus[(int)Iec104ClockAuditStatus::READ_FAILED])
+        .Add("connect_failed", byStatus[(int)Iec104ClockAuditStatus::CONNECT_FAILED])
+        .Add("timeouts", byStatus[(int)Iec104ClockAuditStatus::TIMEOUT])
+        .Add("cancelled", byStatus[(int)Iec104ClockAuditStatus::CANCELLED])
+        .Add("threshold_ms", config.thresholdUs / 1000.0)
+        .Add("abs_offset_p50_ms", percentileMs(0.5))
+        .Add("abs_offset_p95_ms", percentileMs(0.95))
+        .Add("abs_offset_max_ms", percentileMs(1.0))
+        .Add("connect_avg_ms", connected > 0 ? totalConnectMs / connected : 0.0)
+        .Add("elapsed_s", elapsedSec)
+        .Add("stations_per_s", elapsedSec > 0 ? results.size() / elapsedSec : 0.0);
+    if (out != INVALID_HANDLE_VALUE)
+    {
+        std::string line = summary.ToString() + "\n";
+        DWORD written = 0;
+        WriteFile(out, line.data(), (DWORD)line.size(), &written, nullptr);
+        CloseHandle(out);
+    }
+    summary.Print();
+    return byStatus[(int)Iec104ClockAuditStatus::CANCELLED] > 0 ? 1 : 0;
+}
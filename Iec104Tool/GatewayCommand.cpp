@@ -0,0 +1,239 @@
+﻿#include "pch.h"
+#include "ToolCommands.h"
+#include "Iec104Gateway.h"
+#include "Iec104Interrogation.h"
+#include <memory>
+
+namespace
+{
+    constexpr DWORD START_TIMEOUT_MS = 10000;
+
+    std::atomic<bool> g_gatewayStop(false);
+
+    BOOL WINAPI GatewayCtrlHandler(DWORD ctrlType)
+    {
+        if (ctrlType == CTRL_C_EVENT || ctrlType == CTRL_BREAK_EVENT || ctrlType == CTRL_CLOSE_EVENT)
+        {
+            g_gatewayStop = true;
+            return TRUE;
+        }
+        return FALSE;
+    }
+
+    // RTU：地址[:端口][/公共地址]，公共地址用于召唤
+    struct GatewayRtu
+    {
+        std::wstring host;
+        WORD port = IEC104_DEFAULT_PORT;
+        WORD commonAddr = 1;
+        std::unique_ptr<CIec104Master> master;
+    };
+
+    bool ParseRtu(const std::wstring &text, GatewayRtu &rtu)
+    {
+        ToolStationAddress address;
+        if (!ParseStationAddress(text, address))
+            return false;
+        rtu.host = address.host;
+        rtu.port = address.port;
+        rtu.commonAddr = address.commonAddr;
+        return true;
+    }
+
+    void PrintGatewayStats(const char *event, const CIec104Gateway &gateway, const CIec104SharedPointWriter *sharedPoints, double elapsedSec)
+    {
+        Iec104GatewayStats stats = gateway.GetStats();
+        CJsonLine line;
+        line.Add("command", "gateway")
+            .Add("event", event)
+            .Add("elapsed_s", elapsedSec)
+            .Add("sessions", stats.sessions)
+            .Add("connections", stats.connections)
+            .Add("rejected", stats.rejected)
+            .Add("i_frames_sent", stats.iFramesSent)
+            .Add("i_frames_received", stats.iFramesReceived)
+            .Add("published_asdus", stats.publishedAsdus)
+            .Add("forwarded_asdus", stats.forwardedAsdus)
+            .Add("dropped_asdus", stats.droppedAsdus)
+            .Add("interrogations", stats.interrogations)
+            .Add("interrogated_points", stats.interrogatedPoints)
+            .Add("timeouts", stats.timeouts)
+            .Add("protocol_errors", stats.protocolErrors);
+        if (sharedPoints)
+        {
+            line.Add("shm_points", (UINT64)sharedPoints->GetPointCount())
+                .Add("shm_updates", sharedPoints->GetUpdateCount())
+                .Add("shm_dropped", sharedPoints->GetDroppedCount());
+        }
+        line.Print();
+    }
+}
+
+// gateway <RTU地址[:端口][/公共地址]>... [--listen 2404] [--bind 0.0.0.0] [--sessions 64] [--profile 2/2/3] [--upstream-profile 2/2/3]
+//         [--k 12] [--w 8] [--shm [段名]] [--shm-capacity N] [--duration s] [--report s] [--verbose]
+//         [--gi-period s] [--ci-period s] [--max-inflight 8] [--rate 10] [--spread 10]
+// 主站连接各RTU，启动后总召一次并按 --gi-period/--ci-period 周期总召与电能量召唤（各RTU错开，受并发与速率限制），
+// 网关把采集到的点转发给上级主站，上级的总召由点库应答；
+// 指定 --shm 时各点同时发布到共享内存点表，本机其他进程可用 shmread 或 CIec104SharedPointReader 读取
+int RunGatewayCommand(const CToolArgs &args)
+{
+    if (args.Positional().empty())
+    {
+        PrintError(L"用法: Iec104Tool gateway <RTU地址[:端口][/公共地址]>... [--listen 端口] [--bind 地址] [--sessions N] [--profile 2/2/3] [--upstream-profile 2/2/3]");
+        return 2;
+    }
+
+    std::vector<GatewayRtu> rtus(args.Positional().size());
+    for (size_t i = 0; i < rtus.size(); ++i)
+    {
+        if (!ParseRtu(args.Positional()[i], rtus[i]))
+        {
+            PrintError(L"RTU地址无效: " + args.Positional()[i]);
+            return 2;
+        }
+    }
+
+    Iec104LinkProfile rtuProfile;
+    Iec104GatewayConfig config;
+    if (!GetProfileOption(args, 0, rtuProfile))
+    {
+        return 2;
+    }
+    std::wstring upstream = args.Get(L"--upstream-profile");
+    if (!upstream.empty() && !Iec104ParseProfile(upstream, config.profile))
+    {
+        PrintError(L"上送链路参数无效（格式 COT/CA/IOA，如 2/2/3）: " + upstream);
+        return 2;
+    }
+    config.bindAddress = args.Get(L"--bind", L"0.0.0.0");
+    config.port = (WORD)args.GetInt(L"--listen", IEC104_DEFAULT_PORT);
+    config.maxSessions = args.GetInt(L"--sessions", config.maxSessions);
+    config.k = args.GetInt(L"--k", config.k);
+    config.w = args.GetInt(L"--w", config.w);
+
+    Iec104InterrogationPlan plan;
+    plan.giPeriodMs = (DWORD)(args.GetDouble(L"--gi-period", 0.0) * 1000);
+    plan.counterPeriodMs = (DWORD)(args.GetDouble(L"--ci-period", 0.0) * 1000);
+    Iec104InterrogationConfig interrogationConfig;
+    interrogationConfig.maxInFlight = (size_t)(std::max)(args.GetInt(L"--max-inflight", (int)interrogationConfig.maxInFlight), 1);
+    interrogationConfig.ratePerSec = args.GetDouble(L"--rate", interrogationConfig.ratePerSec);
+    interrogationConfig.startupSpreadMs = (DWORD)(args.GetDouble(L"--spread", interrogationConfig.startupSpreadMs / 1000.0) * 1000);
+
+    CIec104Gateway gateway(config);
+    gateway.SetEventCallback([](const std::wstring &message) { PrintError(message); });
+    if (args.Has(L"--verbose"))
+    {
+        gateway.SetLogLevel(Iec104LogLevel::LOG_DEBUG);
+    }
+
+    // 共享内存点表：全部RTU写入同一个段，各主站的接收线程直接写入
+    std::wstring err;
+    std::shared_ptr<CIec104SharedPointWriter> sharedPoints;
+    if (args.Has(L"--shm"))
+    {
+        std::wstring shmName = args.Get(L"--shm");
+        sharedPoints = std::make_shared<CIec104SharedPointWriter>();
+        if (!sharedPoints->Create(shmName.empty() ? IEC104_SHARED_POINTS_NAME : shmName, args.GetInt(L"--shm-capacity", 65536), &err))
+        {
+            PrintError(err);
+            return 1;
+        }
+    }
+
+    // 召唤调度在独立的时间轮线程中运行；须在主站断开之后停止，在主站销毁之前析构
+    CTimerWheelThread interrogationThread;
+    CIec104InterrogationScheduler interrogation(interrogationThread, interrogationConfig);
+    interrogation.SetResultCallback([&rtus](size_t station, Iec104InterrogationKind kind, const Iec104CommandResult &result) {
+        if (result.status != Iec104CommandStatus::COMPLETED)
+        {
+            PrintError(std::wstring(kind == Iec104InterrogationKind::COUNTER ? L"电能量召唤失败: " : L"总召唤失败: ") + rtus[station].host);
+        }
+    });
+
+    // 每个RTU一个主站与点库（点库单写者），数据回调在各主站的I/O线程中发布
+    for (size_t i = 0; i < rtus.size(); ++i)
+    {
+        GatewayRtu &rtu = rtus[i];
+        std::shared_ptr<CIec104PointDb> pointDb = std::make_shared<CIec104PointDb>();
+        gateway.AddPointDatabase(pointDb);
+        rtu.master.reset(new CIec104Master());
+        rtu.master->SetLogLevel(Iec104LogLevel::LOG_WARNING);
+        rtu.master->SetFrameRecording(false);
+        rtu.master->SetLinkProfile(rtuProfile);
+        rtu.master->SetPointDatabase(pointDb);
+        rtu.master->SetSharedPoints(sharedPoints);
+        rtu.master->SetEventCallback([](const std::wstring &message) { PrintError(message); });
+        rtu.master->SetDataCallback([&gateway](const CIec104PointBatch &batch) { gateway.Publish(batch); });
+        rtu.master->SetStateCallback([&interrogation, i](Iec104State state) {
+            if (state == Iec104State::STARTED)
+                interrogation.OnStationStarted(i);
+            else
+                interrogation.OnStationStopped(i);
+        });
+        Iec104InterrogationPlan rtuPlan = plan;
+        rtuPlan.commonAddr = rtu.commonAddr;
+        interrogation.AddStation(rtu.master.get(), rtuPlan);
+    }
+
+    if (!interrogationThread.Start() || !gateway.Start(&err))
+    {
+        interrogationThread.Stop();
+        PrintError(err);
+        return 1;
+    }
+
+    // 各RTU并行建立连接，连接失败的RTU不影响其他RTU
+    for (GatewayRtu &rtu : rtus)
+    {
+        rtu.master->ConnectAsync(rtu.host, rtu.port);
+    }
+    size_t started = 0;
+    ULONGLONG deadline = GetTickCount64() + START_TIMEOUT_MS;
+    for (GatewayRtu &rtu : rtus)
+    {
+        while (rtu.master->GetState() == Iec104State::CONNECTING && GetTickCount64() < deadline)
+            Sleep(1);
+        if (!rtu.master->IsConnected() || !rtu.master->StartDataTransfer())
+        {
+            PrintError(L"连接RTU失败: " + rtu.host + L":" + std::to_wstring(rtu.port));
+            continue;
+        }
+        while (!rtu.master->IsStarted() && GetTickCount64() < deadline)
+            Sleep(1);
+        if (rtu.master->IsStarted())
+            ++started;
+    }
+
+    SetConsoleCtrlHandler(GatewayCtrlHandler, TRUE);
+    PrintError(L"网关已启动: " + std::to_wstring(started) + L"/" + std::to_wstring(rtus.size()) + L" 个RTU，上送端口 " +
+               std::to_wstring(config.port) + L"，按 Ctrl+C 停止");
+
+    double duration = args.GetDouble(L"--duration", 0.0);
+    double report = args.GetDouble(L"--report", 5.0);
+    ULONGLONG startMs = GetTickCount64();
+    ULONGLONG nextReportMs = startMs + (ULONGLONG)(report * 1000);
+    while (!g_gatewayStop)
+    {
+        Sleep(50);
+        ULONGLONG nowMs = GetTickCount64();
+        double elapsed = (nowMs - startMs) / 1000.0;
+        if (duration > 0 && elapsed >= duration)
+            break;
+        if (report > 0 && nowMs >= nextReportMs)
+        {
+            PrintGatewayStats("progress", gateway, sharedPoints.get(), elapsed);
+            nextReportMs += (ULONGLONG)(report * 1000);
+        }
+    }
+
+    // 先断开RTU，不再有数据回调发布与召唤完成通知，再停止召唤调度与网关
+    for (GatewayRtu &rtu : rtus)
+    {
+        rtu.master->Disconnect();
+    }
+    interrogationThread.Stop();
+    gateway.Stop();
+    SetConsoleCtrlHandler(GatewayCtrlHandler, FALSE);
+    PrintGatewayStats("final", gateway, sharedPoints.get(), (GetTickCount64() - startMs) / 1000.0);
+    return 0;
+}
@@ -0,0 +1,84 @@
+﻿#include "pch.h"
+#include "ToolCommands.h"
+#include "Iec104Historian.h"
+#include <algorithm>
+#include <climits>
+#include <cwchar>
+
+// history <目录> [--ca N --ioa N] [--from ms] [--to ms] [--limit N]
+// 指定点时每个采样输出一行，最后输出一行汇总；否则只输出历史库统计
+int RunHistoryCommand(const CToolArgs &args)
+{
+    if (args.Positional().empty())
+    {
+        PrintError(L"用法: Iec104Tool history <目录> [--ca N --ioa N] [--from ms] [--to ms] [--limit N]");
+        return 2;
+    }
+
+    // Open 会为新目录创建首个段文件，查询只打开已有的历史库
+    const std::wstring &directory = args.Positional()[0];
+    DWORD attributes = GetFileAttributesW(directory.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES || (attributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+    {
+        PrintError(L"历史库目录不存在: " + directory);
+        return 1;
+    }
+
+    CIec104Historian historian;
+    std::wstring err;
+    if (!historian.Open(directory, CIec104Historian::DEFAULT_SEGMENT_BYTES, &err))
+    {
+        PrintError(err);
+        return 1;
+    }
+
+    Iec104HistorianStats stats = historian.GetStats();
+    if (!args.Has(L"--ioa"))
+    {
+        CJsonLine()
+            .Add("command", "history")
+            .Add("directory", directory)
+            .Add("points", (UINT64)stats.points)
+            .Add("segments", (UINT64)stats.segments)
+            .Add("samples", stats.samples)
+            .Add("blocks", stats.sealedBlocks)
+            .Add("stored_bytes", stats.storedBytes)
+            .Add("bytes_per_sample", stats.samples ? (double)stats.storedBytes / stats.samples : 0.0)
+            .Print();
+        return 0;
+    }
+
+    // 毫秒时标超出 int 范围，按64位解析
+    std::wstring from = args.Get(L"--from");
+    std::wstring to = args.Get(L"--to");
+    INT64 fromMs = from.empty() ? 0 : _wtoi64(from.c_str());
+    INT64 toMs = to.empty() ? INT64_MAX : _wtoi64(to.c_str());
+    WORD commonAddr = (WORD)args.GetInt(L"--ca", 1);
+    DWORD ioa = (DWORD)args.GetInt(L"--ioa", 0);
+    int limit = args.GetInt(L"--limit", 0);
+
+    std::vector<Iec104HistSample> samples;
+    if (!historian.Query(commonAddr, ioa, fromMs, toMs, samples))
+    {
+        PrintError(L"历史库中没有该点");
+        return 1;
+    }
+
+    size_t count = limit > 0 ? (std::min)(samples.size(), (size_t)limit) : samples.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        CJsonLine()
+            .Add("timestamp_ms", (UINT64)samples[i].timestampMs)
+            .Add("value", samples[i].value)
+            .Add("quality", (int)samples[i].quality)
+            .Print();
+    }
+    CJsonLine()
+        .Add("command", "history")
+        .Add("ca", (int)commonAddr)
+        .Add("ioa", (UINT64)ioa)
+        .Add("matched", (UINT64)samples.size())
+        .Add("printed", (UINT64)count)
+        .Print();
+    return 0;
+}
@@ -0,0 +1,186 @@
+﻿#include "pch.h"
+#include "ToolCommands.h"
+#include "Iec104SharedPoints.h"
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+    struct ReaderResult
+    {
+        UINT64 reads = 0;
+        UINT64 failed = 0;
+        double checksum = 0.0;   // 防止读取被优化掉
+    };
+
+    // 按槽位顺序反复读取全部点（读取方缓存槽位号的用法）
+    void ReadBySlot(const CIec104SharedPointReader &reader, UINT32 count, const std::atomic<bool> &stop, ReaderResult &result)
+    {
+        // 各线程的结果相邻存放，循环中只累加局部变量，避免伪共享影响测量
+        Iec104SharedPointSample sample;
+        UINT64 reads = 0, failed = 0;
+        double checksum = 0.0;
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            for (UINT32 slot = 0; slot < count; ++slot)
+            {
+                if (reader.ReadSlot(slot, sample))
+                    checksum += sample.value;
+                else
+                    ++failed;
+            }
+            reads += count;
+        }
+        result.reads = reads;
+        result.failed = failed;
+        result.checksum = checksum;
+    }
+
+    // 每次按(公共地址, IOA)查找后读取（不缓存槽位号的用法）
+    void ReadByKey(const CIec104SharedPointReader &reader, const std::vector<std::pair<WORD, DWORD>> &keys,
+                   const std::atomic<bool> &stop, ReaderResult &result)
+    {
+        Iec104SharedPointSample sample;
+        UINT64 reads = 0, failed = 0;
+        double checksum = 0.0;
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            for (const auto &key : keys)
+            {
+                if (reader.Read(key.first, key.second, sample))
+                    checksum += sample.value;
+                else
+                    ++failed;
+            }
+            reads += keys.size();
+        }
+        result.reads = reads;
+        result.failed = failed;
+        result.checksum = checksum;
+    }
+
+    void PrintSample(const Iec104SharedPointSample &sample)
+    {
+        CJsonLine()
+            .Add("command", "shmread")
+            .Add("ca", (int)sample.commonAddr)
+            .Add("ioa", (UINT64)sample.ioa)
+            .Add("type", (int)sample.type)
+            .Add("quality", (int)sample.quality)
+            .Add("value", sample.value)
+            .Add("timestamp_ms", (double)sample.timestampMs)
+            .Add("changes", (UINT64)sample.changeCount)
+            .Print();
+    }
+}
+
+// shmread [--name 段名] [--ca N --ioa N] [--dump] [--threads N] [--seconds s]
+// 从共享内存点表读取点（如 gateway --shm 发布的段）；不指定 --dump 或单点时，以多个线程测量读取速率
+int RunShmReadCommand(const CToolArgs &args)
+{
+    std::wstring name = args.Get(L"--name", IEC104_SHARED_POINTS_NAME);
+    CIec104SharedPointReader reader;
+    std::wstring err;
+    if (!reader.Open(name, &err))
+    {
+        PrintError(err);
+        return 1;
+    }
+
+    if (args.Has(L"--ioa"))
+    {
+        Iec104SharedPointSample sample;
+        if (!reader.Read((WORD)args.GetInt(L"--ca", 1), (DWORD)args.GetInt(L"--ioa", 0), sample))
+        {
+            PrintError(L"共享点表中没有该点");
+            return 1;
+        }
+        PrintSample(sample);
+        return 0;
+    }
+
+    if (args.Has(L"--dump"))
+    {
+        std::vector<Iec104SharedPointSample> samples;
+        reader.ReadAll(samples);
+        for (const Iec104SharedPointSample &sample : samples)
+        {
+            PrintSample(sample);
+        }
+        return 0;
+    }
+
+    int threads = args.GetInt(L"--threads", 1);
+    double seconds = args.GetDouble(L"--seconds", 2.0);
+    UINT32 count = reader.GetPointCount();
+    if (threads <= 0 || seconds <= 0)
+    {
+        PrintError(L"用法: Iec104Tool shmread [--name 段名] [--ca N --ioa N] [--dump] [--threads N] [--seconds s]");
+        return 2;
+    }
+    if (count == 0)
+    {
+        PrintError(L"共享点表中还没有点");
+        return 1;
+    }
+
+    std::vector<Iec104SharedPointSample> samples;
+    reader.ReadAll(samples);
+    std::vector<std::pair<WORD, DWORD>> keys;
+    keys.reserve(samples.size());
+    for (const Iec104SharedPointSample &sample : samples)
+    {
+        keys.push_back(std::make_pair(sample.commonAddr, sample.ioa));
+    }
+
+    // 两种读取方式各测 seconds 秒，写者的更新次数用于说明读取期间是否有并发写入
+    const char *modes[] = { "slot", "key" };
+    for (const char *mode : modes)
+    {
+        bool bySlot = strcmp(mode, "slot") == 0;
+        std::atomic<bool> stop(false);
+        std::vector<ReaderResult> results(threads);
+        std::vector<std::thread> workers;
+        UINT64 updatesBefore = reader.GetUpdateCount();
+        LARGE_INTEGER freq, start, end;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&start);
+        for (int i = 0; i < threads; ++i)
+        {
+            if (bySlot)
+                workers.emplace_back(ReadBySlot, std::cref(reader), count, std::cref(stop), std::ref(results[i]));
+            else
+                workers.emplace_back(ReadByKey, std::cref(reader), std::cref(keys), std::cref(stop), std::ref(results[i]));
+        }
+        Sleep((DWORD)(seconds * 1000));
+        stop = true;
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+        QueryPerformanceCounter(&end);
+
+        UINT64 reads = 0, failed = 0;
+        for (const ReaderResult &result : results)
+        {
+            reads += result.reads;
+            failed += result.failed;
+        }
+        double elapsed = (double)(end.QuadPart - start.QuadPart) / freq.QuadPart;
+        CJsonLine()
+            .Add("command", "shmread")
+            .Add("mode", mode)
+            .Add("points", (UINT64)count)
+            .Add("threads", threads)
+            .Add("elapsed_s", elapsed)
+            .Add("reads", reads)
+            .Add("reads_per_s", elapsed > 0 ? reads / elapsed : 0.0)
+            .Add("ns_per_read", reads > 0 ? elapsed * 1e9 * threads / reads : 0.0)
+            .Add("failed", failed)
+            .Add("writer_updates", reader.GetUpdateCount() - updatesBefore)
+            .Add("writer_online", reader.IsWriterOnline())
+            .Print();
+    }
+    return 0;
+}
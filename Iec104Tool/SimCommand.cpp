@@ -0,0 +1,224 @@
+﻿#include "pch.h"
+#include "ToolCommands.h"
+#include "Iec104Outstation.h"
+#include <cstdio>
+
+namespace
+{
+    std::atomic<bool> g_simStop(false);
+
+    BOOL WINAPI SimCtrlHandler(DWORD ctrlType)
+    {
+        if (ctrlType == CTRL_C_EVENT || ctrlType == CTRL_BREAK_EVENT || ctrlType == CTRL_CLOSE_EVENT)
+        {
+            g_simStop = true;
+            return TRUE;
+        }
+        return FALSE;
+    }
+
+    void PrintSimStats(const char *event, const CIec104SimServer &server, double elapsedSec)
+    {
+        Iec104OutstationStats totals = server.GetTotals();
+        CJsonLine()
+            .Add("command", "sim")
+            .Add("event", event)
+            .Add("elapsed_s", elapsedSec)
+            .Add("stations", (UINT64)server.GetStationCount())
+            .Add("connections", totals.connections)
+            .Add("i_frames_sent", totals.iFramesSent)
+            .Add("i_frames_received", totals.iFramesReceived)
+            .Add("points_sent", totals.pointsSent)
+            .Add("spontaneous_points", totals.spontaneousPoints)
+            .Add("interrogations", totals.interrogations)
+            .Add("clock_commands", totals.clockCommands)
+            .Add("control_commands", totals.controlCommands)
+            .Add("test_frames", totals.testFrames)
+            .Add("timeouts", totals.timeouts)
+            .Add("protocol_errors", totals.protocolErrors)
+            .Add("tls_handshakes", totals.tlsHandshakes)
+            .Add("tls_resumed", totals.tlsResumed)
+            .Add("tls_failures", totals.tlsFailures)
+            .Print();
+    }
+}
+
+bool GetProfileOption(const CToolArgs &args, DWORD maxIoa, Iec104LinkProfile &profile)
+{
+    profile = Iec104LinkProfile();
+    std::wstring text = args.Get(L"--profile");
+    if (!text.empty() && !Iec104ParseProfile(text, profile))
+    {
+        PrintError(L"链路参数无效（格式 COT/CA/IOA，如 2/2/3）: " + text);
+        return false;
+    }
+    if (maxIoa > Iec104GetCodec(profile).ioaMask)
+    {
+        PrintError(L"IOA " + std::to_wstring(maxIoa) + L" 超出链路参数 " + Iec104FormatProfile(profile) + L" 的地址范围");
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<CIec104TlsCredentials> CreateSimTlsCredentials(const CToolArgs &args, std::wstring &err)
+{
+    // 仿真只用于本机测试，不要求主站提供客户端证书
+    Iec104TlsConfig tls;
+    tls.verifyPeer = false;
+    tls.machineStore = args.Has(L"--tls-machine-store");
+    std::shared_ptr<CIec104TlsCredentials> credentials = std::make_shared<CIec104TlsCredentials>();
+
+    tls.certSubject = args.Get(L"--tls-cert");
+    if (!tls.certSubject.empty())
+    {
+        return credentials->InitServer(tls, &err) ? credentials : nullptr;
+    }
+
+    PCCERT_CONTEXT cert = Iec104TlsCreateSelfSignedCert(L"NTPTool IEC104 Simulator", &err);
+    if (!cert)
+    {
+        return nullptr;
+    }
+    bool ok = credentials->InitServer(cert, tls, &err);
+    CertFreeCertificateContext(cert);
+    return ok ? credentials : nullptr;
+}
+
+// sim [--stations N] [--port P] [--bind 地址] [--ca 起始公共地址] [--points 每站点数] [--types 13,1,...]
+//     [--threads N] [--script 文件] [--burst 点数 --interval ms] [--duration s] [--report s]
+//     [--k 12] [--w 8] [--t1 15] [--t2 10] [--t3 20] [--clock-offset ms] [--clock-spread ms] [--tls [--tls-cert 主题]] [--profile 2/2/3] [--verbose]
+// --clock-spread：各站时钟偏差在 clock-offset ± spread/2 内按站错开，用于 clockaudit 的演练
+int RunSimCommand(const CToolArgs &args)
+{
+    int stations = args.GetInt(L"--stations", 1);
+    int port = args.GetInt(L"--port", IEC104_DEFAULT_PORT);
+    int firstCa = args.GetInt(L"--ca", 1);
+    int points = args.GetInt(L"--points", 1000);
+    std::vector<int> types = args.GetIntList(L"--types", { (int)Iec104TypeId::M_ME_NC_1 });
+    if (stations <= 0 || points <= 0 || port <= 0 || port + stations - 1 > 65535)
+    {
+        PrintError(L"子站数、点数或端口无效");
+        return 2;
+    }
+
+    // 每站点数按类型平均分组，IOA从1开始连续编号
+    Iec104OutstationConfig config;
+    config.bindAddress = args.Get(L"--bind", L"127.0.0.1");
+    config.k = args.GetInt(L"--k", config.k);
+    config.w = args.GetInt(L"--w", config.w);
+    config.t1Ms = (DWORD)(args.GetDouble(L"--t1", config.t1Ms / 1000.0) * 1000);
+    config.t2Ms = (DWORD)(args.GetDouble(L"--t2", config.t2Ms / 1000.0) * 1000);
+    config.t3Ms = (DWORD)(args.GetDouble(L"--t3", config.t3Ms / 1000.0) * 1000);
+    config.clockOffsetMs = args.GetInt(L"--clock-offset", 0);
+    int clockSpreadMs = args.GetInt(L"--clock-spread", 0);
+    if (!GetProfileOption(args, (DWORD)points, config.profile))
+    {
+        return 2;
+    }
+
+    if (args.Has(L"--tls") || args.Has(L"--tls-cert"))
+    {
+        std::wstring tlsErr;
+        config.tls = CreateSimTlsCredentials(args, tlsErr);
+        if (!config.tls)
+        {
+            PrintError(tlsErr);
+            return 1;
+        }
+    }
+
+    DWORD nextIoa = 1;
+    for (size_t i = 0; i < types.size(); ++i)
+    {
+        int elemLen = 0;
+        bool hasTime = false;
+        if (!Iec104GetMonitorLayout((BYTE)types[i], elemLen, hasTime))
+        {
+            PrintError(L"不支持的仿真类型: " + std::to_wstring(types[i]));
+            return 2;
+        }
+
+        Iec104SimPointGroup group;
+        group.type = (BYTE)types[i];
+        group.firstIoa = nextIoa;
+        group.count = points / (DWORD)types.size() + (i < points % types.size() ? 1 : 0);
+        config.groups.push_back(group);
+        nextIoa += group.count;
+    }
+
+    CIec104SimServer server;
+    for (int i = 0; i < stations; ++i)
+    {
+        config.port = (WORD)(port + i);
+        config.commonAddr = (WORD)(firstCa + i);
+        Iec104OutstationConfig stationConfig = config;
+        if (clockSpreadMs > 0)
+        {
+            // 黄金分割序列：任意站数的偏差都大致均匀地分布在区间内
+            double fraction = i * 0.6180339887498949;
+            fraction -= (INT64)fraction;
+            stationConfig.clockOffsetMs += (INT64)((fraction - 0.5) * clockSpreadMs);
+        }
+        server.AddStation(stationConfig);
+    }
+
+    // 脚本文件与命令行突发可同时使用
+    std::vector<Iec104SimStep> script;
+    std::wstring scriptPath = args.Get(L"--script");
+    std::wstring err;
+    if (!scriptPath.empty() && !Iec104LoadSimScript(scriptPath, script, &err))
+    {
+        PrintError(err);
+        return 1;
+    }
+    int burst = args.GetInt(L"--burst", 0);
+    if (burst > 0)
+    {
+        Iec104SimStep step;
+        step.count = burst;
+        step.intervalMs = args.GetInt(L"--interval", 1000);
+        step.repeat = MAXDWORD;
+        script.push_back(step);
+    }
+    server.SetScript(script);
+
+    if (args.Has(L"--verbose"))
+    {
+        server.SetLogLevel(Iec104LogLevel::LOG_DEBUG);
+    }
+    server.SetEventCallback([](const std::wstring &message) { PrintError(message); });
+
+    if (!server.Start(args.GetInt(L"--threads", 1), &err))
+    {
+        PrintError(err);
+        return 1;
+    }
+
+    SetConsoleCtrlHandler(SimCtrlHandler, TRUE);
+    PrintError(L"仿真子站已启动: " + std::to_wstring(stations) + L" 个子站，端口 " + std::to_wstring(port) + L"-" +
+               std::to_wstring(port + stations - 1) + L"，按 Ctrl+C 停止");
+
+    // 定期输出累计统计，--duration 为0时运行到 Ctrl+C
+    double duration = args.GetDouble(L"--duration", 0.0);
+    double report = args.GetDouble(L"--report", 1.0);
+    ULONGLONG startMs = GetTickCount64();
+    ULONGLONG nextReportMs = startMs + (ULONGLONG)(report * 1000);
+    while (!g_simStop)
+    {
+        Sleep(50);
+        ULONGLONG nowMs = GetTickCount64();
+        double elapsed = (nowMs - startMs) / 1000.0;
+        if (duration > 0 && elapsed >= duration)
+            break;
+        if (report > 0 && nowMs >= nextReportMs)
+        {
+            PrintSimStats("progress", server, elapsed);
+            nextReportMs += (ULONGLONG)(report * 1000);
+        }
+    }
+
+    server.Stop();
+    SetConsoleCtrlHandler(SimCtrlHandler, FALSE);
+    PrintSimStats("final", server, (GetTickCount64() - startMs) / 1000.0);
+    return 0;
+}
@@ -0,0 +1,22 @@
+﻿#pragma once
+#include "ToolCommon.h"
+#include "Iec104Profile.h"
+#include "Iec104Tls.h"
+#include <memory>
+
+// 各子命令入口，返回进程退出码
+int RunReplayCommand(const CToolArgs& args);
+int RunSimCommand(const CToolArgs& args);
+int RunBenchCommand(const CToolArgs& args);
+int RunHistoryCommand(const CToolArgs& args);
+int RunTimeDecodeCommand(const CToolArgs& args);
+int RunGatewayCommand(const CToolArgs& args);
+int RunShmReadCommand(const CToolArgs& args);
+int RunLinkSimCommand(const CToolArgs& args);
+int RunClockAuditCommand(const CToolArgs& args);
+
+// 仿真子站的TLS服务端凭据：--tls-cert 指定 MY 存储中的证书主题，否则使用自签名证书
+std::shared_ptr<CIec104TlsCredentials> CreateSimTlsCredentials(const CToolArgs& args, std::wstring& err);
+
+// --profile COT/CA/IOA（如 1/1/2），未指定时为标准的 2/2/3；maxIoa 为要使用的最大IOA，超出IOA字节数可表示的范围时报错
+bool GetProfileOption(const CToolArgs& args, DWORD maxIoa, Iec104LinkProfile& profile);
@@ -0,0 +1,174 @@
+﻿#include "pch.h"
+#include "ToolCommon.h"
+#include <cstdio>
+#include <cwchar>
+
+CToolArgs::CToolArgs(int argc, wchar_t **argv, int first)
+{
+    for (int i = first; i < argc; ++i)
+    {
+        std::wstring arg = argv[i];
+        if (arg.size() > 2 && arg[0] == L'-' && arg[1] == L'-')
+        {
+            // 下一个参数不以"--"开头时视为选项值，否则为开关
+            std::wstring value;
+            if (i + 1 < argc && wcsncmp(argv[i + 1], L"--", 2) != 0)
+            {
+                value = argv[++i];
+            }
+            m_options.emplace_back(arg, value);
+        }
+        else
+        {
+            m_positional.push_back(arg);
+        }
+    }
+}
+
+bool CToolArgs::Has(const wchar_t *name) const
+{
+    for (const auto &opt : m_options)
+    {
+        if (opt.first == name)
+            return true;
+    }
+    return false;
+}
+
+std::wstring CToolArgs::Get(const wchar_t *name, const std::wstring &def) const
+{
+    for (const auto &opt : m_options)
+    {
+        if (opt.first == name && !opt.second.empty())
+            return opt.second;
+    }
+    return def;
+}
+
+int CToolArgs::GetInt(const wchar_t *name, int def) const
+{
+    std::wstring v = Get(name);
+    return v.empty() ? def : _wtoi(v.c_str());
+}
+
+double CToolArgs::GetDouble(const wchar_t *name, double def) const
+{
+    std::wstring v = Get(name);
+    return v.empty() ? def : _wtof(v.c_str());
+}
+
+std::vector<int> CToolArgs::GetIntList(const wchar_t *name, const std::vector<int> &def) const
+{
+    // 逗号分隔，例如 --stations 1,10,100
+    std::wstring v = Get(name);
+    if (v.empty())
+        return def;
+
+    std::vector<int> result;
+    size_t start = 0;
+    while (start <= v.size())
+    {
+        size_t comma = v.find(L',', start);
+        if (comma == std::wstring::npos)
+            comma = v.size();
+        if (comma > start)
+            result.push_back(_wtoi(v.substr(start, comma - start).c_str()));
+        start = comma + 1;
+    }
+    return result.empty() ? def : result;
+}
+
+bool ParseStationAddress(const std::wstring &text, ToolStationAddress &address)
+{
+    std::wstring rest = text;
+    size_t slash = rest.find(L'/');
+    if (slash != std::wstring::npos)
+    {
+        address.commonAddr = (WORD)_wtoi(rest.c_str() + slash + 1);
+        rest = rest.substr(0, slash);
+    }
+    size_t colon = rest.find(L':');
+    if (colon != std::wstring::npos && rest.find(L':', colon + 1) == std::wstring::npos)
+    {
+        int port = _wtoi(rest.c_str() + colon + 1);
+        if (port <= 0 || port > 65535)
+            return false;
+        address.port = (WORD)port;
+        rest = rest.substr(0, colon);
+    }
+    address.host = rest;
+    return !address.host.empty();
+}
+
+std::string ToUtf8(const std::wstring &text)
+{
+    if (text.empty())
+        return std::string();
+
+    int len = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int)text.size(), nullptr, 0, nullptr, nullptr);
+    std::string result(len, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int)text.size(), &result[0], len, nullptr, nullptr);
+    return result;
+}
+
+void PrintError(const std::wstring &message)
+{
+    fprintf(stderr, "%s\n", ToUtf8(message).c_str());
+}
+
+void CJsonLine::AddKey(const char *key)
+{
+    if (!m_body.empty())
+        m_body += ",";
+    m_body += "\"";
+    m_body += key;
+    m_body += "\":";
+}
+
+CJsonLine &CJsonLine::Add(const char *key, const std::wstring &value)
+{
+    return Add(key, ToUtf8(value).c_str());
+}
+
+CJsonLine &CJsonLine::Add(const char *key, const char *value)
+{
+    AddKey(key);
+    m_body += "\"";
+    for (const char *p = value; *p; ++p)
+    {
+        if (*p == '"' || *p == '\\')
+            m_body += '\\';
+        m_body += *p;
+    }
+    m_body += "\"";
+    return *this;
+}
+
+CJsonLine &CJsonLine::Add(const char *key, double value)
+{
+    char buf[32];
+    sprintf_s(buf, "%.6g", value);
+    AddKey(key);
+    m_body += buf;
+    return *this;
+}
+
+CJsonLine &CJsonLine::Add(const char *key, UINT64 value)
+{
+    AddKey(key);
+    m_body += std::to_string(value);
+    return *this;
+}
+
+CJsonLine &CJsonLine::Add(const char *key, bool value)
+{
+    AddKey(key);
+    m_body += value ? "true" : "false";
+    return *this;
+}
+
+void CJsonLine::Print() const
+{
+    printf("%s\n", ToString().c_str());
+    fflush(stdout);
+}
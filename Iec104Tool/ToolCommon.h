@@ -0,0 +1,54 @@
+﻿#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+
+// 命令行参数：位置参数 + "--名称 值" 选项 + "--开关" 标志
+class CToolArgs
+{
+public:
+    CToolArgs(int argc, wchar_t** argv, int first);
+
+    const std::vector<std::wstring>& Positional() const { return m_positional; }
+    bool Has(const wchar_t* name) const;
+    std::wstring Get(const wchar_t* name, const std::wstring& def = L"") const;
+    int GetInt(const wchar_t* name, int def) const;
+    double GetDouble(const wchar_t* name, double def) const;
+    std::vector<int> GetIntList(const wchar_t* name, const std::vector<int>& def) const;
+
+private:
+    std::vector<std::wstring> m_positional;
+    std::vector<std::pair<std::wstring, std::wstring>> m_options;
+};
+
+// 单行JSON对象，每次测量输出一行，便于回归脚本逐行解析
+class CJsonLine
+{
+public:
+    CJsonLine& Add(const char* key, const std::wstring& value);
+    CJsonLine& Add(const char* key, const char* value);
+    CJsonLine& Add(const char* key, double value);
+    CJsonLine& Add(const char* key, UINT64 value);
+    CJsonLine& Add(const char* key, int value) { return Add(key, (double)value); }
+    CJsonLine& Add(const char* key, bool value);
+
+    std::string ToString() const { return "{" + m_body + "}"; }
+    void Print() const;
+
+private:
+    std::string m_body;
+
+    void AddKey(const char* key);
+};
+
+// 站地址：地址[:端口][/公共地址]，只有一个冒号时视为端口（IPv6地址不带端口）
+struct ToolStationAddress
+{
+    std::wstring host;
+    WORD port = 2404;
+    WORD commonAddr = 1;
+};
+bool ParseStationAddress(const std::wstring& text, ToolStationAddress& address);
+
+std::string ToUtf8(const std::wstring& text);
+void PrintError(const std::wstring& message);
@@ -0,0 +1,18 @@
+﻿// pch.h: Iec104Tool 控制台工具的公共头文件
+// NTPClient/src 下的组件在此工程中不依赖 MFC，只需要 Windows 与 WinSock 头文件
+
+#ifndef PCH_H
+#define PCH_H
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+
+#endif //PCH_H
@@ -52,8 +52,20 @@ END_MESSAGE_MAP()
 
 // CNTPClientDlg 对话框
 
+namespace
+{
+	// 对话框只有一个站：启动后500毫秒总召，不需要按站错开
+	Iec104InterrogationConfig DialogInterrogationConfig()
+	{
+		Iec104InterrogationConfig config;
+		config.startupDelayMs = 500;
+		config.startupSpreadMs = 0;
+		return config;
+	}
+}
+
 CNTPClientDlg::CNTPClientDlg(CWnd *pParent /*=nullptr*/)
-	: CDialog(IDD_NTPCLIENT_DIALOG, pParent)
+	: CDialog(IDD_NTPCLIENT_DIALOG, pParent), m_interrogation(m_timerThread, DialogInterrogationConfig())
 {
 	m_hIcon = AfxGetApp()->LoadIcon(IDR_MAINFRAME);
 	
@@ -65,6 +77,17 @@ CNTPClientDlg::CNTPClientDlg(CWnd *pParent /*=nullptr*/)
 	m_iec104.SetClockCallback([this](const SYSTEMTIME& time) {
 		On104ClockReceived(time);
 	});
+
+	// 状态变化在I/O线程中回调，转到UI线程处理
+	m_iec104.SetStateCallback([this](Iec104State state) {
+		PostMessage(WM_104_STATE, (WPARAM)state, 0);
+	});
+
+	// 召唤结果在时间轮线程中回调，经日志队列显示；计划在每次启动数据传输时按当前设置更新
+	m_interrogation.SetResultCallback([this](size_t, Iec104InterrogationKind kind, const Iec104CommandResult& result) {
+		On104InterrogationResult(kind, result);
+	});
+	m_interrogation.AddStation(&m_iec104, Iec104InterrogationPlan());
 }
 
 void CNTPClientDlg::DoDataExchange(CDataExchange *pDX)
@@ -97,6 +120,8 @@ ON_EN_KILLFOCUS(IDC_EDIT7, &CNTPClientDlg::OnEnKillfocusEdit7)
 ON_BN_CLICKED(IDC_CHECK2, &CNTPClientDlg::OnBnClickedCheck2)
 ON_BN_CLICKED(IDC_CHECK3, &CNTPClientDlg::OnBnClickedCheck3)
 ON_MESSAGE(WM_104_EVENT, &CNTPClientDlg::On104EventMessage)
+ON_MESSAGE(WM_104_STATE, &CNTPClientDlg::On104StateMessage)
+ON_MESSAGE(WM_WHEEL_TIMER, &CNTPClientDlg::OnWheelTimerMessage)
 END_MESSAGE_MAP()
 
 // CNTPClientDlg 消息处理程序
@@ -162,11 +187,26 @@ BOOL CNTPClientDlg::OnInitDialog()
 		}
 		pVer->SetCurSel(m_settings.Version == 4 ? 1 : 0);
 	}
+	m_ntpPollTimer.SetCallback([this] { PostMessage(WM_WHEEL_TIMER, WHEEL_TIMER_NTP_POLL, 0); });
+	m_autoConnectTimer.SetCallback([this] { PostMessage(WM_WHEEL_TIMER, WHEEL_TIMER_AUTO_CONNECT, 0); });
+	m_timerThread.Start();
 	if (m_settings.AutoSync)
 	{
-		m_timerId = SetTimer(1, max(5U, m_settings.PeriodSeconds) * 1000, nullptr);
+		m_timerThread.Arm(m_ntpPollTimer, max(5U, m_settings.PeriodSeconds) * 1000);
 	}
 
+	// 104日志级别与报文记录
+	m_iec104.SetLogLevel((Iec104LogLevel)m_settings.Iec104LogLevel);
+	m_iec104.SetFrameRecording(m_settings.Iec104ShowFrames);
+
+	// 非标准链路参数（老网关），格式 COT/CA/IOA
+	Iec104LinkProfile profile;
+	if (!Iec104ParseProfile(m_settings.Iec104LinkProfile, profile))
+	{
+		AppendLog(L"104链路参数无效，使用标准配置 2/2/3: " + m_settings.Iec104LinkProfile);
+	}
+	m_iec104.SetLinkProfile(profile);
+
 	// 初始化104相关界面
 	SetDlgItemTextW(IDC_EDIT5, m_settings.Iec104ServerIP.c_str());  // 使用配置中的IP
 	SetDlgItemInt(IDC_EDIT6, m_settings.Iec104Port, FALSE);         // 使用配置中的端口
@@ -182,11 +222,30 @@ BOOL CNTPClientDlg::OnInitDialog()
 	GetDlgItem(IDC_BUTTON7)->EnableWindow(FALSE);  // 发送S帧
 	GetDlgItem(IDC_BUTTON8)->EnableWindow(FALSE);  // 测试帧
 
+	// 周期时钟分发：以NTP校正后的时间并补偿链路延时，连接启动后自动下发
+	if (m_settings.Iec104ClockSyncSeconds > 0)
+	{
+		Iec104ClockSyncConfig syncConfig;
+		syncConfig.ntpServer = m_settings.Server;
+		syncConfig.ntpPort = m_settings.Port;
+		syncConfig.ntpVersion = m_settings.Version;
+		syncConfig.ntpIntervalMs = max(5U, m_settings.PeriodSeconds) * 1000;
+		syncConfig.syncIntervalMs = m_settings.Iec104ClockSyncSeconds * 1000;
+		m_clockSync.SetConfig(syncConfig);
+		m_clockSync.AddStation(&m_iec104, m_settings.Iec104CommonAddress);
+		m_clockSync.SetLogLevel((Iec104LogLevel)m_settings.Iec104LogLevel);
+		m_clockSync.SetEventCallback([this](const std::wstring& message) { Queue104Log(L"[时钟分发] " + message); });
+		if (m_clockSync.Start())
+		{
+			AppendLog(L"104时钟分发已启用，周期 " + std::to_wstring(m_settings.Iec104ClockSyncSeconds) + L" 秒");
+		}
+	}
+
 	// 如果启用了104自动连接，延迟自动连接
 	if (m_settings.Iec104AutoConnect)
 	{
 		AppendLog(L"104自动连接已启用，1秒后自动连接...");
-		SetTimer(2, 1000, nullptr);  // 使用定时器ID 2，1秒后触发自动连接
+		m_timerThread.Arm(m_autoConnectTimer, 1000);
 	}
 
 	return TRUE; // 除非将焦点设置到控件，否则返回 TRUE
@@ -243,27 +302,30 @@ HCURSOR CNTPClientDlg::OnQueryDragIcon()
 
 void CNTPClientDlg::OnDestroy()
 {
-	if (m_timerId)
-	{
-		KillTimer(m_timerId);
-		m_timerId = 0;
-	}
+	// 停止时间轮线程（周期对时、自动连接、自动与周期召唤），之后不再投递定时器消息
+	m_timerThread.Stop();
+	KillTimer(4);  // 报文显示定时器
 	
-	// 清理104相关定时器
-	KillTimer(2);  // 自动连接定时器
-	KillTimer(3);  // 自动总召定时器
-	
-	// 断开104连接
+	// 先断开104连接：在途的对时命令随断开立即完成，时钟分发停止时不必等到命令超时
 	if (m_iec104Connected)
 	{
 		m_iec104.Disconnect();
 	}
+	m_clockSync.Stop();
 	
 	CDialog::OnDestroy();
 }
 
 void CNTPClientDlg::AppendLog(const std::wstring &s)
 {
+	AppendLogLines(std::vector<std::wstring>{ s });
+}
+
+void CNTPClientDlg::AppendLogLines(const std::vector<std::wstring> &lines)
+{
+	if (lines.empty())
+		return;
+
 	// 获取现有内容并在过大时截断
 	CString content; GetDlgItemTextW(IDC_EDIT4, content);
 	if (content.GetLength() > 10240) content.Empty();
@@ -271,11 +333,15 @@ void CNTPClientDlg::AppendLog(const std::wstring &s)
 	// 构造时间戳前缀 [yyyy-MM-dd HH:mm:ss]
 	SYSTEMTIME st{}; GetLocalTime(&st);
 	CString line;
-	line.Format(L"[%04d-%02d-%02d %02d:%02d:%02d.%03d] %s\r\n",
-				st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond,st.wMilliseconds,
-				s.c_str());
+	for (const auto &s : lines)
+	{
+		line.Format(L"[%04d-%02d-%02d %02d:%02d:%02d.%03d] %s\r\n",
+					st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond,st.wMilliseconds,
+					s.c_str());
+		content += line;
+	}
 
-	content += line;
+	// 一批日志只刷新一次控件
 	SetDlgItemTextW(IDC_EDIT4, content);
 
 	// 自动滚动至末尾（若控件为多行编辑框）
@@ -288,38 +354,22 @@ void CNTPClientDlg::AppendLog(const std::wstring &s)
 
 void CNTPClientDlg::RestartTimerFromSettings()
 {
-	if (m_timerId)
+	// 重新设置即从现在起按新周期计时
+	if (m_settings.AutoSync)
 	{
-		KillTimer(m_timerId);
-		m_timerId = 0;
+		m_timerThread.Arm(m_ntpPollTimer, max(5U, m_settings.PeriodSeconds) * 1000);
 	}
-	if (m_settings.AutoSync)
+	else
 	{
-		m_timerId = SetTimer(1, max(5U, m_settings.PeriodSeconds) * 1000, nullptr);
+		m_timerThread.Cancel(m_ntpPollTimer);
 	}
 }
 
 void CNTPClientDlg::OnTimer(UINT_PTR nIDEvent)
 {
-	if (nIDEvent == m_timerId)
+	if (nIDEvent == 4)  // 104报文显示定时器
 	{
-		OnBnClickedButton1();
-	}
-	else if (nIDEvent == 2)  // 104自动连接定时器
-	{
-		KillTimer(2);  // 只执行一次
-		if (m_settings.Iec104AutoConnect && !m_iec104Connected)
-		{
-			OnBnClicked104Connect();
-		}
-	}
-	else if (nIDEvent == 3)  // 104自动总召定时器
-	{
-		KillTimer(3);  // 只执行一次
-		if (m_iec104.IsStarted())
-		{
-			OnBnClicked104GeneralCall();
-		}
+		Drain104Frames();
 	}
 	
 	// 定期更新104统计信息
@@ -418,30 +468,18 @@ void CNTPClientDlg::OnBnClicked104Connect()
 
 	AppendLog(L"正在连接104服务器: " + std::wstring((LPCWSTR)ipStr) + L":" + std::to_wstring(port));
 
-	if (m_iec104.Connect((LPCWSTR)ipStr, (WORD)port))
+	// 只显示本次连接之后的报文
+	m_frameCursor = m_iec104.GetFrameRing().GetHead();
+
+	// 解析与连接在I/O线程中进行，结果由 On104StateMessage 处理，界面不等待
+	if (m_iec104.ConnectAsync((LPCWSTR)ipStr, (WORD)port))
 	{
 		m_iec104Connected = true;
 		
-		// 更新按钮状态
+		// 更新按钮状态（连接过程中可以断开以取消）
 		GetDlgItem(IDC_BUTTON2)->EnableWindow(FALSE);  // 连接按钮
 		GetDlgItem(IDC_BUTTON3)->EnableWindow(TRUE);   // 断开按钮
-		
-		AppendLog(L"104连接成功，正在初始化链路...");
-		
-		// 异步初始化链路
-		if (m_iec104.InitializeLink())
-		{
-			AppendLog(L"104链路初始化命令发送成功，等待响应...");
-			
-			// 启用基本功能按钮（等待STARTDT_CON后才启用数据传输相关按钮）
-			GetDlgItem(IDC_BUTTON7)->EnableWindow(TRUE);  // 发送S帧
-			GetDlgItem(IDC_BUTTON8)->EnableWindow(TRUE);  // 测试帧
-			Update104Statistics();
-		}
-		else
-		{
-			AppendLog(L"104链路初始化失败");
-		}
+		Update104Statistics();
 	}
 	else
 	{
@@ -449,10 +487,54 @@ void CNTPClientDlg::OnBnClicked104Connect()
 	}
 }
 
+void CNTPClientDlg::On104Connected()
+{
+	if (m_settings.Iec104ShowFrames)
+	{
+		SetTimer(4, 250, nullptr);  // 定期读取报文环并显示
+	}
+
+	if (!m_settings.Iec104CaptureFile.empty())
+	{
+		std::wstring err;
+		if (m_iec104.StartCapture(m_settings.Iec104CaptureFile, &err))
+			AppendLog(L"104抓包已开始: " + m_settings.Iec104CaptureFile);
+		else
+			AppendLog(L"104抓包启动失败: " + err);
+	}
+
+	AppendLog(L"104连接成功，正在初始化链路...");
+	
+	// 异步初始化链路
+	if (m_iec104.InitializeLink())
+	{
+		AppendLog(L"104链路初始化命令发送成功，等待响应...");
+		
+		// 启用基本功能按钮（等待STARTDT_CON后才启用数据传输相关按钮）
+		GetDlgItem(IDC_BUTTON7)->EnableWindow(TRUE);  // 发送S帧
+		GetDlgItem(IDC_BUTTON8)->EnableWindow(TRUE);  // 测试帧
+		Update104Statistics();
+	}
+	else
+	{
+		AppendLog(L"104链路初始化失败");
+	}
+}
+
 void CNTPClientDlg::OnBnClicked104Disconnect()
 {
+	m_interrogation.OnStationStopped(0);
 	m_iec104.Disconnect();
 	m_iec104Connected = false;
+	m_iec104Initialized = false;
+	KillTimer(4);
+	Drain104Frames();
+
+	if (m_iec104.IsCapturing())
+	{
+		m_iec104.StopCapture();
+		AppendLog(L"104抓包已停止，共 " + std::to_wstring(m_iec104.GetCapturedFrames()) + L" 帧");
+	}
 	
 	// 更新按钮状态
 	GetDlgItem(IDC_BUTTON2)->EnableWindow(TRUE);   // 连接按钮
@@ -473,7 +555,27 @@ void CNTPClientDlg::OnBnClicked104GeneralCall()
 	if (commonAddr == 0)
 		commonAddr = 1;
 	
-	if (m_iec104.SendGeneralCall((WORD)commonAddr))
+	// 总召完成（激活终止）后在日志中给出点数与耗时，回调在I/O线程执行
+	Iec104Command command;
+	command.type = Iec104TypeId::C_IC_NA_1;
+	command.commonAddr = (WORD)commonAddr;
+	UINT64 id = m_iec104.SendCommand(command, [this](const Iec104CommandResult& result) {
+		if (result.status == Iec104CommandStatus::COMPLETED)
+		{
+			Queue104Log(L"总召完成，点数: " + std::to_wstring(result.points) + L"，耗时: " +
+				std::to_wstring((result.completedUs - result.sentUs) / 1000) + L"ms");
+		}
+		else if (result.status == Iec104CommandStatus::NEGATIVE)
+		{
+			Queue104Log(L"总召被否定确认");
+		}
+		else
+		{
+			Queue104Log(L"总召未完成（超时或连接断开）");
+		}
+	});
+
+	if (id != 0)
 	{
 		AppendLog(L"发送总召命令成功，公共地址: " + std::to_wstring(commonAddr));
 	}
@@ -489,14 +591,30 @@ void CNTPClientDlg::OnBnClicked104ReadClock()
 	if (commonAddr == 0)
 		commonAddr = 1;
 	
-	if (m_iec104.ReadClock((WORD)commonAddr))
-	{
-		AppendLog(L"发送时钟读取命令，公共地址: " + std::to_wstring(commonAddr));
-	}
-	else
+	if (!m_iec104.IsStarted())
 	{
 		AppendLog(L"发送时钟读取命令失败");
+		return;
 	}
+
+	// 多次读取取往返最短的样本，给出 偏差±不确定度；已启用时钟分发时以NTP时间为参考
+	const int samples = 5;
+	INT64 referenceOffsetUs = m_clockSync.HasNtpTime() ? m_clockSync.GetNtpOffsetUs() : 0;
+	Iec104MeasureClockOffset(m_iec104, (WORD)commonAddr, samples, referenceOffsetUs, IEC104_T1_TIMEOUT_MS,
+		[this](const Iec104ClockOffset& offset) {
+			if (!offset.valid)
+			{
+				Queue104Log(L"时钟偏差测量失败，公共地址: " + std::to_wstring(offset.commonAddr));
+				return;
+			}
+			wchar_t msg[160];
+			swprintf_s(msg, L"子站 %u 时钟偏差 %+.3f ms ± %.3f ms（%s，样本 %d/%d，往返 %.3f~%.3f ms）",
+				offset.commonAddr, offset.offsetUs / 1000.0, offset.uncertaintyUs / 1000.0,
+				offset.offsetUs >= 0 ? L"快" : L"慢", offset.samples, offset.attempts,
+				offset.minRttUs / 1000.0, offset.maxRttUs / 1000.0);
+			Queue104Log(msg);
+		});
+	AppendLog(L"发送时钟读取命令，公共地址: " + std::to_wstring(commonAddr) + L"，测量偏差（" + std::to_wstring(samples) + L" 次）");
 }
 
 void CNTPClientDlg::OnBnClicked104SyncClock()
@@ -544,6 +662,14 @@ void CNTPClientDlg::OnBnClicked104SyncClock()
 		}
 	}
 	
+	// 未指定时间且启用了时钟分发：立即按NTP时间并补偿延时下发
+	if (!useCustomTime && m_clockSync.IsRunning())
+	{
+		m_clockSync.SyncNow();
+		AppendLog(L"已触发时钟分发（NTP时间，补偿链路延时）");
+		return;
+	}
+
 	// 如果没有自定义时间或格式错误，使用系统时间
 	if (!useCustomTime)
 	{
@@ -598,8 +724,47 @@ void CNTPClientDlg::OnBnClicked104Test()
 void CNTPClientDlg::On104Event(const std::wstring& message)
 {
 	// 在UI线程中更新日志
-	std::wstring* pMsg = new std::wstring(L"[104] " + message);
-	PostMessage(WM_104_EVENT, 0, (LPARAM)pMsg);
+	Queue104Log(L"[104] " + message);
+}
+
+void CNTPClientDlg::Queue104Log(std::wstring&& message)
+{
+	// 队列由空变为非空时才投递消息，UI线程一次取走整批
+	bool post = false;
+	{
+		std::lock_guard<std::mutex> lock(m_104LogMutex);
+		m_104LogQueue.push_back(std::move(message));
+		if (!m_104LogPosted)
+		{
+			m_104LogPosted = true;
+			post = true;
+		}
+	}
+
+	if (post)
+	{
+		PostMessage(WM_104_EVENT, 0, 0);
+	}
+}
+
+void CNTPClientDlg::Drain104Frames()
+{
+	m_frameBuffer.clear();
+	UINT64 lost = m_iec104.GetFrameRing().Read(m_frameCursor, m_frameBuffer, 256);
+	if (m_frameBuffer.empty() && lost == 0)
+		return;
+
+	std::vector<std::wstring> lines;
+	lines.reserve(m_frameBuffer.size() + 1);
+	if (lost > 0)
+	{
+		lines.push_back(L"[104] 报文显示跟不上，跳过 " + std::to_wstring(lost) + L" 帧");
+	}
+	for (const auto &frame : m_frameBuffer)
+	{
+		lines.push_back(L"[104] " + CIec104FrameRing::FormatFrame(frame));
+	}
+	AppendLogLines(lines);
 }
 
 void CNTPClientDlg::On104ClockReceived(const SYSTEMTIME& clockTime)
@@ -609,42 +774,138 @@ void CNTPClientDlg::On104ClockReceived(const SYSTEMTIME& clockTime)
 		clockTime.wYear, clockTime.wMonth, clockTime.wDay,
 		clockTime.wHour, clockTime.wMinute, clockTime.wSecond, clockTime.wMilliseconds);
 	
-	std::wstring* pMsg = new std::wstring(timeStr);
-	PostMessage(WM_104_EVENT, 0, (LPARAM)pMsg);
+	Queue104Log(timeStr);
+}
+
+Iec104InterrogationPlan CNTPClientDlg::Make104InterrogationPlan() const
+{
+	Iec104InterrogationPlan plan;
+	plan.commonAddr = m_settings.Iec104CommonAddress;
+	plan.initialGi = m_settings.Iec104AutoGeneralCall;
+	plan.giPeriodMs = m_settings.Iec104GiPeriodSeconds * 1000;
+	plan.counterPeriodMs = m_settings.Iec104CounterPeriodSeconds * 1000;
+	return plan;
+}
+
+void CNTPClientDlg::On104InterrogationResult(Iec104InterrogationKind kind, const Iec104CommandResult& result)
+{
+	// 在时间轮线程中调用，经日志队列转到UI线程
+	std::wstring name = kind == Iec104InterrogationKind::COUNTER ? L"电能量召唤" : L"总召";
+	if (result.status == Iec104CommandStatus::COMPLETED)
+	{
+		Queue104Log(L"[自动召唤] " + name + L"完成，点数: " + std::to_wstring(result.points) + L"，耗时: " +
+			std::to_wstring((result.completedUs - result.sentUs) / 1000) + L"ms");
+	}
+	else if (result.status == Iec104CommandStatus::NEGATIVE)
+	{
+		Queue104Log(L"[自动召唤] " + name + L"被否定确认");
+	}
+	else
+	{
+		Queue104Log(L"[自动召唤] " + name + L"未完成（超时或连接断开）");
+	}
 }
 
 LRESULT CNTPClientDlg::On104EventMessage(WPARAM wParam, LPARAM lParam)
 {
-	std::wstring* pMsg = (std::wstring*)lParam;
-	if (pMsg)
+	std::vector<std::wstring> lines;
+	{
+		std::lock_guard<std::mutex> lock(m_104LogMutex);
+		lines.swap(m_104LogQueue);
+		m_104LogPosted = false;
+	}
+
+	// 先显示排在前面的报文，保证报文与事件的先后顺序大致一致
+	Drain104Frames();
+	AppendLogLines(lines);
+	
+	// 更新统计信息
+	Update104Statistics();
+	
+	return 0;
+}
+
+LRESULT CNTPClientDlg::OnWheelTimerMessage(WPARAM wParam, LPARAM lParam)
+{
+	// 消息可能晚于设置变更到达，按当前设置与状态判断
+	switch (wParam)
 	{
-		AppendLog(*pMsg);
+	case WHEEL_TIMER_NTP_POLL:
+		if (m_settings.AutoSync)
+		{
+			// 先设置下一周期，再执行本次同步
+			m_timerThread.Arm(m_ntpPollTimer, max(5U, m_settings.PeriodSeconds) * 1000);
+			OnBnClickedButton1();
+		}
+		break;
+
+	case WHEEL_TIMER_AUTO_CONNECT:
+		if (m_settings.Iec104AutoConnect && !m_iec104Connected)
+		{
+			OnBnClicked104Connect();
+		}
+		break;
+	}
+	return 0;
+}
+
+LRESULT CNTPClientDlg::On104StateMessage(WPARAM wParam, LPARAM lParam)
+{
+	// 消息可能晚于用户的断开/重连到达，以连接当前的状态为准
+	Iec104State state = (Iec104State)wParam;
+	if (!m_iec104Connected || state != m_iec104.GetState())
+	{
+		return 0;
+	}
+
+	Drain104Frames();
+	switch (state)
+	{
+	case Iec104State::CONNECTED:
+		// 连接建立（STOPDT确认同样回到此状态，此时链路已初始化）
+		if (!m_iec104Initialized)
+		{
+			m_iec104Initialized = true;
+			On104Connected();
+		}
+		// STOPDT确认后停止自动召唤
+		m_interrogation.OnStationStopped(0);
+		break;
+
+	case Iec104State::STARTED:
+		// 启用数据传输相关按钮
+		GetDlgItem(IDC_BUTTON4)->EnableWindow(TRUE);  // 总召按钮
+		GetDlgItem(IDC_BUTTON5)->EnableWindow(TRUE);  // 读取时钟
+		GetDlgItem(IDC_BUTTON6)->EnableWindow(TRUE);  // 同步时钟
+		
+		AppendLog(L"[UI] 104链路初始化完成，功能按钮已启用");
 		
-		// 检查是否是数据传输启动完成的消息
-		if (pMsg->find(L"数据传输已启动") != std::wstring::npos)
+		// 自动总召（按调度器的启动延时，确保状态稳定）与周期召唤按当前设置开始调度
+		if (m_settings.Iec104AutoGeneralCall)
 		{
-			// 启用数据传输相关按钮
-			GetDlgItem(IDC_BUTTON4)->EnableWindow(TRUE);  // 总召按钮
-			GetDlgItem(IDC_BUTTON5)->EnableWindow(TRUE);  // 读取时钟
-			GetDlgItem(IDC_BUTTON6)->EnableWindow(TRUE);  // 同步时钟
-			
-			AppendLog(L"[UI] 104链路初始化完成，功能按钮已启用");
-			
-			// 如果启用了自动总召，自动执行总召
-			if (m_settings.Iec104AutoGeneralCall)
+			const Iec104InterrogationConfig& config = m_interrogation.GetConfig();
+			std::wstring when = std::to_wstring(config.startupDelayMs) + L"ms";
+			if (config.startupSpreadMs > 0)
 			{
-				AppendLog(L"[UI] 自动总召已启用，正在执行总召...");
-				// 延迟500ms执行总召，确保状态稳定
-				SetTimer(3, 500, nullptr);
+				when += L"至" + std::to_wstring(config.startupDelayMs + config.startupSpreadMs) + L"ms";
 			}
+			AppendLog(L"[UI] 自动总召已启用，" + when + L"后执行总召...");
 		}
-		
-		delete pMsg;
+		m_interrogation.SetPlan(0, Make104InterrogationPlan());
+		m_interrogation.OnStationStarted(0);
+		break;
+
+	case Iec104State::DISCONNECTED:
+		// 连接失败、超时或链路断开：回收连接并恢复按钮
+		AppendLog(m_iec104Initialized ? L"104链路已断开" : L"104连接失败");
+		OnBnClicked104Disconnect();
+		break;
+
+	default:
+		break;
 	}
-	
-	// 更新统计信息
+
 	Update104Statistics();
-	
 	return 0;
 }
 
@@ -673,6 +934,14 @@ void CNTPClientDlg::Update104Statistics()
 			status = L"数据传输中";
 			break;
 		}
+
+		// 序号异常时在状态后附加计数（跨重连累计）
+		Iec104SequenceStats seq = m_iec104.GetSequenceStats();
+		if (seq.gaps + seq.duplicates + seq.invalidAcks + seq.ackTimeouts > 0)
+		{
+			status += L"（序号缺口 " + std::to_wstring(seq.gaps) + L"，重复 " + std::to_wstring(seq.duplicates) + L"，确认异常 " +
+				std::to_wstring(seq.invalidAcks + seq.ackTimeouts) + L"）";
+		}
 		SetDlgItemTextW(IDC_STATIC_CONN_STATUS, status.c_str());
 	}
 	else
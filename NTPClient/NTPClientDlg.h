@@ -7,9 +7,21 @@
 #include "src/Ntp.h"
 #include "src/Settings.h"
 #include "src/Iec104Master.h"
+#include "src/Iec104ClockSync.h"
+#include "src/Iec104Interrogation.h"
+#include "src/TimerWheel.h"
 
 // 自定义消息
 #define WM_104_EVENT (WM_USER + 1)
+#define WM_104_STATE (WM_USER + 2)
+#define WM_WHEEL_TIMER (WM_USER + 3)   // wParam 为下面的定时器号
+
+// 时间轮定时器号
+enum : WPARAM
+{
+	WHEEL_TIMER_NTP_POLL = 1,      // 周期对时
+	WHEEL_TIMER_AUTO_CONNECT = 2   // 104自动连接
+};
 
 
 // CNTPClientDlg 对话框
@@ -35,19 +47,45 @@ protected:
 	// 功能与配置
 	CNtpClient   m_ntp;
 	CAppSettings m_settings;
-	UINT_PTR     m_timerId = 0;
+
+	// 周期对时与104自动连接：回调在时间轮线程中执行，投递 WM_WHEEL_TIMER 回到界面线程
+	CTimerWheelThread m_timerThread;
+	CWheelTimer  m_ntpPollTimer;
+	CWheelTimer  m_autoConnectTimer;
 
 	// IEC 104 Master
 	CIec104Master m_iec104;
-	bool m_iec104Connected = false;
+	bool m_iec104Connected = false;       // 已发起连接（含连接中）
+	bool m_iec104Initialized = false;     // 连接建立后已发送链路初始化
+
+	// NTP→104时钟分发（引用 m_iec104，须在其后声明以先于其析构）
+	CIec104ClockDistributor m_clockSync;
+
+	// 104自动总召与周期召唤：在 m_timerThread 中调度（引用 m_iec104，须在其后声明）
+	CIec104InterrogationScheduler m_interrogation;
+
+	// 104日志队列：工作线程入队，UI线程批量取出，每批只投递一次消息
+	std::mutex m_104LogMutex;
+	std::vector<std::wstring> m_104LogQueue;
+	bool m_104LogPosted = false;
+
+	// 报文环读取游标（报文只在此处读取时才格式化）
+	UINT64 m_frameCursor = 0;
+	std::vector<Iec104FrameRecord> m_frameBuffer;
 
 	// 辅助
 	void RestartTimerFromSettings();
 	void AppendLog(const std::wstring& s);
+	void AppendLogLines(const std::vector<std::wstring>& lines);
+	void Queue104Log(std::wstring&& message);
+	void Drain104Frames();
 
 	// IEC 104相关方法
 	void On104Event(const std::wstring& message);
+	void On104Connected();
 	void On104ClockReceived(const SYSTEMTIME& clockTime);
+	void On104InterrogationResult(Iec104InterrogationKind kind, const Iec104CommandResult& result);
+	Iec104InterrogationPlan Make104InterrogationPlan() const;
 	void Update104Statistics();
 
 	// 生成的消息映射函数
@@ -80,5 +118,7 @@ protected:
 	afx_msg void OnBnClickedCheck2();         // 104自动连接
 	afx_msg void OnBnClickedCheck3();         // 104自动总召
 	afx_msg LRESULT On104EventMessage(WPARAM wParam, LPARAM lParam);  // 104事件消息
+	afx_msg LRESULT On104StateMessage(WPARAM wParam, LPARAM lParam);  // 104连接状态变化
+	afx_msg LRESULT OnWheelTimerMessage(WPARAM wParam, LPARAM lParam); // 时间轮定时器到期
 	DECLARE_MESSAGE_MAP()
 };
@@ -0,0 +1,188 @@
+﻿#include "pch.h"
+#include "Iec104Capture.h"
+#include <cstring>
+
+namespace
+{
+#pragma pack(push, 1)
+    struct PcapFileHeader
+    {
+        DWORD magic;
+        WORD versionMajor;
+        WORD versionMinor;
+        LONG thisZone;
+        DWORD sigFigs;
+        DWORD snapLen;
+        DWORD linkType;
+    };
+
+    struct PcapRecordHeader
+    {
+        DWORD tsSec;
+        DWORD tsUsec;
+        DWORD inclLen;
+        DWORD origLen;
+    };
+#pragma pack(pop)
+
+    std::wstring LastErrorText(const std::wstring &prefix)
+    {
+        return prefix + L"，错误代码: " + std::to_wstring(GetLastError());
+    }
+}
+
+CIec104CaptureWriter::CIec104CaptureWriter()
+    : m_file(INVALID_HANDLE_VALUE), m_open(false), m_frames(0)
+{
+}
+
+CIec104CaptureWriter::~CIec104CaptureWriter()
+{
+    Close();
+}
+
+bool CIec104CaptureWriter::Open(const std::wstring &path, std::wstring *err)
+{
+    Close();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        if (err)
+            *err = LastErrorText(L"创建抓包文件失败: " + path);
+        return false;
+    }
+
+    PcapFileHeader header = {};
+    header.magic = IEC104_PCAP_MAGIC;
+    header.versionMajor = 2;
+    header.versionMinor = 4;
+    header.snapLen = 1 + IEC104_MAX_APDU_LEN;
+    header.linkType = IEC104_PCAP_LINKTYPE;
+
+    m_buffer.clear();
+    m_buffer.reserve(FLUSH_BYTES + sizeof(PcapRecordHeader) + 1 + IEC104_MAX_APDU_LEN);
+    const BYTE *p = (const BYTE *)&header;
+    m_buffer.insert(m_buffer.end(), p, p + sizeof(header));
+
+    m_frames = 0;
+    m_open.store(true, std::memory_order_release);
+    return true;
+}
+
+void CIec104CaptureWriter::Close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return;
+
+    m_open.store(false, std::memory_order_release);
+    FlushLocked();
+    CloseHandle(m_file);
+    m_file = INVALID_HANDLE_VALUE;
+}
+
+void CIec104CaptureWriter::Write(Iec104FrameDir dir, const BYTE *data, int length, INT64 timeUs)
+{
+    if (!data || length <= 0 || length > IEC104_MAX_APDU_LEN)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return;
+
+    PcapRecordHeader record;
+    record.tsSec = (DWORD)(timeUs / 1000000);
+    record.tsUsec = (DWORD)(timeUs % 1000000);
+    record.inclLen = (DWORD)length + 1;
+    record.origLen = record.inclLen;
+
+    const BYTE *p = (const BYTE *)&record;
+    m_buffer.insert(m_buffer.end(), p, p + sizeof(record));
+    m_buffer.push_back((BYTE)dir);
+    m_buffer.insert(m_buffer.end(), data, data + length);
+    m_frames.fetch_add(1, std::memory_order_relaxed);
+
+    if (m_buffer.size() >= FLUSH_BYTES)
+    {
+        FlushLocked();
+    }
+}
+
+void CIec104CaptureWriter::FlushLocked()
+{
+    if (m_buffer.empty() || m_file == INVALID_HANDLE_VALUE)
+        return;
+
+    DWORD written = 0;
+    WriteFile(m_file, m_buffer.data(), (DWORD)m_buffer.size(), &written, nullptr);
+    m_buffer.clear();
+}
+
+bool Iec104LoadCapture(const std::wstring &path, Iec104Capture &capture, std::wstring *err)
+{
+    capture.records.clear();
+    capture.data.clear();
+
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        if (err)
+            *err = LastErrorText(L"打开抓包文件失败: " + path);
+        return false;
+    }
+
+    LARGE_INTEGER size = {};
+    GetFileSizeEx(file, &size);
+    std::vector<BYTE> content((size_t)size.QuadPart);
+    DWORD read = 0;
+    bool ok = content.empty() || (ReadFile(file, content.data(), (DWORD)content.size(), &read, nullptr) && read == content.size());
+    CloseHandle(file);
+    if (!ok)
+    {
+        if (err)
+            *err = L"读取抓包文件失败: " + path;
+        return false;
+    }
+
+    PcapFileHeader header;
+    if (content.size() < sizeof(header))
+    {
+        if (err)
+            *err = L"抓包文件过短";
+        return false;
+    }
+    memcpy(&header, content.data(), sizeof(header));
+    if (header.magic != IEC104_PCAP_MAGIC || header.linkType != IEC104_PCAP_LINKTYPE)
+    {
+        if (err)
+            *err = L"不是104抓包文件（需要微秒时标、LINKTYPE_USER0）";
+        return false;
+    }
+
+    size_t pos = sizeof(header);
+    capture.data.reserve(content.size());
+    while (pos + sizeof(PcapRecordHeader) <= content.size())
+    {
+        PcapRecordHeader record;
+        memcpy(&record, &content[pos], sizeof(record));
+        pos += sizeof(record);
+        if (record.inclLen < 2 || record.inclLen > 1 + IEC104_MAX_APDU_LEN || pos + record.inclLen > content.size())
+        {
+            // 文件末尾被截断（例如程序异常退出），保留已完整读取的部分
+            break;
+        }
+
+        Iec104CaptureRecord r;
+        r.timeUs = (INT64)record.tsSec * 1000000 + record.tsUsec;
+        r.dir = content[pos] == (BYTE)Iec104FrameDir::TX ? Iec104FrameDir::TX : Iec104FrameDir::RX;
+        r.length = (BYTE)(record.inclLen - 1);
+        r.offset = (DWORD)capture.data.size();
+        capture.data.insert(capture.data.end(), content.data() + pos + 1, content.data() + pos + record.inclLen);
+        capture.records.push_back(r);
+        pos += record.inclLen;
+    }
+
+    return true;
+}
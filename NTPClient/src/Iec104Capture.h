@@ -0,0 +1,61 @@
+﻿#pragma once
+#include <windows.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Iec104Log.h"
+
+// 抓包文件格式：标准pcap（微秒时标），链路类型 LINKTYPE_USER0(147)
+// 每个报文的数据区为 1字节方向(0=接收,1=发送) + 完整APDU
+constexpr DWORD IEC104_PCAP_MAGIC = 0xA1B2C3D4;
+constexpr DWORD IEC104_PCAP_LINKTYPE = 147;
+
+// 抓包文件中的一条报文
+struct Iec104CaptureRecord
+{
+    INT64 timeUs;         // UTC时间，自1970-01-01起的微秒数
+    Iec104FrameDir dir;
+    BYTE length;          // APDU长度
+    DWORD offset;         // APDU在数据区中的偏移
+};
+
+// 抓包文件内容（报文元数据与APDU数据分开连续存放，回放时顺序访问）
+struct Iec104Capture
+{
+    std::vector<Iec104CaptureRecord> records;
+    std::vector<BYTE> data;
+
+    const BYTE* GetApdu(const Iec104CaptureRecord& record) const { return data.data() + record.offset; }
+};
+
+bool Iec104LoadCapture(const std::wstring& path, Iec104Capture& capture, std::wstring* err = nullptr);
+
+// 抓包写入器：收发线程都可调用，写入先进入内存缓冲，满64KB或关闭时落盘
+class CIec104CaptureWriter
+{
+public:
+    CIec104CaptureWriter();
+    ~CIec104CaptureWriter();
+
+    CIec104CaptureWriter(const CIec104CaptureWriter&) = delete;
+    CIec104CaptureWriter& operator=(const CIec104CaptureWriter&) = delete;
+
+    bool Open(const std::wstring& path, std::wstring* err = nullptr);
+    void Close();
+    bool IsOpen() const { return m_open.load(std::memory_order_acquire); }
+
+    void Write(Iec104FrameDir dir, const BYTE* data, int length, INT64 timeUs);
+    UINT64 GetFrameCount() const { return m_frames.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t FLUSH_BYTES = 64 * 1024;
+
+    std::mutex m_mutex;
+    HANDLE m_file;
+    std::vector<BYTE> m_buffer;
+    std::atomic<bool> m_open;
+    std::atomic<UINT64> m_frames;
+
+    void FlushLocked();
+};
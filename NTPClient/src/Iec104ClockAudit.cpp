@@ -0,0 +1,299 @@
+﻿#include "pch.h"
+#include "Iec104ClockAudit.h"
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+    // 没有更早的站时限时事件循环的最长等待
+    constexpr INT64 AUDIT_IDLE_WAIT_US = 100000;
+
+    INT64 AbsUs(INT64 value)
+    {
+        return value < 0 ? -value : value;
+    }
+}
+
+CIec104ClockAudit::CIec104ClockAudit(const Iec104ClockAuditConfig &config)
+    : m_config(config), m_active(0), m_cancel(false), m_logLevel(Iec104LogLevel::LOG_WARNING)
+{
+    m_config.maxConnections = (std::max)(m_config.maxConnections, (size_t)1);
+    m_config.samples = (std::max)(m_config.samples, 1);
+    m_config.verifySamples = (std::max)(m_config.verifySamples, 0);
+}
+
+CIec104ClockAudit::~CIec104ClockAudit()
+{
+}
+
+std::vector<Iec104ClockAuditResult> CIec104ClockAudit::Run(const std::vector<Iec104ClockAuditStation> &stations,
+                                                          Iec104ClockAuditCallback progress)
+{
+    m_progress = progress;
+    m_sessions.clear();
+    m_sessions.resize(stations.size());
+    m_results.assign(stations.size(), Iec104ClockAuditResult());
+    for (size_t i = 0; i < stations.size(); ++i)
+    {
+        m_results[i].index = i;
+        m_results[i].station = stations[i];
+    }
+    {
+        // 上一次 Run 的取消不影响本次，对象可以重复使用
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_events.clear();
+        m_cancel.store(false, std::memory_order_release);
+    }
+    m_active = 0;
+
+    // 一站结束立即补上下一站：同时进行的站数保持在 maxConnections
+    size_t next = 0;
+    std::vector<Event> events;
+    while (next < stations.size() || m_active > 0)
+    {
+        bool cancel = m_cancel.load(std::memory_order_acquire);
+        while (!cancel && next < stations.size() && m_active < m_config.maxConnections)
+        {
+            Begin(next++);
+        }
+        if (cancel)
+        {
+            next = stations.size();
+            for (size_t i = 0; i < m_sessions.size(); ++i)
+            {
+                if (m_sessions[i])
+                    Finish(i, Iec104ClockAuditStatus::CANCELLED);
+            }
+            break;
+        }
+
+        // 等到有事件或最早的站时限
+        INT64 nowUs = Iec104MonotonicUs();
+        INT64 waitUs = AUDIT_IDLE_WAIT_US;
+        for (const auto &session : m_sessions)
+        {
+            if (session)
+                waitUs = (std::min)(waitUs, (std::max)(session->deadlineUs - nowUs, (INT64)0));
+        }
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait_for(lock, std::chrono::microseconds(waitUs),
+                            [this] { return !m_events.empty() || m_cancel.load(std::memory_order_acquire); });
+            events.swap(m_events);
+        }
+
+        for (const Event &event : events)
+        {
+            Handle(event);
+        }
+        events.clear();
+
+        nowUs = Iec104MonotonicUs();
+        for (size_t i = 0; i < m_sessions.size(); ++i)
+        {
+            if (m_sessions[i] && nowUs >= m_sessions[i]->deadlineUs)
+            {
+                IEC104_LOG(LOG_WARNING, IEC104_LOG_CLOCK, L"审计超时: " + m_results[i].station.host + L":" + std::to_wstring(m_results[i].station.port));
+                Finish(i, Iec104ClockAuditStatus::TIMEOUT);
+            }
+        }
+    }
+
+    m_progress = nullptr;
+    std::vector<Iec104ClockAuditResult> results;
+    results.swap(m_results);
+    m_sessions.clear();
+    return results;
+}
+
+void CIec104ClockAudit::Cancel()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cancel.store(true, std::memory_order_release);
+    }
+    m_wake.notify_all();
+}
+
+void CIec104ClockAudit::Begin(size_t index)
+{
+    const Iec104ClockAuditStation &station = m_results[index].station;
+    std::unique_ptr<Session> session(new Session());
+    session->startUs = Iec104MonotonicUs();
+    session->deadlineUs = session->startUs + (INT64)m_config.stationTimeoutMs * 1000;
+    session->master.reset(new CIec104Master());
+
+    CIec104Master &master = *session->master;
+    master.SetLogLevel(m_logLevel.load(std::memory_order_relaxed));
+    master.SetFrameRecording(false);
+    master.SetLinkProfile(m_config.profile);
+    master.SetConnectTimeout(m_config.connectTimeoutMs);
+    std::wstring name = station.host + L":" + std::to_wstring(station.port);
+    master.SetEventCallback([this, name](const std::wstring &message) { LogEvent(L"[" + name + L"] " + message); });
+    master.SetStateCallback([this, index](Iec104State state) {
+        Event event{};
+        event.index = index;
+        event.type = EventType::STATE;
+        event.state = state;
+        Push(event);
+    });
+
+    m_sessions[index] = std::move(session);
+    ++m_active;
+    if (!master.ConnectAsync(station.host, station.port))
+    {
+        Finish(index, Iec104ClockAuditStatus::CONNECT_FAILED);
+    }
+}
+
+void CIec104ClockAudit::Handle(const Event &event)
+{
+    Session *session = m_sessions[event.index].get();
+    if (!session)
+        return;
+
+    Iec104ClockAuditResult &result = m_results[event.index];
+    switch (event.type)
+    {
+    case EventType::STATE:
+        if (session->phase == Phase::CONNECTING && event.state == Iec104State::CONNECTED)
+        {
+            session->phase = Phase::STARTING;
+            if (!session->master->StartDataTransfer())
+                Finish(event.index, Iec104ClockAuditStatus::CONNECT_FAILED);
+        }
+        else if (session->phase == Phase::STARTING && event.state == Iec104State::STARTED)
+        {
+            result.connectMs = (Iec104MonotonicUs() - session->startUs) / 1000.0;
+            session->phase = Phase::MEASURING;
+            Measure(event.index, m_config.samples);
+        }
+        else if (event.state == Iec104State::DISCONNECTED && (session->phase == Phase::CONNECTING || session->phase == Phase::STARTING))
+        {
+            // 测量与校正阶段的断开由命令回调以失败结束
+            Finish(event.index, Iec104ClockAuditStatus::CONNECT_FAILED);
+        }
+        break;
+
+    case EventType::MEASURED:
+        if (session->phase == Phase::MEASURING)
+        {
+            result.before = event.offset;
+            if (!event.offset.valid)
+            {
+                Finish(event.index, Iec104ClockAuditStatus::READ_FAILED);
+            }
+            else if (AbsUs(event.offset.offsetUs) <= m_config.thresholdUs)
+            {
+                Finish(event.index, Iec104ClockAuditStatus::OK);
+            }
+            else if (m_config.correct && event.offset.minRttUs <= (INT64)m_config.maxCorrectRttMs * 1000)
+            {
+                session->phase = Phase::CORRECTING;
+                Correct(event.index);
+            }
+            else
+            {
+                Finish(event.index, Iec104ClockAuditStatus::DRIFTED);
+            }
+        }
+        else if (session->phase == Phase::VERIFYING)
+        {
+            result.after = event.offset;
+            Finish(event.index, Iec104ClockAuditStatus::CORRECTED);
+        }
+        break;
+
+    case EventType::CORRECTED:
+        if (session->phase != Phase::CORRECTING)
+            break;
+        if (event.status != Iec104CommandStatus::COMPLETED)
+        {
+            Finish(event.index, Iec104ClockAuditStatus::CORRECT_FAILED);
+        }
+        else if (m_config.verifySamples > 0)
+        {
+            session->phase = Phase::VERIFYING;
+            Measure(event.index, m_config.verifySamples);
+        }
+        else
+        {
+            Finish(event.index, Iec104ClockAuditStatus::CORRECTED);
+        }
+        break;
+    }
+}
+
+void CIec104ClockAudit::Measure(size_t index, int samples)
+{
+    Iec104MeasureClockOffset(*m_sessions[index]->master, m_results[index].station.commonAddr, samples, m_config.referenceOffsetUs,
+                             m_config.commandTimeoutMs, [this, index](const Iec104ClockOffset &offset) {
+                                 Event event{};
+                                 event.index = index;
+                                 event.type = EventType::MEASURED;
+                                 event.offset = offset;
+                                 Push(event);
+                             });
+}
+
+void CIec104ClockAudit::Correct(size_t index)
+{
+    // 与时钟分发相同：假定链路对称，下发时间补偿最短往返的一半
+    Iec104ClockAuditResult &result = m_results[index];
+    result.correctionDelayUs = result.before.minRttUs / 2;
+
+    Iec104Command command;
+    command.type = Iec104TypeId::C_CS_NA_1;
+    command.commonAddr = result.station.commonAddr;
+    command.timeoutMs = m_config.commandTimeoutMs;
+    command.time = Iec104UtcUsToLocalTime(Iec104UtcNowUs() + m_config.referenceOffsetUs + result.correctionDelayUs);
+
+    IEC104_LOG(LOG_INFO, IEC104_LOG_CLOCK, L"校正子站 " + result.station.host + L":" + std::to_wstring(result.station.port) + L" 时钟，偏差 " +
+                                              std::to_wstring(result.before.offsetUs / 1000) + L"ms");
+    m_sessions[index]->master->SendCommand(command, [this, index](const Iec104CommandResult &syncResult) {
+        Event event{};
+        event.index = index;
+        event.type = EventType::CORRECTED;
+        event.status = syncResult.status;
+        Push(event);
+    });
+}
+
+void CIec104ClockAudit::Finish(size_t index, Iec104ClockAuditStatus status)
+{
+    // 先取出会话：断开时主站完成的回调产生的事件随后被丢弃
+    std::unique_ptr<Session> session = std::move(m_sessions[index]);
+    if (!session)
+        return;
+    --m_active;
+
+    Iec104ClockAuditResult &result = m_results[index];
+    result.status = status;
+    result.elapsedMs = (Iec104MonotonicUs() - session->startUs) / 1000.0;
+    session->master->Disconnect();
+    session->master->SetStateCallback(nullptr);
+    session->master->SetEventCallback(nullptr);
+    session.reset();
+
+    if (m_progress)
+    {
+        m_progress(result);
+    }
+}
+
+void CIec104ClockAudit::Push(const Event &event)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_events.push_back(event);
+    }
+    m_wake.notify_one();
+}
+
+void CIec104ClockAudit::LogEvent(const std::wstring &message)
+{
+    if (m_eventCallback)
+    {
+        m_eventCallback(message);
+    }
+}
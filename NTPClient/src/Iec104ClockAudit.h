@@ -0,0 +1,142 @@
+﻿#pragma once
+#include "Iec104ClockSync.h"
+#include <condition_variable>
+#include <memory>
+#include <vector>
+
+// 审计的站：地址、端口与公共地址
+struct Iec104ClockAuditStation
+{
+    std::wstring host;
+    WORD port = IEC104_DEFAULT_PORT;
+    WORD commonAddr = 1;
+};
+
+struct Iec104ClockAuditConfig
+{
+    size_t maxConnections = 128;         // 同时审计的站数（每站一个主站与I/O线程）
+    int samples = 5;                     // 每站读取时钟的次数，取往返最短的样本
+    INT64 referenceOffsetUs = 0;         // 参考时钟相对本机时钟的偏差（NTP偏差），0表示以本机时钟为参考
+    DWORD connectTimeoutMs = 5000;
+    DWORD commandTimeoutMs = 5000;       // 每次读取或下发的等待时间
+    DWORD stationTimeoutMs = 30000;      // 单站从开始连接到完成的上限
+    bool correct = false;                // 偏差超过阈值时下发校正
+    INT64 thresholdUs = 500000;          // 偏差阈值（绝对值）
+    DWORD maxCorrectRttMs = 2000;        // 最短往返超过此值时不校正（补偿误差过大）
+    int verifySamples = 3;               // 校正后复测的次数，0表示不复测
+    Iec104LinkProfile profile;
+};
+
+enum class Iec104ClockAuditStatus : BYTE
+{
+    OK,                 // 偏差在阈值内
+    DRIFTED,            // 偏差超过阈值，未校正（未启用校正或往返超限）
+    CORRECTED,          // 已校正（启用复测时为复测后的偏差）
+    CORRECT_FAILED,     // 校正命令失败或被否定
+    READ_FAILED,        // 连接成功但读取时钟失败
+    CONNECT_FAILED,     // 连接或启动数据传输失败
+    TIMEOUT,            // 超过 stationTimeoutMs
+    CANCELLED
+};
+
+struct Iec104ClockAuditResult
+{
+    size_t index = 0;                    // 在站列表中的序号
+    Iec104ClockAuditStation station;
+    Iec104ClockAuditStatus status = Iec104ClockAuditStatus::CANCELLED;
+    Iec104ClockOffset before;            // 审计测得的偏差
+    Iec104ClockOffset after;             // 校正后复测的偏差（校正且复测时有效）
+    INT64 correctionDelayUs = 0;         // 校正时补偿的单向延时
+    double connectMs = 0.0;              // 开始连接到数据传输启动
+    double elapsedMs = 0.0;              // 开始连接到审计结束
+};
+
+using Iec104ClockAuditCallback = std::function<void(const Iec104ClockAuditResult&)>;
+
+// 全站时钟审计：并行连接站列表中的各站，多次读取时钟（C_CS_NA_1，COT=5）按往返补偿测量偏差，
+// 可选对偏差超过阈值的站下发校正（参考时间 + 最短往返/2）并复测
+// - 同时进行的站数不超过 maxConnections，一站结束（断开）后立即开始下一站，
+//   连接失败或不应答的站在各自的时限后结束，不影响其他站
+// - 各主站的状态与命令回调只把事件放入队列，连接、测量、校正与断开都在调用 Run 的线程中衔接
+class CIec104ClockAudit
+{
+public:
+    explicit CIec104ClockAudit(const Iec104ClockAuditConfig& config);
+    ~CIec104ClockAudit();
+
+    CIec104ClockAudit(const CIec104ClockAudit&) = delete;
+    CIec104ClockAudit& operator=(const CIec104ClockAudit&) = delete;
+
+    void SetEventCallback(Iec104EventCallback callback) { m_eventCallback = callback; }
+    void SetLogLevel(Iec104LogLevel level) { m_logLevel = level; }
+
+    // 阻塞运行到全部站结束；每站结束时在本线程回调 progress，返回按站序排列的结果
+    std::vector<Iec104ClockAuditResult> Run(const std::vector<Iec104ClockAuditStation>& stations,
+                                            Iec104ClockAuditCallback progress = nullptr);
+
+    // 任意线程：未开始的站不再开始，进行中的站以 CANCELLED 结束；只作用于正在进行的 Run，下次 Run 开始时清除
+    void Cancel();
+
+    bool IsLogEnabled(Iec104LogLevel level, DWORD /*category*/) const
+    {
+        return (BYTE)level <= (BYTE)m_logLevel.load(std::memory_order_relaxed);
+    }
+
+private:
+    enum class Phase : BYTE
+    {
+        CONNECTING,
+        STARTING,           // 已连接，等待STARTDT确认
+        MEASURING,
+        CORRECTING,
+        VERIFYING
+    };
+
+    enum class EventType : BYTE
+    {
+        STATE,
+        MEASURED,
+        CORRECTED
+    };
+
+    // 主站回调放入队列的事件，按站序号引用会话（会话结束后到达的事件丢弃）
+    struct Event
+    {
+        size_t index;
+        EventType type;
+        Iec104State state;
+        Iec104CommandStatus status;
+        Iec104ClockOffset offset;
+    };
+
+    struct Session
+    {
+        std::unique_ptr<CIec104Master> master;
+        Phase phase = Phase::CONNECTING;
+        INT64 startUs = 0;
+        INT64 deadlineUs = 0;
+    };
+
+    void Begin(size_t index);
+    void Handle(const Event& event);
+    void Measure(size_t index, int samples);
+    void Correct(size_t index);
+    void Finish(size_t index, Iec104ClockAuditStatus status);
+    void Push(const Event& event);
+
+    void LogEvent(const std::wstring& message);
+
+    Iec104ClockAuditConfig m_config;
+    std::vector<std::unique_ptr<Session>> m_sessions;
+    std::vector<Iec104ClockAuditResult> m_results;
+    size_t m_active;
+    Iec104ClockAuditCallback m_progress;
+
+    std::mutex m_mutex;                  // 保护事件队列
+    std::condition_variable m_wake;
+    std::vector<Event> m_events;
+    std::atomic<bool> m_cancel;
+
+    Iec104EventCallback m_eventCallback;
+    std::atomic<Iec104LogLevel> m_logLevel;
+};
@@ -0,0 +1,417 @@
+﻿#include "pch.h"
+#include "Iec104ClockSync.h"
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+    constexpr INT64 CP56_HALF_RESOLUTION_US = 500;   // CP56Time2a 只到毫秒，截断误差按半毫秒计
+
+    // UTC微秒 → 本地时间的“纪元微秒”（与 SystemTimeToEpochMs 对本地时间的换算一致）
+    INT64 UtcUsToLocalEpochUs(INT64 utcUs)
+    {
+        SYSTEMTIME local = Iec104UtcUsToLocalTime(utcUs);
+        return CIec104Master::SystemTimeToEpochMs(local) * 1000 + utcUs % 1000;
+    }
+
+    // 一次偏差测量的状态，在各样本的命令回调之间传递
+    struct OffsetProbe
+    {
+        CIec104Master* master;
+        WORD commonAddr;
+        int samples;
+        INT64 referenceOffsetUs;
+        DWORD timeoutMs;
+        Iec104ClockOffsetCallback callback;
+        Iec104ClockOffset result;
+        INT64 utcBaseUs;                 // 发送前同时读取的UTC与主站时钟，用于把命令结果的时刻换算为本机时间
+        INT64 monoBaseUs;
+    };
+
+    void SendProbeSample(const std::shared_ptr<OffsetProbe>& probe);
+
+    void OnProbeSample(const std::shared_ptr<OffsetProbe>& probe, const Iec104CommandResult& sample)
+    {
+        Iec104ClockOffset& result = probe->result;
+        result.lastStatus = sample.status;
+        if (sample.status == Iec104CommandStatus::COMPLETED && CIec104Master::SystemTimeToEpochMs(sample.clock) != 0)
+        {
+            INT64 rttUs = sample.confirmedUs - sample.sentUs;
+            if (result.samples == 0 || rttUs < result.minRttUs)
+            {
+                // 参考时刻取往返中点；子站时间截断到毫秒，取该毫秒的中点
+                INT64 midUtcUs = probe->utcBaseUs + (sample.sentUs + rttUs / 2 - probe->monoBaseUs) + probe->referenceOffsetUs;
+                INT64 stationUs = CIec104Master::SystemTimeToEpochMs(sample.clock) * 1000 + CP56_HALF_RESOLUTION_US;
+                result.offsetUs = stationUs - UtcUsToLocalEpochUs(midUtcUs);
+                result.uncertaintyUs = rttUs / 2 + CP56_HALF_RESOLUTION_US;
+                result.minRttUs = rttUs;
+                result.clock = sample.clock;
+            }
+            result.maxRttUs = (std::max)(result.maxRttUs, rttUs);
+            ++result.samples;
+            result.valid = true;
+        }
+
+        // 连接断开时不再继续
+        if (result.attempts < probe->samples && sample.status != Iec104CommandStatus::FAILED)
+        {
+            SendProbeSample(probe);
+            return;
+        }
+        if (probe->callback)
+        {
+            probe->callback(result);
+        }
+    }
+
+    void SendProbeSample(const std::shared_ptr<OffsetProbe>& probe)
+    {
+        Iec104Command command;
+        command.type = Iec104TypeId::C_CS_NA_1;
+        command.commonAddr = probe->commonAddr;
+        command.read = true;
+        command.timeoutMs = probe->timeoutMs;
+
+        ++probe->result.attempts;
+        probe->utcBaseUs = Iec104UtcNowUs();
+        probe->monoBaseUs = probe->master->GetClock().NowUs();
+        probe->master->SendCommand(command, [probe](const Iec104CommandResult& sample) { OnProbeSample(probe, sample); });
+    }
+}
+
+void Iec104MeasureClockOffset(CIec104Master &master, WORD commonAddr, int samples, INT64 referenceOffsetUs,
+                              DWORD timeoutMs, Iec104ClockOffsetCallback callback)
+{
+    std::shared_ptr<OffsetProbe> probe = std::make_shared<OffsetProbe>();
+    probe->master = &master;
+    probe->commonAddr = commonAddr;
+    probe->samples = (std::max)(samples, 1);
+    probe->referenceOffsetUs = referenceOffsetUs;
+    probe->timeoutMs = timeoutMs;
+    probe->callback = std::move(callback);
+    probe->result.commonAddr = commonAddr;
+    probe->utcBaseUs = 0;
+    probe->monoBaseUs = 0;
+    SendProbeSample(probe);
+}
+
+CIec104ClockDistributor::CIec104ClockDistributor()
+    : m_inFlight(0), m_ntpOffsetUs(0), m_ntpValid(false), m_stop(false), m_syncRequested(false),
+      m_logLevel(Iec104LogLevel::LOG_INFO)
+{
+}
+
+CIec104ClockDistributor::~CIec104ClockDistributor()
+{
+    Stop();
+}
+
+size_t CIec104ClockDistributor::AddStation(CIec104Master *master, WORD commonAddr)
+{
+    std::unique_ptr<Station> station(new Station());
+    station->master = master;
+    station->status.commonAddr = commonAddr;
+    station->status.delayAcquisition = m_config.delayMode == Iec104DelayMode::DELAY_ACQUISITION;
+    station->busy = false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stations.push_back(std::move(station));
+    return m_stations.size() - 1;
+}
+
+bool CIec104ClockDistributor::Start(std::wstring *err)
+{
+    if (IsRunning() || m_stations.empty())
+    {
+        if (err)
+            *err = IsRunning() ? L"时钟分发已在运行" : L"没有配置子站";
+        return false;
+    }
+
+    m_stop = false;
+    m_syncRequested = false;
+    m_thread = std::thread(&CIec104ClockDistributor::WorkerProc, this);
+    return true;
+}
+
+void CIec104ClockDistributor::Stop()
+{
+    if (m_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        m_thread.join();
+    }
+
+    // 等待在途命令（含未启动时 MeasureOffsets 发出的测量）的回调结束：回调引用 this 与站，不能在其之前返回。
+    // 命令超时或连接断开时主站都会完成回调，因此不设时限
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this] { return m_inFlight == 0; });
+}
+
+void CIec104ClockDistributor::SetNtpResult(const CNtpResult &result)
+{
+    if (!result.Success)
+        return;
+
+    m_ntpOffsetUs.store((INT64)(result.OffsetMs * 1000.0), std::memory_order_release);
+    m_ntpValid.store(true, std::memory_order_release);
+}
+
+void CIec104ClockDistributor::SyncNow()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_syncRequested = true;
+    }
+    m_wake.notify_all();
+}
+
+SYSTEMTIME CIec104ClockDistributor::GetDisciplinedLocalTime(INT64 additionalUs) const
+{
+    INT64 offsetUs = m_ntpValid.load(std::memory_order_acquire) ? m_ntpOffsetUs.load(std::memory_order_acquire) : 0;
+    return Iec104UtcUsToLocalTime(Iec104UtcNowUs() + offsetUs + additionalUs);
+}
+
+std::vector<Iec104ClockSyncStatus> CIec104ClockDistributor::GetStatus() const
+{
+    std::vector<Iec104ClockSyncStatus> status;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    status.reserve(m_stations.size());
+    for (const auto &station : m_stations)
+    {
+        status.push_back(station->status);
+    }
+    return status;
+}
+
+size_t CIec104ClockDistributor::MeasureOffsets(int samples, Iec104ClockOffsetCallback callback)
+{
+    std::vector<Station *> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &station : m_stations)
+        {
+            if (station->master->IsStarted())
+            {
+                ++m_inFlight;
+                ready.push_back(station.get());
+            }
+        }
+    }
+
+    // 与下发周期共用在途计数，Stop 会等待测量结束
+    INT64 referenceOffsetUs = HasNtpTime() ? GetNtpOffsetUs() : 0;
+    for (Station *station : ready)
+    {
+        Iec104MeasureClockOffset(*station->master, station->status.commonAddr, samples, referenceOffsetUs, m_config.commandTimeoutMs,
+                                 [this, callback](const Iec104ClockOffset &offset) {
+                                     if (callback)
+                                     {
+                                         callback(offset);
+                                     }
+                                     std::lock_guard<std::mutex> lock(m_mutex);
+                                     if (--m_inFlight == 0)
+                                     {
+                                         m_idle.notify_all();
+                                     }
+                                 });
+    }
+    return ready.size();
+}
+
+void CIec104ClockDistributor::WorkerProc()
+{
+    ULONGLONG nextNtpMs = 0;
+    ULONGLONG nextSyncMs = 0;
+
+    for (;;)
+    {
+        ULONGLONG nowMs = GetTickCount64();
+        if (!m_config.ntpServer.empty() && nowMs >= nextNtpMs)
+        {
+            QueryNtp();
+            nextNtpMs = nowMs + (std::max)(m_config.ntpIntervalMs, (DWORD)1000);
+        }
+
+        if (nowMs >= nextSyncMs)
+        {
+            RunCycle();
+            nextSyncMs = nowMs + (std::max)(m_config.syncIntervalMs, (DWORD)1000);
+        }
+
+        // 等到下一个NTP查询或下发时刻，SyncNow 提前唤醒
+        ULONGLONG wakeMs = nextSyncMs;
+        if (!m_config.ntpServer.empty())
+            wakeMs = (std::min)(wakeMs, nextNtpMs);
+        ULONGLONG waitMs = wakeMs > GetTickCount64() ? wakeMs - GetTickCount64() : 0;
+
+        std::unique_lock<std::mutex> lock(m_wakeMutex);
+        m_wake.wait_for(lock, std::chrono::milliseconds(waitMs), [this] { return m_stop || m_syncRequested; });
+        if (m_stop)
+            break;
+        if (m_syncRequested)
+        {
+            m_syncRequested = false;
+            nextSyncMs = 0;
+        }
+    }
+}
+
+void CIec104ClockDistributor::QueryNtp()
+{
+    CNtpResult result{};
+    if (!m_ntp.Query(m_config.ntpServer, m_config.ntpPort, m_config.ntpVersion, result))
+    {
+        // 查询失败时沿用上一次的偏差（本机时钟短时间内漂移很小）
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_CLOCK, L"NTP查询失败: " + result.Error);
+        return;
+    }
+
+    SetNtpResult(result);
+    wchar_t msg[96];
+    swprintf_s(msg, L"NTP偏差 %.1f ms，往返 %.1f ms", result.OffsetMs, result.DelayMs);
+    IEC104_LOG(LOG_DEBUG, IEC104_LOG_CLOCK, msg);
+}
+
+void CIec104ClockDistributor::RunCycle()
+{
+    if (m_config.requireNtp && !HasNtpTime())
+    {
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_CLOCK, L"尚无NTP时间，跳过本周期时钟下发");
+        return;
+    }
+
+    std::vector<Station *> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &station : m_stations)
+        {
+            if (station->busy || !station->master->IsStarted())
+            {
+                ++station->status.skipped;
+                continue;
+            }
+            station->busy = true;
+            ++m_inFlight;
+            ready.push_back(station.get());
+        }
+    }
+
+    // 命令在锁外发送：发送失败时回调会同步执行
+    for (Station *station : ready)
+    {
+        MeasureDelay(station);
+    }
+}
+
+void CIec104ClockDistributor::MeasureDelay(Station *station)
+{
+    bool delayAcquisition;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        delayAcquisition = station->status.delayAcquisition;
+    }
+
+    Iec104Command command;
+    command.commonAddr = station->status.commonAddr;
+    command.timeoutMs = m_config.commandTimeoutMs;
+    if (delayAcquisition)
+    {
+        command.type = Iec104TypeId::C_CD_NA_1;
+        command.time = GetDisciplinedLocalTime();
+    }
+    else
+    {
+        command.type = Iec104TypeId::C_CS_NA_1;
+        command.read = true;
+    }
+
+    station->master->SendCommand(command, [this, station](const Iec104CommandResult &result) {
+        OnDelayMeasured(station, result);
+    });
+}
+
+void CIec104ClockDistributor::OnDelayMeasured(Station *station, const Iec104CommandResult &result)
+{
+    if (result.status != Iec104CommandStatus::COMPLETED)
+    {
+        // 子站不支持延时获得：改用时钟读取并立即重测
+        if (result.command.type == Iec104TypeId::C_CD_NA_1 && result.status == Iec104CommandStatus::NEGATIVE)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                station->status.delayAcquisition = false;
+            }
+            IEC104_LOG(LOG_INFO, IEC104_LOG_CLOCK, L"子站 " + std::to_wstring(station->status.commonAddr) + L" 不支持延时获得，改用时钟读取测量延时");
+            MeasureDelay(station);
+            return;
+        }
+        Finish(station, result.status);
+        return;
+    }
+
+    INT64 rttUs = result.confirmedUs - result.sentUs;
+    if (rttUs < 0 || rttUs > (INT64)m_config.maxRttMs * 1000)
+    {
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_CLOCK, L"子站 " + std::to_wstring(station->status.commonAddr) + L" 往返时间 " +
+                                                      std::to_wstring(rttUs / 1000) + L"ms 超限，本周期不下发");
+        Finish(station, Iec104CommandStatus::FAILED);
+        return;
+    }
+
+    // 假定链路对称，单向延时取往返时间的一半
+    INT64 delayUs = rttUs / 2;
+    Iec104Command command;
+    command.type = Iec104TypeId::C_CS_NA_1;
+    command.commonAddr = station->status.commonAddr;
+    command.timeoutMs = m_config.commandTimeoutMs;
+    command.time = GetDisciplinedLocalTime(delayUs);
+
+    station->master->SendCommand(command, [this, station, rttUs, delayUs](const Iec104CommandResult &syncResult) {
+        OnSyncDone(station, syncResult, rttUs, delayUs);
+    });
+}
+
+void CIec104ClockDistributor::OnSyncDone(Station *station, const Iec104CommandResult &result, INT64 rttUs, INT64 delayUs)
+{
+    if (result.status == Iec104CommandStatus::COMPLETED)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        station->status.lastRttUs = rttUs;
+        station->status.lastDelayUs = delayUs;
+        station->status.lastSyncUtcUs = Iec104UtcNowUs();
+        ++station->status.syncs;
+    }
+
+    IEC104_LOG(LOG_DEBUG, IEC104_LOG_CLOCK, L"子站 " + std::to_wstring(station->status.commonAddr) +
+                                               (result.status == Iec104CommandStatus::COMPLETED ? L" 时钟已下发，补偿 " : L" 时钟下发失败，补偿 ") +
+                                               std::to_wstring(delayUs) + L"us");
+    Finish(station, result.status);
+}
+
+void CIec104ClockDistributor::Finish(Station *station, Iec104CommandStatus status)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    station->status.lastStatus = status;
+    if (status != Iec104CommandStatus::COMPLETED)
+    {
+        ++station->status.failures;
+    }
+    station->busy = false;
+    if (--m_inFlight == 0)
+    {
+        m_idle.notify_all();
+    }
+}
+
+void CIec104ClockDistributor::LogEvent(const std::wstring &message)
+{
+    if (m_eventCallback)
+    {
+        m_eventCallback(message);
+    }
+}
@@ -0,0 +1,151 @@
+﻿#pragma once
+#include "Iec104Master.h"
+#include "Ntp.h"
+#include <condition_variable>
+#include <memory>
+
+// 链路延时的测量方式
+enum class Iec104DelayMode : BYTE
+{
+    DELAY_ACQUISITION,    // C_CD_NA_1 激活→激活确认的往返时间；子站否定确认时自动改用时钟读取
+    CLOCK_READ            // C_CS_NA_1 读取（COT=5）的往返时间
+};
+
+struct Iec104ClockSyncConfig
+{
+    // NTP时间源：服务器为空时使用 SetNtpResult 提供的结果
+    std::wstring ntpServer;
+    unsigned short ntpPort = 123;
+    int ntpVersion = 4;
+    DWORD ntpIntervalMs = 300000;
+    bool requireNtp = true;              // 尚无NTP结果时不下发（false 时直接使用本机时钟）
+
+    DWORD syncIntervalMs = 60000;        // 下发周期
+    Iec104DelayMode delayMode = Iec104DelayMode::DELAY_ACQUISITION;
+    DWORD commandTimeoutMs = 5000;
+    DWORD maxRttMs = 2000;               // 往返时间超过此值时本周期不下发（补偿误差过大）
+};
+
+// 单个子站的分发状态
+struct Iec104ClockSyncStatus
+{
+    WORD commonAddr = 0;
+    bool delayAcquisition = true;        // 子站是否支持 C_CD_NA_1
+    UINT64 syncs = 0;
+    UINT64 failures = 0;
+    UINT64 skipped = 0;                  // 未连接或上一周期未结束
+    INT64 lastRttUs = 0;
+    INT64 lastDelayUs = 0;               // 下发时补偿的单向延时
+    INT64 lastSyncUtcUs = 0;             // 最近一次成功的时刻（UTC微秒）
+    Iec104CommandStatus lastStatus = Iec104CommandStatus::PENDING;
+};
+
+// 子站时钟偏差测量结果
+// 偏差 = 子站时钟 - 参考时钟（正值表示子站快），取往返时间最小的样本，
+// 不确定度为 ±(往返时间/2 + CP56Time2a 毫秒分辨率的一半)
+struct Iec104ClockOffset
+{
+    WORD commonAddr = 0;
+    bool valid = false;
+    int attempts = 0;
+    int samples = 0;                     // 成功的样本数
+    INT64 offsetUs = 0;
+    INT64 uncertaintyUs = 0;
+    INT64 minRttUs = 0;
+    INT64 maxRttUs = 0;
+    SYSTEMTIME clock{};                  // 最佳样本中的子站时间
+    Iec104CommandStatus lastStatus = Iec104CommandStatus::PENDING;
+};
+
+using Iec104ClockOffsetCallback = std::function<void(const Iec104ClockOffset&)>;
+
+// 测量子站时钟偏差：连续发送 samples 次时钟读取（C_CS_NA_1，COT=5），
+// 以单调时钟记录请求与应答时刻，参考时间取往返中点的本机时间 + referenceOffsetUs（NTP偏差）。
+// 结果在主站I/O线程回调；连接断开时提前结束
+void Iec104MeasureClockOffset(CIec104Master& master, WORD commonAddr, int samples, INT64 referenceOffsetUs,
+                              DWORD timeoutMs, Iec104ClockOffsetCallback callback);
+
+// NTP→IEC 104 时钟分发
+// - 工作线程按周期查询NTP，得到本机时钟相对NTP的偏差
+// - 每个周期对所有已启动数据传输的子站：先测往返时间，再下发 C_CS_NA_1，
+//   时间取 NTP校正后的本地时间 + 往返时间/2
+// - 测量与下发在主站I/O线程的命令回调中衔接，子站之间并行
+// 主站对象须在本对象停止后才能销毁
+class CIec104ClockDistributor
+{
+public:
+    CIec104ClockDistributor();
+    ~CIec104ClockDistributor();
+
+    CIec104ClockDistributor(const CIec104ClockDistributor&) = delete;
+    CIec104ClockDistributor& operator=(const CIec104ClockDistributor&) = delete;
+
+    // 启动前配置
+    void SetConfig(const Iec104ClockSyncConfig& config) { m_config = config; }
+    size_t AddStation(CIec104Master* master, WORD commonAddr);
+    void SetEventCallback(Iec104EventCallback callback) { m_eventCallback = callback; }
+    void SetLogLevel(Iec104LogLevel level) { m_logLevel = level; }
+
+    bool Start(std::wstring* err = nullptr);
+    // 等待在途命令的回调结束后返回，不能在主站的回调（I/O线程）中调用
+    void Stop();
+    bool IsRunning() const { return m_thread.joinable(); }
+
+    // 任意线程：提供外部NTP查询结果；立即开始一个下发周期
+    void SetNtpResult(const CNtpResult& result);
+    void SyncNow();
+
+    bool HasNtpTime() const { return m_ntpValid.load(std::memory_order_acquire); }
+    INT64 GetNtpOffsetUs() const { return m_ntpOffsetUs.load(std::memory_order_acquire); }
+
+    // NTP校正后的本地时间，additionalUs 为额外加上的时间（延时补偿）
+    SYSTEMTIME GetDisciplinedLocalTime(INT64 additionalUs = 0) const;
+
+    std::vector<Iec104ClockSyncStatus> GetStatus() const;
+
+    // 任意线程：以NTP时间为参考测量所有已启动子站的时钟偏差，每个子站回调一次
+    // 返回参与测量的子站数
+    size_t MeasureOffsets(int samples, Iec104ClockOffsetCallback callback);
+
+    bool IsLogEnabled(Iec104LogLevel level, DWORD /*category*/) const
+    {
+        return (BYTE)level <= (BYTE)m_logLevel.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Station
+    {
+        CIec104Master* master;
+        Iec104ClockSyncStatus status;
+        bool busy;                       // 本周期的测量/下发尚未结束
+    };
+
+    void WorkerProc();
+    void QueryNtp();
+    void RunCycle();
+    void MeasureDelay(Station* station);
+    void OnDelayMeasured(Station* station, const Iec104CommandResult& result);
+    void OnSyncDone(Station* station, const Iec104CommandResult& result, INT64 rttUs, INT64 delayUs);
+    void Finish(Station* station, Iec104CommandStatus status);
+
+    void LogEvent(const std::wstring& message);
+
+    Iec104ClockSyncConfig m_config;
+    std::vector<std::unique_ptr<Station>> m_stations;
+    mutable std::mutex m_mutex;          // 保护各子站状态与 m_inFlight
+    std::condition_variable m_idle;
+    size_t m_inFlight;
+
+    CNtpClient m_ntp;
+    std::atomic<INT64> m_ntpOffsetUs;
+    std::atomic<bool> m_ntpValid;
+
+    std::thread m_thread;
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wake;
+    bool m_stop;
+    bool m_syncRequested;
+
+    Iec104EventCallback m_eventCallback;
+    std::atomic<Iec104LogLevel> m_logLevel;
+};
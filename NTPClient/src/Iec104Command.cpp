@@ -0,0 +1,324 @@
+﻿#include "pch.h"
+#include "Iec104Command.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    constexpr BYTE QOI_STATION = 20;      // 站召唤
+    constexpr BYTE QCC_GENERAL = 5;       // 总的电能量召唤
+
+    bool IsSelectable(Iec104TypeId type)
+    {
+        return type == Iec104TypeId::C_SC_NA_1 || type == Iec104TypeId::C_DC_NA_1 || type == Iec104TypeId::C_SE_NA_1 ||
+               type == Iec104TypeId::C_SE_NB_1 || type == Iec104TypeId::C_SE_NC_1;
+    }
+
+    bool IsInterrogation(Iec104TypeId type)
+    {
+        return type == Iec104TypeId::C_IC_NA_1 || type == Iec104TypeId::C_CI_NA_1;
+    }
+
+    // 召唤应答数据的传送原因：站/组召唤为 QOI，电能量召唤为 37（总）或 37+组号
+    BYTE GetInterrogatedCot(const Iec104Command &command)
+    {
+        if (command.type == Iec104TypeId::C_IC_NA_1)
+            return command.qualifier;
+        BYTE rqt = command.qualifier & 0x3F;
+        return (BYTE)Iec104Cot::COUNTER_INTERROGATED + (rqt == QCC_GENERAL ? 0 : rqt);
+    }
+}
+
+int Iec104EncodeCommand(const Iec104Command &command, bool select, BYTE *out)
+{
+    BYTE *p = out;
+    BYTE se = select ? 0x80 : 0x00;   // S/E：1选择，0执行
+
+    switch (command.type)
+    {
+    case Iec104TypeId::C_SC_NA_1:
+        *p++ = (command.value != 0.0 ? 0x01 : 0x00) | ((command.qualifier & 0x1F) << 2) | se;
+        break;
+
+    case Iec104TypeId::C_DC_NA_1:
+        *p++ = ((BYTE)command.value & 0x03) | ((command.qualifier & 0x1F) << 2) | se;
+        break;
+
+    case Iec104TypeId::C_SE_NA_1:
+    case Iec104TypeId::C_SE_NB_1:
+    {
+        double scaled = command.type == Iec104TypeId::C_SE_NA_1 ? command.value * 32768.0 : command.value;
+        short v = (short)(std::max)(-32768.0, (std::min)(32767.0, scaled));
+        *p++ = v & 0xFF;
+        *p++ = (v >> 8) & 0xFF;
+        *p++ = (command.qualifier & 0x7F) | se;
+        break;
+    }
+
+    case Iec104TypeId::C_SE_NC_1:
+    {
+        float f = (float)command.value;
+        memcpy(p, &f, sizeof(f));
+        p += sizeof(f);
+        *p++ = (command.qualifier & 0x7F) | se;
+        break;
+    }
+
+    case Iec104TypeId::C_RD_NA_1:
+        break;
+
+    case Iec104TypeId::C_IC_NA_1:
+        *p++ = command.qualifier != 0 ? command.qualifier : QOI_STATION;
+        break;
+
+    case Iec104TypeId::C_CI_NA_1:
+        *p++ = command.qualifier != 0 ? command.qualifier : QCC_GENERAL;
+        break;
+
+    case Iec104TypeId::C_CS_NA_1:
+        if (!command.read)
+        {
+            Iec104CP56Time cp56 = CIec104Master::SystemTimeToCP56(command.time);
+            memcpy(p, &cp56, sizeof(cp56));
+            p += sizeof(cp56);
+        }
+        break;
+
+    case Iec104TypeId::C_CD_NA_1:
+    {
+        // CP16Time2a：分钟内的毫秒数
+        WORD ms = (WORD)(command.time.wSecond * 1000 + command.time.wMilliseconds);
+        *p++ = ms & 0xFF;
+        *p++ = (ms >> 8) & 0xFF;
+        break;
+    }
+
+    default:
+        return -1;
+    }
+
+    return (int)(p - out);
+}
+
+CIec104CommandTracker::CIec104CommandTracker()
+    : m_nextId(1), m_count(0)
+{
+}
+
+UINT64 CIec104CommandTracker::Begin(const Iec104Command &command, Iec104CommandCallback callback, INT64 nowUs)
+{
+    Entry entry;
+    entry.callback = std::move(callback);
+    entry.result.command = command;
+    entry.result.sentUs = nowUs;
+    entry.stage = (command.selectBeforeOperate && IsSelectable(command.type)) ? Stage::SELECT : Stage::ACTIVATION;
+    entry.deadlineUs = nowUs + (INT64)command.timeoutMs * 1000;
+
+    // 限定词缺省值与编码保持一致，便于匹配应答
+    if (command.type == Iec104TypeId::C_IC_NA_1 && command.qualifier == 0)
+        entry.result.command.qualifier = QOI_STATION;
+    else if (command.type == Iec104TypeId::C_CI_NA_1 && command.qualifier == 0)
+        entry.result.command.qualifier = QCC_GENERAL;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    entry.result.id = m_nextId++;
+    m_entries.push_back(std::move(entry));
+    m_count.store(m_entries.size(), std::memory_order_release);
+    return m_entries.back().result.id;
+}
+
+void CIec104CommandTracker::OnSent(UINT64 id, INT64 nowUs)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (Entry &entry : m_entries)
+    {
+        if (entry.result.id == id)
+        {
+            entry.result.sentUs = nowUs;
+            break;
+        }
+    }
+}
+
+void CIec104CommandTracker::Abort(UINT64 id, INT64 nowUs, std::vector<Iec104CommandCompletion> &done)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        if (m_entries[i].result.id == id)
+        {
+            Complete(i, Iec104CommandStatus::FAILED, nowUs, done);
+            break;
+        }
+    }
+}
+
+bool CIec104CommandTracker::OnControlResponse(BYTE typeId, BYTE cot, WORD commonAddr, DWORD ioa, const BYTE *element, int elementLen,
+                                              INT64 nowUs, std::vector<Iec104CommandCompletion> &done,
+                                              std::vector<Iec104CommandExecute> &executes)
+{
+    BYTE base = cot & 0x3F;
+    bool negative = (cot & IEC104_COT_NEGATIVE) != 0;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        Entry &entry = m_entries[i];
+        const Iec104Command &command = entry.result.command;
+        if ((BYTE)command.type != typeId || command.ioa != ioa ||
+            (command.commonAddr != commonAddr && command.commonAddr != 0xFFFF))
+            continue;
+        if (IsInterrogation(command.type) && (elementLen < 1 || element[0] != command.qualifier))
+            continue;
+        if (entry.stage == Stage::TERMINATION && base != (BYTE)Iec104Cot::ACTIVATION_TERM)
+            continue;
+
+        entry.result.cot = cot;
+        if (negative)
+        {
+            Complete(i, Iec104CommandStatus::NEGATIVE, nowUs, done);
+            return true;
+        }
+
+        switch ((Iec104Cot)base)
+        {
+        case Iec104Cot::ACTIVATION_CON:
+            if (entry.stage == Stage::SELECT)
+            {
+                // 选择已确认，转入执行阶段
+                entry.result.selectedUs = nowUs;
+                entry.stage = Stage::ACTIVATION;
+                entry.deadlineUs = nowUs + (INT64)command.timeoutMs * 1000;
+                executes.push_back({ entry.result.id, command });
+                return true;
+            }
+
+            entry.result.confirmedUs = nowUs;
+            if (command.type == Iec104TypeId::C_CS_NA_1)
+            {
+                if (elementLen >= (int)sizeof(Iec104CP56Time))
+                {
+                    Iec104CP56Time cp56;
+                    memcpy(&cp56, element, sizeof(cp56));
+                    entry.result.clock = CIec104Master::CP56ToSystemTime(cp56);
+                }
+                Complete(i, Iec104CommandStatus::COMPLETED, nowUs, done);
+            }
+            else if (command.type == Iec104TypeId::C_CD_NA_1)
+            {
+                // 延时获得以激活确认为完成，确认时刻即往返时间
+                Complete(i, Iec104CommandStatus::COMPLETED, nowUs, done);
+            }
+            else if (IsInterrogation(command.type) || command.waitTermination)
+            {
+                entry.stage = Stage::TERMINATION;
+                entry.deadlineUs = nowUs + (INT64)command.timeoutMs * 1000;
+            }
+            else
+            {
+                Complete(i, Iec104CommandStatus::COMPLETED, nowUs, done);
+            }
+            return true;
+
+        case Iec104Cot::ACTIVATION_TERM:
+            if (entry.result.confirmedUs == 0)
+                entry.result.confirmedUs = nowUs;
+            Complete(i, Iec104CommandStatus::COMPLETED, nowUs, done);
+            return true;
+
+        case Iec104Cot::REQUEST:
+            // 时钟读取应答
+            if (command.type == Iec104TypeId::C_CS_NA_1 && elementLen >= (int)sizeof(Iec104CP56Time))
+            {
+                Iec104CP56Time cp56;
+                memcpy(&cp56, element, sizeof(cp56));
+                entry.result.clock = CIec104Master::CP56ToSystemTime(cp56);
+                entry.result.confirmedUs = nowUs;
+                Complete(i, Iec104CommandStatus::COMPLETED, nowUs, done);
+                return true;
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return false;
+}
+
+void CIec104CommandTracker::OnInterrogatedData(BYTE cot, WORD commonAddr, DWORD count, INT64 nowUs)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &entry : m_entries)
+    {
+        const Iec104Command &command = entry.result.command;
+        if (IsInterrogation(command.type) && entry.stage != Stage::SELECT && GetInterrogatedCot(command) == cot &&
+            (command.commonAddr == commonAddr || command.commonAddr == 0xFFFF))
+        {
+            // 召唤数据持续到达时重新计时
+            entry.result.points += count;
+            entry.deadlineUs = nowUs + (INT64)command.timeoutMs * 1000;
+            return;
+        }
+    }
+}
+
+void CIec104CommandTracker::OnReadResponse(BYTE typeId, WORD commonAddr, DWORD ioa, BYTE quality, double value, INT64 nowUs,
+                                           std::vector<Iec104CommandCompletion> &done)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        Entry &entry = m_entries[i];
+        const Iec104Command &command = entry.result.command;
+        if (command.type == Iec104TypeId::C_RD_NA_1 && command.ioa == ioa &&
+            (command.commonAddr == commonAddr || command.commonAddr == 0xFFFF))
+        {
+            entry.result.cot = (BYTE)Iec104Cot::REQUEST;
+            entry.result.responseType = typeId;
+            entry.result.quality = quality;
+            entry.result.value = value;
+            entry.result.points = 1;
+            entry.result.confirmedUs = nowUs;
+            Complete(i, Iec104CommandStatus::COMPLETED, nowUs, done);
+            return;
+        }
+    }
+}
+
+void CIec104CommandTracker::Expire(INT64 nowUs, std::vector<Iec104CommandCompletion> &done)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_entries.size();)
+    {
+        if (nowUs >= m_entries[i].deadlineUs)
+            Complete(i, Iec104CommandStatus::TIMEOUT, nowUs, done);
+        else
+            ++i;
+    }
+}
+
+void CIec104CommandTracker::FailAll(INT64 nowUs, std::vector<Iec104CommandCompletion> &done)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while (!m_entries.empty())
+    {
+        Complete(0, Iec104CommandStatus::FAILED, nowUs, done);
+    }
+}
+
+void CIec104CommandTracker::Complete(size_t index, Iec104CommandStatus status, INT64 nowUs, std::vector<Iec104CommandCompletion> &done)
+{
+    Entry &entry = m_entries[index];
+    entry.result.status = status;
+    entry.result.completedUs = nowUs;
+
+    Iec104CommandCompletion completion;
+    completion.callback = std::move(entry.callback);
+    completion.result = entry.result;
+    done.push_back(std::move(completion));
+
+    m_entries.erase(m_entries.begin() + index);
+    m_count.store(m_entries.size(), std::memory_order_release);
+}
@@ -0,0 +1,74 @@
+﻿#pragma once
+#include "Iec104Master.h"
+
+// 编码命令的信息元素（不含IOA，IOA按链路参数另行编码），返回字节数，不支持的类型返回-1
+int Iec104EncodeCommand(const Iec104Command& command, bool select, BYTE* out);
+
+// 命令完成通知，由调用方在锁外回调
+struct Iec104CommandCompletion
+{
+    Iec104CommandCallback callback;
+    Iec104CommandResult result;
+};
+
+// 先选择后执行：选择被确认后需要发送的执行命令
+struct Iec104CommandExecute
+{
+    UINT64 id;
+    Iec104Command command;
+};
+
+// 命令跟踪表
+// - 任意线程登记命令，I/O线程按 类型+公共地址+IOA（召唤命令再加限定词）匹配应答
+// - 同一键的多条命令按发送顺序匹配（应答按序返回）
+// - 每条命令按阶段计时：发送→激活确认→激活终止，超时即完成为TIMEOUT
+class CIec104CommandTracker
+{
+public:
+    CIec104CommandTracker();
+
+    CIec104CommandTracker(const CIec104CommandTracker&) = delete;
+    CIec104CommandTracker& operator=(const CIec104CommandTracker&) = delete;
+
+    UINT64 Begin(const Iec104Command& command, Iec104CommandCallback callback, INT64 nowUs);
+    void Abort(UINT64 id, INT64 nowUs, std::vector<Iec104CommandCompletion>& done);
+    // 命令帧真正发出（填写序号）时更新 sentUs：k窗口外等待的时间不计入往返；超时仍从 Begin 起算
+    void OnSent(UINT64 id, INT64 nowUs);
+
+    // 控制方向应答（激活确认/停止激活确认/激活终止/否定确认及请求应答）
+    bool OnControlResponse(BYTE typeId, BYTE cot, WORD commonAddr, DWORD ioa, const BYTE* element, int elementLen, INT64 nowUs,
+                           std::vector<Iec104CommandCompletion>& done, std::vector<Iec104CommandExecute>& executes);
+
+    // 监视方向数据：召唤期间计数，COT=5 的数据完成对应的读命令
+    void OnInterrogatedData(BYTE cot, WORD commonAddr, DWORD count, INT64 nowUs);
+    void OnReadResponse(BYTE typeId, WORD commonAddr, DWORD ioa, BYTE quality, double value, INT64 nowUs,
+                        std::vector<Iec104CommandCompletion>& done);
+
+    void Expire(INT64 nowUs, std::vector<Iec104CommandCompletion>& done);
+    void FailAll(INT64 nowUs, std::vector<Iec104CommandCompletion>& done);
+
+    size_t GetPendingCount() const { return m_count.load(std::memory_order_acquire); }
+
+private:
+    enum class Stage : BYTE
+    {
+        SELECT,           // 等待选择确认
+        ACTIVATION,       // 等待激活确认（读命令等待数据）
+        TERMINATION       // 等待激活终止
+    };
+
+    struct Entry
+    {
+        Iec104CommandCallback callback;
+        Iec104CommandResult result;
+        Stage stage;
+        INT64 deadlineUs;
+    };
+
+    void Complete(size_t index, Iec104CommandStatus status, INT64 nowUs, std::vector<Iec104CommandCompletion>& done);
+
+    mutable std::mutex m_mutex;
+    std::vector<Entry> m_entries;       // 按发送顺序
+    UINT64 m_nextId;
+    std::atomic<size_t> m_count;
+};
@@ -0,0 +1,1041 @@
+﻿#include "pch.h"
+#include "Iec104Gateway.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // FILETIME(1601-01-01) 与 1970-01-01 之间的100ns数
+    constexpr UINT64 FILETIME_UNIX_EPOCH = 116444736000000000ULL;
+
+    constexpr size_t TX_HIGH_WATER = 32 * 1024;                          // 发送缓冲积压超过此值时暂停生成报文
+    constexpr size_t REPLY_QUEUE_LEN = 16;
+    constexpr DWORD POLL_MAX_WAIT_MS = 1000;
+    constexpr BYTE QOI_STATION = 20;                                     // 站召唤
+    constexpr BYTE QCC_GENERAL = 5;                                      // 总的电能量召唤
+    constexpr WORD BROADCAST_CA = 0xFFFF;
+
+    bool IsCounterType(BYTE type)
+    {
+        return type == (BYTE)Iec104TypeId::M_IT_NA_1 || type == (BYTE)Iec104TypeId::M_IT_TB_1;
+    }
+
+    void PutAsduHeader(const Iec104CodecOps &codec, BYTE *asdu, BYTE type, int count, BYTE cot, WORD commonAddr)
+    {
+        Iec104AsduHeader header;
+        header.typeId = type;
+        header.vsq = (BYTE)count;
+        header.cot = cot;
+        header.commonAddr = commonAddr;
+        codec.putHeader(asdu, header);
+    }
+
+    // 毫秒时标（本地时间）转换为CP56Time2a，与 SystemTimeToEpochMs 互逆
+    Iec104CP56Time EpochMsToCP56(INT64 timestampMs)
+    {
+        ULARGE_INTEGER uli;
+        uli.QuadPart = (UINT64)timestampMs * 10000 + FILETIME_UNIX_EPOCH;
+        FILETIME ft;
+        ft.dwLowDateTime = uli.LowPart;
+        ft.dwHighDateTime = uli.HighPart;
+        SYSTEMTIME st = {};
+        FileTimeToSystemTime(&ft, &st);
+        return CIec104Master::SystemTimeToCP56(st);
+    }
+
+    // 召唤索引排序：公共地址、非计数量在前、类型、IOA
+    bool KeyLess(WORD ca1, bool counter1, BYTE type1, DWORD ioa1, WORD ca2, bool counter2, BYTE type2, DWORD ioa2)
+    {
+        if (ca1 != ca2)
+            return ca1 < ca2;
+        if (counter1 != counter2)
+            return !counter1;
+        if (type1 != type2)
+            return type1 < type2;
+        return ioa1 < ioa2;
+    }
+}
+
+struct CIec104Gateway::Session
+{
+    SOCKET socket = INVALID_SOCKET;
+    std::wstring peer;
+    bool closing = false;
+    bool started = false;
+
+    BYTE rxBuffer[4096];
+    int rxLength = 0;
+    std::vector<BYTE> txBuffer;
+    size_t txSent = 0;
+
+    WORD sendSeq = 0;          // 下一个发送序号 N(S)
+    WORD ackSeq = 0;           // 上级已确认到的序号
+    WORD recvSeq = 0;          // 下一个期望接收序号 N(R)
+    int unackedRecv = 0;
+    std::vector<ULONGLONG> sendTimes;   // 未确认I帧的发送时刻，按序号对k取模
+    ULONGLONG lastRxMs = 0;
+    bool testPending = false;
+    CWheelTimer t1AckTimer;
+    CWheelTimer t1TestTimer;
+    CWheelTimer t2Timer;
+    CWheelTimer t3Timer;
+
+    std::deque<Asdu> replies;               // 待发送的应答（确认、读应答等）
+    std::deque<SharedAsdu> spontaneous;     // 待发送的突发ASDU（与其他会话共享）
+
+    // 召唤进度：广播召唤每个公共地址一个任务
+    std::shared_ptr<const InterrogationIndex> irIndex;
+    std::deque<InterrogationJob> irJobs;
+    BYTE irCot = 0;
+    Asdu irCommand;
+};
+
+CIec104Gateway::CIec104Gateway(const Iec104GatewayConfig &config)
+    : m_config(config), m_codec(&Iec104GetCodec(config.profile)), m_listen(INVALID_SOCKET), m_wake(INVALID_SOCKET), m_wakeAddr(),
+      m_wakePending(false), m_sessionCount(0), m_timers(nullptr), m_stop(false), m_winsockReady(false), m_logLevel(Iec104LogLevel::LOG_WARNING)
+{
+    m_config.k = (std::max)(1, (std::min)(m_config.k, 32767));
+    m_config.w = (std::max)(1, m_config.w);
+    m_config.maxSessions = (std::max)(1, m_config.maxSessions);
+    m_config.queueLimit = (std::max)((size_t)1, m_config.queueLimit);
+
+    WSADATA wsaData;
+    m_winsockReady = WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+}
+
+CIec104Gateway::~CIec104Gateway()
+{
+    Stop();
+    if (m_winsockReady)
+    {
+        WSACleanup();
+    }
+}
+
+bool CIec104Gateway::Start(std::wstring *err)
+{
+    if (IsRunning())
+    {
+        if (err)
+            *err = L"网关已在运行";
+        return false;
+    }
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(m_config.port);
+    if (InetPtonW(AF_INET, m_config.bindAddress.c_str(), &addr.sin_addr) != 1)
+    {
+        if (err)
+            *err = L"无效的监听地址: " + m_config.bindAddress;
+        return false;
+    }
+
+    m_listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    m_wake = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    u_long nonBlocking = 1;
+    ioctlsocket(m_listen, FIONBIO, &nonBlocking);
+    ioctlsocket(m_wake, FIONBIO, &nonBlocking);
+
+    // 唤醒socket绑定回环地址的临时端口，发布线程向该地址发送
+    m_wakeAddr = sockaddr_in();
+    m_wakeAddr.sin_family = AF_INET;
+    m_wakeAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int wakeLen = sizeof(m_wakeAddr);
+    bool ok = m_listen != INVALID_SOCKET && m_wake != INVALID_SOCKET &&
+              bind(m_wake, (sockaddr *)&m_wakeAddr, sizeof(m_wakeAddr)) != SOCKET_ERROR &&
+              getsockname(m_wake, (sockaddr *)&m_wakeAddr, &wakeLen) != SOCKET_ERROR;
+    if (ok && (bind(m_listen, (sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR || listen(m_listen, SOMAXCONN) == SOCKET_ERROR))
+    {
+        if (err)
+            *err = L"监听端口失败: " + m_config.bindAddress + L":" + std::to_wstring(m_config.port) + L"，错误码 " + std::to_wstring(WSAGetLastError());
+        ok = false;
+    }
+    else if (!ok && err)
+    {
+        *err = L"创建网关socket失败，错误码 " + std::to_wstring(WSAGetLastError());
+    }
+
+    if (!ok)
+    {
+        if (m_listen != INVALID_SOCKET)
+            closesocket(m_listen);
+        if (m_wake != INVALID_SOCKET)
+            closesocket(m_wake);
+        m_listen = INVALID_SOCKET;
+        m_wake = INVALID_SOCKET;
+        return false;
+    }
+
+    m_stop = false;
+    m_wakePending = false;
+    m_thread = std::thread(&CIec104Gateway::ThreadProc, this);
+    IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"网关开始监听 " + m_config.bindAddress + L":" + std::to_wstring(m_config.port));
+    return true;
+}
+
+void CIec104Gateway::Stop()
+{
+    if (!IsRunning())
+        return;
+
+    m_stop = true;
+    m_wakePending = false;
+    Wake();
+    m_thread.join();
+
+    closesocket(m_listen);
+    closesocket(m_wake);
+    m_listen = INVALID_SOCKET;
+    m_wake = INVALID_SOCKET;
+
+    std::lock_guard<std::mutex> lock(m_inboxMutex);
+    m_inbox.clear();
+}
+
+Iec104GatewayStats CIec104Gateway::GetStats() const
+{
+    Iec104GatewayStats stats;
+    stats.sessions = m_sessionCount.load(std::memory_order_relaxed);
+    stats.connections = m_counters.connections.load(std::memory_order_relaxed);
+    stats.rejected = m_counters.rejected.load(std::memory_order_relaxed);
+    stats.iFramesSent = m_counters.iFramesSent.load(std::memory_order_relaxed);
+    stats.iFramesReceived = m_counters.iFramesReceived.load(std::memory_order_relaxed);
+    stats.publishedAsdus = m_counters.publishedAsdus.load(std::memory_order_relaxed);
+    stats.forwardedAsdus = m_counters.forwardedAsdus.load(std::memory_order_relaxed);
+    stats.droppedAsdus = m_counters.droppedAsdus.load(std::memory_order_relaxed);
+    stats.interrogations = m_counters.interrogations.load(std::memory_order_relaxed);
+    stats.interrogatedPoints = m_counters.interrogatedPoints.load(std::memory_order_relaxed);
+    stats.timeouts = m_counters.timeouts.load(std::memory_order_relaxed);
+    stats.protocolErrors = m_counters.protocolErrors.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void CIec104Gateway::Publish(const CIec104PointBatch &batch)
+{
+    // 召唤、读命令等应答只更新点库，上级通过自己的召唤取得
+    BYTE cot = batch.GetCot();
+    if (batch.empty() || m_sessionCount.load(std::memory_order_relaxed) == 0 ||
+        (cot != (BYTE)Iec104Cot::PERIODIC && cot != (BYTE)Iec104Cot::BACKGROUND && cot != (BYTE)Iec104Cot::SPONTANEOUS))
+    {
+        return;
+    }
+
+    BYTE type = batch.GetType();
+    int elemLen = 0;
+    bool hasTime = false;
+    if (!Iec104GetMonitorLayout(type, elemLen, hasTime))
+        return;
+
+    // 按上送链路参数编码，超出ASDU长度时拆分（RTU与上送的IOA字节数可能不同）
+    int objLen = m_codec->ioaLen + elemLen + (hasTime ? (int)sizeof(Iec104CP56Time) : 0);
+    size_t maxCount = (size_t)(std::min)(127, (IEC104_MAX_ASDU_LEN - m_codec->headerLen) / objLen);
+    SharedAsdu encoded[CIec104PointBatch::MAX_POINTS];
+    size_t asduCount = 0;
+    for (size_t first = 0; first < batch.size(); first += maxCount)
+    {
+        size_t count = (std::min)(maxCount, batch.size() - first);
+        std::shared_ptr<Asdu> asdu = std::make_shared<Asdu>();
+        BYTE *p = asdu->data + m_codec->headerLen;
+        for (size_t i = first; i < first + count; ++i)
+        {
+            const Iec104DataPoint &point = batch[i];
+            m_codec->putIoa(p, point.ioa & m_codec->ioaMask);
+            p += m_codec->ioaLen;
+            p += Iec104EncodeMonitorElement(type, point.quality, point.value, p);
+            if (hasTime)
+            {
+                Iec104CP56Time cp56 = EpochMsToCP56(point.timestampMs);
+                memcpy(p, &cp56, sizeof(cp56));
+                p += sizeof(cp56);
+            }
+        }
+        PutAsduHeader(*m_codec, asdu->data, type, (int)count, cot, batch.GetCommonAddr());
+        asdu->length = (int)(p - asdu->data);
+        encoded[asduCount++] = std::move(asdu);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_inboxMutex);
+        // 网关线程长时间取不走时丢弃最旧的，内存不随积压增长
+        size_t limit = m_config.queueLimit;
+        if (m_inbox.size() + asduCount > limit)
+        {
+            size_t drop = (std::min)(m_inbox.size(), m_inbox.size() + asduCount - limit);
+            m_inbox.erase(m_inbox.begin(), m_inbox.begin() + drop);
+            m_counters.droppedAsdus.fetch_add(drop, std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < asduCount; ++i)
+            m_inbox.push_back(std::move(encoded[i]));
+    }
+    m_counters.publishedAsdus.fetch_add(asduCount, std::memory_order_relaxed);
+    Wake();
+}
+
+void CIec104Gateway::Wake()
+{
+    // 网关线程取走之前只发送一次
+    if (m_wake != INVALID_SOCKET && !m_wakePending.exchange(true, std::memory_order_acq_rel))
+    {
+        char signal = 0;
+        sendto(m_wake, &signal, 1, 0, (const sockaddr *)&m_wakeAddr, sizeof(m_wakeAddr));
+    }
+}
+
+void CIec104Gateway::DrainInbox()
+{
+    char discard[64];
+    while (recv(m_wake, discard, sizeof(discard), 0) > 0)
+    {
+    }
+    m_wakePending.store(false, std::memory_order_release);
+
+    {
+        std::lock_guard<std::mutex> lock(m_inboxMutex);
+        m_inboxDrain.swap(m_inbox);
+    }
+
+    // 分发只复制共享指针；未启动数据传输的会话不接收突发
+    for (const SharedAsdu &asdu : m_inboxDrain)
+    {
+        for (auto &session : m_sessions)
+        {
+            if (!session->started || session->closing)
+                continue;
+            if (session->spontaneous.size() >= m_config.queueLimit)
+            {
+                session->spontaneous.pop_front();
+                m_counters.droppedAsdus.fetch_add(1, std::memory_order_relaxed);
+            }
+            session->spontaneous.push_back(asdu);
+        }
+    }
+    m_inboxDrain.clear();
+}
+
+void CIec104Gateway::ThreadProc()
+{
+    CTimerWheel wheel(GetTickCount64());
+    m_timers = &wheel;
+
+    std::vector<WSAPOLLFD> fds;
+    while (!m_stop)
+    {
+        // 唤醒socket、监听socket、各会话
+        fds.resize(2 + m_sessions.size());
+        fds[0].fd = m_wake;
+        fds[0].events = POLLRDNORM;
+        fds[1].fd = m_listen;
+        fds[1].events = POLLRDNORM;
+        size_t polled = m_sessions.size();
+        for (size_t i = 0; i < polled; ++i)
+        {
+            const Session &session = *m_sessions[i];
+            fds[2 + i].fd = session.socket;
+            fds[2 + i].events = POLLRDNORM | (session.txSent < session.txBuffer.size() ? POLLWRNORM : 0);
+        }
+        for (auto &fd : fds)
+            fd.revents = 0;
+
+        int waitMs = (int)wheel.GetNextTimeoutMs(POLL_MAX_WAIT_MS);
+        if (WSAPoll(fds.data(), (ULONG)fds.size(), waitMs) == SOCKET_ERROR)
+        {
+            Sleep(waitMs);
+        }
+        if (m_stop)
+            break;
+
+        ULONGLONG nowMs = GetTickCount64();
+        wheel.Advance(nowMs);
+
+        if (fds[0].revents != 0)
+            DrainInbox();
+        if (fds[1].revents != 0)
+            Accept(nowMs);
+
+        for (size_t i = 0; i < polled; ++i)
+        {
+            Session &session = *m_sessions[i];
+            if (!session.closing && (fds[2 + i].revents & (POLLRDNORM | POLLHUP | POLLERR)) && !ReadSession(session, nowMs))
+                CloseSession(session);
+        }
+
+        for (auto &session : m_sessions)
+        {
+            if (session->closing)
+                continue;
+            Pump(*session, nowMs);
+            if (!Flush(*session))
+            {
+                IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"网关会话 " + session->peer + L" 发送失败，关闭连接");
+                CloseSession(*session);
+            }
+        }
+
+        // 定时器回调与接收处理中只做标记，在此统一释放
+        auto closed = std::remove_if(m_sessions.begin(), m_sessions.end(), [](const std::unique_ptr<Session> &session) { return session->closing; });
+        if (closed != m_sessions.end())
+        {
+            m_sessions.erase(closed, m_sessions.end());
+            m_sessionCount.store(m_sessions.size(), std::memory_order_relaxed);
+        }
+    }
+
+    for (auto &session : m_sessions)
+        CloseSession(*session);
+    m_sessions.clear();
+    m_sessionCount = 0;
+    m_irIndex.reset();
+    m_timers = nullptr;
+}
+
+void CIec104Gateway::Accept(ULONGLONG nowMs)
+{
+    for (;;)
+    {
+        sockaddr_in peerAddr = {};
+        int peerLen = sizeof(peerAddr);
+        SOCKET client = accept(m_listen, (sockaddr *)&peerAddr, &peerLen);
+        if (client == INVALID_SOCKET)
+            return;
+
+        wchar_t host[INET_ADDRSTRLEN] = {};
+        InetNtopW(AF_INET, &peerAddr.sin_addr, host, INET_ADDRSTRLEN);
+        std::wstring peer = std::wstring(host) + L":" + std::to_wstring(ntohs(peerAddr.sin_port));
+        if ((int)m_sessions.size() >= m_config.maxSessions)
+        {
+            closesocket(client);
+            m_counters.rejected.fetch_add(1, std::memory_order_relaxed);
+            IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"网关连接数已达上限 " + std::to_wstring(m_config.maxSessions) + L"，拒绝 " + peer);
+            continue;
+        }
+
+        u_long nonBlocking = 1;
+        ioctlsocket(client, FIONBIO, &nonBlocking);
+        BOOL noDelay = TRUE;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+
+        m_sessions.emplace_back(new Session());
+        Session &session = *m_sessions.back();
+        session.socket = client;
+        session.peer = peer;
+        session.lastRxMs = nowMs;
+        session.sendTimes.resize(m_config.k);
+        session.txBuffer.reserve(TX_HIGH_WATER + 4 * IEC104_MAX_APDU_LEN);
+        session.irCommand.length = 0;
+        Session *target = &session;
+        session.t1AckTimer.SetCallback([this, target] { OnAckTimeout(*target); });
+        session.t1TestTimer.SetCallback([this, target] { OnTestTimeout(*target); });
+        session.t2Timer.SetCallback([this, target] { OnRecvAckTimeout(*target); });
+        session.t3Timer.SetCallback([this, target] { OnIdleTimeout(*target); });
+        m_timers->Arm(session.t3Timer, m_config.t3Ms);
+
+        m_sessionCount.store(m_sessions.size(), std::memory_order_relaxed);
+        m_counters.connections.fetch_add(1, std::memory_order_relaxed);
+        IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"网关接受上级连接 " + peer);
+    }
+}
+
+void CIec104Gateway::CloseSession(Session &session)
+{
+    if (session.socket != INVALID_SOCKET)
+    {
+        closesocket(session.socket);
+        session.socket = INVALID_SOCKET;
+    }
+    session.closing = true;
+    session.started = false;
+    session.t1AckTimer.Cancel();
+    session.t1TestTimer.Cancel();
+    session.t2Timer.Cancel();
+    session.t3Timer.Cancel();
+    session.spontaneous.clear();
+    session.replies.clear();
+    session.irJobs.clear();
+    session.irIndex.reset();
+}
+
+bool CIec104Gateway::ReadSession(Session &session, ULONGLONG nowMs)
+{
+    for (;;)
+    {
+        int received = recv(session.socket, (char *)session.rxBuffer + session.rxLength, (int)sizeof(session.rxBuffer) - session.rxLength, 0);
+        if (received == 0)
+        {
+            IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"网关会话 " + session.peer + L" 被上级关闭");
+            return false;
+        }
+        if (received < 0)
+        {
+            return WSAGetLastError() == WSAEWOULDBLOCK;
+        }
+        session.rxLength += received;
+
+        int pos = 0;
+        while (session.rxLength - pos >= 2)
+        {
+            if (session.rxBuffer[pos] != IEC104_START_BYTE)
+            {
+                m_counters.protocolErrors.fetch_add(1, std::memory_order_relaxed);
+                IEC104_LOG(LOG_WARNING, IEC104_LOG_FRAME, L"网关会话 " + session.peer + L" 接收失步");
+                return false;
+            }
+
+            int apduLen = session.rxBuffer[pos + 1] + 2;
+            if (session.rxLength - pos < apduLen)
+                break;
+            if (!HandleFrame(session, &session.rxBuffer[pos], apduLen, nowMs))
+                return false;
+            pos += apduLen;
+        }
+
+        if (pos > 0)
+        {
+            memmove(session.rxBuffer, session.rxBuffer + pos, session.rxLength - pos);
+            session.rxLength -= pos;
+        }
+    }
+}
+
+bool CIec104Gateway::HandleFrame(Session &session, const BYTE *frame, int length, ULONGLONG nowMs)
+{
+    if (length < 6)
+    {
+        m_counters.protocolErrors.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    session.lastRxMs = nowMs;
+    BYTE control0 = frame[2];
+
+    if ((control0 & 0x01) == 0)
+    {
+        WORD sendSeq = ((WORD)frame[3] << 7) | (frame[2] >> 1);
+        WORD ackSeq = ((WORD)frame[5] << 7) | (frame[4] >> 1);
+        if (sendSeq != session.recvSeq)
+        {
+            m_counters.protocolErrors.fetch_add(1, std::memory_order_relaxed);
+            IEC104_LOG(LOG_WARNING, IEC104_LOG_FRAME, L"网关会话 " + session.peer + L" 接收序号错误，期望 " +
+                                                         std::to_wstring(session.recvSeq) + L"，收到 " + std::to_wstring(sendSeq));
+            return false;
+        }
+        if (!Acknowledge(session, ackSeq))
+            return false;
+
+        session.recvSeq = (session.recvSeq + 1) % 32768;
+        if (session.unackedRecv++ == 0)
+            m_timers->Arm(session.t2Timer, m_config.t2Ms);
+        m_counters.iFramesReceived.fetch_add(1, std::memory_order_relaxed);
+
+        if (length > 6)
+            HandleAsdu(session, frame + 6, length - 6);
+
+        if (session.unackedRecv >= m_config.w)
+            SendSFrame(session);
+        return true;
+    }
+
+    if ((control0 & 0x03) == 0x01)
+    {
+        WORD ackSeq = ((WORD)frame[5] << 7) | (frame[4] >> 1);
+        return Acknowledge(session, ackSeq);
+    }
+
+    switch ((Iec104UFunction)control0)
+    {
+    case Iec104UFunction::STARTDT_ACT:
+        session.started = true;
+        SendUFrame(session, Iec104UFunction::STARTDT_CON);
+        IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"网关会话 " + session.peer + L" 数据传输已启动");
+        break;
+
+    case Iec104UFunction::STOPDT_ACT:
+        // 停止期间的突发不再排队，上级重新启动后以总召取得当前状态
+        session.started = false;
+        session.spontaneous.clear();
+        SendUFrame(session, Iec104UFunction::STOPDT_CON);
+        break;
+
+    case Iec104UFunction::TESTFR_ACT:
+        SendUFrame(session, Iec104UFunction::TESTFR_CON);
+        break;
+
+    case Iec104UFunction::TESTFR_CON:
+        session.testPending = false;
+        session.t1TestTimer.Cancel();
+        break;
+
+    default:
+        m_counters.protocolErrors.fetch_add(1, std::memory_order_relaxed);
+        break;
+    }
+    return true;
+}
+
+bool CIec104Gateway::Acknowledge(Session &session, WORD ackSeq)
+{
+    // 确认序号必须落在 [已确认, 已发送] 区间内
+    WORD outstanding = (session.sendSeq - session.ackSeq) & 0x7FFF;
+    WORD acked = (ackSeq - session.ackSeq) & 0x7FFF;
+    if (acked > outstanding)
+    {
+        m_counters.protocolErrors.fetch_add(1, std::memory_order_relaxed);
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_FRAME, L"网关会话 " + session.peer + L" 收到非法确认序号 " + std::to_wstring(ackSeq));
+        return false;
+    }
+
+    session.ackSeq = ackSeq;
+    if (session.sendSeq == session.ackSeq)
+        session.t1AckTimer.Cancel();
+    return true;
+}
+
+void CIec104Gateway::HandleAsdu(Session &session, const BYTE *asdu, int length)
+{
+    const int elementOffset = m_codec->headerLen + m_codec->ioaLen;
+    if (length < elementOffset)
+    {
+        m_counters.protocolErrors.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Iec104AsduHeader header;
+    m_codec->getHeader(asdu, header);
+    BYTE cot = header.cot & 0x3F;
+    WORD commonAddr = header.commonAddr;
+
+    switch ((Iec104TypeId)header.typeId)
+    {
+    case Iec104TypeId::C_IC_NA_1:
+    {
+        // 点库没有分组信息，只应答站召唤
+        BYTE qoi = length > elementOffset ? asdu[elementOffset] : QOI_STATION;
+        if (cot != (BYTE)Iec104Cot::ACTIVATION)
+            QueueReply(session, asdu, length, (BYTE)Iec104Cot::UNKNOWN_COT | IEC104_COT_NEGATIVE, commonAddr);
+        else if (qoi != QOI_STATION)
+            QueueReply(session, asdu, length, (BYTE)Iec104Cot::ACTIVATION_CON | IEC104_COT_NEGATIVE, commonAddr);
+        else
+            StartInterrogation(session, asdu, length, false, (BYTE)Iec104Cot::INTERROGATED, commonAddr);
+        break;
+    }
+
+    case Iec104TypeId::C_CI_NA_1:
+    {
+        // 计数量按点库中的当前值应答，不区分冻结/复位方式
+        BYTE rqt = length > elementOffset ? (asdu[elementOffset] & 0x3F) : QCC_GENERAL;
+        if (cot != (BYTE)Iec104Cot::ACTIVATION)
+            QueueReply(session, asdu, length, (BYTE)Iec104Cot::UNKNOWN_COT | IEC104_COT_NEGATIVE, commonAddr);
+        else if (rqt != QCC_GENERAL)
+            QueueReply(session, asdu, length, (BYTE)Iec104Cot::ACTIVATION_CON | IEC104_COT_NEGATIVE, commonAddr);
+        else
+            StartInterrogation(session, asdu, length, true, (BYTE)Iec104Cot::COUNTER_INTERROGATED, commonAddr);
+        break;
+    }
+
+    case Iec104TypeId::C_RD_NA_1:
+        HandleRead(session, asdu, length, cot, commonAddr);
+        break;
+
+    case Iec104TypeId::C_CS_NA_1:
+    {
+        // 网关的时钟由本机对时维护：读取返回本机时钟，同步命令否定确认
+        const int replyLen = elementOffset + (int)sizeof(Iec104CP56Time);
+        if (cot == (BYTE)Iec104Cot::REQUEST && length >= replyLen)
+        {
+            Asdu reply = MakeReply(asdu, replyLen, (BYTE)Iec104Cot::REQUEST, commonAddr);
+            SYSTEMTIME now;
+            GetLocalTime(&now);
+            Iec104CP56Time cp56 = CIec104Master::SystemTimeToCP56(now);
+            memcpy(reply.data + elementOffset, &cp56, sizeof(cp56));
+            if (session.replies.size() < REPLY_QUEUE_LEN)
+                session.replies.push_back(reply);
+        }
+        else
+        {
+            QueueReply(session, asdu, length, (cot == (BYTE)Iec104Cot::ACTIVATION ? (BYTE)Iec104Cot::ACTIVATION_CON : (BYTE)Iec104Cot::UNKNOWN_COT) | IEC104_COT_NEGATIVE, commonAddr);
+        }
+        break;
+    }
+
+    default:
+        // 控制命令不转发给RTU
+        QueueReply(session, asdu, length, (BYTE)Iec104Cot::UNKNOWN_TYPE | IEC104_COT_NEGATIVE, commonAddr);
+        break;
+    }
+}
+
+void CIec104Gateway::StartInterrogation(Session &session, const BYTE *asdu, int length, bool counters, BYTE cot, WORD commonAddr)
+{
+    std::shared_ptr<const InterrogationIndex> index = GetInterrogationIndex();
+    const std::vector<InterrogationKey> &keys = index->keys;
+
+    // 新的召唤替换尚未完成的召唤；广播地址按点库中的每个公共地址分别确认与终止
+    session.irJobs.clear();
+    auto rangeBegin = [&](WORD ca) {
+        return (size_t)(std::lower_bound(keys.begin(), keys.end(), ca, [counters](const InterrogationKey &key, WORD value) {
+                            return KeyLess(key.commonAddr, IsCounterType(key.type), key.type, key.ioa, value, counters, 0, 0);
+                        }) - keys.begin());
+    };
+    auto rangeEnd = [&](size_t from, WORD ca) {
+        size_t end = from;
+        while (end < keys.size() && keys[end].commonAddr == ca && IsCounterType(keys[end].type) == counters)
+            ++end;
+        return end;
+    };
+
+    if (commonAddr == BROADCAST_CA)
+    {
+        size_t pos = 0;
+        while (pos < keys.size())
+        {
+            WORD ca = keys[pos].commonAddr;
+            size_t begin = rangeBegin(ca);
+            size_t end = rangeEnd(begin, ca);
+            if (end > begin)
+                session.irJobs.push_back({ ca, false, begin, end });
+            while (pos < keys.size() && keys[pos].commonAddr == ca)
+                ++pos;
+        }
+    }
+    else
+    {
+        if (!IsKnownCommonAddr(commonAddr))
+        {
+            QueueReply(session, asdu, length, (BYTE)Iec104Cot::UNKNOWN_CA | IEC104_COT_NEGATIVE, commonAddr);
+            return;
+        }
+        size_t begin = rangeBegin(commonAddr);
+        session.irJobs.push_back({ commonAddr, false, begin, rangeEnd(begin, commonAddr) });
+    }
+
+    if (session.irJobs.empty())
+    {
+        // 点库为空时的广播召唤：以广播地址确认并终止
+        session.irJobs.push_back({ commonAddr, false, 0, 0 });
+    }
+
+    session.irIndex = index;
+    session.irCot = cot;
+    memcpy(session.irCommand.data, asdu, length);
+    session.irCommand.length = length;
+    m_counters.interrogations.fetch_add(1, std::memory_order_relaxed);
+    IEC104_LOG(LOG_DEBUG, IEC104_LOG_CMD, L"网关会话 " + session.peer + L" 开始召唤，公共地址 " + std::to_wstring(commonAddr) +
+                                             L"，公共地址数 " + std::to_wstring(session.irJobs.size()));
+}
+
+void CIec104Gateway::HandleRead(Session &session, const BYTE *asdu, int length, BYTE cot, WORD commonAddr)
+{
+    if (cot != (BYTE)Iec104Cot::REQUEST)
+    {
+        QueueReply(session, asdu, length, (BYTE)Iec104Cot::UNKNOWN_COT | IEC104_COT_NEGATIVE, commonAddr);
+        return;
+    }
+
+    DWORD ioa = m_codec->getIoa(asdu + m_codec->headerLen);
+    Iec104PointValue value;
+    bool found = false;
+    for (const auto &source : m_sources)
+    {
+        if (source->Read(commonAddr, ioa, value))
+        {
+            found = true;
+            break;
+        }
+    }
+    if (!found)
+    {
+        QueueReply(session, asdu, length, (BYTE)(IsKnownCommonAddr(commonAddr) ? Iec104Cot::UNKNOWN_IOA : Iec104Cot::UNKNOWN_CA) | IEC104_COT_NEGATIVE, commonAddr);
+        return;
+    }
+
+    // 以点最近一次更新的类型应答，带时标类型使用点库中的时标
+    int elemLen = 0;
+    bool hasTime = false;
+    if (!Iec104GetMonitorLayout(value.type, elemLen, hasTime) || session.replies.size() >= REPLY_QUEUE_LEN)
+        return;
+
+    Asdu reply;
+    BYTE *p = reply.data + m_codec->headerLen;
+    m_codec->putIoa(p, ioa);
+    p += m_codec->ioaLen;
+    p += Iec104EncodeMonitorElement(value.type, value.quality, value.value, p);
+    if (hasTime)
+    {
+        Iec104CP56Time cp56 = EpochMsToCP56(value.timestampMs);
+        memcpy(p, &cp56, sizeof(cp56));
+        p += sizeof(cp56);
+    }
+    PutAsduHeader(*m_codec, reply.data, value.type, 1, (BYTE)Iec104Cot::REQUEST, commonAddr);
+    reply.length = (int)(p - reply.data);
+    session.replies.push_back(reply);
+}
+
+void CIec104Gateway::OnAckTimeout(Session &session)
+{
+    if (session.sendSeq == session.ackSeq)
+        return;
+    ULONGLONG elapsedMs = m_timers->GetNowMs() - session.sendTimes[session.ackSeq % m_config.k];
+    if (elapsedMs < m_config.t1Ms)
+    {
+        m_timers->Arm(session.t1AckTimer, m_config.t1Ms - elapsedMs);
+        return;
+    }
+
+    m_counters.timeouts.fetch_add(1, std::memory_order_relaxed);
+    IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"网关会话 " + session.peer + L" t1超时：I帧未被确认");
+    CloseSession(session);
+}
+
+void CIec104Gateway::OnTestTimeout(Session &session)
+{
+    if (!session.testPending)
+        return;
+
+    m_counters.timeouts.fetch_add(1, std::memory_order_relaxed);
+    IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"网关会话 " + session.peer + L" t1超时：测试帧未被确认");
+    CloseSession(session);
+}
+
+void CIec104Gateway::OnRecvAckTimeout(Session &session)
+{
+    if (session.unackedRecv > 0)
+        SendSFrame(session);
+}
+
+void CIec104Gateway::OnIdleTimeout(Session &session)
+{
+    ULONGLONG nowMs = m_timers->GetNowMs();
+    ULONGLONG idleMs = nowMs - session.lastRxMs;
+    if (idleMs < m_config.t3Ms)
+    {
+        m_timers->Arm(session.t3Timer, m_config.t3Ms - idleMs);
+        return;
+    }
+
+    if (!session.testPending)
+    {
+        SendUFrame(session, Iec104UFunction::TESTFR_ACT);
+        session.testPending = true;
+        m_timers->Arm(session.t1TestTimer, m_config.t1Ms);
+    }
+    session.lastRxMs = nowMs;
+    m_timers->Arm(session.t3Timer, m_config.t3Ms);
+}
+
+void CIec104Gateway::Pump(Session &session, ULONGLONG nowMs)
+{
+    // 应答、突发、召唤依次生成I帧：突发先于召唤发出，召唤读取的点值不会早于已排队的突发
+    while (session.started && ((session.sendSeq - session.ackSeq) & 0x7FFF) < m_config.k &&
+           session.txBuffer.size() - session.txSent < TX_HIGH_WATER)
+    {
+        if (!session.replies.empty())
+        {
+            const Asdu &reply = session.replies.front();
+            SendIFrame(session, reply.data, reply.length, nowMs);
+            session.replies.pop_front();
+        }
+        else if (!session.spontaneous.empty())
+        {
+            const Asdu &asdu = *session.spontaneous.front();
+            SendIFrame(session, asdu.data, asdu.length, nowMs);
+            session.spontaneous.pop_front();
+            m_counters.forwardedAsdus.fetch_add(1, std::memory_order_relaxed);
+        }
+        else if (!session.irJobs.empty())
+        {
+            EmitInterrogation(session, nowMs);
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+void CIec104Gateway::EmitInterrogation(Session &session, ULONGLONG nowMs)
+{
+    InterrogationJob &job = session.irJobs.front();
+    if (!job.confirmed)
+    {
+        Asdu con = MakeReply(session.irCommand.data, session.irCommand.length, (BYTE)Iec104Cot::ACTIVATION_CON, job.commonAddr);
+        SendIFrame(session, con.data, con.length, nowMs);
+        job.confirmed = true;
+        return;
+    }
+
+    if (job.next >= job.end)
+    {
+        Asdu term = MakeReply(session.irCommand.data, session.irCommand.length, (BYTE)Iec104Cot::ACTIVATION_TERM, job.commonAddr);
+        SendIFrame(session, term.data, term.length, nowMs);
+        session.irJobs.pop_front();
+        if (session.irJobs.empty())
+            session.irIndex.reset();
+        return;
+    }
+
+    // 同类型的连续点打包为SQ=0的ASDU，点值在发送时从点库读取
+    const std::vector<InterrogationKey> &keys = session.irIndex->keys;
+    BYTE type = keys[job.next].type;
+    int elemLen = 0;
+    bool hasTime = false;
+    Iec104GetMonitorLayout(type, elemLen, hasTime);
+    int objLen = m_codec->ioaLen + elemLen;
+    int maxCount = (std::min)(127, (IEC104_MAX_ASDU_LEN - m_codec->headerLen) / objLen);
+
+    Asdu asdu;
+    BYTE *p = asdu.data + m_codec->headerLen;
+    int count = 0;
+    while (job.next < job.end && count < maxCount && keys[job.next].type == type)
+    {
+        const InterrogationKey &key = keys[job.next++];
+        Iec104PointValue value;
+        if (!m_sources[key.source]->Read(key.commonAddr, key.ioa, value))
+            continue;
+        m_codec->putIoa(p, key.ioa & m_codec->ioaMask);
+        p += m_codec->ioaLen;
+        p += Iec104EncodeMonitorElement(type, value.quality, value.value, p);
+        ++count;
+    }
+    if (count == 0)
+        return;
+
+    PutAsduHeader(*m_codec, asdu.data, type, count, session.irCot, job.commonAddr);
+    SendIFrame(session, asdu.data, (int)(p - asdu.data), nowMs);
+    m_counters.interrogatedPoints.fetch_add(count, std::memory_order_relaxed);
+}
+
+bool CIec104Gateway::Flush(Session &session)
+{
+    while (session.txSent < session.txBuffer.size())
+    {
+        int sent = send(session.socket, (const char *)session.txBuffer.data() + session.txSent, (int)(session.txBuffer.size() - session.txSent), 0);
+        if (sent == SOCKET_ERROR)
+        {
+            return WSAGetLastError() == WSAEWOULDBLOCK;
+        }
+        session.txSent += sent;
+    }
+
+    session.txBuffer.clear();
+    session.txSent = 0;
+    return true;
+}
+
+void CIec104Gateway::AppendFrame(Session &session, const BYTE *frame, int length)
+{
+    if (session.txSent > 0 && session.txSent >= session.txBuffer.size() / 2)
+    {
+        session.txBuffer.erase(session.txBuffer.begin(), session.txBuffer.begin() + session.txSent);
+        session.txSent = 0;
+    }
+    session.txBuffer.insert(session.txBuffer.end(), frame, frame + length);
+}
+
+void CIec104Gateway::SendIFrame(Session &session, const BYTE *asdu, int length, ULONGLONG nowMs)
+{
+    // APCI与ASDU直接写入发送缓冲，共享的突发ASDU只在此复制一次
+    BYTE apci[6];
+    apci[0] = IEC104_START_BYTE;
+    apci[1] = (BYTE)(length + 4);
+    apci[2] = (session.sendSeq << 1) & 0xFF;
+    apci[3] = (session.sendSeq >> 7) & 0xFF;
+    apci[4] = (session.recvSeq << 1) & 0xFF;
+    apci[5] = (session.recvSeq >> 7) & 0xFF;
+    AppendFrame(session, apci, sizeof(apci));
+    session.txBuffer.insert(session.txBuffer.end(), asdu, asdu + length);
+
+    session.sendTimes[session.sendSeq % m_config.k] = nowMs;
+    session.sendSeq = (session.sendSeq + 1) % 32768;
+    session.unackedRecv = 0;
+    session.t2Timer.Cancel();
+    if (!session.t1AckTimer.IsArmed())
+        m_timers->Arm(session.t1AckTimer, m_config.t1Ms);
+    m_counters.iFramesSent.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CIec104Gateway::SendSFrame(Session &session)
+{
+    BYTE frame[6] = { IEC104_START_BYTE, 4, 0x01, 0x00, (BYTE)((session.recvSeq << 1) & 0xFF), (BYTE)((session.recvSeq >> 7) & 0xFF) };
+    AppendFrame(session, frame, sizeof(frame));
+    session.unackedRecv = 0;
+    session.t2Timer.Cancel();
+}
+
+void CIec104Gateway::SendUFrame(Session &session, Iec104UFunction function)
+{
+    BYTE frame[6] = { IEC104_START_BYTE, 4, (BYTE)function, 0x00, 0x00, 0x00 };
+    AppendFrame(session, frame, sizeof(frame));
+}
+
+CIec104Gateway::Asdu CIec104Gateway::MakeReply(const BYTE *asdu, int length, BYTE cot, WORD commonAddr) const
+{
+    // 镜像命令ASDU，替换传送原因与公共地址（保留源发站地址与试验位）
+    Asdu reply;
+    memcpy(reply.data, asdu, length);
+    Iec104AsduHeader header;
+    m_codec->getHeader(asdu, header);
+    header.cot = cot | (header.cot & IEC104_COT_TEST);
+    header.commonAddr = commonAddr;
+    m_codec->putHeader(reply.data, header);
+    reply.length = length;
+    return reply;
+}
+
+void CIec104Gateway::QueueReply(Session &session, const BYTE *asdu, int length, BYTE cot, WORD commonAddr)
+{
+    if (session.replies.size() >= REPLY_QUEUE_LEN || length > IEC104_MAX_ASDU_LEN)
+    {
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_CMD, L"网关会话 " + session.peer + L" 应答队列已满，丢弃应答");
+        return;
+    }
+    session.replies.push_back(MakeReply(asdu, length, cot, commonAddr));
+}
+
+std::shared_ptr<const CIec104Gateway::InterrogationIndex> CIec104Gateway::GetInterrogationIndex()
+{
+    // 点库只增不删：点数不变时沿用上次的索引，多个会话同时召唤只排序一次
+    size_t pointCount = 0;
+    for (const auto &source : m_sources)
+        pointCount += source->GetPointCount();
+    if (m_irIndex && m_irIndex->pointCount == pointCount)
+        return m_irIndex;
+
+    std::shared_ptr<InterrogationIndex> index = std::make_shared<InterrogationIndex>();
+    index->pointCount = pointCount;
+    index->keys.reserve(pointCount);
+    std::vector<Iec104PointValue> snapshot;
+    for (size_t s = 0; s < m_sources.size(); ++s)
+    {
+        m_sources[s]->Snapshot(snapshot);
+        for (const Iec104PointValue &point : snapshot)
+        {
+            int elemLen = 0;
+            bool hasTime = false;
+            BYTE type = Iec104GetUntimedType(point.type);
+            if (!Iec104GetMonitorLayout(type, elemLen, hasTime))
+                continue;
+            index->keys.push_back({ point.commonAddr, type, (BYTE)s, point.ioa });
+        }
+    }
+    std::sort(index->keys.begin(), index->keys.end(), [](const InterrogationKey &a, const InterrogationKey &b) {
+        return KeyLess(a.commonAddr, IsCounterType(a.type), a.type, a.ioa, b.commonAddr, IsCounterType(b.type), b.type, b.ioa);
+    });
+    m_irIndex = index;
+    return m_irIndex;
+}
+
+bool CIec104Gateway::IsKnownCommonAddr(WORD commonAddr)
+{
+    std::shared_ptr<const InterrogationIndex> index = GetInterrogationIndex();
+    const std::vector<InterrogationKey> &keys = index->keys;
+    auto it = std::lower_bound(keys.begin(), keys.end(), commonAddr, [](const InterrogationKey &key, WORD value) { return key.commonAddr < value; });
+    return it != keys.end() && it->commonAddr == commonAddr;
+}
+
+void CIec104Gateway::LogEvent(const std::wstring &message)
+{
+    if (m_eventCallback)
+    {
+        m_eventCallback(message);
+    }
+}
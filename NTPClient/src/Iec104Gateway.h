@@ -0,0 +1,182 @@
+﻿#pragma once
+#include "Iec104Master.h"
+#include "TimerWheel.h"
+#include <deque>
+#include <memory>
+
+// 网关（上送被控站）配置
+struct Iec104GatewayConfig
+{
+    std::wstring bindAddress = L"0.0.0.0";
+    WORD port = IEC104_DEFAULT_PORT;
+    Iec104LinkProfile profile;               // 上送链路的传送原因/公共地址/IOA字节数，与各RTU的链路参数无关
+    int maxSessions = 64;                    // 同时保持的上级主站连接数，超出时拒绝新连接
+    int k = 12;                              // 未被确认的I帧上限
+    int w = 8;                               // 收到w个I帧后立即确认
+    DWORD t1Ms = IEC104_T1_TIMEOUT_MS;
+    DWORD t2Ms = IEC104_T2_TIMEOUT_MS;
+    DWORD t3Ms = IEC104_T3_TIMEOUT_MS;
+    size_t queueLimit = 4096;                // 每个会话待发送的突发ASDU上限，超出时丢弃最旧的
+};
+
+// 网关统计
+struct Iec104GatewayStats
+{
+    UINT64 sessions = 0;                     // 当前连接数
+    UINT64 connections = 0;
+    UINT64 rejected = 0;                     // 超出 maxSessions 被拒绝的连接
+    UINT64 iFramesSent = 0;
+    UINT64 iFramesReceived = 0;
+    UINT64 publishedAsdus = 0;               // 编码的突发ASDU，每个只编码一次，由各会话共享
+    UINT64 forwardedAsdus = 0;               // 各会话发出的突发ASDU之和
+    UINT64 droppedAsdus = 0;                 // 会话积压超出 queueLimit 而丢弃的突发ASDU
+    UINT64 interrogations = 0;
+    UINT64 interrogatedPoints = 0;
+    UINT64 timeouts = 0;                     // t1超时断开次数
+    UINT64 protocolErrors = 0;
+};
+
+// IEC 104 网关：以被控站身份把主站采集到的点转发给上级主站（如SCADA）
+// - 一个监听端口接受多个上级连接，全部会话由一个线程以 WSAPoll 驱动，链路定时器挂在该线程的时间轮上
+// - 突发：Publish 在主站的数据回调中调用，每个ASDU按上送链路参数只编码一次，各会话共享同一份报文；
+//   周期、背景扫描与突发的点原样转发，召唤与读命令应答只写入点库
+// - 总召与电能量召唤直接从点库（各RTU主站的实时点库）应答，不向RTU重新召唤；读命令同样从点库应答
+// - 只实现站召唤与总的电能量召唤，分组召唤、控制命令与时钟同步以否定确认应答，时钟读取返回本机时钟
+class CIec104Gateway
+{
+public:
+    explicit CIec104Gateway(const Iec104GatewayConfig& config);
+    ~CIec104Gateway();
+
+    CIec104Gateway(const CIec104Gateway&) = delete;
+    CIec104Gateway& operator=(const CIec104Gateway&) = delete;
+
+    // 启动前设置：召唤从这些点库应答（通常每个RTU主站一个，见 CIec104Master::SetPointDatabase）
+    void AddPointDatabase(std::shared_ptr<const CIec104PointDb> pointDb) { m_sources.push_back(pointDb); }
+
+    bool Start(std::wstring* err = nullptr);
+    void Stop();
+    bool IsRunning() const { return m_thread.joinable(); }
+
+    // 任意线程（通常为主站的数据回调）：转发一个ASDU解码出的点，没有上级连接时直接返回
+    void Publish(const CIec104PointBatch& batch);
+
+    Iec104GatewayStats GetStats() const;
+
+    void SetEventCallback(Iec104EventCallback callback) { m_eventCallback = callback; }
+    void SetLogLevel(Iec104LogLevel level) { m_logLevel = level; }
+    bool IsLogEnabled(Iec104LogLevel level, DWORD /*category*/) const
+    {
+        return (BYTE)level <= (BYTE)m_logLevel.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Asdu
+    {
+        int length;
+        BYTE data[IEC104_MAX_ASDU_LEN];
+    };
+    using SharedAsdu = std::shared_ptr<const Asdu>;
+
+    // 召唤索引：各点库全部点按(公共地址, 是否计数量, 类型, IOA)排序，点数不变时各会话共用
+    struct InterrogationKey
+    {
+        WORD commonAddr;
+        BYTE type;            // 不带时标的类型
+        BYTE source;          // 点库下标
+        DWORD ioa;
+    };
+
+    struct InterrogationIndex
+    {
+        size_t pointCount;
+        std::vector<InterrogationKey> keys;
+    };
+
+    // 一个公共地址的召唤应答：激活确认、[next, end) 的点、激活终止
+    struct InterrogationJob
+    {
+        WORD commonAddr;
+        bool confirmed;
+        size_t next;
+        size_t end;
+    };
+
+    struct Session;
+
+    struct Counters
+    {
+        std::atomic<UINT64> connections{ 0 };
+        std::atomic<UINT64> rejected{ 0 };
+        std::atomic<UINT64> iFramesSent{ 0 };
+        std::atomic<UINT64> iFramesReceived{ 0 };
+        std::atomic<UINT64> publishedAsdus{ 0 };
+        std::atomic<UINT64> forwardedAsdus{ 0 };
+        std::atomic<UINT64> droppedAsdus{ 0 };
+        std::atomic<UINT64> interrogations{ 0 };
+        std::atomic<UINT64> interrogatedPoints{ 0 };
+        std::atomic<UINT64> timeouts{ 0 };
+        std::atomic<UINT64> protocolErrors{ 0 };
+    };
+
+    void ThreadProc();
+    void Wake();
+    void DrainInbox();
+
+    // 会话（仅网关线程）
+    void Accept(ULONGLONG nowMs);
+    void CloseSession(Session& session);
+    bool ReadSession(Session& session, ULONGLONG nowMs);
+    bool HandleFrame(Session& session, const BYTE* frame, int length, ULONGLONG nowMs);
+    bool Acknowledge(Session& session, WORD ackSeq);
+    void HandleAsdu(Session& session, const BYTE* asdu, int length);
+    void StartInterrogation(Session& session, const BYTE* asdu, int length, bool counters, BYTE cot, WORD commonAddr);
+    void HandleRead(Session& session, const BYTE* asdu, int length, BYTE cot, WORD commonAddr);
+    void OnAckTimeout(Session& session);
+    void OnTestTimeout(Session& session);
+    void OnRecvAckTimeout(Session& session);
+    void OnIdleTimeout(Session& session);
+    void Pump(Session& session, ULONGLONG nowMs);
+    void EmitInterrogation(Session& session, ULONGLONG nowMs);
+    bool Flush(Session& session);
+
+    // 报文生成
+    void AppendFrame(Session& session, const BYTE* frame, int length);
+    void SendIFrame(Session& session, const BYTE* asdu, int length, ULONGLONG nowMs);
+    void SendSFrame(Session& session);
+    void SendUFrame(Session& session, Iec104UFunction function);
+    void QueueReply(Session& session, const BYTE* asdu, int length, BYTE cot, WORD commonAddr);
+    Asdu MakeReply(const BYTE* asdu, int length, BYTE cot, WORD commonAddr) const;
+
+    std::shared_ptr<const InterrogationIndex> GetInterrogationIndex();
+    bool IsKnownCommonAddr(WORD commonAddr);
+
+    void LogEvent(const std::wstring& message);
+
+    Iec104GatewayConfig m_config;
+    const Iec104CodecOps* m_codec;
+    std::vector<std::shared_ptr<const CIec104PointDb>> m_sources;
+    std::shared_ptr<const InterrogationIndex> m_irIndex;
+
+    // 其他线程发布的突发ASDU，网关线程取走后分发给各会话
+    std::mutex m_inboxMutex;
+    std::vector<SharedAsdu> m_inbox;
+    std::vector<SharedAsdu> m_inboxDrain;
+
+    // 网络（监听与唤醒socket在 Start/Stop 中创建与关闭，会话仅网关线程访问）
+    SOCKET m_listen;
+    SOCKET m_wake;             // 绑定本机回环地址的UDP socket，向自身发送一个字节唤醒 WSAPoll
+    sockaddr_in m_wakeAddr;
+    std::atomic<bool> m_wakePending;
+    std::vector<std::unique_ptr<Session>> m_sessions;
+    std::atomic<size_t> m_sessionCount;
+    CTimerWheel* m_timers;
+
+    std::thread m_thread;
+    std::atomic<bool> m_stop;
+    bool m_winsockReady;
+
+    Counters m_counters;
+    Iec104EventCallback m_eventCallback;
+    std::atomic<Iec104LogLevel> m_logLevel;
+};
@@ -0,0 +1,654 @@
+﻿#include "pch.h"
+#include "Iec104Historian.h"
+#include <algorithm>
+#include <cstring>
+#include <cwchar>
+#include <intrin.h>
+
+namespace
+{
+    constexpr DWORD SEGMENT_MAGIC = 0x34303148;   // "H104"
+    constexpr DWORD BLOCK_MAGIC = 0x4B4C4248;     // "HBLK"
+    constexpr DWORD SEGMENT_VERSION = 1;
+    constexpr size_t SEGMENT_HEADER_BYTES = 64;
+    constexpr size_t MIN_SEGMENT_BYTES = 1024 * 1024;
+
+    struct HistSegmentHeader
+    {
+        DWORD magic;
+        DWORD version;
+        DWORD number;
+        DWORD reserved;
+    };
+
+    // 块头之后紧跟 words 个64位字的编码数据，块头与数据均按8字节对齐
+    struct HistBlockHeader
+    {
+        DWORD magic;
+        DWORD words;
+        WORD commonAddr;
+        BYTE type;
+        BYTE reserved;
+        DWORD ioa;
+        DWORD samples;
+        DWORD checksum;
+        INT64 firstMs;
+        INT64 minMs;
+        INT64 maxMs;
+    };
+
+    inline int LeadingZeros(UINT64 x)
+    {
+        unsigned long index;
+#if defined(_M_X64) || defined(_M_ARM64)
+        _BitScanReverse64(&index, x);
+        return 63 - (int)index;
+#else
+        if (_BitScanReverse(&index, (unsigned long)(x >> 32)))
+            return 31 - (int)index;
+        _BitScanReverse(&index, (unsigned long)x);
+        return 63 - (int)index;
+#endif
+    }
+
+    inline int TrailingZeros(UINT64 x)
+    {
+        unsigned long index;
+#if defined(_M_X64) || defined(_M_ARM64)
+        _BitScanForward64(&index, x);
+        return (int)index;
+#else
+        if (_BitScanForward(&index, (unsigned long)x))
+            return (int)index;
+        _BitScanForward(&index, (unsigned long)(x >> 32));
+        return 32 + (int)index;
+#endif
+    }
+
+    inline size_t BlockBytes(size_t words)
+    {
+        return sizeof(HistBlockHeader) + words * sizeof(UINT64);
+    }
+
+    std::wstring LastErrorText(const std::wstring &prefix)
+    {
+        return prefix + L"，错误代码: " + std::to_wstring(GetLastError());
+    }
+
+    std::wstring SegmentPath(const std::wstring &directory, DWORD number)
+    {
+        wchar_t name[32];
+        swprintf_s(name, L"\\seg-%06lu.h104", (unsigned long)number);
+        return directory + name;
+    }
+}
+
+void CIec104Historian::BitWriter::Write(UINT64 value, int bits)
+{
+    if (bits < 64)
+        value &= (1ULL << bits) - 1;
+
+    int used = (int)(m_bits & 63);
+    if (used == 0)
+        m_words.push_back(0);
+    int free = 64 - used;
+    if (bits <= free)
+    {
+        m_words.back() |= value << (free - bits);
+    }
+    else
+    {
+        m_words.back() |= value >> (bits - free);
+        m_words.push_back(value << (64 - (bits - free)));
+    }
+    m_bits += bits;
+}
+
+UINT64 CIec104Historian::BitReader::Read(int bits)
+{
+    size_t index = (size_t)(m_pos >> 6);
+    int offset = (int)(m_pos & 63);
+    m_pos += bits;
+    if (index >= m_count)
+        return 0;   // 数据截断，由调用方按采样数停止
+
+    UINT64 high = m_words[index] << offset;
+    int avail = 64 - offset;
+    if (bits > avail && index + 1 < m_count)
+        high |= m_words[index + 1] >> avail;
+    return high >> (64 - bits);
+}
+
+CIec104Historian::CIec104Historian()
+    : m_segmentBytes(DEFAULT_SEGMENT_BYTES), m_open(false), m_writeOffset(0), m_samples(0), m_sealedBlocks(0), m_storedBytes(0)
+{
+}
+
+CIec104Historian::~CIec104Historian()
+{
+    Close();
+}
+
+bool CIec104Historian::Open(const std::wstring &directory, size_t segmentBytes, std::wstring *err)
+{
+    Close();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!CreateDirectoryW(directory.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        if (err)
+            *err = LastErrorText(L"创建历史库目录失败: " + directory);
+        return false;
+    }
+
+    m_directory = directory;
+    m_segmentBytes = (std::max)(segmentBytes, MIN_SEGMENT_BYTES) & ~(size_t)7;
+    m_samples = 0;
+    m_sealedBlocks = 0;
+    m_storedBytes = 0;
+
+    // 按编号顺序打开已有段并重建索引
+    std::vector<DWORD> numbers;
+    WIN32_FIND_DATAW find;
+    HANDLE handle = FindFirstFileW((directory + L"\\seg-*.h104").c_str(), &find);
+    if (handle != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            DWORD number = (DWORD)wcstoul(find.cFileName + 4, nullptr, 10);
+            if (number != 0)
+                numbers.push_back(number);
+        } while (FindNextFileW(handle, &find));
+        FindClose(handle);
+    }
+    std::sort(numbers.begin(), numbers.end());
+
+    for (DWORD number : numbers)
+    {
+        if (!OpenSegmentLocked(number, false, err))
+        {
+            CloseSegments();
+            return false;
+        }
+        ScanSegmentLocked((DWORD)m_segments.size() - 1);
+    }
+    if (m_segments.empty() && !OpenSegmentLocked(1, true, err))
+    {
+        CloseSegments();
+        return false;
+    }
+
+    m_open = true;
+    return true;
+}
+
+void CIec104Historian::Close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_open)
+        return;
+
+    FlushLocked();
+    for (const Segment &segment : m_segments)
+    {
+        FlushViewOfFile(segment.view, 0);
+        FlushFileBuffers(segment.file);
+    }
+    CloseSegments();
+    m_series.clear();
+    m_seriesIndex.clear();
+    m_open = false;
+}
+
+bool CIec104Historian::IsOpen() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_open;
+}
+
+bool CIec104Historian::OpenSegmentLocked(DWORD number, bool create, std::wstring *err)
+{
+    std::wstring path = SegmentPath(m_directory, number);
+    Segment segment;
+    segment.number = number;
+    segment.file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, create ? CREATE_NEW : OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (segment.file == INVALID_HANDLE_VALUE)
+    {
+        if (err)
+            *err = LastErrorText(L"打开历史段文件失败: " + path);
+        return false;
+    }
+
+    if (create)
+    {
+        segment.size = m_segmentBytes;
+    }
+    else
+    {
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(segment.file, &size) || size.QuadPart < (LONGLONG)SEGMENT_HEADER_BYTES)
+        {
+            if (err)
+                *err = L"历史段文件无效: " + path;
+            CloseHandle(segment.file);
+            return false;
+        }
+        segment.size = (size_t)size.QuadPart;
+    }
+
+    // 新段按固定大小预分配，映射时即扩展文件
+    UINT64 mapSize = segment.size;
+    segment.mapping = CreateFileMappingW(segment.file, nullptr, PAGE_READWRITE, (DWORD)(mapSize >> 32), (DWORD)mapSize, nullptr);
+    if (segment.mapping)
+        segment.view = (BYTE *)MapViewOfFile(segment.mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, segment.size);
+    if (!segment.view)
+    {
+        if (err)
+            *err = LastErrorText(L"映射历史段文件失败: " + path);
+        if (segment.mapping)
+            CloseHandle(segment.mapping);
+        CloseHandle(segment.file);
+        return false;
+    }
+
+    HistSegmentHeader *header = (HistSegmentHeader *)segment.view;
+    if (create)
+    {
+        header->magic = SEGMENT_MAGIC;
+        header->version = SEGMENT_VERSION;
+        header->number = number;
+        header->reserved = 0;
+    }
+    else if (header->magic != SEGMENT_MAGIC || header->version != SEGMENT_VERSION)
+    {
+        if (err)
+            *err = L"历史段文件格式不符: " + path;
+        UnmapViewOfFile(segment.view);
+        CloseHandle(segment.mapping);
+        CloseHandle(segment.file);
+        return false;
+    }
+
+    m_segments.push_back(segment);
+    m_writeOffset = SEGMENT_HEADER_BYTES;
+    return true;
+}
+
+void CIec104Historian::ScanSegmentLocked(DWORD segmentIndex)
+{
+    const Segment &segment = m_segments[segmentIndex];
+    size_t offset = SEGMENT_HEADER_BYTES;
+    while (offset + sizeof(HistBlockHeader) <= segment.size)
+    {
+        const HistBlockHeader *header = (const HistBlockHeader *)(segment.view + offset);
+        if (header->magic != BLOCK_MAGIC || header->samples == 0 || header->words == 0)
+            break;
+        size_t bytes = BlockBytes(header->words);
+        if (offset + bytes > segment.size)
+            break;
+        const UINT64 *words = (const UINT64 *)(header + 1);
+        if (header->checksum != (DWORD)Checksum(words, header->words))
+            break;   // 写入中断的块，从此处覆盖
+
+        UINT64 key = MakeKey(header->commonAddr, header->ioa);
+        auto it = m_seriesIndex.find(key);
+        if (it == m_seriesIndex.end())
+        {
+            std::unique_ptr<Series> series(new Series());
+            series->commonAddr = header->commonAddr;
+            series->ioa = header->ioa;
+            it = m_seriesIndex.emplace(key, m_series.size()).first;
+            m_series.push_back(std::move(series));
+        }
+        Series &series = *m_series[it->second];
+        series.type = header->type;
+
+        BlockRef ref;
+        ref.segment = segmentIndex;
+        ref.offset = (DWORD)offset;
+        ref.samples = header->samples;
+        ref.minMs = header->minMs;
+        ref.maxMs = header->maxMs;
+        ref.prefixMaxMs = series.blocks.empty() ? header->maxMs : (std::max)(series.blocks.back().prefixMaxMs, header->maxMs);
+        series.blocks.push_back(ref);
+
+        m_samples += header->samples;
+        ++m_sealedBlocks;
+        m_storedBytes += bytes;
+        offset += bytes;
+    }
+    m_writeOffset = offset;
+}
+
+void CIec104Historian::CloseSegments()
+{
+    for (Segment &segment : m_segments)
+    {
+        UnmapViewOfFile(segment.view);
+        CloseHandle(segment.mapping);
+        CloseHandle(segment.file);
+    }
+    m_segments.clear();
+    m_writeOffset = 0;
+}
+
+UINT64 CIec104Historian::Checksum(const UINT64 *words, size_t count)
+{
+    // FNV-1a，按64位字处理
+    UINT64 hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < count; ++i)
+    {
+        hash ^= words[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash ^ (hash >> 32);
+}
+
+void CIec104Historian::EncodeSample(BitWriter &writer, CodecState &state, DWORD index, INT64 timestampMs, double value, BYTE quality)
+{
+    UINT64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    if (index == 0)
+    {
+        // 块内首个采样：时标在块头，值与品质原样存放
+        writer.Write(bits, 64);
+        writer.Write(quality, 8);
+        state.prevMs = timestampMs;
+        state.prevDelta = 0;
+        state.prevBits = bits;
+        state.prevLead = -1;
+        state.prevTrail = 0;
+        state.prevQuality = quality;
+        return;
+    }
+
+    // 时标：二阶差分的zigzag值按 0 / 10+7位 / 110+9位 / 1110+12位 / 1111+64位 编码，等间隔上送时每采样1位
+    INT64 delta = (INT64)((UINT64)timestampMs - (UINT64)state.prevMs);
+    INT64 dod = (INT64)((UINT64)delta - (UINT64)state.prevDelta);
+    UINT64 zigzag = ((UINT64)dod << 1) ^ (UINT64)(dod >> 63);
+    if (zigzag == 0)
+        writer.Write(0, 1);
+    else if (zigzag < (1u << 7))
+        writer.Write((0x2ULL << 7) | zigzag, 9);
+    else if (zigzag < (1u << 9))
+        writer.Write((0x6ULL << 9) | zigzag, 12);
+    else if (zigzag < (1u << 12))
+        writer.Write((0xEULL << 12) | zigzag, 16);
+    else
+    {
+        writer.Write(0xF, 4);
+        writer.Write(zigzag, 64);
+    }
+    state.prevMs = timestampMs;
+    state.prevDelta = delta;
+
+    // 值：与前值异或，0 表示不变；10 表示有效位落在上次的窗口内；11 另带前导零(5位)与有效位数(6位)
+    UINT64 x = bits ^ state.prevBits;
+    if (x == 0)
+    {
+        writer.Write(0, 1);
+    }
+    else
+    {
+        int lead = (std::min)(LeadingZeros(x), 31);
+        int trail = TrailingZeros(x);
+        if (state.prevLead >= 0 && lead >= state.prevLead && trail >= state.prevTrail)
+        {
+            writer.Write(0x2, 2);
+            writer.Write(x >> state.prevTrail, 64 - state.prevLead - state.prevTrail);
+        }
+        else
+        {
+            int length = 64 - lead - trail;
+            writer.Write((0x3ULL << 11) | ((UINT64)lead << 6) | (UINT64)(length - 1), 13);
+            writer.Write(x >> trail, length);
+            state.prevLead = lead;
+            state.prevTrail = trail;
+        }
+    }
+    state.prevBits = bits;
+
+    // 品质：只在变化时记录
+    if (quality == state.prevQuality)
+    {
+        writer.Write(0, 1);
+    }
+    else
+    {
+        writer.Write(0x100 | quality, 9);
+        state.prevQuality = quality;
+    }
+}
+
+void CIec104Historian::DecodeBlock(const UINT64 *words, size_t wordCount, DWORD samples, INT64 firstMs, INT64 fromMs, INT64 toMs,
+                                   std::vector<Iec104HistSample> &out)
+{
+    BitReader reader(words, wordCount);
+    CodecState state;
+    for (DWORD i = 0; i < samples; ++i)
+    {
+        if (i == 0)
+        {
+            state.prevBits = reader.Read(64);
+            state.prevQuality = (BYTE)reader.Read(8);
+            state.prevMs = firstMs;
+        }
+        else
+        {
+            UINT64 zigzag = 0;
+            if (reader.ReadBit())
+            {
+                if (!reader.ReadBit())
+                    zigzag = reader.Read(7);
+                else if (!reader.ReadBit())
+                    zigzag = reader.Read(9);
+                else if (!reader.ReadBit())
+                    zigzag = reader.Read(12);
+                else
+                    zigzag = reader.Read(64);
+            }
+            INT64 dod = (INT64)(zigzag >> 1) ^ -(INT64)(zigzag & 1);
+            state.prevDelta = (INT64)((UINT64)state.prevDelta + (UINT64)dod);
+            state.prevMs = (INT64)((UINT64)state.prevMs + (UINT64)state.prevDelta);
+
+            if (reader.ReadBit())
+            {
+                if (reader.ReadBit())
+                {
+                    state.prevLead = (int)reader.Read(5);
+                    int length = (int)reader.Read(6) + 1;
+                    state.prevTrail = 64 - state.prevLead - length;
+                }
+                int length = 64 - state.prevLead - state.prevTrail;
+                state.prevBits ^= reader.Read(length) << state.prevTrail;
+            }
+
+            if (reader.ReadBit())
+                state.prevQuality = (BYTE)reader.Read(8);
+        }
+
+        if (state.prevMs >= fromMs && state.prevMs <= toMs)
+        {
+            Iec104HistSample sample;
+            sample.timestampMs = state.prevMs;
+            memcpy(&sample.value, &state.prevBits, sizeof(sample.value));
+            sample.quality = state.prevQuality;
+            out.push_back(sample);
+        }
+    }
+}
+
+void CIec104Historian::Append(const Iec104PointUpdate &update)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_open)
+        AppendLocked(update);
+}
+
+void CIec104Historian::Append(const Iec104PointUpdate *updates, size_t count)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_open)
+        return;
+    for (size_t i = 0; i < count; ++i)
+        AppendLocked(updates[i]);
+}
+
+void CIec104Historian::AppendLocked(const Iec104PointUpdate &update)
+{
+    UINT64 key = MakeKey(update.commonAddr, update.ioa);
+    auto it = m_seriesIndex.find(key);
+    if (it == m_seriesIndex.end())
+    {
+        std::unique_ptr<Series> series(new Series());
+        series->commonAddr = update.commonAddr;
+        series->ioa = update.ioa & 0xFFFFFF;
+        series->type = update.type;
+        it = m_seriesIndex.emplace(key, m_series.size()).first;
+        m_series.push_back(std::move(series));
+    }
+
+    Series &series = *m_series[it->second];
+    // 块头只记一个类型，类型变化时另起一块
+    if (series.samples != 0 && series.type != update.type)
+        SealLocked(series);
+    series.type = update.type;
+
+    if (series.samples == 0)
+    {
+        series.firstMs = update.timestampMs;
+        series.minMs = update.timestampMs;
+        series.maxMs = update.timestampMs;
+    }
+    else
+    {
+        series.minMs = (std::min)(series.minMs, update.timestampMs);
+        series.maxMs = (std::max)(series.maxMs, update.timestampMs);
+    }
+    EncodeSample(series.writer, series.state, series.samples, update.timestampMs, update.value, update.quality);
+    ++series.samples;
+    ++m_samples;
+
+    if (series.samples >= BLOCK_MAX_SAMPLES || series.writer.GetWordCount() >= BLOCK_MAX_WORDS)
+        SealLocked(series);
+}
+
+void CIec104Historian::SealLocked(Series &series)
+{
+    if (series.samples == 0)
+        return;
+
+    size_t words = series.writer.GetWordCount();
+    size_t bytes = BlockBytes(words);
+    if (m_writeOffset + bytes > m_segments.back().size)
+    {
+        // 当前段写满，创建下一段；失败时（如磁盘已满）本块只保留在内存中，下次封存再试
+        if (!OpenSegmentLocked(m_segments.back().number + 1, true, nullptr))
+            return;
+    }
+
+    Segment &segment = m_segments.back();
+    HistBlockHeader *header = (HistBlockHeader *)(segment.view + m_writeOffset);
+    memcpy(header + 1, series.writer.GetWords(), words * sizeof(UINT64));
+    header->words = (DWORD)words;
+    header->commonAddr = series.commonAddr;
+    header->type = series.type;
+    header->reserved = 0;
+    header->ioa = series.ioa;
+    header->samples = series.samples;
+    header->checksum = (DWORD)Checksum(series.writer.GetWords(), words);
+    header->firstMs = series.firstMs;
+    header->minMs = series.minMs;
+    header->maxMs = series.maxMs;
+    header->magic = BLOCK_MAGIC;
+
+    BlockRef ref;
+    ref.segment = (DWORD)m_segments.size() - 1;
+    ref.offset = (DWORD)m_writeOffset;
+    ref.samples = series.samples;
+    ref.minMs = series.minMs;
+    ref.maxMs = series.maxMs;
+    ref.prefixMaxMs = series.blocks.empty() ? series.maxMs : (std::max)(series.blocks.back().prefixMaxMs, series.maxMs);
+    series.blocks.push_back(ref);
+
+    m_writeOffset += bytes;
+    m_storedBytes += bytes;
+    ++m_sealedBlocks;
+
+    series.writer.Clear();
+    series.state = CodecState();
+    series.samples = 0;
+}
+
+void CIec104Historian::FlushLocked()
+{
+    for (auto &series : m_series)
+        SealLocked(*series);
+}
+
+void CIec104Historian::Flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_open)
+        FlushLocked();
+}
+
+bool CIec104Historian::Sync()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_open)
+        return false;
+
+    FlushLocked();
+    // 封存只写最后一段（以及写满前的上一段）
+    bool ok = true;
+    size_t first = m_segments.size() >= 2 ? m_segments.size() - 2 : 0;
+    for (size_t i = first; i < m_segments.size(); ++i)
+    {
+        ok = FlushViewOfFile(m_segments[i].view, 0) && FlushFileBuffers(m_segments[i].file) && ok;
+    }
+    return ok;
+}
+
+bool CIec104Historian::Query(WORD commonAddr, DWORD ioa, INT64 fromMs, INT64 toMs, std::vector<Iec104HistSample> &samples) const
+{
+    samples.clear();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_seriesIndex.find(MakeKey(commonAddr, ioa));
+    if (!m_open || it == m_seriesIndex.end())
+        return false;
+
+    // 前缀最大时标单调不减：其前的块不可能含有 >= fromMs 的采样
+    const Series &series = *m_series[it->second];
+    auto first = std::lower_bound(series.blocks.begin(), series.blocks.end(), fromMs,
+                                  [](const BlockRef &block, INT64 value) { return block.prefixMaxMs < value; });
+    for (auto block = first; block != series.blocks.end(); ++block)
+    {
+        if (block->minMs > toMs || block->maxMs < fromMs)
+            continue;
+        const HistBlockHeader *header = (const HistBlockHeader *)(m_segments[block->segment].view + block->offset);
+        DecodeBlock((const UINT64 *)(header + 1), header->words, header->samples, header->firstMs, fromMs, toMs, samples);
+    }
+
+    if (series.samples != 0 && series.minMs <= toMs && series.maxMs >= fromMs)
+    {
+        DecodeBlock(series.writer.GetWords(), series.writer.GetWordCount(), series.samples, series.firstMs, fromMs, toMs, samples);
+    }
+    return true;
+}
+
+Iec104HistorianStats CIec104Historian::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Iec104HistorianStats stats;
+    stats.points = m_series.size();
+    stats.segments = m_segments.size();
+    stats.samples = m_samples;
+    stats.sealedBlocks = m_sealedBlocks;
+    stats.storedBytes = m_storedBytes;
+    for (const auto &series : m_series)
+        stats.openBytes += series->writer.GetWordCount() * sizeof(UINT64);
+    return stats;
+}
@@ -0,0 +1,169 @@
+﻿#pragma once
+#include <windows.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Iec104Subscription.h"
+
+// 历史库中的一个采样
+struct Iec104HistSample
+{
+    INT64 timestampMs;
+    double value;
+    BYTE quality;
+};
+
+struct Iec104HistorianStats
+{
+    size_t points = 0;            // 序列数（公共地址+IOA）
+    size_t segments = 0;
+    UINT64 samples = 0;           // 已写入的采样（含未封存的块）
+    UINT64 sealedBlocks = 0;
+    UINT64 storedBytes = 0;       // 段文件中已封存块的字节数（含块头）
+    UINT64 openBytes = 0;         // 内存中未封存块的编码字节数
+};
+
+// 嵌入式历史库：只追加，按点分列存储
+// - 每个点（公共地址+IOA）的采样编码在自己的块中：时标为二阶差分（delta-of-delta）变长编码，
+//   值为与前值异或后的前导零/尾随零压缩（Gorilla），品质只在变化时记录
+// - 块满（BLOCK_MAX_SAMPLES 个采样或 BLOCK_MAX_WORDS 个64位字）时封存，写入内存映射的段文件；
+//   段文件固定大小预分配，写满后创建下一段，目录下依次为 seg-000001.h104、seg-000002.h104 ...
+// - 每个点保存已封存块的时间索引（块内最小/最大时标及其前缀最大值），区间查询二分定位起始块，
+//   只解码与区间相交的块；未封存块也参与查询
+// - Open 时扫描已有段文件重建索引，末尾不完整的块（校验失败）被丢弃并从该处继续写入
+// - 未封存的块只在内存中：Flush 封存全部打开的块，Sync 另把映射视图刷到磁盘；Close 时自动 Sync
+// - 所有方法由一把互斥量保护；写入宜按批调用（如接入队列的消费线程），查询期间写入等待
+class CIec104Historian
+{
+public:
+    static constexpr DWORD BLOCK_MAX_SAMPLES = 1024;
+    static constexpr DWORD BLOCK_MAX_WORDS = 512;
+    static constexpr size_t DEFAULT_SEGMENT_BYTES = 64 * 1024 * 1024;
+
+    CIec104Historian();
+    ~CIec104Historian();
+
+    CIec104Historian(const CIec104Historian&) = delete;
+    CIec104Historian& operator=(const CIec104Historian&) = delete;
+
+    // 目录不存在时创建；segmentBytes 至少 1MB
+    bool Open(const std::wstring& directory, size_t segmentBytes = DEFAULT_SEGMENT_BYTES, std::wstring* err = nullptr);
+    void Close();
+    bool IsOpen() const;
+
+    void Append(const Iec104PointUpdate& update);
+    void Append(const Iec104PointUpdate* updates, size_t count);
+
+    // 封存全部未封存的块
+    void Flush();
+    // Flush 并把段文件的修改刷到磁盘
+    bool Sync();
+
+    // 返回 [fromMs, toMs] 内的采样（按写入顺序），点不存在时返回 false
+    bool Query(WORD commonAddr, DWORD ioa, INT64 fromMs, INT64 toMs, std::vector<Iec104HistSample>& samples) const;
+    Iec104HistorianStats GetStats() const;
+
+private:
+    // 64位字、高位在前的位流
+    class BitWriter
+    {
+    public:
+        void Clear() { m_words.clear(); m_bits = 0; }
+        void Write(UINT64 value, int bits);
+        size_t GetWordCount() const { return m_words.size(); }
+        const UINT64* GetWords() const { return m_words.data(); }
+
+    private:
+        std::vector<UINT64> m_words;   // 封存后清空，容量保留给下一个块
+        UINT64 m_bits = 0;
+    };
+
+    class BitReader
+    {
+    public:
+        BitReader(const UINT64* words, size_t count) : m_words(words), m_count(count), m_pos(0) {}
+        UINT64 Read(int bits);
+        bool ReadBit() { return Read(1) != 0; }
+
+    private:
+        const UINT64* m_words;
+        size_t m_count;
+        UINT64 m_pos;
+    };
+
+    // 已封存块的索引项
+    struct BlockRef
+    {
+        DWORD segment;        // m_segments 下标
+        DWORD offset;         // 块头在段内的偏移
+        DWORD samples;
+        INT64 minMs;
+        INT64 maxMs;
+        INT64 prefixMaxMs;    // 本点此前所有块（含本块）最大时标，单调不减，用于二分查找
+    };
+
+    // 块的编码状态（写入与解码共用）
+    struct CodecState
+    {
+        INT64 prevMs = 0;
+        INT64 prevDelta = 0;
+        UINT64 prevBits = 0;
+        int prevLead = -1;    // 上一个非零异或值的前导零与尾随零，-1 表示尚无
+        int prevTrail = 0;
+        BYTE prevQuality = 0;
+    };
+
+    struct Series
+    {
+        WORD commonAddr;
+        DWORD ioa;
+        BYTE type;
+        std::vector<BlockRef> blocks;
+
+        // 未封存的块
+        BitWriter writer;
+        CodecState state;
+        DWORD samples = 0;
+        INT64 firstMs = 0;
+        INT64 minMs = 0;
+        INT64 maxMs = 0;
+    };
+
+    struct Segment
+    {
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+        BYTE* view = nullptr;
+        size_t size = 0;
+        DWORD number = 0;
+    };
+
+    static void EncodeSample(BitWriter& writer, CodecState& state, DWORD index, INT64 timestampMs, double value, BYTE quality);
+    static void DecodeBlock(const UINT64* words, size_t wordCount, DWORD samples, INT64 firstMs, INT64 fromMs, INT64 toMs,
+                            std::vector<Iec104HistSample>& out);
+    static UINT64 Checksum(const UINT64* words, size_t count);
+
+    void AppendLocked(const Iec104PointUpdate& update);
+    void SealLocked(Series& series);
+    void FlushLocked();
+    bool OpenSegmentLocked(DWORD number, bool create, std::wstring* err);
+    void ScanSegmentLocked(DWORD segmentIndex);
+    void CloseSegments();
+    static UINT64 MakeKey(WORD commonAddr, DWORD ioa) { return ((UINT64)commonAddr << 24) | (ioa & 0xFFFFFF); }
+
+    mutable std::mutex m_mutex;
+    std::wstring m_directory;
+    size_t m_segmentBytes;
+    bool m_open;
+
+    std::vector<std::unique_ptr<Series>> m_series;
+    std::unordered_map<UINT64, size_t> m_seriesIndex;
+    std::vector<Segment> m_segments;
+    size_t m_writeOffset;         // 最后一段的写入位置
+
+    UINT64 m_samples;
+    UINT64 m_sealedBlocks;
+    UINT64 m_storedBytes;
+};
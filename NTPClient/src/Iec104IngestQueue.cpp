@@ -0,0 +1,388 @@
+﻿#include "pch.h"
+#include "Iec104IngestQueue.h"
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    inline size_t HashKey(UINT64 key)
+    {
+        // 与点库相同的64位混合
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return (size_t)key;
+    }
+
+    inline UINT64 MakePointKey(WORD commonAddr, DWORD ioa)
+    {
+        return ((UINT64)commonAddr << 24) | (ioa & 0xFFFFFF);
+    }
+}
+
+CIec104IngestQueue::CIec104IngestQueue(size_t capacity, Iec104OverflowPolicy policy)
+    : m_policy(policy), m_mask(0), m_tail(0), m_head(0), m_hashMask(0), m_pointCount(0), m_waitingProducers(0), m_consumerWaiting(false),
+      m_closed(false), m_pushed(0), m_delivered(0), m_merged(0), m_dropped(0), m_blocked(0)
+{
+    // 容量取不小于请求值的2的幂
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    m_mask = size - 1;
+
+    m_cells.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i)
+    {
+        m_cells[i].seq.store(i, std::memory_order_relaxed);
+        m_cells[i].slot = NO_SLOT;
+    }
+
+    if (m_policy == Iec104OverflowPolicy::COALESCE)
+    {
+        // 点表容量与环相同：每点最多排队一次，入队不会因环满失败
+        size_t hashSize = size * 2;
+        m_hashMask = hashSize - 1;
+        m_hashKeys.reset(new std::atomic<UINT64>[hashSize]);
+        m_hashSlots.reset(new std::atomic<DWORD>[hashSize]);
+        for (size_t i = 0; i < hashSize; ++i)
+        {
+            m_hashKeys[i].store(0, std::memory_order_relaxed);
+            m_hashSlots[i].store(NO_SLOT, std::memory_order_relaxed);
+        }
+
+        m_points.reset(new PointSlot[size]);
+        for (size_t i = 0; i < size; ++i)
+        {
+            m_points[i].seq.store(0, std::memory_order_relaxed);
+            m_points[i].queued.store(false, std::memory_order_relaxed);
+            for (int w = 0; w < VALUE_WORDS; ++w)
+                m_points[i].words[w].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+CIec104IngestQueue::~CIec104IngestQueue()
+{
+    Close();
+}
+
+bool CIec104IngestQueue::TryEnqueue(const Iec104PointUpdate *update, DWORD slot)
+{
+    size_t pos = m_tail.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        Cell &cell = m_cells[pos & m_mask];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                if (update)
+                    cell.update = *update;
+                cell.slot = slot;
+                cell.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;   // 队列已满
+        }
+        else
+        {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool CIec104IngestQueue::TryDequeue(Iec104PointUpdate *update, DWORD *slot)
+{
+    // DROP_OLDEST 时生产者也会出队，队首以CAS推进
+    size_t pos = m_head.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        Cell &cell = m_cells[pos & m_mask];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                if (update)
+                    *update = cell.update;
+                if (slot)
+                    *slot = cell.slot;
+                cell.seq.store(pos + m_mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;   // 队列为空
+        }
+        else
+        {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+DWORD CIec104IngestQueue::FindOrInsertSlot(UINT64 key)
+{
+    const UINT64 stored = key + 1;
+    size_t h = HashKey(key) & m_hashMask;
+    for (size_t probe = 0; probe <= m_hashMask; ++probe)
+    {
+        std::atomic<UINT64> &cell = m_hashKeys[h];
+        UINT64 current = cell.load(std::memory_order_acquire);
+        if (current == 0)
+        {
+            if (cell.compare_exchange_strong(current, stored, std::memory_order_acq_rel))
+            {
+                // 抢到键后分配点表下标；点表已满时该键永久记为无下标
+                DWORD slot = m_pointCount.fetch_add(1, std::memory_order_relaxed);
+                if (slot > m_mask)
+                    slot = NO_SLOT - 1;
+                m_hashSlots[h].store(slot, std::memory_order_release);
+                return slot == NO_SLOT - 1 ? NO_SLOT : slot;
+            }
+            // 被其他生产者抢先，current 已更新为其键
+        }
+        if (current == stored)
+        {
+            DWORD slot;
+            while ((slot = m_hashSlots[h].load(std::memory_order_acquire)) == NO_SLOT)
+            {
+                std::this_thread::yield();   // 抢到键的生产者尚未发布下标
+            }
+            return slot == NO_SLOT - 1 ? NO_SLOT : slot;
+        }
+        h = (h + 1) & m_hashMask;
+    }
+    return NO_SLOT;
+}
+
+bool CIec104IngestQueue::PushCoalesce(const Iec104PointUpdate &update)
+{
+    DWORD slot = FindOrInsertSlot(MakePointKey(update.commonAddr, update.ioa));
+    if (slot == NO_SLOT)
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    PointSlot &point = m_points[slot];
+    UINT64 words[VALUE_WORDS] = {};
+    memcpy(words, &update, sizeof(update));
+
+    // 序号锁写入：多个生产者写同一点时以CAS取得写权
+    DWORD seq = point.seq.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        if ((seq & 1) == 0 && point.seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire))
+            break;
+        if ((seq & 1) != 0)
+        {
+            std::this_thread::yield();
+            seq = point.seq.load(std::memory_order_relaxed);
+        }
+    }
+    for (int w = 0; w < VALUE_WORDS; ++w)
+        point.words[w].store(words[w], std::memory_order_relaxed);
+    point.seq.store(seq + 2, std::memory_order_release);
+
+    // 已在排队中则只是覆盖了旧值
+    if (point.queued.exchange(true, std::memory_order_acq_rel))
+    {
+        m_merged.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    while (!TryEnqueue(nullptr, slot))
+    {
+        std::this_thread::yield();   // 每点最多排队一次，环不会真正满，仅等待出队的消费者释放槽位
+    }
+    return true;
+}
+
+bool CIec104IngestQueue::Push(const Iec104PointUpdate &update)
+{
+    if (m_closed.load(std::memory_order_acquire))
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    m_pushed.fetch_add(1, std::memory_order_relaxed);
+
+    if (m_policy == Iec104OverflowPolicy::COALESCE)
+    {
+        if (!PushCoalesce(update))
+            return false;
+        WakeConsumer();
+        return true;
+    }
+
+    bool waited = false;
+    while (!TryEnqueue(&update, NO_SLOT))
+    {
+        if (m_policy == Iec104OverflowPolicy::DROP_OLDEST)
+        {
+            if (TryDequeue(nullptr, nullptr))
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        // BLOCK：等待消费者出队；超时重试以防唤醒丢失
+        if (!waited)
+        {
+            m_blocked.fetch_add(1, std::memory_order_relaxed);
+            waited = true;
+        }
+        std::unique_lock<std::mutex> lock(m_waitMutex);
+        m_waitingProducers.fetch_add(1);
+        if (m_closed.load(std::memory_order_acquire))
+        {
+            m_waitingProducers.fetch_sub(1);
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        const Cell &cell = m_cells[m_tail.load(std::memory_order_relaxed) & m_mask];
+        if (cell.seq.load(std::memory_order_acquire) != m_tail.load(std::memory_order_relaxed))
+            m_spaceAvailable.wait_for(lock, std::chrono::milliseconds(10));
+        m_waitingProducers.fetch_sub(1);
+    }
+    WakeConsumer();
+    return true;
+}
+
+void CIec104IngestQueue::WakeConsumer()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_consumerWaiting.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(m_waitMutex);
+        m_dataAvailable.notify_one();
+    }
+}
+
+size_t CIec104IngestQueue::Pop(Iec104PointUpdate *out, size_t maxCount)
+{
+    size_t count = 0;
+    if (m_policy == Iec104OverflowPolicy::COALESCE)
+    {
+        DWORD slot;
+        while (count < maxCount && TryDequeue(nullptr, &slot))
+        {
+            PointSlot &point = m_points[slot];
+            // 先清除排队标志再读值：读值期间的新写入会重新排队，不会丢失
+            point.queued.store(false, std::memory_order_seq_cst);
+
+            UINT64 words[VALUE_WORDS];
+            DWORD seq;
+            do
+            {
+                seq = point.seq.load(std::memory_order_acquire);
+                for (int w = 0; w < VALUE_WORDS; ++w)
+                    words[w] = point.words[w].load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+            } while ((seq & 1) != 0 || point.seq.load(std::memory_order_relaxed) != seq);
+            memcpy(&out[count++], words, sizeof(Iec104PointUpdate));
+        }
+    }
+    else
+    {
+        while (count < maxCount && TryDequeue(&out[count], nullptr))
+            ++count;
+    }
+
+    if (count != 0)
+    {
+        m_delivered.fetch_add(count, std::memory_order_relaxed);
+        if (m_policy == Iec104OverflowPolicy::BLOCK)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_waitingProducers.load(std::memory_order_relaxed) > 0)
+            {
+                std::lock_guard<std::mutex> lock(m_waitMutex);
+                m_spaceAvailable.notify_all();
+            }
+        }
+    }
+    return count;
+}
+
+bool CIec104IngestQueue::Wait(DWORD timeoutMs)
+{
+    auto hasData = [this]() {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        return m_cells[pos & m_mask].seq.load(std::memory_order_acquire) == pos + 1;
+    };
+    if (hasData())
+        return true;
+
+    std::unique_lock<std::mutex> lock(m_waitMutex);
+    m_consumerWaiting.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    m_dataAvailable.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&]() { return hasData() || IsClosed(); });
+    m_consumerWaiting.store(false);
+    return hasData() || !IsClosed();
+}
+
+void CIec104IngestQueue::Close()
+{
+    m_closed.store(true, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(m_waitMutex);
+    m_spaceAvailable.notify_all();
+    m_dataAvailable.notify_all();
+}
+
+Iec104IngestStats CIec104IngestQueue::GetStats() const
+{
+    Iec104IngestStats stats;
+    stats.pushed = m_pushed.load(std::memory_order_relaxed);
+    stats.delivered = m_delivered.load(std::memory_order_relaxed);
+    stats.merged = m_merged.load(std::memory_order_relaxed);
+    stats.dropped = m_dropped.load(std::memory_order_relaxed);
+    stats.blocked = m_blocked.load(std::memory_order_relaxed);
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t head = m_head.load(std::memory_order_relaxed);
+    stats.depth = tail > head ? tail - head : 0;
+    return stats;
+}
+
+bool CIec104IngestWorker::Start(std::shared_ptr<CIec104IngestQueue> queue, Iec104IngestCallback callback, size_t batch)
+{
+    if (m_thread.joinable() || !queue || !callback)
+        return false;
+
+    m_queue = std::move(queue);
+    m_callback = std::move(callback);
+    m_thread = std::thread(&CIec104IngestWorker::WorkerProc, this, batch == 0 ? 1 : batch);
+    return true;
+}
+
+void CIec104IngestWorker::Stop()
+{
+    if (!m_thread.joinable())
+        return;
+    m_queue->Close();
+    m_thread.join();
+    m_queue.reset();
+    m_callback = nullptr;
+}
+
+void CIec104IngestWorker::WorkerProc(size_t batch)
+{
+    std::vector<Iec104PointUpdate> buffer(batch);
+    for (;;)
+    {
+        size_t count = m_queue->Pop(buffer.data(), buffer.size());
+        if (count != 0)
+        {
+            m_callback(buffer.data(), count);
+            continue;
+        }
+        if (!m_queue->Wait(100))
+            break;
+    }
+}
@@ -0,0 +1,138 @@
+﻿#pragma once
+#include <windows.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "Iec104Subscription.h"
+
+// 队列满时的处理方式
+enum class Iec104OverflowPolicy : BYTE
+{
+    COALESCE,             // 每点只保留最新值：同一点未被取走时覆盖，队列按点数而不是更新数占用
+    DROP_OLDEST,          // 丢弃最早的更新，接收线程不等待
+    BLOCK                 // 接收线程等待消费者腾出空间（TCP接收随之暂停，由对端流控）
+};
+
+struct Iec104IngestStats
+{
+    UINT64 pushed = 0;        // 生产者提交的更新
+    UINT64 delivered = 0;     // 消费者取走的更新
+    UINT64 merged = 0;        // COALESCE：被同一点的新值覆盖
+    UINT64 dropped = 0;       // DROP_OLDEST：被丢弃；COALESCE：点表已满的新点；关闭后提交的更新
+    UINT64 blocked = 0;       // BLOCK：生产者等待的次数
+    size_t depth = 0;         // 当前排队数（近似值）
+};
+
+// 解码与消费者之间的有界队列
+// - 固定容量的无锁环形队列（每槽位序号），容量与点表在构造时一次性分配，运行中不分配内存
+// - 多生产者（各连接的接收线程）、单消费者；DROP_OLDEST 时生产者也从队首出队以腾出空间
+// - COALESCE：环中只排队点表下标，点的最新值存放在点表中（每点序号锁），
+//   消费者先清除排队标志再读取值，不会丢失更新，最坏情况同一值交付两次
+// - 只有 BLOCK 时生产者等待，以及消费者空闲时的等待使用互斥量/条件变量，快路径无锁
+class CIec104IngestQueue
+{
+public:
+    explicit CIec104IngestQueue(size_t capacity = 65536, Iec104OverflowPolicy policy = Iec104OverflowPolicy::COALESCE);
+    ~CIec104IngestQueue();
+
+    CIec104IngestQueue(const CIec104IngestQueue&) = delete;
+    CIec104IngestQueue& operator=(const CIec104IngestQueue&) = delete;
+
+    // 生产者：返回 false 表示本次更新被丢弃（点表已满或队列已关闭）
+    bool Push(const Iec104PointUpdate& update);
+
+    // 消费者：一次最多取 maxCount 条，返回条数
+    size_t Pop(Iec104PointUpdate* out, size_t maxCount);
+    // 消费者：等待至有数据或超时，已关闭且为空时返回 false
+    bool Wait(DWORD timeoutMs);
+
+    // 关闭：唤醒等待中的生产者与消费者，此后提交的更新被丢弃，已排队的仍可取出
+    void Close();
+    bool IsClosed() const { return m_closed.load(std::memory_order_acquire); }
+
+    Iec104OverflowPolicy GetPolicy() const { return m_policy; }
+    size_t GetCapacity() const { return m_mask + 1; }
+    Iec104IngestStats GetStats() const;
+
+private:
+    static constexpr DWORD NO_SLOT = 0xFFFFFFFF;
+    static constexpr int VALUE_WORDS = (int)((sizeof(Iec104PointUpdate) + 7) / 8);
+
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        Iec104PointUpdate update;    // DROP_OLDEST/BLOCK
+        DWORD slot;                  // COALESCE：点表下标
+    };
+
+    // COALESCE 点表，值按字存放供序号锁读取
+    struct PointSlot
+    {
+        std::atomic<DWORD> seq;      // 奇数表示正在写
+        std::atomic<bool> queued;
+        std::atomic<UINT64> words[VALUE_WORDS];
+    };
+
+    bool TryEnqueue(const Iec104PointUpdate* update, DWORD slot);
+    bool TryDequeue(Iec104PointUpdate* update, DWORD* slot);
+    bool PushCoalesce(const Iec104PointUpdate& update);
+    DWORD FindOrInsertSlot(UINT64 key);
+    void WakeConsumer();
+
+    Iec104OverflowPolicy m_policy;
+    size_t m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+    std::atomic<size_t> m_tail;
+    char m_pad1[64];
+    std::atomic<size_t> m_head;
+    char m_pad2[64];
+
+    // COALESCE 点表：键→下标的开放寻址哈希（只增不删）
+    size_t m_hashMask;
+    std::unique_ptr<std::atomic<UINT64>[]> m_hashKeys;   // 键+1，0 表示空
+    std::unique_ptr<std::atomic<DWORD>[]> m_hashSlots;
+    std::unique_ptr<PointSlot[]> m_points;
+    std::atomic<DWORD> m_pointCount;
+
+    // 等待（慢路径）
+    std::mutex m_waitMutex;
+    std::condition_variable m_spaceAvailable;
+    std::condition_variable m_dataAvailable;
+    std::atomic<int> m_waitingProducers;
+    std::atomic<bool> m_consumerWaiting;
+    std::atomic<bool> m_closed;
+
+    std::atomic<UINT64> m_pushed;
+    std::atomic<UINT64> m_delivered;
+    std::atomic<UINT64> m_merged;
+    std::atomic<UINT64> m_dropped;
+    std::atomic<UINT64> m_blocked;
+};
+
+using Iec104IngestCallback = std::function<void(const Iec104PointUpdate* updates, size_t count)>;
+
+// 消费线程：从队列批量取出更新并回调，回调的耗时不再影响接收线程
+class CIec104IngestWorker
+{
+public:
+    CIec104IngestWorker() = default;
+    ~CIec104IngestWorker() { Stop(); }
+
+    CIec104IngestWorker(const CIec104IngestWorker&) = delete;
+    CIec104IngestWorker& operator=(const CIec104IngestWorker&) = delete;
+
+    bool Start(std::shared_ptr<CIec104IngestQueue> queue, Iec104IngestCallback callback, size_t batch = 256);
+    // 关闭队列，取完剩余更新后退出
+    void Stop();
+    bool IsRunning() const { return m_thread.joinable(); }
+
+private:
+    void WorkerProc(size_t batch);
+
+    std::shared_ptr<CIec104IngestQueue> m_queue;
+    Iec104IngestCallback m_callback;
+    std::thread m_thread;
+};
@@ -0,0 +1,346 @@
+﻿#include "pch.h"
+#include "Iec104Interrogation.h"
+#include <cmath>
+#include <random>
+
+namespace
+{
+    constexpr BYTE QOI_STATION = 20;
+    constexpr double GOLDEN_RATIO_FRACTION = 0.6180339887498949;
+
+    double Fraction(double value)
+    {
+        return value - std::floor(value);
+    }
+
+    // 首次总召的相位不回绕：抖动越过0的站（如0号站）不能被推到窗口末尾
+    double ClampPhase(double value)
+    {
+        return (std::min)((std::max)(value, 0.0), std::nextafter(1.0, 0.0));
+    }
+
+    void UpdateMax(std::atomic<UINT64> &target, UINT64 value)
+    {
+        UINT64 current = target.load(std::memory_order_relaxed);
+        while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        {
+        }
+    }
+}
+
+CIec104InterrogationScheduler::CIec104InterrogationScheduler(CTimerWheelThread &thread, const Iec104InterrogationConfig &config)
+    : m_thread(thread), m_config(config), m_tokens(0.0), m_tokensAtMs(0), m_started(0), m_completed(0), m_negative(0), m_timeouts(0),
+      m_failed(0), m_skipped(0), m_limitedByConcurrency(0), m_limitedByRate(0), m_points(0), m_maxStartDelayMs(0), m_inFlight(0),
+      m_peakInFlight(0), m_queued(0)
+{
+    m_config.maxInFlight = (std::max)(m_config.maxInFlight, (size_t)1);
+    m_config.burst = (std::max)(m_config.burst, 1.0);
+    m_config.jitter = (std::max)(0.0, (std::min)(m_config.jitter, 1.0));
+    m_tokens = m_config.burst;
+    m_tokensAtMs = m_thread.GetNowMs();
+    m_dispatchTimer.SetCallback([this]() { Dispatch(); });
+}
+
+CIec104InterrogationScheduler::~CIec104InterrogationScheduler()
+{
+}
+
+size_t CIec104InterrogationScheduler::AddStation(CIec104Master *master, const Iec104InterrogationPlan &plan)
+{
+    std::unique_ptr<Station> station(new Station());
+    station->master = master;
+    station->plan = plan;
+    station->index = m_stations.size();
+    m_stations.push_back(std::move(station));
+    return m_stations.size() - 1;
+}
+
+void CIec104InterrogationScheduler::SetPlan(size_t station, const Iec104InterrogationPlan &plan)
+{
+    m_thread.Post([this, station, plan](CTimerWheel &) {
+        if (station < m_stations.size())
+            m_stations[station]->plan = plan;
+    });
+}
+
+void CIec104InterrogationScheduler::OnStationStarted(size_t station)
+{
+    m_thread.Post([this, station](CTimerWheel &) {
+        if (station < m_stations.size())
+            StartStation(*m_stations[station]);
+    });
+}
+
+void CIec104InterrogationScheduler::OnStationStopped(size_t station)
+{
+    m_thread.Post([this, station](CTimerWheel &) {
+        if (station < m_stations.size())
+            StopStation(*m_stations[station]);
+    });
+}
+
+Iec104InterrogationStats CIec104InterrogationScheduler::GetStats() const
+{
+    Iec104InterrogationStats stats;
+    stats.started = m_started.load(std::memory_order_relaxed);
+    stats.completed = m_completed.load(std::memory_order_relaxed);
+    stats.negative = m_negative.load(std::memory_order_relaxed);
+    stats.timeouts = m_timeouts.load(std::memory_order_relaxed);
+    stats.failed = m_failed.load(std::memory_order_relaxed);
+    stats.skipped = m_skipped.load(std::memory_order_relaxed);
+    stats.limitedByConcurrency = m_limitedByConcurrency.load(std::memory_order_relaxed);
+    stats.limitedByRate = m_limitedByRate.load(std::memory_order_relaxed);
+    stats.points = m_points.load(std::memory_order_relaxed);
+    stats.maxStartDelayMs = m_maxStartDelayMs.load(std::memory_order_relaxed);
+    stats.inFlight = m_inFlight.load(std::memory_order_relaxed);
+    stats.peakInFlight = m_peakInFlight.load(std::memory_order_relaxed);
+    stats.queued = m_queued.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void CIec104InterrogationScheduler::StartStation(Station &station)
+{
+    // 重复的启动通知（如 STOPDT 后再次 STARTDT）按重新启动处理
+    if (station.started)
+        StopStation(station);
+
+    UINT64 nowMs = m_thread.GetNowMs();
+    station.started = true;
+    station.generation++;
+    BuildJobs(station, nowMs);
+    for (size_t i = 0; i < station.jobs.size(); ++i)
+    {
+        Job &job = *station.jobs[i];
+        Station *target = &station;
+        job.timer.SetCallback([this, target, i]() { OnJobDue(*target, i); });
+        m_thread.Arm(job.timer, job.dueMs - nowMs);
+    }
+}
+
+void CIec104InterrogationScheduler::StopStation(Station &station)
+{
+    if (!station.started)
+        return;
+
+    // 正在进行的召唤由主站以失败结束（断开时），完成通知到达后释放站与并发名额
+    station.started = false;
+    station.generation++;
+    for (auto &job : station.jobs)
+    {
+        job->timer.Cancel();
+    }
+    station.jobs.clear();
+
+    size_t before = m_ready.size();
+    Station *target = &station;
+    m_ready.erase(std::remove_if(m_ready.begin(), m_ready.end(), [target](const ReadyItem &item) { return item.station == target; }),
+                  m_ready.end());
+    m_queued.fetch_sub(before - m_ready.size(), std::memory_order_relaxed);
+}
+
+void CIec104InterrogationScheduler::BuildJobs(Station &station, UINT64 nowMs)
+{
+    // 站的基准相位取黄金分割序列：前N个站总是把[0,1)分成大致相等的N段；抖动避免不同调度器之间步调一致
+    std::mt19937 rng(m_config.seed ^ (UINT32)(station.index * 2654435761u));
+    std::uniform_real_distribution<double> jitter(-m_config.jitter / 2, m_config.jitter / 2);
+    double base = Fraction(station.index * GOLDEN_RATIO_FRACTION);
+    const Iec104InterrogationPlan &plan = station.plan;
+
+    station.jobs.clear();
+    auto addJob = [&station](Iec104InterrogationKind kind, BYTE qualifier, DWORD periodMs, double phase) -> Job & {
+        std::unique_ptr<Job> job(new Job());
+        job->kind = kind;
+        job->qualifier = qualifier;
+        job->periodMs = periodMs;
+        job->phase = phase;
+        station.jobs.push_back(std::move(job));
+        return *station.jobs.back();
+    };
+
+    UINT64 firstMs = nowMs + m_config.startupDelayMs;
+    UINT64 initialDueMs = 0;
+    if (plan.initialGi)
+    {
+        Job &job = addJob(Iec104InterrogationKind::GENERAL, QOI_STATION, 0, ClampPhase(base + jitter(rng)));
+        job.dueMs = firstMs + (UINT64)(job.phase * m_config.startupSpreadMs);
+        initialDueMs = job.dueMs;
+    }
+    if (plan.giPeriodMs > 0)
+    {
+        // 刚做过首次总召时，周期总召的第一次不早于半个周期之后
+        Job &job = addJob(Iec104InterrogationKind::GENERAL, QOI_STATION, plan.giPeriodMs, Fraction(base + jitter(rng)));
+        job.dueMs = NextAligned(job, firstMs);
+        if (plan.initialGi && job.dueMs < initialDueMs + plan.giPeriodMs / 2)
+            job.dueMs += plan.giPeriodMs;
+    }
+    if (plan.groupPeriodMs > 0)
+    {
+        // 各组的相位在站的相位之后依次错开
+        for (size_t k = 0; k < plan.groups.size(); ++k)
+        {
+            BYTE group = plan.groups[k];
+            if (group < 1 || group > 16)
+                continue;
+            double offset = (1.0 + (double)k / plan.groups.size()) / 3.0;
+            Job &job = addJob(Iec104InterrogationKind::GROUP, (BYTE)(QOI_STATION + group), plan.groupPeriodMs, Fraction(base + offset + jitter(rng)));
+            job.dueMs = NextAligned(job, firstMs);
+        }
+    }
+    if (plan.counterPeriodMs > 0)
+    {
+        Job &job = addJob(Iec104InterrogationKind::COUNTER, plan.counterQcc, plan.counterPeriodMs, Fraction(base + 2.0 / 3.0 + jitter(rng)));
+        job.dueMs = NextAligned(job, firstMs);
+    }
+}
+
+UINT64 CIec104InterrogationScheduler::NextAligned(const Job &job, UINT64 afterMs) const
+{
+    // 全局时间轴上 t % 周期 == 相位×周期 的第一个时刻（不早于 afterMs）
+    UINT64 offsetMs = (UINT64)(job.phase * job.periodMs) % job.periodMs;
+    UINT64 dueMs = afterMs - afterMs % job.periodMs + offsetMs;
+    if (dueMs < afterMs)
+        dueMs += job.periodMs;
+    return dueMs;
+}
+
+void CIec104InterrogationScheduler::OnJobDue(Station &station, size_t index)
+{
+    if (!station.started || index >= station.jobs.size())
+        return;
+
+    Job &job = *station.jobs[index];
+    UINT64 nowMs = m_thread.GetNowMs();
+    UINT64 dueMs = job.dueMs;
+    if (job.periodMs > 0)
+    {
+        // 保持相位：下一次按原到期时刻加周期，落后超过一个周期时跳到下一个对齐时刻
+        job.dueMs += job.periodMs;
+        if (job.dueMs <= nowMs)
+            job.dueMs = NextAligned(job, nowMs + 1);
+        m_thread.Arm(job.timer, job.dueMs - nowMs);
+    }
+
+    if (job.pending)
+    {
+        // 上一次还在排队或进行中（周期短于召唤时长或被限制推迟），不重复召唤
+        Bump(m_skipped);
+        return;
+    }
+    job.pending = true;
+    m_ready.push_back(ReadyItem{ &station, index, station.generation, dueMs });
+    m_queued.fetch_add(1, std::memory_order_relaxed);
+    Dispatch();
+}
+
+void CIec104InterrogationScheduler::Dispatch()
+{
+    UINT64 nowMs = m_thread.GetNowMs();
+    for (auto it = m_ready.begin(); it != m_ready.end();)
+    {
+        // 同一站的召唤依次进行，后面其他站的召唤不受影响
+        if (it->station->busy)
+        {
+            ++it;
+            continue;
+        }
+        if (m_inFlight.load(std::memory_order_relaxed) >= m_config.maxInFlight)
+        {
+            Bump(m_limitedByConcurrency);
+            return;
+        }
+        if (!TakeToken(nowMs))
+        {
+            // 令牌恢复到1个时再继续
+            Bump(m_limitedByRate);
+            DWORD waitMs = (DWORD)std::ceil((1.0 - m_tokens) * 1000.0 / m_config.ratePerSec);
+            m_thread.Arm(m_dispatchTimer, (std::max)(waitMs, (DWORD)1));
+            return;
+        }
+
+        ReadyItem item = *it;
+        it = m_ready.erase(it);
+        m_queued.fetch_sub(1, std::memory_order_relaxed);
+        Begin(item, nowMs);
+    }
+}
+
+bool CIec104InterrogationScheduler::TakeToken(UINT64 nowMs)
+{
+    if (m_config.ratePerSec <= 0)
+        return true;
+
+    if (nowMs > m_tokensAtMs)
+    {
+        m_tokens = (std::min)(m_config.burst, m_tokens + (nowMs - m_tokensAtMs) * m_config.ratePerSec / 1000.0);
+        m_tokensAtMs = nowMs;
+    }
+    if (m_tokens < 1.0)
+        return false;
+    m_tokens -= 1.0;
+    return true;
+}
+
+void CIec104InterrogationScheduler::Begin(const ReadyItem &item, UINT64 nowMs)
+{
+    Station &station = *item.station;
+    Job &job = *station.jobs[item.job];
+    station.busy = true;
+    size_t inFlight = m_inFlight.fetch_add(1, std::memory_order_relaxed) + 1;
+    size_t peak = m_peakInFlight.load(std::memory_order_relaxed);
+    while (inFlight > peak && !m_peakInFlight.compare_exchange_weak(peak, inFlight, std::memory_order_relaxed))
+    {
+    }
+    Bump(m_started);
+    UpdateMax(m_maxStartDelayMs, nowMs > item.dueMs ? nowMs - item.dueMs : 0);
+
+    Iec104Command command;
+    command.type = job.kind == Iec104InterrogationKind::COUNTER ? Iec104TypeId::C_CI_NA_1 : Iec104TypeId::C_IC_NA_1;
+    command.commonAddr = station.plan.commonAddr;
+    command.qualifier = job.qualifier;
+    command.timeoutMs = station.plan.timeoutMs;
+
+    // 完成回调在主站I/O线程（发送失败时在本线程）中调用，转回时间轮线程处理
+    Station *target = &station;
+    size_t index = item.job;
+    UINT64 generation = item.generation;
+    station.master->SendCommand(command, [this, target, index, generation](const Iec104CommandResult &result) {
+        m_thread.Post([this, target, index, generation, result](CTimerWheel &) { OnCompleted(*target, index, generation, result); });
+    });
+}
+
+void CIec104InterrogationScheduler::OnCompleted(Station &station, size_t index, UINT64 generation, const Iec104CommandResult &result)
+{
+    station.busy = false;
+    m_inFlight.fetch_sub(1, std::memory_order_relaxed);
+    m_points.fetch_add(result.points, std::memory_order_relaxed);
+    switch (result.status)
+    {
+    case Iec104CommandStatus::COMPLETED:
+        Bump(m_completed);
+        break;
+    case Iec104CommandStatus::NEGATIVE:
+        Bump(m_negative);
+        break;
+    case Iec104CommandStatus::TIMEOUT:
+        Bump(m_timeouts);
+        break;
+    default:
+        Bump(m_failed);
+        break;
+    }
+
+    // 站停止后作业已重建，旧代次的完成只释放名额
+    if (generation == station.generation && index < station.jobs.size())
+    {
+        station.jobs[index]->pending = false;
+    }
+
+    if (m_resultCallback)
+    {
+        Iec104InterrogationKind kind = result.command.type == Iec104TypeId::C_CI_NA_1 ? Iec104InterrogationKind::COUNTER
+                                       : result.command.qualifier == QOI_STATION   ? Iec104InterrogationKind::GENERAL
+                                                                                   : Iec104InterrogationKind::GROUP;
+        m_resultCallback(station.index, kind, result);
+    }
+    Dispatch();
+}
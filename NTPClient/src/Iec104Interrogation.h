@@ -0,0 +1,156 @@
+﻿#pragma once
+#include "Iec104Master.h"
+#include "TimerWheel.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+enum class Iec104InterrogationKind : BYTE
+{
+    GENERAL,        // 站召唤（QOI=20）
+    GROUP,          // 分组召唤（QOI=21-36）
+    COUNTER         // 电能量召唤（C_CI_NA_1）
+};
+
+// 单个站的召唤计划
+struct Iec104InterrogationPlan
+{
+    WORD commonAddr = 1;
+    bool initialGi = true;              // STARTDT确认后总召一次
+    DWORD giPeriodMs = 0;               // 周期总召，0表示不周期召唤
+    std::vector<BYTE> groups;           // 分组召唤的组号（1-16）
+    DWORD groupPeriodMs = 0;
+    DWORD counterPeriodMs = 0;          // 周期电能量召唤
+    BYTE counterQcc = 5;                // QCC：RQT=5总的请求，FRZ=0读取
+    DWORD timeoutMs = IEC104_T1_TIMEOUT_MS;   // 每个阶段的等待时间（召唤期间收到数据重新计时）
+};
+
+// 全局限制：所有站共用
+struct Iec104InterrogationConfig
+{
+    size_t maxInFlight = 8;             // 同时进行的召唤数上限；每个站同时只有一个召唤
+    double ratePerSec = 10.0;           // 每秒开始的召唤数预算（令牌桶），0表示不限
+    double burst = 4.0;                 // 令牌桶容量：空闲后允许连续开始的召唤数
+    DWORD startupDelayMs = 500;         // STARTDT确认后首次总召的最小延时
+    DWORD startupSpreadMs = 10000;      // 首次总召按站错开的窗口（全部站同时重启时）
+    double jitter = 0.05;               // 周期相位的随机抖动，占周期的比例
+    UINT32 seed = 104;
+};
+
+struct Iec104InterrogationStats
+{
+    UINT64 started = 0;
+    UINT64 completed = 0;
+    UINT64 negative = 0;
+    UINT64 timeouts = 0;
+    UINT64 failed = 0;                  // 发送失败或连接断开
+    UINT64 skipped = 0;                 // 到期时同一召唤尚未开始或未结束，本次跳过
+    UINT64 limitedByConcurrency = 0;    // 因并发上限推迟开始的次数
+    UINT64 limitedByRate = 0;           // 因速率预算推迟开始的次数
+    UINT64 points = 0;                  // 召唤期间收到的信息对象数
+    UINT64 maxStartDelayMs = 0;         // 到期到实际开始的最大延迟
+    size_t inFlight = 0;
+    size_t peakInFlight = 0;
+    size_t queued = 0;
+};
+
+using Iec104InterrogationCallback = std::function<void(size_t station, Iec104InterrogationKind kind, const Iec104CommandResult& result)>;
+
+// 多站召唤调度：周期总召、分组召唤与电能量召唤按站错开相位，受全局并发上限与速率预算约束
+// - 周期召唤在全局时间轴上按 周期×相位 到期：相位按站序号取黄金分割序列并加少量随机抖动，
+//   任意站数都均匀分布在周期内，与各站的启动时刻无关，重启后保持不变
+// - STARTDT确认后的首次总召在 startupDelayMs 之后、startupSpreadMs 窗口内按站错开，全部站同时重启时不会同时召唤
+// - 到期的召唤进入就绪队列，按到期顺序开始；并发达到上限或预算用尽时等待，同一站同时只进行一个召唤
+// - 全部状态只在所属 CTimerWheelThread 的线程中访问；OnStationStarted/OnStationStopped 可在任意线程调用
+// - 使用方先停止时间轮线程、断开各主站，再销毁调度器
+class CIec104InterrogationScheduler
+{
+public:
+    explicit CIec104InterrogationScheduler(CTimerWheelThread& thread, const Iec104InterrogationConfig& config = Iec104InterrogationConfig());
+    ~CIec104InterrogationScheduler();
+
+    CIec104InterrogationScheduler(const CIec104InterrogationScheduler&) = delete;
+    CIec104InterrogationScheduler& operator=(const CIec104InterrogationScheduler&) = delete;
+
+    // 登记站，返回站序号；须在首次 OnStationStarted 之前完成全部登记，master 须比调度器存在得更久
+    size_t AddStation(CIec104Master* master, const Iec104InterrogationPlan& plan);
+    // 修改计划，下次启动时生效
+    void SetPlan(size_t station, const Iec104InterrogationPlan& plan);
+    // 召唤结束（完成、否定、超时或失败）时在时间轮线程中调用，须在登记站之前设置
+    void SetResultCallback(Iec104InterrogationCallback callback) { m_resultCallback = callback; }
+
+    // 站的数据传输已启动（STARTED）/已停止：由站的状态回调调用
+    void OnStationStarted(size_t station);
+    void OnStationStopped(size_t station);
+
+    Iec104InterrogationStats GetStats() const;
+    size_t GetStationCount() const { return m_stations.size(); }
+    const Iec104InterrogationConfig& GetConfig() const { return m_config; }
+
+private:
+    struct Job
+    {
+        Iec104InterrogationKind kind = Iec104InterrogationKind::GENERAL;
+        BYTE qualifier = 0;
+        DWORD periodMs = 0;             // 0为一次性（首次总召）
+        double phase = 0.0;             // 周期内的相位（0-1）
+        UINT64 dueMs = 0;
+        bool pending = false;           // 在就绪队列中或正在进行
+        CWheelTimer timer;
+    };
+
+    struct Station
+    {
+        CIec104Master* master = nullptr;
+        Iec104InterrogationPlan plan;
+        size_t index = 0;
+        bool started = false;
+        bool busy = false;
+        UINT64 generation = 0;          // 每次启动/停止加一，丢弃旧的就绪项
+        std::vector<std::unique_ptr<Job>> jobs;
+    };
+
+    // 就绪项与完成通知按序号与启动代次引用作业：重新启动时作业会重建
+    struct ReadyItem
+    {
+        Station* station;
+        size_t job;
+        UINT64 generation;
+        UINT64 dueMs;
+    };
+
+    void StartStation(Station& station);
+    void StopStation(Station& station);
+    void BuildJobs(Station& station, UINT64 nowMs);
+    UINT64 NextAligned(const Job& job, UINT64 afterMs) const;
+    void OnJobDue(Station& station, size_t job);
+    void Dispatch();
+    bool TakeToken(UINT64 nowMs);
+    void Begin(const ReadyItem& item, UINT64 nowMs);
+    void OnCompleted(Station& station, size_t job, UINT64 generation, const Iec104CommandResult& result);
+    static void Bump(std::atomic<UINT64>& counter) { counter.fetch_add(1, std::memory_order_relaxed); }
+
+    CTimerWheelThread& m_thread;
+    Iec104InterrogationConfig m_config;
+    std::vector<std::unique_ptr<Station>> m_stations;
+    std::deque<ReadyItem> m_ready;
+    CWheelTimer m_dispatchTimer;        // 预算恢复后继续开始就绪的召唤
+    double m_tokens;
+    UINT64 m_tokensAtMs;
+    Iec104InterrogationCallback m_resultCallback;
+
+    std::atomic<UINT64> m_started;
+    std::atomic<UINT64> m_completed;
+    std::atomic<UINT64> m_negative;
+    std::atomic<UINT64> m_timeouts;
+    std::atomic<UINT64> m_failed;
+    std::atomic<UINT64> m_skipped;
+    std::atomic<UINT64> m_limitedByConcurrency;
+    std::atomic<UINT64> m_limitedByRate;
+    std::atomic<UINT64> m_points;
+    std::atomic<UINT64> m_maxStartDelayMs;
+    std::atomic<size_t> m_inFlight;
+    std::atomic<size_t> m_peakInFlight;
+    std::atomic<size_t> m_queued;
+};
@@ -0,0 +1,535 @@
+﻿#include "pch.h"
+#include "Iec104LinkSim.h"
+#include "Iec104Command.h"
+
+namespace
+{
+    // 虚拟时钟的起点：0 在主站中表示"没有未确认的测试帧"等，不能作为时刻
+    constexpr INT64 SIM_START_US = 3600LL * 1000 * 1000;
+    constexpr int SIM_MAX_ASDU = 249;
+    // 没有定时器时主站链路的最长等待（与调度器的下一个事件取较早者）
+    constexpr DWORD SIM_IDLE_WAIT_MS = 60000;
+}
+
+CIec104LinkSim::CIec104LinkSim(const Iec104LinkSimConfig &config)
+    : m_config(config), m_clock(SIM_START_US), m_scheduler(CMonotonicClock(&m_clock)), m_interrogation(m_scheduler, config.interrogation),
+      m_codec(&Iec104GetCodec(Iec104LinkProfile())), m_sendSeq(0), m_outage(false), m_initialized(false), m_frameSecond(0), m_framesInSecond(0),
+      m_giSecond(0), m_giInSecond(0), m_lastStarted(0)
+{
+    m_config.latencyMs = (std::max)(m_config.latencyMs, (DWORD)1);
+    m_config.w = (std::max)(m_config.w, (WORD)1);
+    m_config.stations = (std::max)(m_config.stations, (size_t)1);
+
+    for (size_t i = 0; i < m_config.stations; ++i)
+    {
+        std::unique_ptr<Station> station(new Station());
+        Station *target = station.get();
+        station->index = i;
+        station->master.reset(new CIec104Master());
+        CIec104Master &master = *station->master;
+        master.SetClock(CMonotonicClock(&m_clock));
+        master.SetLinkTimers(m_config.t1Ms, m_config.t3Ms);
+        master.SetAckWindow(m_config.w, m_config.t2Ms);
+        // 点库按子站的点数分配（缺省容量每站数MB，上千站时占用过多内存）
+        master.SetPointDatabase(std::make_shared<CIec104PointDb>(m_config.giPoints + m_config.counterPoints + 1));
+        // 状态回调在主站内部调用，处理推迟到本站服务结束
+        master.SetStateCallback([target](Iec104State state) { target->stateChanges.push_back(state); });
+
+        station->connectTimer.SetCallback([this, target]() { OnConnectTimer(*target); });
+        station->connectResult.SetCallback([this, target]() { OnConnectResult(*target); });
+        station->spontTimer.SetCallback([this, target]() { OnSpontaneousTimer(*target); });
+        station->peerAckTimer.SetCallback([this, target]() { OnPeerAckTimer(*target); });
+
+        Iec104InterrogationPlan plan = m_config.plan;
+        plan.commonAddr = (WORD)(i + 1);
+        m_interrogation.AddStation(&master, plan);
+        m_stations.push_back(std::move(station));
+    }
+    m_ntpPollTimer.SetCallback([this]() { OnNtpPollTimer(); });
+    m_outageTimer.SetCallback([this]() { OnOutageTimer(); });
+}
+
+CIec104LinkSim::~CIec104LinkSim()
+{
+    // 定时器对象在调度器停止后才能销毁；主站先于召唤调度器断开
+    m_scheduler.Stop();
+    for (auto &station : m_stations)
+    {
+        station->master->SetStateCallback(nullptr);
+        station->master->Disconnect();
+    }
+}
+
+Iec104LinkSimStats CIec104LinkSim::Run()
+{
+    if (!m_initialized)
+    {
+        // 各站的连接与突发上送按站序号在一个周期内错开
+        m_initialized = true;
+        m_scheduler.Start();
+        size_t count = m_stations.size();
+        for (auto &station : m_stations)
+        {
+            m_scheduler.Arm(station->connectTimer, m_config.connectDelayMs);
+            if (m_config.spontaneousMs > 0)
+                m_scheduler.Arm(station->spontTimer, m_config.spontaneousMs + m_config.spontaneousMs * station->index / count);
+        }
+        if (m_config.ntpPollMs > 0)
+            m_scheduler.Arm(m_ntpPollTimer, m_config.ntpPollMs);
+        if (m_config.outageEveryMs > 0)
+            m_scheduler.Arm(m_outageTimer, m_config.outageEveryMs);
+    }
+
+    m_stats = Iec104LinkSimStats();
+    UINT64 startMs = m_clock.NowMs();
+    UINT64 endMs = startMs + m_config.durationMs;
+    UINT64 pointsBefore = 0;
+    for (auto &station : m_stations)
+    {
+        pointsBefore += station->master->GetPointDatabase().GetUpdateCount();
+    }
+    m_frameSecond = m_giSecond = 0;
+    m_framesInSecond = m_giInSecond = 0;
+    INT64 cpuStartUs = CMonotonicClock::SystemNowUs();
+
+    // 每一步：投递到期报文 -> 调度器定时器 -> 服务需要处理的主站链路，然后跳到下一个事件时刻
+    for (;;)
+    {
+        UINT64 nowMs = m_clock.NowMs();
+        DeliverDue(nowMs);
+        m_stats.timerCallbacks += m_scheduler.RunDue();
+        while (!m_linkTimers.empty() && m_linkTimers.top().dueMs <= nowMs)
+        {
+            LinkTimerEntry entry = m_linkTimers.top();
+            m_linkTimers.pop();
+            if (entry.station->timerDueMs == entry.dueMs)
+                MarkDirty(*entry.station);
+        }
+        ServiceDirty(nowMs);
+
+        UINT64 started = m_interrogation.GetStats().started;
+        CountPerSecond(nowMs, started - m_lastStarted, m_giSecond, m_giInSecond, m_stats.peakInterrogationsPerSec);
+        m_lastStarted = started;
+
+        if (nowMs >= endMs)
+            break;
+        m_clock.AdvanceTo((INT64)NextEventMs(nowMs, endMs) * 1000);
+        m_stats.steps++;
+    }
+
+    m_stats.cpuMs = (CMonotonicClock::SystemNowUs() - cpuStartUs) / 1000.0;
+    m_stats.simulatedMs = endMs - startMs;
+    for (auto &station : m_stations)
+    {
+        if (station->startedSinceMs != 0)
+        {
+            m_stats.startedMs += endMs - station->startedSinceMs;
+            station->startedSinceMs = endMs;
+        }
+        m_stats.points += station->master->GetPointDatabase().GetUpdateCount();
+
+        Iec104SequenceStats sequence = station->master->GetSequenceStats();
+        m_stats.sequence.iFramesReceived += sequence.iFramesReceived;
+        m_stats.sequence.gaps += sequence.gaps;
+        m_stats.sequence.duplicates += sequence.duplicates;
+        m_stats.sequence.invalidAcks += sequence.invalidAcks;
+        m_stats.sequence.ackTimeouts += sequence.ackTimeouts;
+        m_stats.sequence.linkResets += sequence.linkResets;
+        m_stats.sequence.ackedFrames += sequence.ackedFrames;
+        m_stats.sequence.ackLagMaxUs = (std::max)(m_stats.sequence.ackLagMaxUs, sequence.ackLagMaxUs);
+        m_stats.sequence.windowStalls += sequence.windowStalls;
+        m_stats.sequence.windowBlockedUs += sequence.windowBlockedUs;
+        m_stats.sequence.unacked += sequence.unacked;
+    }
+    m_stats.points -= pointsBefore;
+    m_stats.interrogation = m_interrogation.GetStats();
+    return m_stats;
+}
+
+UINT64 CIec104LinkSim::NextEventMs(UINT64 nowMs, UINT64 endMs)
+{
+    DWORD maxMs = (DWORD)(std::min)(endMs - nowMs, (UINT64)MAXDWORD);
+    UINT64 next = nowMs + m_scheduler.GetNextTimeoutMs(maxMs);
+    while (!m_linkTimers.empty() && m_linkTimers.top().station->timerDueMs != m_linkTimers.top().dueMs)
+    {
+        m_linkTimers.pop();
+    }
+    if (!m_linkTimers.empty())
+        next = (std::min)(next, m_linkTimers.top().dueMs);
+    if (!m_outage && !m_inFlight.empty())
+        next = (std::min)(next, m_inFlight.top().deliverMs);
+    return (std::max)(next, nowMs + 1);
+}
+
+void CIec104LinkSim::Send(Station &station, bool toMaster, const BYTE *data, int length)
+{
+    if (!toMaster)
+        m_stats.masterFramesSent++;
+    m_inFlight.push(InFlight{ m_clock.NowMs() + m_config.latencyMs, m_sendSeq++, &station, station.linkEpoch, toMaster,
+                              std::vector<BYTE>(data, data + length) });
+}
+
+void CIec104LinkSim::DeliverDue(UINT64 nowMs)
+{
+    // 中断期间报文滞留在连接中（TCP不丢数据），中断结束后按序到达；连接断开时才丢弃
+    if (m_outage)
+        return;
+
+    while (!m_inFlight.empty() && m_inFlight.top().deliverMs <= nowMs)
+    {
+        InFlight item = std::move(const_cast<InFlight &>(m_inFlight.top()));
+        m_inFlight.pop();
+        Station &station = *item.station;
+        if (item.linkEpoch != station.linkEpoch || !station.linkActive)
+        {
+            m_stats.droppedFrames++;
+            continue;
+        }
+        if (item.toMaster)
+        {
+            m_stats.masterFramesReceived++;
+            station.master->ReceiveVirtual(item.data.data(), (int)item.data.size());
+            MarkDirty(station);
+        }
+        else
+        {
+            PeerReceive(station, item.data.data(), (int)item.data.size());
+        }
+    }
+}
+
+void CIec104LinkSim::MarkDirty(Station &station)
+{
+    if (!station.dirty)
+    {
+        station.dirty = true;
+        m_dirty.push_back(&station);
+    }
+}
+
+void CIec104LinkSim::ServiceDirty(UINT64 nowMs)
+{
+    // 与I/O线程相同：命令超时、链路定时器、发出队列中的报文，然后按最近的定时器登记下一次服务
+    for (size_t i = 0; i < m_dirty.size(); ++i)
+    {
+        Station &station = *m_dirty[i];
+        if (station.linkActive)
+        {
+            m_stats.services++;
+            station.master->ServiceVirtualLink();
+        }
+        station.dirty = false;
+        HandleStateChanges(station, nowMs);
+
+        if (station.linkActive)
+        {
+            DWORD waitMs = station.master->m_commands->GetPendingCount() > 0 ? IEC104_IO_WAIT_MS : SIM_IDLE_WAIT_MS;
+            UINT64 dueMs = nowMs + station.master->m_timers.GetNextTimeoutMs(waitMs);
+            if (dueMs != station.timerDueMs)
+            {
+                station.timerDueMs = dueMs;
+                m_linkTimers.push(LinkTimerEntry{ dueMs, &station });
+            }
+        }
+        else
+        {
+            station.timerDueMs = 0;
+        }
+    }
+    m_dirty.clear();
+}
+
+void CIec104LinkSim::OnConnectTimer(Station &station)
+{
+    if (station.linkActive || station.connecting)
+        return;
+
+    // 中断期间没有应答，连接尝试在时限到达后失败；否则一个往返后建立
+    station.connecting = true;
+    station.connectWillSucceed = !m_outage;
+    m_scheduler.Arm(station.connectResult, station.connectWillSucceed ? 2 * m_config.latencyMs : m_config.connectTimeoutMs);
+}
+
+void CIec104LinkSim::OnConnectResult(Station &station)
+{
+    station.connecting = false;
+    if (!station.connectWillSucceed || m_outage)
+    {
+        m_stats.connectFailures++;
+        m_scheduler.Arm(station.connectTimer, m_config.connectDelayMs);
+        return;
+    }
+
+    station.peer = Peer();
+    station.linkEpoch++;
+    station.linkActive = true;
+    Station *target = &station;
+    if (!station.master->ConnectVirtual([this, target](const BYTE *data, int length) { Send(*target, false, data, length); },
+                                        [this, target]() { MarkDirty(*target); }))
+    {
+        station.linkActive = false;
+        m_stats.connectFailures++;
+        m_scheduler.Arm(station.connectTimer, m_config.connectDelayMs);
+        return;
+    }
+    m_stats.connects++;
+    station.master->StartDataTransfer();
+}
+
+void CIec104LinkSim::OnNtpPollTimer()
+{
+    // 与对话框相同：先重新设置下一次，再执行本次
+    m_scheduler.Arm(m_ntpPollTimer, m_config.ntpPollMs);
+    m_stats.ntpPolls++;
+}
+
+void CIec104LinkSim::OnOutageTimer()
+{
+    m_outage = !m_outage;
+    m_scheduler.Arm(m_outageTimer, m_outage ? m_config.outageMs : m_config.outageEveryMs);
+}
+
+void CIec104LinkSim::OnSpontaneousTimer(Station &station)
+{
+    m_scheduler.Arm(station.spontTimer, m_config.spontaneousMs);
+    if (station.linkActive && station.peer.started)
+    {
+        PeerSendPoints(station, (BYTE)Iec104TypeId::M_ME_NC_1, 1, 1, (BYTE)Iec104Cot::SPONTANEOUS);
+    }
+}
+
+void CIec104LinkSim::OnPeerAckTimer(Station &station)
+{
+    if (station.linkActive && station.peer.unacked > 0)
+    {
+        PeerSendSFrame(station);
+    }
+}
+
+void CIec104LinkSim::HandleStateChanges(Station &station, UINT64 nowMs)
+{
+    if (station.stateChanges.empty())
+        return;
+
+    std::vector<Iec104State> changes;
+    changes.swap(station.stateChanges);
+    for (Iec104State state : changes)
+    {
+        if (state == Iec104State::STARTED)
+        {
+            station.startedSinceMs = nowMs;
+            m_interrogation.OnStationStarted(station.index);
+            continue;
+        }
+
+        if (station.startedSinceMs != 0)
+        {
+            m_stats.startedMs += nowMs - station.startedSinceMs;
+            station.startedSinceMs = 0;
+            m_interrogation.OnStationStopped(station.index);
+        }
+        if (state == Iec104State::DISCONNECTED && station.linkActive)
+        {
+            // 链路断开（t1超时或序号错误）：连接上仍在传输的报文随之丢弃，延时后重新连接
+            station.linkActive = false;
+            station.peer = Peer();
+            m_stats.linkLosses++;
+            m_scheduler.Cancel(station.peerAckTimer);
+            m_scheduler.Arm(station.connectTimer, m_config.connectDelayMs);
+        }
+    }
+}
+
+void CIec104LinkSim::CountPerSecond(UINT64 nowMs, UINT64 count, UINT64 &second, UINT64 &inSecond, UINT64 &peak)
+{
+    if (count == 0)
+        return;
+    if (nowMs / 1000 != second)
+    {
+        second = nowMs / 1000;
+        inSecond = 0;
+    }
+    inSecond += count;
+    peak = (std::max)(peak, inSecond);
+}
+
+void CIec104LinkSim::PeerReceive(Station &station, const BYTE *data, int length)
+{
+    Peer &peer = station.peer;
+    int capacity = (int)sizeof(peer.buffer);
+    length = (std::min)(length, capacity - peer.buffered);
+    memcpy(peer.buffer + peer.buffered, data, length);
+    peer.buffered += length;
+
+    int pos = 0;
+    while (peer.buffered - pos >= 2)
+    {
+        int apduLen = peer.buffer[pos + 1] + 2;
+        if (peer.buffer[pos] != IEC104_START_BYTE || apduLen < 6)
+        {
+            peer.buffered = 0;
+            return;
+        }
+        if (peer.buffered - pos < apduLen)
+            break;
+        PeerHandleFrame(station, peer.buffer + pos, apduLen);
+        pos += apduLen;
+    }
+    if (pos > 0)
+    {
+        memmove(peer.buffer, peer.buffer + pos, peer.buffered - pos);
+        peer.buffered -= pos;
+    }
+}
+
+void CIec104LinkSim::PeerHandleFrame(Station &station, const BYTE *frame, int length)
+{
+    Peer &peer = station.peer;
+    BYTE control0 = frame[2];
+    if ((control0 & 0x03) == 0x03)
+    {
+        switch ((Iec104UFunction)control0)
+        {
+        case Iec104UFunction::STARTDT_ACT:
+            peer.started = true;
+            PeerSendUFrame(station, Iec104UFunction::STARTDT_CON);
+            break;
+        case Iec104UFunction::STOPDT_ACT:
+            peer.started = false;
+            PeerSendUFrame(station, Iec104UFunction::STOPDT_CON);
+            break;
+        case Iec104UFunction::TESTFR_ACT:
+            m_stats.testFrames++;
+            PeerSendUFrame(station, Iec104UFunction::TESTFR_CON);
+            break;
+        default:
+            break;
+        }
+        return;
+    }
+    if ((control0 & 0x01) != 0)
+    {
+        return;     // S帧：子站不检查自己发出的I帧是否被确认
+    }
+
+    // I帧：按w或t2确认
+    peer.recvSeq = (peer.recvSeq + 1) & 0x7FFF;
+    if (++peer.unacked >= m_config.w)
+    {
+        PeerSendSFrame(station);
+    }
+    else if (peer.unacked == 1)
+    {
+        m_scheduler.Arm(station.peerAckTimer, m_config.t2Ms);
+    }
+
+    if (length < 6 + m_codec->headerLen + m_codec->ioaLen + 1 || !peer.started)
+        return;
+    Iec104AsduHeader header;
+    m_codec->getHeader(frame + 6, header);
+    BYTE qualifier = frame[6 + m_codec->headerLen + m_codec->ioaLen];
+    if ((header.cot & 0x3F) != (BYTE)Iec104Cot::ACTIVATION)
+        return;
+
+    // 召唤：激活确认、数据（传送原因为响应的召唤组）、激活终止；其他命令只确认
+    PeerSendCommandReply(station, header.typeId, header.commonAddr, (BYTE)Iec104Cot::ACTIVATION_CON, qualifier);
+    if (header.typeId == (BYTE)Iec104TypeId::C_IC_NA_1)
+    {
+        PeerSendPoints(station, (BYTE)Iec104TypeId::M_ME_NC_1, 1, m_config.giPoints, qualifier);
+        PeerSendCommandReply(station, header.typeId, header.commonAddr, (BYTE)Iec104Cot::ACTIVATION_TERM, qualifier);
+    }
+    else if (header.typeId == (BYTE)Iec104TypeId::C_CI_NA_1)
+    {
+        BYTE rqt = qualifier & 0x3F;
+        BYTE cot = (BYTE)Iec104Cot::COUNTER_INTERROGATED + (rqt >= 1 && rqt <= 4 ? rqt : 0);
+        PeerSendPoints(station, (BYTE)Iec104TypeId::M_IT_NA_1, 0x6401, m_config.counterPoints, cot);
+        PeerSendCommandReply(station, header.typeId, header.commonAddr, (BYTE)Iec104Cot::ACTIVATION_TERM, qualifier);
+    }
+}
+
+void CIec104LinkSim::PeerSendUFrame(Station &station, Iec104UFunction function)
+{
+    BYTE frame[6] = { IEC104_START_BYTE, 4, (BYTE)function, 0, 0, 0 };
+    Send(station, true, frame, sizeof(frame));
+}
+
+void CIec104LinkSim::PeerSendSFrame(Station &station)
+{
+    Peer &peer = station.peer;
+    BYTE frame[6] = { IEC104_START_BYTE, 4, 0x01, 0, (BYTE)((peer.recvSeq << 1) & 0xFF), (BYTE)(peer.recvSeq >> 7) };
+    peer.unacked = 0;
+    m_scheduler.Cancel(station.peerAckTimer);
+    m_stats.peerSFrames++;
+    CountPerSecond(m_clock.NowMs(), 1, m_frameSecond, m_framesInSecond, m_stats.peakFramesPerSec);
+    Send(station, true, frame, sizeof(frame));
+}
+
+void CIec104LinkSim::PeerSendAsdu(Station &station, const BYTE *asdu, int length)
+{
+    // I帧捎带确认
+    Peer &peer = station.peer;
+    BYTE frame[255];
+    frame[0] = IEC104_START_BYTE;
+    frame[1] = (BYTE)(length + 4);
+    frame[2] = (BYTE)((peer.sendSeq << 1) & 0xFF);
+    frame[3] = (BYTE)(peer.sendSeq >> 7);
+    frame[4] = (BYTE)((peer.recvSeq << 1) & 0xFF);
+    frame[5] = (BYTE)(peer.recvSeq >> 7);
+    memcpy(frame + 6, asdu, length);
+    peer.sendSeq = (peer.sendSeq + 1) & 0x7FFF;
+    if (peer.unacked > 0)
+    {
+        peer.unacked = 0;
+        m_scheduler.Cancel(station.peerAckTimer);
+    }
+    m_stats.peerIFrames++;
+    CountPerSecond(m_clock.NowMs(), 1, m_frameSecond, m_framesInSecond, m_stats.peakFramesPerSec);
+    Send(station, true, frame, length + 6);
+}
+
+void CIec104LinkSim::PeerSendCommandReply(Station &station, BYTE typeId, WORD commonAddr, BYTE cot, BYTE qualifier)
+{
+    BYTE asdu[SIM_MAX_ASDU];
+    Iec104AsduHeader header;
+    header.typeId = typeId;
+    header.vsq = 1;
+    header.cot = cot;
+    header.commonAddr = commonAddr;
+    m_codec->putHeader(asdu, header);
+    int length = m_codec->headerLen;
+    m_codec->putIoa(asdu + length, 0);
+    length += m_codec->ioaLen;
+    asdu[length++] = qualifier;
+    PeerSendAsdu(station, asdu, length);
+}
+
+void CIec104LinkSim::PeerSendPoints(Station &station, BYTE typeId, DWORD firstIoa, DWORD count, BYTE cot)
+{
+    // 短浮点遥测或累计量，每个ASDU装满为止
+    Peer &peer = station.peer;
+    BYTE element[16];
+    int elementLen = Iec104EncodeMonitorElement(typeId, 0, 0.0, element);
+    DWORD perAsdu = (DWORD)((SIM_MAX_ASDU - m_codec->headerLen) / (m_codec->ioaLen + elementLen));
+    DWORD ioa = firstIoa;
+    while (count > 0)
+    {
+        DWORD objects = (std::min)(count, perAsdu);
+        BYTE asdu[SIM_MAX_ASDU];
+        Iec104AsduHeader header;
+        header.typeId = typeId;
+        header.vsq = (BYTE)objects;
+        header.cot = cot;
+        header.commonAddr = (WORD)(station.index + 1);
+        m_codec->putHeader(asdu, header);
+        int length = m_codec->headerLen;
+        for (DWORD i = 0; i < objects; ++i)
+        {
+            double value = typeId == (BYTE)Iec104TypeId::M_IT_NA_1 ? (double)++peer.counter : (double)(peer.value += 0.5f);
+            m_codec->putIoa(asdu + length, ioa++);
+            length += m_codec->ioaLen;
+            length += Iec104EncodeMonitorElement(typeId, 0, value, asdu + length);
+        }
+        PeerSendAsdu(station, asdu, length);
+        count -= objects;
+    }
+}
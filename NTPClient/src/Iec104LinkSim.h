@@ -0,0 +1,189 @@
+﻿#pragma once
+#include "Iec104Master.h"
+#include "Iec104Interrogation.h"
+#include "TimerWheel.h"
+#include "VirtualTime.h"
+#include <queue>
+
+// 虚拟链路仿真配置（时间均为虚拟时间）
+struct Iec104LinkSimConfig
+{
+    UINT64 durationMs = 3600ULL * 1000;      // 每次 Run 仿真的时长
+    size_t stations = 1;                     // 站数：每站一个主站与一个仿真子站
+    DWORD latencyMs = 5;                     // 单向传输时延（至少1毫秒）
+    DWORD t1Ms = IEC104_T1_TIMEOUT_MS;
+    DWORD t2Ms = IEC104_T2_TIMEOUT_MS;
+    DWORD t3Ms = IEC104_T3_TIMEOUT_MS;
+    WORD w = 8;                              // 主站与仿真子站收到w个I帧后确认
+    DWORD spontaneousMs = 1000;              // 子站突发上送周期，0表示不上送（链路空闲，只有测试帧）
+    DWORD giPoints = 100;                    // 子站总召应答的点数
+    DWORD counterPoints = 16;                // 子站电能量召唤应答的累计量个数
+    DWORD outageEveryMs = 0;                 // 链路中断（全部站的双向报文滞留不到达）的间隔，0表示不中断
+    DWORD outageMs = 60000;                  // 每次中断的时长（超过 t3+t1 时主站断开链路）
+    DWORD connectDelayMs = 1000;             // 启动与链路断开后重新连接的延时（对话框自动连接为1秒）
+    DWORD connectTimeoutMs = IEC104_TIMEOUT_MS;  // 中断期间连接尝试失败所需的时间
+    DWORD ntpPollMs = 64000;                 // NTP轮询周期（0表示不轮询，只计次，不发送）
+    Iec104InterrogationPlan plan;            // 每站的召唤计划（公共地址为站序号+1），缺省只在STARTDT后总召一次
+    Iec104InterrogationConfig interrogation; // 召唤调度的并发上限与速率预算
+};
+
+// 仿真统计
+struct Iec104LinkSimStats
+{
+    UINT64 simulatedMs = 0;
+    double cpuMs = 0.0;                      // 本次 Run 消耗的实际时间
+    UINT64 steps = 0;                        // 虚拟时钟推进的次数（只在有事件的时刻停留）
+    UINT64 services = 0;                     // 主站链路的服务次数（收到报文、定时器到期或有报文待发）
+    UINT64 timerCallbacks = 0;               // 调度器定时器回调数
+    UINT64 connects = 0;
+    UINT64 connectFailures = 0;
+    UINT64 linkLosses = 0;                   // 链路断开（t1超时、序号错误）
+    UINT64 startedMs = 0;                    // 各站处于数据传输状态的累计时间
+    UINT64 masterFramesSent = 0;
+    UINT64 masterFramesReceived = 0;
+    UINT64 peerIFrames = 0;                  // 子站发出的I帧
+    UINT64 peerSFrames = 0;
+    UINT64 peakFramesPerSec = 0;             // 子站发出报文最多的一秒内的报文数（带宽尖峰）
+    UINT64 testFrames = 0;                   // 子站收到的 TESTFR_ACT
+    UINT64 droppedFrames = 0;                // 链路断开时仍在传输中、随连接丢弃的报文
+    UINT64 points = 0;                       // 主站点库的更新次数
+    UINT64 ntpPolls = 0;
+    UINT64 peakInterrogationsPerSec = 0;     // 开始召唤最多的一秒内的召唤数
+    Iec104InterrogationStats interrogation;  // 召唤调度统计（自构造起累计）
+    Iec104SequenceStats sequence;            // 各站主站的序号统计之和（自构造起累计）
+};
+
+// 虚拟时间链路仿真：每站一个主站（CIec104Master 的真实链路代码）经虚拟网络连接一个仿真子站，
+// 全部定时器（主站 t1/t2/t3 与测试帧、重连延时、召唤调度、NTP轮询、子站突发与链路中断）在同一个虚拟时钟上运行
+// - 单线程：主站以虚拟链路连接（不使用socket与I/O线程），调度器为虚拟时钟的 CTimerWheelThread（不创建线程），
+//   召唤由 CIec104InterrogationScheduler 按计划错开发起
+// - 虚拟时钟只在有事件的时刻停留，空闲时间直接跳过，每步只服务有报文到达、定时器到期或有报文待发的主站：
+//   数小时的链路行为（含超时与重连）在毫秒级CPU时间内完成，结果只取决于配置，可重复，用作定时器逻辑的快速测试与基准
+// - 子站模型：应答 STARTDT/STOPDT/TESTFR，按w或t2确认主站的I帧，总召应答激活确认、giPoints 个短浮点遥测与激活终止，
+//   电能量召唤应答 counterPoints 个累计量，按 spontaneousMs 突发上送；
+//   中断期间双向报文滞留（中断结束后按序到达），连接尝试在 connectTimeoutMs 后失败
+class CIec104LinkSim
+{
+public:
+    explicit CIec104LinkSim(const Iec104LinkSimConfig& config);
+    ~CIec104LinkSim();
+
+    CIec104LinkSim(const CIec104LinkSim&) = delete;
+    CIec104LinkSim& operator=(const CIec104LinkSim&) = delete;
+
+    // 运行 durationMs 虚拟时间，返回本次的统计；可重复调用，链路状态在两次之间保持
+    Iec104LinkSimStats Run();
+
+    // Run 之前可设置主站的回调与日志（状态回调由仿真使用，不能替换）
+    CIec104Master& GetMaster(size_t station = 0) { return *m_stations[station]->master; }
+    size_t GetStationCount() const { return m_stations.size(); }
+    const CVirtualClock& GetClock() const { return m_clock; }
+
+private:
+    // 仿真子站的链路状态（连接断开时复位）
+    struct Peer
+    {
+        bool started = false;
+        WORD sendSeq = 0;
+        WORD recvSeq = 0;
+        WORD unacked = 0;
+        int buffered = 0;
+        BYTE buffer[4096];
+        float value = 0.0f;
+        DWORD counter = 0;
+    };
+
+    struct Station
+    {
+        size_t index = 0;
+        std::unique_ptr<CIec104Master> master;
+        Peer peer;
+        bool linkActive = false;             // 主站虚拟链路已建立
+        bool connecting = false;
+        bool connectWillSucceed = false;
+        bool dirty = false;                  // 本步需要服务主站链路
+        UINT64 timerDueMs = 0;               // 主站链路定时器的下一次到期时刻（已登记在 m_linkTimers 中）
+        UINT64 startedSinceMs = 0;           // 进入数据传输状态的时刻，0表示不在该状态
+        UINT64 linkEpoch = 0;                // 每次连接加一，丢弃旧连接上仍在传输的报文
+        std::vector<Iec104State> stateChanges;
+        CWheelTimer connectTimer;            // 连接延时
+        CWheelTimer connectResult;           // 连接尝试完成（成功或超时失败）
+        CWheelTimer spontTimer;
+        CWheelTimer peerAckTimer;            // 子站的t2
+    };
+
+    // 传输中的报文，按到达时刻与发送顺序投递
+    struct InFlight
+    {
+        UINT64 deliverMs;
+        UINT64 seq;
+        Station* station;
+        UINT64 linkEpoch;
+        bool toMaster;
+        std::vector<BYTE> data;
+    };
+    struct InFlightLater
+    {
+        bool operator()(const InFlight& a, const InFlight& b) const
+        {
+            return a.deliverMs != b.deliverMs ? a.deliverMs > b.deliverMs : a.seq > b.seq;
+        }
+    };
+    // 主站链路定时器的到期登记（过时的登记在取出时丢弃）
+    struct LinkTimerEntry
+    {
+        UINT64 dueMs;
+        Station* station;
+        bool operator>(const LinkTimerEntry& other) const { return dueMs > other.dueMs; }
+    };
+
+    // 虚拟网络
+    void Send(Station& station, bool toMaster, const BYTE* data, int length);
+    void DeliverDue(UINT64 nowMs);
+    void MarkDirty(Station& station);
+    void ServiceDirty(UINT64 nowMs);
+
+    // 调度器事件（对应对话框的自动连接与NTP轮询定时器）
+    void OnConnectTimer(Station& station);
+    void OnConnectResult(Station& station);
+    void OnNtpPollTimer();
+    void OnOutageTimer();
+    void OnSpontaneousTimer(Station& station);
+    void OnPeerAckTimer(Station& station);
+    void HandleStateChanges(Station& station, UINT64 nowMs);
+    static void CountPerSecond(UINT64 nowMs, UINT64 count, UINT64& second, UINT64& inSecond, UINT64& peak);
+
+    // 仿真子站
+    void PeerReceive(Station& station, const BYTE* data, int length);
+    void PeerHandleFrame(Station& station, const BYTE* frame, int length);
+    void PeerSendUFrame(Station& station, Iec104UFunction function);
+    void PeerSendSFrame(Station& station);
+    void PeerSendAsdu(Station& station, const BYTE* asdu, int length);
+    void PeerSendCommandReply(Station& station, BYTE typeId, WORD commonAddr, BYTE cot, BYTE qualifier);
+    void PeerSendPoints(Station& station, BYTE typeId, DWORD firstIoa, DWORD count, BYTE cot);
+
+    UINT64 NextEventMs(UINT64 nowMs, UINT64 endMs);
+
+    Iec104LinkSimConfig m_config;
+    CVirtualClock m_clock;
+    CTimerWheelThread m_scheduler;
+    CIec104InterrogationScheduler m_interrogation;
+    const Iec104CodecOps* m_codec;
+    std::vector<std::unique_ptr<Station>> m_stations;
+
+    CWheelTimer m_ntpPollTimer;
+    CWheelTimer m_outageTimer;           // 中断开始与结束交替
+
+    std::priority_queue<InFlight, std::vector<InFlight>, InFlightLater> m_inFlight;
+    std::priority_queue<LinkTimerEntry, std::vector<LinkTimerEntry>, std::greater<LinkTimerEntry>> m_linkTimers;
+    std::vector<Station*> m_dirty;
+    UINT64 m_sendSeq;
+    bool m_outage;
+    bool m_initialized;
+    UINT64 m_frameSecond;                // 子站报文与召唤开始的每秒计数（虚拟时间的秒）
+    UINT64 m_framesInSecond;
+    UINT64 m_giSecond;
+    UINT64 m_giInSecond;
+    UINT64 m_lastStarted;
+    Iec104LinkSimStats m_stats;
+};
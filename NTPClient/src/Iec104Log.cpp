@@ -0,0 +1,156 @@
+﻿#include "pch.h"
+#include "Iec104Log.h"
+#include "VirtualTime.h"
+#include <cstring>
+
+namespace
+{
+    // FILETIME(1601-01-01) 与 1970-01-01 之间的100ns数
+    constexpr UINT64 FILETIME_UNIX_EPOCH = 116444736000000000ULL;
+
+    const wchar_t HEX_DIGITS[] = L"0123456789ABCDEF";
+}
+
+INT64 Iec104UtcNowUs()
+{
+    FILETIME ft;
+    GetSystemTimePreciseAsFileTime(&ft);
+    ULARGE_INTEGER uli;
+    uli.LowPart = ft.dwLowDateTime;
+    uli.HighPart = ft.dwHighDateTime;
+    return (INT64)(uli.QuadPart - FILETIME_UNIX_EPOCH) / 10;
+}
+
+INT64 Iec104MonotonicUs()
+{
+    return CMonotonicClock::SystemNowUs();
+}
+
+SYSTEMTIME Iec104UtcUsToLocalTime(INT64 timeUs)
+{
+    ULARGE_INTEGER uli;
+    uli.QuadPart = (UINT64)timeUs * 10 + FILETIME_UNIX_EPOCH;
+    FILETIME ftUtc, ftLocal;
+    ftUtc.dwLowDateTime = uli.LowPart;
+    ftUtc.dwHighDateTime = uli.HighPart;
+    SYSTEMTIME st = {};
+    FileTimeToLocalFileTime(&ftUtc, &ftLocal);
+    FileTimeToSystemTime(&ftLocal, &st);
+    return st;
+}
+
+CIec104FrameRing::CIec104FrameRing(size_t capacity)
+    : m_mask(0), m_head(0)
+{
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+    m_mask = size - 1;
+
+    m_slots.reset(new Slot[size]);
+    for (size_t i = 0; i < size; ++i)
+    {
+        m_slots[i].seq.store(0, std::memory_order_relaxed);
+        m_slots[i].timeUs = 0;
+        m_slots[i].dir = Iec104FrameDir::RX;
+        m_slots[i].length = 0;
+    }
+}
+
+void CIec104FrameRing::Record(Iec104FrameDir dir, const BYTE *data, int length)
+{
+    if (!data || length <= 0)
+        return;
+    if (length > IEC104_MAX_APDU_LEN)
+        length = IEC104_MAX_APDU_LEN;
+
+    UINT64 ticket = m_head.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = m_slots[ticket & m_mask];
+
+    slot.seq.store(ticket * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.timeUs = Iec104UtcNowUs();
+    slot.dir = dir;
+    slot.length = (BYTE)length;
+    memcpy(slot.data, data, length);
+
+    slot.seq.store(ticket * 2 + 2, std::memory_order_release);
+}
+
+UINT64 CIec104FrameRing::Read(UINT64 &cursor, std::vector<Iec104FrameRecord> &out, size_t maxCount) const
+{
+    UINT64 lost = 0;
+    UINT64 head = m_head.load(std::memory_order_acquire);
+    UINT64 capacity = m_mask + 1;
+
+    // 读取端落后超过一圈，直接跳到仍可能有效的最旧记录
+    if (head > cursor + capacity)
+    {
+        lost += head - capacity - cursor;
+        cursor = head - capacity;
+    }
+
+    while (cursor < head && maxCount > 0)
+    {
+        const Slot &slot = m_slots[cursor & m_mask];
+        UINT64 expected = cursor * 2 + 2;
+
+        UINT64 seq1 = slot.seq.load(std::memory_order_acquire);
+        if (seq1 < expected)
+        {
+            // 写入端已领取序号但尚未写完，下次再读
+            break;
+        }
+
+        Iec104FrameRecord record;
+        record.sequence = cursor;
+        record.timeUs = slot.timeUs;
+        record.dir = slot.dir;
+        record.length = slot.length;
+        memcpy(record.data, slot.data, record.length);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        UINT64 seq2 = slot.seq.load(std::memory_order_relaxed);
+        if (seq1 != expected || seq2 != expected)
+        {
+            // 读取期间被新记录覆盖
+            ++lost;
+        }
+        else
+        {
+            out.push_back(record);
+            --maxCount;
+        }
+        ++cursor;
+    }
+
+    return lost;
+}
+
+std::wstring CIec104FrameRing::FormatFrame(const Iec104FrameRecord &frame)
+{
+    // 转换为本地时间 HH:mm:ss.ffffff
+    SYSTEMTIME st = Iec104UtcUsToLocalTime(frame.timeUs);
+
+    wchar_t prefix[48];
+    swprintf_s(prefix, L"%02d:%02d:%02d.%06d %s ",
+               st.wHour, st.wMinute, st.wSecond, (int)(frame.timeUs % 1000000),
+               frame.dir == Iec104FrameDir::TX ? L"发送报文:" : L"接收报文:");
+
+    return prefix + Iec104HexString(frame.data, frame.length);
+}
+
+std::wstring Iec104HexString(const BYTE *data, int length)
+{
+    if (!data || length <= 0)
+        return L"";
+
+    std::wstring result(length * 3 - 1, L' ');
+    for (int i = 0; i < length; ++i)
+    {
+        result[i * 3] = HEX_DIGITS[data[i] >> 4];
+        result[i * 3 + 1] = HEX_DIGITS[data[i] & 0x0F];
+    }
+    return result;
+}
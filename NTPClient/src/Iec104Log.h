@@ -0,0 +1,101 @@
+﻿#pragma once
+#include <windows.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+// 日志级别（数值越大越详细）
+enum class Iec104LogLevel : BYTE
+{
+    LOG_ERROR = 0,
+    LOG_WARNING = 1,
+    LOG_INFO = 2,
+    LOG_DEBUG = 3,
+    LOG_TRACE = 4
+};
+
+// 日志类别（位掩码）
+constexpr DWORD IEC104_LOG_LINK = 0x01;    // 连接、STARTDT/STOPDT、测试帧
+constexpr DWORD IEC104_LOG_FRAME = 0x02;   // 逐帧信息（I/S帧收发）
+constexpr DWORD IEC104_LOG_DATA = 0x04;    // 监视数据
+constexpr DWORD IEC104_LOG_CLOCK = 0x08;   // 时钟读取/同步
+constexpr DWORD IEC104_LOG_CMD = 0x10;     // 总召等命令
+constexpr DWORD IEC104_LOG_ALL = 0xFFFFFFFF;
+
+// 先检查级别与类别再构造日志文本，被过滤的日志不产生任何格式化开销
+#define IEC104_LOG(level, category, message)                          \
+    do                                                                \
+    {                                                                 \
+        if (IsLogEnabled(Iec104LogLevel::level, category))            \
+        {                                                             \
+            LogEvent(message);                                        \
+        }                                                             \
+    } while (0)
+
+// 报文方向
+enum class Iec104FrameDir : BYTE
+{
+    RX = 0,
+    TX = 1
+};
+
+constexpr int IEC104_MAX_APDU_LEN = 255;   // 0x68 + 长度字节 + 最多253字节
+
+// 报文记录（读取端使用）
+struct Iec104FrameRecord
+{
+    UINT64 sequence;      // 全局递增序号
+    INT64 timeUs;         // UTC时间，自1970-01-01起的微秒数
+    Iec104FrameDir dir;
+    BYTE length;
+    BYTE data[IEC104_MAX_APDU_LEN];
+};
+
+// 当前UTC时间（微秒，自1970-01-01起）
+INT64 Iec104UtcNowUs();
+
+// 单调时钟（微秒，QueryPerformanceCounter），用于测量时延，不受系统时间调整影响
+INT64 Iec104MonotonicUs();
+
+// UTC微秒时间转换为本地时间
+SYSTEMTIME Iec104UtcUsToLocalTime(INT64 timeUs);
+
+// 报文环形缓冲区
+// - 收发线程以二进制形式写入预分配槽位，不做任何格式化、不分配内存
+// - 读取端按游标取出，只有真正读取时才格式化为文本
+// - 读取过慢时旧记录被覆盖，读取端可得知丢失数量
+class CIec104FrameRing
+{
+public:
+    explicit CIec104FrameRing(size_t capacity = 4096);
+
+    CIec104FrameRing(const CIec104FrameRing&) = delete;
+    CIec104FrameRing& operator=(const CIec104FrameRing&) = delete;
+
+    // 写入端（可多线程）
+    void Record(Iec104FrameDir dir, const BYTE* data, int length);
+
+    // 读取端：从 cursor 开始读取最多 maxCount 条，更新 cursor，返回被覆盖而丢失的条数
+    UINT64 Read(UINT64& cursor, std::vector<Iec104FrameRecord>& out, size_t maxCount) const;
+    UINT64 GetHead() const { return m_head.load(std::memory_order_acquire); }
+
+    static std::wstring FormatFrame(const Iec104FrameRecord& frame);
+
+private:
+    struct Slot
+    {
+        std::atomic<UINT64> seq;   // 2*序号+1 表示写入中，2*序号+2 表示写入完成
+        INT64 timeUs;
+        Iec104FrameDir dir;
+        BYTE length;
+        BYTE data[IEC104_MAX_APDU_LEN];
+    };
+
+    size_t m_mask;
+    std::unique_ptr<Slot[]> m_slots;
+    std::atomic<UINT64> m_head;
+};
+
+// 报文转十六进制文本（查表实现，不使用流）
+std::wstring Iec104HexString(const BYTE* data, int length);
@@ -1,13 +1,164 @@
 ﻿#include "pch.h"
 #include "Iec104Master.h"
-#include <iostream>
-#include <sstream>
+#include "Iec104Command.h"
+#include "Iec104TimeDecode.h"
+#include <algorithm>
 #include <chrono>
-#include <iomanip>
+
+namespace
+{
+    // FILETIME(1601-01-01) 与 1970-01-01 之间的100ns数
+    constexpr UINT64 FILETIME_UNIX_EPOCH = 116444736000000000ULL;
+}
+
+bool Iec104GetMonitorLayout(BYTE typeId, int &elemLen, bool &hasTime)
+{
+    hasTime = false;
+    switch ((Iec104TypeId)typeId)
+    {
+    case Iec104TypeId::M_SP_TB_1:
+    case Iec104TypeId::M_DP_TB_1:
+        hasTime = true;
+        // fall through
+    case Iec104TypeId::M_SP_NA_1:
+    case Iec104TypeId::M_DP_NA_1:
+        elemLen = 1; // SIQ/DIQ
+        return true;
+
+    case Iec104TypeId::M_ST_TB_1:
+        hasTime = true;
+        // fall through
+    case Iec104TypeId::M_ST_NA_1:
+        elemLen = 2; // VTI + QDS
+        return true;
+
+    case Iec104TypeId::M_ME_ND_1:
+        elemLen = 2; // NVA
+        return true;
+
+    case Iec104TypeId::M_ME_TD_1:
+    case Iec104TypeId::M_ME_TE_1:
+        hasTime = true;
+        // fall through
+    case Iec104TypeId::M_ME_NA_1:
+    case Iec104TypeId::M_ME_NB_1:
+        elemLen = 3; // NVA/SVA + QDS
+        return true;
+
+    case Iec104TypeId::M_ME_TF_1:
+    case Iec104TypeId::M_IT_TB_1:
+        hasTime = true;
+        // fall through
+    case Iec104TypeId::M_ME_NC_1:
+    case Iec104TypeId::M_IT_NA_1:
+        elemLen = 5; // IEEE STD 754 + QDS / BCR
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+BYTE Iec104GetUntimedType(BYTE type)
+{
+    switch ((Iec104TypeId)type)
+    {
+    case Iec104TypeId::M_SP_TB_1: return (BYTE)Iec104TypeId::M_SP_NA_1;
+    case Iec104TypeId::M_DP_TB_1: return (BYTE)Iec104TypeId::M_DP_NA_1;
+    case Iec104TypeId::M_ST_TB_1: return (BYTE)Iec104TypeId::M_ST_NA_1;
+    case Iec104TypeId::M_ME_TD_1: return (BYTE)Iec104TypeId::M_ME_NA_1;
+    case Iec104TypeId::M_ME_TE_1: return (BYTE)Iec104TypeId::M_ME_NB_1;
+    case Iec104TypeId::M_ME_TF_1: return (BYTE)Iec104TypeId::M_ME_NC_1;
+    case Iec104TypeId::M_IT_TB_1: return (BYTE)Iec104TypeId::M_IT_NA_1;
+    default: return type;
+    }
+}
+
+int Iec104EncodeMonitorElement(BYTE type, BYTE quality, double value, BYTE *out)
+{
+    switch ((Iec104TypeId)type)
+    {
+    case Iec104TypeId::M_SP_NA_1:
+    case Iec104TypeId::M_SP_TB_1:
+        out[0] = (value != 0.0 ? 0x01 : 0x00) | (quality & 0xF0);
+        return 1;
+
+    case Iec104TypeId::M_DP_NA_1:
+    case Iec104TypeId::M_DP_TB_1:
+        out[0] = ((BYTE)value & 0x03) | (quality & 0xF0);
+        return 1;
+
+    case Iec104TypeId::M_ST_NA_1:
+    case Iec104TypeId::M_ST_TB_1:
+        out[0] = (BYTE)((int)value & 0x7F);
+        out[1] = quality;
+        return 2;
+
+    case Iec104TypeId::M_ME_ND_1:
+    case Iec104TypeId::M_ME_NA_1:
+    case Iec104TypeId::M_ME_TD_1:
+    {
+        double scaled = (std::max)(-32768.0, (std::min)(32767.0, value * 32768.0));
+        short nva = (short)scaled;
+        out[0] = nva & 0xFF;
+        out[1] = (nva >> 8) & 0xFF;
+        if (type == (BYTE)Iec104TypeId::M_ME_ND_1)
+            return 2;
+        out[2] = quality;
+        return 3;
+    }
+
+    case Iec104TypeId::M_ME_NB_1:
+    case Iec104TypeId::M_ME_TE_1:
+    {
+        short sva = (short)value;
+        out[0] = sva & 0xFF;
+        out[1] = (sva >> 8) & 0xFF;
+        out[2] = quality;
+        return 3;
+    }
+
+    case Iec104TypeId::M_ME_NC_1:
+    case Iec104TypeId::M_ME_TF_1:
+    {
+        float f = (float)value;
+        memcpy(out, &f, sizeof(f));
+        out[4] = quality;
+        return 5;
+    }
+
+    case Iec104TypeId::M_IT_NA_1:
+    case Iec104TypeId::M_IT_TB_1:
+    {
+        DWORD counter = (DWORD)(INT64)value;
+        out[0] = counter & 0xFF;
+        out[1] = (counter >> 8) & 0xFF;
+        out[2] = (counter >> 16) & 0xFF;
+        out[3] = (counter >> 24) & 0xFF;
+        out[4] = quality & 0xE0;
+        return 5;
+    }
+
+    default:
+        return 0;
+    }
+}
 
 CIec104Master::CIec104Master()
-    : m_socket(INVALID_SOCKET), m_port(IEC104_DEFAULT_PORT), m_state(Iec104State::DISCONNECTED), m_sendSeqNum(0), m_recvSeqNum(0), m_sentFrames(0), m_receivedFrames(0), m_stopReceive(false)
+    : m_socket(INVALID_SOCKET), m_port(IEC104_DEFAULT_PORT), m_state(Iec104State::DISCONNECTED), m_sendSeqNum(0), m_recvSeqNum(0), m_ackSeqNum(0),
+      m_rxSeqSynced(true), m_seqResetPending(false), m_iSendTimesUs(), m_seqIFrames(0), m_seqGaps(0), m_seqDuplicates(0), m_seqInvalidAcks(0),
+      m_seqAckTimeouts(0), m_seqLinkResets(0), m_ackedFrames(0), m_ackLagTotalUs(0), m_ackLagMaxUs(0), m_windowStalls(0), m_windowBlockedUs(0), m_windowBlocked(false), m_windowBlockedSinceUs(0), m_sentFrames(0), m_receivedFrames(0),
+      m_netEvent(WSA_INVALID_EVENT), m_txEvent(WSA_INVALID_EVENT), m_ioThreadId(0), m_txWakePending(false), m_txOffset(0), m_txBlocked(false), m_txHeldMask(0), m_txHeldHead(0), m_txHeldCount(0), m_txOffsetHeld(false), m_txSyscalls(0),
+      m_stopReceive(false), m_connectTimeoutMs(IEC104_TIMEOUT_MS), m_tlsTxSent(0), m_tlsResumed(false), m_t1Ms(IEC104_T1_TIMEOUT_MS), m_t2Ms(IEC104_T2_TIMEOUT_MS), m_t3Ms(IEC104_T3_TIMEOUT_MS), m_ackWindow(8), m_sendWindow(IEC104_DEFAULT_K), m_unackedRx(0), m_lastRxUs(0), m_testSentUs(0), m_linkTimedOut(false), m_logLevel(Iec104LogLevel::LOG_INFO), m_logCategories(IEC104_LOG_ALL), m_frameRecording(true), m_replayTimeUs(0), m_virtualRxBuffered(0),
+      m_commands(new CIec104CommandTracker()), m_codec(&Iec104GetCodec(Iec104LinkProfile())), m_processAsdu(&CIec104Master::ProcessAsdu<Iec104StandardCodec>),
+      m_pointDb(std::make_shared<CIec104PointDb>()), m_subscriptions(std::make_shared<CIec104SubscriptionIndex>())
 {
+    m_txHeldMask = m_txQueue.GetCapacity() - 1;
+    m_txHeld.reset(new Iec104TxFrame[m_txHeldMask + 1]);
+    m_t1AckTimer.SetCallback([this] { OnAckTimeout(); });
+    m_t1TestTimer.SetCallback([this] { OnTestTimeout(); });
+    m_t2Timer.SetCallback([this] { OnRecvAckTimeout(); });
+    m_t3Timer.SetCallback([this] { OnIdleTimeout(); });
     InitializeWinsock();
 }
 
@@ -29,107 +180,393 @@ void CIec104Master::CleanupWinsock()
     WSACleanup();
 }
 
-bool CIec104Master::Connect(const std::wstring &ipAddress, WORD port)
+bool CIec104Master::Connect(const std::wstring &host, WORD port)
 {
-    if (IsConnected())
+    if (!ConnectAsync(host, port))
     {
-        LogEvent(L"已经连接，先断开现有连接");
+        return false;
+    }
+
+    // 等待I/O线程完成名称解析与连接（成功、失败或超时）
+    std::unique_lock<std::mutex> lock(m_stateMutex);
+    m_stateChanged.wait(lock, [this] { return m_state != Iec104State::CONNECTING; });
+    return IsConnected();
+}
+
+bool CIec104Master::ConnectAsync(const std::wstring &host, WORD port)
+{
+    // 上一次连接的套接字与I/O线程（含失败的连接尝试）重连前一并回收
+    if (m_receiveThread.joinable() || m_socket != INVALID_SOCKET)
+    {
+        if (IsConnected())
+        {
+            IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"已经连接，先断开现有连接");
+        }
         Disconnect();
     }
 
-    m_ipAddress = ipAddress;
+    if (host.empty())
+    {
+        IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"未指定子站地址");
+        return false;
+    }
+
+    m_ipAddress = host;
     m_port = port;
-    m_state = Iec104State::CONNECTING;
 
-    // 创建socket
-    m_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (m_socket == INVALID_SOCKET)
+    // 事件驱动I/O：套接字事件 + 发送队列唤醒事件（连接建立阶段兼作取消事件）
+    m_netEvent = WSACreateEvent();
+    m_txEvent = WSACreateEvent();
+    if (m_netEvent == WSA_INVALID_EVENT || m_txEvent == WSA_INVALID_EVENT)
     {
-        LogEvent(L"创建socket失败: " + GetLastErrorString());
-        m_state = Iec104State::DISCONNECTED;
+        IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"创建网络事件失败: " + GetLastErrorString());
+        Disconnect();
         return false;
     }
 
-    // 设置socket超时
-    DWORD timeout = IEC104_TIMEOUT_MS;
-    setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
-    setsockopt(m_socket, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout, sizeof(timeout));
+    ResetLinkState();
+    ChangeState(Iec104State::CONNECTING);
+
+    // 名称解析与连接在I/O线程中进行，调用线程立即返回
+    m_stopReceive = false;
+    m_receiveThread = std::thread(&CIec104Master::ReceiveThreadProc, this);
+    return true;
+}
 
-    // 转换IP地址
-    std::string ipStr(ipAddress.begin(), ipAddress.end());
-    sockaddr_in serverAddr = {};
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(port);
+void CIec104Master::ResetLinkState()
+{
+    m_sendSeqNum = 0;
+    m_recvSeqNum = 0;
+    m_ackSeqNum = 0;
+    m_rxSeqSynced = true;
+    m_seqResetPending = false;
+    m_sentFrames = 0;
+    m_receivedFrames = 0;
+    m_txSyscalls = 0;
+    m_txOffset = 0;
+    m_txBlocked = false;
+    m_txWakePending = false;
+    m_txQueue.Clear();
+    m_txHeldHead = 0;
+    m_txHeldCount = 0;
+    m_txOffsetHeld = false;
+    m_testSentUs = 0;
+    m_tls.Reset();
+    m_tlsTx.clear();
+    m_tlsTxSent = 0;
+    m_tlsResumed = false;
+}
 
-    if (inet_pton(AF_INET, ipStr.c_str(), &serverAddr.sin_addr) <= 0)
+bool CIec104Master::EstablishConnection()
+{
+    // AF_UNSPEC 同时解析IPv4与IPv6地址，按系统返回的优先顺序逐个尝试
+    ADDRINFOW hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    ADDRINFOW *addresses = nullptr;
+    std::wstring service = std::to_wstring(m_port);
+    int result = GetAddrInfoW(m_ipAddress.c_str(), service.c_str(), &hints, &addresses);
+    if (result != 0)
     {
-        LogEvent(L"无效的IP地址: " + ipAddress);
-        closesocket(m_socket);
-        m_socket = INVALID_SOCKET;
-        m_state = Iec104State::DISCONNECTED;
+        WSASetLastError(result);
+        IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"解析地址失败: " + m_ipAddress + L" " + GetLastErrorString());
         return false;
     }
 
-    // 连接服务器
-    if (connect(m_socket, (sockaddr *)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR)
+    // 连接时限从解析完成开始计算，所有候选地址共用
+    INT64 deadlineUs = Iec104MonotonicUs() + (INT64)m_connectTimeoutMs * 1000;
+    SOCKET sock = INVALID_SOCKET;
+    std::wstring address;
+    bool timedOut = false;
+    for (ADDRINFOW *ai = addresses; ai && sock == INVALID_SOCKET && !timedOut && !m_stopReceive; ai = ai->ai_next)
     {
-        LogEvent(L"连接失败: " + GetLastErrorString());
-        closesocket(m_socket);
-        m_socket = INVALID_SOCKET;
-        m_state = Iec104State::DISCONNECTED;
+        address = FormatAddress(ai->ai_addr, (DWORD)ai->ai_addrlen);
+        sock = TryConnect(ai, address, deadlineUs, timedOut);
+    }
+    FreeAddrInfoW(addresses);
+
+    // TLS握手与TCP连接共用时限
+    if (sock != INVALID_SOCKET && m_tlsCredentials && !TlsHandshake(sock, deadlineUs))
+    {
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+    }
+
+    if (sock == INVALID_SOCKET)
+    {
+        if (timedOut)
+        {
+            IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"连接超时: " + m_ipAddress + L":" + std::to_wstring(m_port));
+        }
+        else if (!m_stopReceive)
+        {
+            IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"连接失败: " + m_ipAddress + L":" + std::to_wstring(m_port));
+        }
         return false;
     }
 
-    m_state = Iec104State::CONNECTED;
-    m_sendSeqNum = 0;
-    m_recvSeqNum = 0;
-    m_sentFrames = 0;
-    m_receivedFrames = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_socketMutex);
+        m_socket = sock;
+    }
+    WSAEventSelect(m_socket, m_netEvent, FD_READ | FD_WRITE | FD_CLOSE);
+    m_lastRxUs = m_clock.NowUs();
+    ChangeState(Iec104State::CONNECTED);
 
-    // 启动接收线程
-    m_stopReceive = false;
-    m_receiveThread = std::thread(&CIec104Master::ReceiveThreadProc, this);
+    IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"成功连接到 " + m_ipAddress + L" (" + address + L")");
+    return true;
+}
+
+SOCKET CIec104Master::TryConnect(const ADDRINFOW *ai, const std::wstring &address, INT64 deadlineUs, bool &timedOut)
+{
+    SOCKET sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (sock == INVALID_SOCKET)
+    {
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"创建socket失败: " + address + L" " + GetLastErrorString());
+        return INVALID_SOCKET;
+    }
+
+    // 关闭Nagle：S帧/U帧很短，合并发送由发送队列完成，避免与对端延迟确认叠加产生百毫秒级延迟
+    BOOL noDelay = TRUE;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+
+    // WSAEventSelect 把套接字置为非阻塞，connect 立即返回，结果以 FD_CONNECT 通知
+    WSAResetEvent(m_netEvent);
+    WSAEventSelect(sock, m_netEvent, FD_CONNECT);
+    if (connect(sock, ai->ai_addr, (int)ai->ai_addrlen) == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK)
+    {
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"连接 " + address + L" 失败: " + GetLastErrorString());
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+
+    WSAEVENT events[2] = { m_netEvent, m_txEvent };
+    for (;;)
+    {
+        INT64 remainingUs = deadlineUs - Iec104MonotonicUs();
+        if (remainingUs <= 0)
+        {
+            timedOut = true;
+            break;
+        }
 
-    LogEvent(L"成功连接到 " + ipAddress + L":" + std::to_wstring(port));
+        DWORD wait = WSAWaitForMultipleEvents(2, events, FALSE, (DWORD)((remainingUs + 999) / 1000), FALSE);
+        if (m_stopReceive)
+        {
+            // Disconnect 取消了连接
+            break;
+        }
+        if (wait == WSA_WAIT_FAILED)
+        {
+            IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"等待网络事件失败: " + GetLastErrorString());
+            break;
+        }
+        if (wait == WSA_WAIT_EVENT_0 + 1)
+        {
+            WSAResetEvent(m_txEvent);
+            continue;
+        }
+        if (wait != WSA_WAIT_EVENT_0)
+        {
+            continue;
+        }
+
+        WSANETWORKEVENTS netEvents = {};
+        if (WSAEnumNetworkEvents(sock, m_netEvent, &netEvents) == SOCKET_ERROR)
+        {
+            IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"获取网络事件失败: " + GetLastErrorString());
+            break;
+        }
+        if (netEvents.lNetworkEvents & FD_CONNECT)
+        {
+            int error = netEvents.iErrorCode[FD_CONNECT_BIT];
+            if (error == 0)
+            {
+                return sock;
+            }
+            WSASetLastError(error);
+            IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"连接 " + address + L" 失败: " + GetLastErrorString());
+            break;
+        }
+    }
+
+    closesocket(sock);
+    return INVALID_SOCKET;
+}
+
+bool CIec104Master::TlsHandshake(SOCKET sock, INT64 deadlineUs)
+{
+    // 同一凭据上重连时 Schannel 按服务器名查找缓存的会话，做简化握手
+    m_tls.Start(m_tlsCredentials.get(), m_tlsServerName.empty() ? m_ipAddress : m_tlsServerName);
+    m_tlsTx.clear();
+    m_tlsTxSent = 0;
+    WSAEventSelect(sock, m_netEvent, FD_READ | FD_WRITE | FD_CLOSE);
+
+    INT64 startUs = Iec104MonotonicUs();
+    Iec104TlsStatus status = m_tls.Handshake(nullptr, 0, m_tlsTx);
+    BYTE buffer[4096];
+    WSAEVENT events[2] = { m_netEvent, m_txEvent };
+    while (status == Iec104TlsStatus::PENDING)
+    {
+        // 发出握手报文，发送缓冲区满时等待FD_WRITE
+        while (m_tlsTxSent < m_tlsTx.size())
+        {
+            int sent = send(sock, (const char *)m_tlsTx.data() + m_tlsTxSent, (int)(m_tlsTx.size() - m_tlsTxSent), 0);
+            if (sent == SOCKET_ERROR)
+            {
+                if (WSAGetLastError() == WSAEWOULDBLOCK)
+                    break;
+                IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"发送TLS握手报文失败: " + GetLastErrorString());
+                return false;
+            }
+            m_tlsTxSent += sent;
+        }
+
+        INT64 remainingUs = deadlineUs - Iec104MonotonicUs();
+        if (remainingUs <= 0)
+        {
+            IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"TLS握手超时");
+            return false;
+        }
+
+        DWORD wait = WSAWaitForMultipleEvents(2, events, FALSE, (DWORD)((remainingUs + 999) / 1000), FALSE);
+        if (m_stopReceive)
+        {
+            return false;
+        }
+        if (wait == WSA_WAIT_FAILED)
+        {
+            IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"等待网络事件失败: " + GetLastErrorString());
+            return false;
+        }
+        if (wait == WSA_WAIT_EVENT_0 + 1)
+        {
+            WSAResetEvent(m_txEvent);
+            continue;
+        }
+        if (wait != WSA_WAIT_EVENT_0)
+        {
+            continue;
+        }
+
+        WSANETWORKEVENTS netEvents = {};
+        WSAEnumNetworkEvents(sock, m_netEvent, &netEvents);
+        for (;;)
+        {
+            int received = recv(sock, (char *)buffer, sizeof(buffer), 0);
+            if (received == 0)
+            {
+                IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"TLS握手期间连接被关闭");
+                return false;
+            }
+            if (received < 0)
+            {
+                if (WSAGetLastError() == WSAEWOULDBLOCK)
+                    break;
+                IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"接收TLS握手报文失败: " + GetLastErrorString());
+                return false;
+            }
+
+            status = m_tls.Handshake(buffer, received, m_tlsTx);
+            if (status != Iec104TlsStatus::PENDING)
+                break;
+        }
+    }
+
+    if (status != Iec104TlsStatus::OK)
+    {
+        IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, m_tls.GetErrorText());
+        return false;
+    }
+
+    // 握手的最后一段报文（会话恢复时为客户端Finished）留在 m_tlsTx，由I/O循环先于应用数据发出
+    m_tlsResumed = m_tls.IsResumed();
+    IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, std::wstring(m_tlsResumed ? L"TLS会话恢复" : L"TLS完整握手") + L"完成，耗时 " +
+                                             std::to_wstring(Iec104MonotonicUs() - startUs) + L"us");
     return true;
 }
 
+std::wstring CIec104Master::FormatAddress(const sockaddr *addr, DWORD addrLen)
+{
+    wchar_t host[NI_MAXHOST] = {};
+    wchar_t service[16] = {};
+    if (GetNameInfoW(addr, (int)addrLen, host, _countof(host), service, _countof(service), NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+    {
+        return L"?";
+    }
+    // IPv6 形如 [::1]:2404
+    return addr->sa_family == AF_INET6 ? L"[" + std::wstring(host) + L"]:" + service : std::wstring(host) + L":" + service;
+}
+
 void CIec104Master::Disconnect()
 {
-    if (m_socket != INVALID_SOCKET)
+    // I/O线程（包括仍在解析或连接中的线程）
+    if (m_receiveThread.joinable())
     {
-        // 停止数据传输
+        // 停止数据传输（STOPDT_ACT入队，I/O线程退出前发出）
         if (IsStarted())
         {
             StopDataTransfer();
         }
 
-        // 停止接收线程
         m_stopReceive = true;
-        if (m_receiveThread.joinable())
+        if (m_txEvent != WSA_INVALID_EVENT)
         {
-            m_receiveThread.join();
+            WSASetEvent(m_txEvent);
         }
+        m_receiveThread.join();
+    }
 
-        // 关闭socket
+    // 虚拟链路没有I/O线程，由驱动线程在这里结束
+    if (m_virtualSend)
+    {
+        m_virtualSend = nullptr;
+        m_virtualWake = nullptr;
+        m_ioThreadId = 0;
+        m_timers.Reset(0);
+    }
+
+    // 关闭socket
+    if (m_socket != INVALID_SOCKET)
+    {
         std::lock_guard<std::mutex> lock(m_socketMutex);
         closesocket(m_socket);
         m_socket = INVALID_SOCKET;
     }
+    if (m_netEvent != WSA_INVALID_EVENT)
+    {
+        WSACloseEvent(m_netEvent);
+        m_netEvent = WSA_INVALID_EVENT;
+    }
+    if (m_txEvent != WSA_INVALID_EVENT)
+    {
+        WSACloseEvent(m_txEvent);
+        m_txEvent = WSA_INVALID_EVENT;
+    }
+    m_txQueue.Clear();
+    m_txHeldHead = 0;
+    m_txHeldCount = 0;
+
+    // 未完成的命令以失败结束
+    std::vector<Iec104CommandCompletion> done;
+    m_commands->FailAll(m_clock.NowUs(), done);
+    DispatchCommandCompletions(done);
 
-    m_state = Iec104State::DISCONNECTED;
-    LogEvent(L"连接已断开");
+    ChangeState(Iec104State::DISCONNECTED);
+    IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"连接已断开");
 }
 
 bool CIec104Master::InitializeLink()
 {
     if (!IsConnected())
     {
-        LogEvent(L"未连接，无法初始化链路");
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"未连接，无法初始化链路");
         return false;
     }
 
-    LogEvent(L"开始链路初始化...");
+    IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"开始链路初始化...");
 
     // 异步发送STARTDT_ACT，不等待响应
     return StartDataTransfer();
@@ -139,14 +576,14 @@ bool CIec104Master::StartDataTransfer()
 {
     if (!IsConnected())
     {
-        LogEvent(L"未连接，无法启动数据传输");
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"未连接，无法启动数据传输");
         return false;
     }
 
     bool result = SendUFrame(Iec104UFunction::STARTDT_ACT);
     if (result)
     {
-        LogEvent(L"发送STARTDT_ACT");
+        IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"发送STARTDT_ACT");
         // 不阻塞等待，让接收线程处理STARTDT_CON响应
     }
 
@@ -163,8 +600,8 @@ bool CIec104Master::StopDataTransfer()
     bool result = SendUFrame(Iec104UFunction::STOPDT_ACT);
     if (result)
     {
-        LogEvent(L"发送STOPDT_ACT");
-        m_state = Iec104State::CONNECTED;
+        // 收到STOPDT_CON之前子站仍可能发送数据，状态在确认后再改变
+        IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"发送STOPDT_ACT");
     }
 
     return result;
@@ -174,19 +611,17 @@ bool CIec104Master::SendGeneralCall(WORD commonAddr)
 {
     if (!IsStarted())
     {
-        LogEvent(L"数据传输未启动，无法发送总召");
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_CMD, L"数据传输未启动，无法发送总召");
         return false;
     }
 
-    // 构建总召数据
-    BYTE data[IEC104_IOA_LEN + 1];   // IOA + QOI
-    memset(data, 0, IEC104_IOA_LEN); // IOA=0 (3字节)
-    data[IEC104_IOA_LEN] = 0x14;     // QOI=20(站总召)
+    // 构建总召数据：IOA=0
+    BYTE qoi = 0x14; // QOI=20(站总召)
 
-    bool result = SendIFrame((BYTE)Iec104TypeId::C_IC_NA_1, 0x06, commonAddr, data, sizeof(data));
+    bool result = SendIFrame((BYTE)Iec104TypeId::C_IC_NA_1, 0x06, commonAddr, 0, &qoi, sizeof(qoi));
     if (result)
     {
-        LogEvent(L"发送总召命令");
+        IEC104_LOG(LOG_INFO, IEC104_LOG_CMD, L"发送总召命令");
     }
 
     return result;
@@ -211,10 +646,10 @@ bool CIec104Master::SendSFrame()
     frame[4] = (recvSeq << 1) & 0xFF;
     frame[5] = (recvSeq >> 7) & 0xFF;
 
-    bool result = SendApdu(frame, sizeof(frame));
+    bool result = SendApdu(frame, sizeof(frame), Iec104TxKind::S_FRAME);
     if (result)
     {
-        LogEvent(L"发送S帧，接收序号: " + std::to_wstring(recvSeq));
+        IEC104_LOG(LOG_DEBUG, IEC104_LOG_FRAME, L"发送S帧，接收序号: " + std::to_wstring(recvSeq));
     }
 
     return result;
@@ -230,7 +665,7 @@ bool CIec104Master::SendTestFrame()
     bool result = SendUFrame(Iec104UFunction::TESTFR_ACT);
     if (result)
     {
-        LogEvent(L"发送测试帧");
+        IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"发送测试帧");
     }
 
     return result;
@@ -238,173 +673,890 @@ bool CIec104Master::SendTestFrame()
 
 bool CIec104Master::ReadClock(WORD commonAddr)
 {
-    if (!IsStarted())
+    if (!IsStarted())
+    {
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_CLOCK, L"数据传输未启动，无法读取时钟");
+        return false;
+    }
+
+    // 时钟读取命令只有IOA=0
+    bool result = SendIFrame((BYTE)Iec104TypeId::C_CS_NA_1, 0x05, commonAddr, 0);
+    if (result)
+    {
+        IEC104_LOG(LOG_INFO, IEC104_LOG_CLOCK, L"发送时钟读取命令");
+    }
+
+    return result;
+}
+
+bool CIec104Master::SyncClock(const SYSTEMTIME &time, WORD commonAddr)
+{
+    if (!IsStarted())
+    {
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_CLOCK, L"数据传输未启动，无法同步时钟");
+        return false;
+    }
+
+    // 构建时钟同步数据：IOA=0 + CP56Time2a
+    Iec104CP56Time cp56Time = SystemTimeToCP56(time);
+
+    bool result = SendIFrame((BYTE)Iec104TypeId::C_CS_NA_1, 0x06, commonAddr, 0, (const BYTE *)&cp56Time, sizeof(cp56Time));
+    if (result)
+    {
+        IEC104_LOG(LOG_INFO, IEC104_LOG_CLOCK, L"发送时钟同步命令");
+    }
+
+    return result;
+}
+
+UINT64 CIec104Master::SendCommand(const Iec104Command &command, Iec104CommandCallback callback)
+{
+    BYTE element[IEC104_MAX_ASDU_LEN];
+    int elementLen = Iec104EncodeCommand(command, command.selectBeforeOperate, element);
+    std::vector<Iec104CommandCompletion> done;
+
+    if (elementLen < 0 || !IsStarted())
+    {
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_CMD, elementLen < 0 ? L"不支持的命令类型: " + std::to_wstring((BYTE)command.type)
+                                                              : std::wstring(L"数据传输未启动，无法发送命令"));
+        Iec104CommandCompletion failed;
+        failed.callback = std::move(callback);
+        failed.result.command = command;
+        failed.result.status = Iec104CommandStatus::FAILED;
+        done.push_back(std::move(failed));
+        DispatchCommandCompletions(done);
+        return 0;
+    }
+
+    // 先登记再发送，保证应答到达时能找到命令
+    UINT64 id = m_commands->Begin(command, std::move(callback), m_clock.NowUs());
+    bool request = command.type == Iec104TypeId::C_RD_NA_1 || (command.type == Iec104TypeId::C_CS_NA_1 && command.read);
+    BYTE cot = request ? (BYTE)Iec104Cot::REQUEST : (BYTE)Iec104Cot::ACTIVATION;
+    if (!SendIFrame((BYTE)command.type, cot, command.commonAddr, command.ioa, element, elementLen, id))
+    {
+        m_commands->Abort(id, m_clock.NowUs(), done);
+        DispatchCommandCompletions(done);
+        return 0;
+    }
+
+    IEC104_LOG(LOG_DEBUG, IEC104_LOG_CMD, L"发送命令 #" + std::to_wstring(id) + L"，类型: " + std::to_wstring((BYTE)command.type) +
+                                             L"，IOA: " + std::to_wstring(command.ioa) + (command.selectBeforeOperate ? L"（选择）" : L""));
+    return id;
+}
+
+std::future<Iec104CommandResult> CIec104Master::SendCommand(const Iec104Command &command)
+{
+    auto promise = std::make_shared<std::promise<Iec104CommandResult>>();
+    std::future<Iec104CommandResult> future = promise->get_future();
+    SendCommand(command, [promise](const Iec104CommandResult &result) { promise->set_value(result); });
+    return future;
+}
+
+size_t CIec104Master::GetPendingCommands() const
+{
+    return m_commands->GetPendingCount();
+}
+
+void CIec104Master::HandleCommandResponse(const Iec104AsduHeader &header, DWORD ioa, const BYTE *element, int elementLen)
+{
+    if (m_commands->GetPendingCount() == 0)
+    {
+        return;
+    }
+
+    m_commandExecutes.clear();
+    m_commands->OnControlResponse(header.typeId, header.cot, header.commonAddr, ioa, element, elementLen, m_clock.NowUs(), m_commandDone,
+                                  m_commandExecutes);
+
+    // 选择已确认的命令发送执行
+    for (const auto &execute : m_commandExecutes)
+    {
+        BYTE element[IEC104_MAX_ASDU_LEN];
+        int elementLen = Iec104EncodeCommand(execute.command, false, element);
+        if (!SendIFrame((BYTE)execute.command.type, (BYTE)Iec104Cot::ACTIVATION, execute.command.commonAddr, execute.command.ioa, element,
+                        elementLen))
+        {
+            m_commands->Abort(execute.id, m_clock.NowUs(), m_commandDone);
+        }
+        else
+        {
+            IEC104_LOG(LOG_DEBUG, IEC104_LOG_CMD, L"选择已确认，执行命令 #" + std::to_wstring(execute.id));
+        }
+    }
+
+    DispatchCommandCompletions(m_commandDone);
+}
+
+void CIec104Master::DispatchCommandCompletions(std::vector<Iec104CommandCompletion> &done)
+{
+    static const wchar_t *STATUS_TEXT[] = { L"进行中", L"完成", L"否定确认", L"超时", L"失败" };
+
+    for (auto &completion : done)
+    {
+        const Iec104CommandResult &result = completion.result;
+        IEC104_LOG(LOG_DEBUG, IEC104_LOG_CMD, L"命令 #" + std::to_wstring(result.id) + L" " + STATUS_TEXT[(BYTE)result.status] +
+                                                 L"，类型: " + std::to_wstring((BYTE)result.command.type) +
+                                                 L"，IOA: " + std::to_wstring(result.command.ioa));
+        if (completion.callback)
+        {
+            completion.callback(result);
+        }
+    }
+    done.clear();
+}
+
+bool CIec104Master::SendApdu(const BYTE *data, int length, Iec104TxKind kind, UINT64 commandId)
+{
+    if (m_socket == INVALID_SOCKET && !m_virtualSend)
+    {
+        return false;
+    }
+
+    // 只入队，不做系统调用；由I/O线程合并发送
+    if (!m_txQueue.Push(kind, data, length, commandId))
+    {
+        IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"发送队列已满，丢弃报文");
+        return false;
+    }
+
+    WakeIoThread();
+    return true;
+}
+
+void CIec104Master::WakeIoThread()
+{
+    // I/O线程自身入队的报文在本轮处理结束时统一发出；其他线程只在首次入队时唤醒一次
+    if (GetCurrentThreadId() == m_ioThreadId.load(std::memory_order_relaxed))
+    {
+        if (m_virtualWake && !m_txWakePending.exchange(true))
+        {
+            m_virtualWake();
+        }
+        return;
+    }
+
+    if (!m_txWakePending.exchange(true))
+    {
+        WSASetEvent(m_txEvent);
+    }
+}
+
+void CIec104Master::StampTxFrame(Iec104TxFrame &frame)
+{
+    // 序号在发出前才填写，保证N(S)按发送顺序递增、N(R)为最新接收序号
+    if (frame.stamped)
+    {
+        return;
+    }
+    frame.stamped = true;
+
+    WORD recvSeq = m_recvSeqNum.load();
+    if (frame.kind == Iec104TxKind::I_FRAME)
+    {
+        WORD sendSeq = m_sendSeqNum.load();
+        frame.data[2] = (sendSeq << 1) & 0xFF;
+        frame.data[3] = (sendSeq >> 7) & 0xFF;
+        m_iSendTimesUs[sendSeq % IEC104_ACK_RING] = m_clock.NowUs();
+        m_sendSeqNum = (sendSeq + 1) % 32768;
+        if (frame.commandId != 0)
+        {
+            // 命令的发送时刻取帧离开k窗口、即将写出的时刻，往返时间不含在窗口外等待的时间
+            m_commands->OnSent(frame.commandId, m_iSendTimesUs[sendSeq % IEC104_ACK_RING]);
+        }
+        if (!m_t1AckTimer.IsArmed())
+        {
+            ArmLinkTimer(m_t1AckTimer, m_t1Ms);
+        }
+    }
+    if (frame.kind == Iec104TxKind::I_FRAME || frame.kind == Iec104TxKind::S_FRAME)
+    {
+        frame.data[4] = (recvSeq << 1) & 0xFF;
+        frame.data[5] = (recvSeq >> 7) & 0xFF;
+        // 已确认到最新接收序号
+        m_unackedRx = 0;
+        m_t2Timer.Cancel();
+    }
+}
+
+size_t CIec104Master::PeekTxFrames(Iec104TxFrame **frames, size_t &heldCount)
+{
+    // k窗口：已填写序号的帧照常发出，未填写序号的I帧只在未确认数小于k时加入本批；
+    // 窗口满时队首的I帧移到暂存，其后的S帧与U帧继续发出，暂存的I帧在确认后按序先于队列中的I帧发出
+    WORD outstanding = (m_sendSeqNum.load(std::memory_order_relaxed) - m_ackSeqNum.load(std::memory_order_relaxed)) & 0x7FFF;
+    size_t count = 0;
+    bool stalled = false;
+
+    // 队列中的队首帧只发出了一部分时先发完它，暂存的帧留到下一批
+    if (m_txOffset == 0 || m_txOffsetHeld)
+    {
+        for (size_t i = 0; i < m_txHeldCount && count < IEC104_TX_BATCH; ++i)
+        {
+            Iec104TxFrame &frame = m_txHeld[(m_txHeldHead + i) & m_txHeldMask];
+            if (!frame.stamped)
+            {
+                if (outstanding >= m_sendWindow)
+                {
+                    stalled = true;
+                    break;
+                }
+                ++outstanding;
+            }
+            frames[count++] = &frame;
+        }
+    }
+    heldCount = count;
+    bool heldWaiting = heldCount < m_txHeldCount;
+
+    while (count < IEC104_TX_BATCH)
+    {
+        Iec104TxFrame *queued[IEC104_TX_BATCH];
+        size_t available = m_txQueue.Peek(queued, IEC104_TX_BATCH - count);
+        size_t taken = 0;
+        bool windowFull = false;
+        for (; taken < available; ++taken)
+        {
+            Iec104TxFrame &frame = *queued[taken];
+            if (frame.kind == Iec104TxKind::I_FRAME && !frame.stamped)
+            {
+                if (heldWaiting || outstanding >= m_sendWindow)
+                {
+                    stalled = stalled || outstanding >= m_sendWindow;
+                    windowFull = true;
+                    break;
+                }
+                ++outstanding;
+            }
+            frames[count + taken] = &frame;
+        }
+        if (windowFull && taken == 0 && m_txHeldCount <= m_txHeldMask)
+        {
+            // 写入本批之后的空槽，本批已取的暂存帧不受影响；暂存已满时I帧留在队首，其后的帧等确认后再发
+            m_txHeld[(m_txHeldHead + m_txHeldCount) & m_txHeldMask] = *queued[0];
+            ++m_txHeldCount;
+            m_txQueue.Pop(1);
+            heldWaiting = true;
+            continue;
+        }
+        count += taken;
+        break;
+    }
+
+    // 等待确认的时长计入统计，由 AcknowledgeSent 或链路断开结束
+    if (stalled && !m_windowBlocked)
+    {
+        m_windowBlocked = true;
+        m_windowBlockedSinceUs = m_clock.NowUs();
+        m_windowStalls.fetch_add(1, std::memory_order_relaxed);
+    }
+    return count;
+}
+
+void CIec104Master::EndWindowStall()
+{
+    if (m_windowBlocked)
+    {
+        m_windowBlockedUs.fetch_add((UINT64)(std::max)((INT64)0, m_clock.NowUs() - m_windowBlockedSinceUs), std::memory_order_relaxed);
+        m_windowBlocked = false;
+    }
+}
+
+void CIec104Master::PopTxFrames(size_t count, size_t heldCount)
+{
+    size_t fromHeld = (std::min)(count, heldCount);
+    m_txHeldHead = (m_txHeldHead + fromHeld) & m_txHeldMask;
+    m_txHeldCount -= fromHeld;
+    m_txQueue.Pop(count - fromHeld);
+}
+
+bool CIec104Master::FlushTxQueue()
+{
+    if (m_virtualSend)
+    {
+        return FlushVirtualTxQueue();
+    }
+    if (m_tls.IsEstablished())
+    {
+        return FlushTlsTxQueue();
+    }
+
+    for (;;)
+    {
+        Iec104TxFrame *frames[IEC104_TX_BATCH];
+        size_t heldCount = 0;
+        size_t count = PeekTxFrames(frames, heldCount);
+        if (count == 0)
+        {
+            return true;
+        }
+
+        // 队首连续多帧组成一次分散写
+        WSABUF buffers[IEC104_TX_BATCH];
+        for (size_t i = 0; i < count; ++i)
+        {
+            StampTxFrame(*frames[i]);
+            DWORD offset = (i == 0) ? m_txOffset : 0;
+            buffers[i].buf = (char *)frames[i]->data + offset;
+            buffers[i].len = frames[i]->length - offset;
+        }
+
+        DWORD sent = 0;
+        int rc = WSASend(m_socket, buffers, (DWORD)count, &sent, 0, nullptr, nullptr);
+        m_txSyscalls++;
+        if (rc == SOCKET_ERROR)
+        {
+            if (WSAGetLastError() == WSAEWOULDBLOCK)
+            {
+                // 发送缓冲区满，等待FD_WRITE
+                m_txBlocked = true;
+                return true;
+            }
+            IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"发送数据失败: " + GetLastErrorString());
+            return false;
+        }
+
+        // 统计完整发出的帧，剩余部分记录偏移留待下次发送
+        DWORD remaining = sent + m_txOffset;
+        size_t done = 0;
+        while (done < count && remaining >= frames[done]->length)
+        {
+            remaining -= frames[done]->length;
+            OnFrameSent(*frames[done]);
+            ++done;
+        }
+        m_txOffset = remaining;
+        m_txOffsetHeld = done < heldCount;
+        PopTxFrames(done, heldCount);
+
+        if (done < count)
+        {
+            m_txBlocked = true;
+            return true;
+        }
+    }
+}
+
+bool CIec104Master::FlushTlsTxQueue()
+{
+    for (;;)
+    {
+        // 先发出已加密的数据（含握手尾部与 close_notify）
+        while (m_tlsTxSent < m_tlsTx.size())
+        {
+            int sent = send(m_socket, (const char *)m_tlsTx.data() + m_tlsTxSent, (int)(m_tlsTx.size() - m_tlsTxSent), 0);
+            m_txSyscalls++;
+            if (sent == SOCKET_ERROR)
+            {
+                if (WSAGetLastError() == WSAEWOULDBLOCK)
+                {
+                    m_txBlocked = true;
+                    return true;
+                }
+                IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"发送数据失败: " + GetLastErrorString());
+                return false;
+            }
+            m_tlsTxSent += sent;
+        }
+        m_tlsTx.clear();
+        m_tlsTxSent = 0;
+
+        Iec104TxFrame *frames[IEC104_TX_BATCH];
+        size_t heldCount = 0;
+        size_t count = PeekTxFrames(frames, heldCount);
+        if (count == 0)
+        {
+            return true;
+        }
+
+        // 队首连续多帧合并为一个TLS记录（最多 32×255 字节，小于16KB的记录上限），摊薄记录头与MAC开销
+        m_tlsTxPlain.clear();
+        for (size_t i = 0; i < count; ++i)
+        {
+            StampTxFrame(*frames[i]);
+            m_tlsTxPlain.insert(m_tlsTxPlain.end(), frames[i]->data, frames[i]->data + frames[i]->length);
+        }
+        if (!m_tls.Encrypt(m_tlsTxPlain.data(), m_tlsTxPlain.size(), m_tlsTx))
+        {
+            IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, m_tls.GetErrorText());
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            OnFrameSent(*frames[i]);
+        }
+        PopTxFrames(count, heldCount);
+    }
+}
+
+bool CIec104Master::FlushVirtualTxQueue()
+{
+    for (;;)
+    {
+        Iec104TxFrame *frames[IEC104_TX_BATCH];
+        size_t heldCount = 0;
+        size_t count = PeekTxFrames(frames, heldCount);
+        if (count == 0)
+        {
+            return true;
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            StampTxFrame(*frames[i]);
+            m_virtualSend(frames[i]->data, frames[i]->length);
+            OnFrameSent(*frames[i]);
+        }
+        m_txSyscalls++;
+        PopTxFrames(count, heldCount);
+    }
+}
+
+void CIec104Master::OnFrameSent(const Iec104TxFrame &frame)
+{
+    // 记录发送的报文（二进制写入报文环，读取时才格式化）
+    if (m_frameRecording)
+    {
+        m_frameRing.Record(Iec104FrameDir::TX, frame.data, frame.length);
+    }
+    if (m_capture.IsOpen())
+    {
+        m_capture.Write(Iec104FrameDir::TX, frame.data, frame.length, Iec104UtcNowUs());
+    }
+    m_sentFrames++;
+}
+
+bool CIec104Master::SendIFrame(BYTE typeId, BYTE cot, WORD commonAddr, DWORD ioa, const BYTE *element, int elementLen, UINT64 commandId)
+{
+    if (!IsConnected())
+    {
+        return false;
+    }
+
+    const Iec104CodecOps &codec = *m_codec;
+    int totalLen = 6 + codec.headerLen + codec.ioaLen + elementLen; // APCI(6) + ASDU头 + IOA + 信息元素
+    if (totalLen > IEC104_MAX_APDU_LEN || elementLen < 0)
+    {
+        return false;
+    }
+
+    BYTE frame[IEC104_MAX_APDU_LEN];
+
+    // APCI
+    frame[0] = IEC104_START_BYTE;
+    frame[1] = totalLen - 2; // 除去起始字节和长度字节
+
+    // I帧控制域（N(S)/N(R)由I/O线程发送时填写）
+    frame[2] = 0x00;
+    frame[3] = 0x00;
+    frame[4] = 0x00;
+    frame[5] = 0x00;
+
+    // ASDU：单个信息对象，源发站地址为0
+    Iec104AsduHeader header;
+    header.typeId = typeId;
+    header.vsq = 0x01;
+    header.cot = cot;
+    header.commonAddr = commonAddr;
+    codec.putHeader(&frame[6], header);
+    codec.putIoa(&frame[6 + codec.headerLen], ioa);
+
+    // 信息元素
+    if (element && elementLen > 0)
+    {
+        memcpy(&frame[6 + codec.headerLen + codec.ioaLen], element, elementLen);
+    }
+
+    return SendApdu(frame, totalLen, Iec104TxKind::I_FRAME, commandId);
+}
+
+bool CIec104Master::SendUFrame(Iec104UFunction function)
+{
+    BYTE frame[6];
+    frame[0] = IEC104_START_BYTE;
+    frame[1] = 4; // 长度
+    frame[2] = (BYTE)function;
+    frame[3] = 0x00;
+    frame[4] = 0x00;
+    frame[5] = 0x00;
+
+    return SendApdu(frame, sizeof(frame), Iec104TxKind::U_FRAME);
+}
+
+void CIec104Master::ReceiveThreadProc()
+{
+    m_ioThreadId = GetCurrentThreadId();
+
+    if (!EstablishConnection())
+    {
+        m_ioThreadId = 0;
+        ChangeState(Iec104State::DISCONNECTED);
+        return;
+    }
+
+    // TCP是字节流，一次recv可能包含多个APDU或半个APDU，按长度字节切分
+    BYTE buffer[4096];
+    int buffered = 0;
+    WSAEVENT events[2] = { m_netEvent, m_txEvent };
+    bool linkUp = true;
+
+    // 链路定时器从连接建立时起算
+    m_timers.Reset(m_clock.NowMs());
+    m_linkTimedOut = false;
+    m_unackedRx = 0;
+    ArmLinkTimers();
+    DWORD waitMs = IEC104_IO_WAIT_MS;
+
+    while (linkUp && !m_stopReceive && IsConnected())
+    {
+        DWORD wait = WSAWaitForMultipleEvents(2, events, FALSE, waitMs, FALSE);
+        if (wait == WSA_WAIT_FAILED)
+        {
+            IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"等待网络事件失败: " + GetLastErrorString());
+            break;
+        }
+
+        if (wait == WSA_WAIT_EVENT_0)
+        {
+            WSANETWORKEVENTS netEvents = {};
+            if (WSAEnumNetworkEvents(m_socket, m_netEvent, &netEvents) == SOCKET_ERROR)
+            {
+                IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"获取网络事件失败: " + GetLastErrorString());
+                break;
+            }
+
+            if (netEvents.lNetworkEvents & (FD_READ | FD_CLOSE))
+            {
+                linkUp = ReadAvailable(buffer, sizeof(buffer), buffered);
+            }
+            if (m_seqResetPending)
+            {
+                // 序号错误：按规约关闭连接，由上层（对话框/冗余组）重新建立
+                m_seqLinkResets.fetch_add(1, std::memory_order_relaxed);
+                linkUp = false;
+            }
+            if (netEvents.lNetworkEvents & FD_WRITE)
+            {
+                m_txBlocked = false;
+            }
+            if (netEvents.lNetworkEvents & FD_CLOSE)
+            {
+                IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"连接被远程关闭");
+                linkUp = false;
+            }
+        }
+
+        linkUp = ServiceLink(linkUp);
+
+        // 等到最近的定时器到期；命令超时仍按 IEC104_IO_WAIT_MS 检查
+        waitMs = m_timers.GetNextTimeoutMs(IEC104_IO_WAIT_MS);
+    }
+
+    // 主动断开时尽量发出剩余报文（如STOPDT_ACT），TLS连接随后发送 close_notify
+    if (linkUp && !m_txBlocked)
+    {
+        FlushTxQueue();
+        if (m_tls.IsEstablished() && !m_txBlocked)
+        {
+            m_tls.Shutdown(m_tlsTx);
+            FlushTlsTxQueue();
+        }
+    }
+
+    FinishLink(linkUp);
+}
+
+bool CIec104Master::ServiceLink(bool linkUp)
+{
+    // 命令超时
+    if (m_commands->GetPendingCount() > 0)
+    {
+        m_commands->Expire(m_clock.NowUs(), m_commandDone);
+        DispatchCommandCompletions(m_commandDone);
+    }
+
+    // t1/t2/t3 到期处理：测试帧与确认帧在下面随发送队列一起发出
+    if (linkUp)
+    {
+        m_timers.Advance(m_clock.NowMs());
+        linkUp = !m_linkTimedOut;
+    }
+
+    // 发出接收处理中产生的确认帧以及其他线程入队的报文
+    m_txWakePending = false;
+    if (m_txEvent != WSA_INVALID_EVENT)
+    {
+        WSAResetEvent(m_txEvent);
+    }
+    if (linkUp && !m_txBlocked && !FlushTxQueue())
+    {
+        linkUp = false;
+    }
+    return linkUp;
+}
+
+void CIec104Master::FinishLink(bool linkUp)
+{
+    EndWindowStall();
+    m_ioThreadId = 0;
+    m_timers.Reset(0);
+    if (!linkUp)
+    {
+        ChangeState(Iec104State::DISCONNECTED);
+        m_commands->FailAll(m_clock.NowUs(), m_commandDone);
+        DispatchCommandCompletions(m_commandDone);
+    }
+}
+
+bool CIec104Master::ConnectVirtual(std::function<void(const BYTE *data, int length)> send, std::function<void()> wake)
+{
+    if (m_receiveThread.joinable() || m_socket != INVALID_SOCKET || m_virtualSend)
+    {
+        return false;
+    }
+
+    // 与 ConnectAsync + EstablishConnection 相同的初始状态，调用线程兼作I/O线程
+    ResetLinkState();
+    m_virtualSend = std::move(send);
+    m_virtualWake = std::move(wake);
+    m_virtualRxBuffered = 0;
+    m_txWakePending = false;
+    m_ioThreadId = GetCurrentThreadId();
+    m_lastRxUs = m_clock.NowUs();
+    ChangeState(Iec104State::CONNECTED);
+
+    m_timers.Reset(m_clock.NowMs());
+    m_linkTimedOut = false;
+    m_unackedRx = 0;
+    ArmLinkTimers();
+    return true;
+}
+
+void CIec104Master::ReceiveVirtual(const BYTE *data, int length)
+{
+    // 与 ReadAvailable 的明文路径相同：任何接收都清除未确认的测试帧
+    m_lastRxUs = m_clock.NowUs();
+    m_testSentUs = 0;
+    m_t1TestTimer.Cancel();
+
+    INT64 rxTimeUs = Iec104UtcNowUs();
+    while (length > 0)
+    {
+        int chunk = (std::min)(length, (int)sizeof(m_virtualRx) - m_virtualRxBuffered);
+        memcpy(m_virtualRx + m_virtualRxBuffered, data, chunk);
+        m_virtualRxBuffered += chunk;
+        data += chunk;
+        length -= chunk;
+        SplitFrames(m_virtualRx, m_virtualRxBuffered, rxTimeUs);
+    }
+}
+
+bool CIec104Master::ServiceVirtualLink()
+{
+    if (!m_virtualSend)
+    {
+        return false;
+    }
+
+    bool linkUp = true;
+    if (m_seqResetPending)
+    {
+        m_seqLinkResets.fetch_add(1, std::memory_order_relaxed);
+        linkUp = false;
+    }
+    linkUp = ServiceLink(linkUp);
+    if (!linkUp)
+    {
+        m_virtualSend = nullptr;
+        m_virtualWake = nullptr;
+        FinishLink(false);
+    }
+    return linkUp;
+}
+
+void CIec104Master::ArmLinkTimers()
+{
+    // 连接建立时只有空闲定时器，其余在发送I帧、测试帧或收到I帧时设置
+    ArmLinkTimer(m_t3Timer, m_t3Ms);
+}
+
+void CIec104Master::ArmLinkTimer(CWheelTimer& timer, UINT64 delayMs)
+{
+    // 接收处理在 ServiceLink 推进时间轮之前进行，时间轮的当前时刻可能落后一个等待周期，
+    // 到期时刻按单调时钟的当前值计算，避免接收中设置的 t1/t2/t3 提前到期
+    m_timers.ArmAt(timer, m_clock.NowMs() + delayMs);
+}
+
+void CIec104Master::OnAckTimeout()
+{
+    // 最早未确认的I帧 t1 内未被确认；期间已有确认时按新的最早帧的剩余时间重新设置
+    WORD ackSeq = m_ackSeqNum.load(std::memory_order_relaxed);
+    if (m_sendSeqNum.load(std::memory_order_relaxed) == ackSeq)
     {
-        LogEvent(L"数据传输未启动，无法读取时钟");
-        return false;
+        return;
     }
-
-    // 构建时钟读取命令数据
-    BYTE data[IEC104_IOA_LEN]; // IOA=0 (3字节)
-    memset(data, 0, IEC104_IOA_LEN);
-
-    bool result = SendIFrame((BYTE)Iec104TypeId::C_CS_NA_1, 0x05, commonAddr, data, sizeof(data));
-    if (result)
+    INT64 elapsedMs = (m_clock.NowUs() - m_iSendTimesUs[ackSeq % IEC104_ACK_RING]) / 1000;
+    if (elapsedMs < (INT64)m_t1Ms)
     {
-        LogEvent(L"发送时钟读取命令");
+        ArmLinkTimer(m_t1AckTimer, m_t1Ms - elapsedMs);
+        return;
     }
 
-    return result;
+    IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"I帧确认超时(t1)，发送序号 " + std::to_wstring(ackSeq) + L"，链路断开");
+    m_seqAckTimeouts.fetch_add(1, std::memory_order_relaxed);
+    m_seqLinkResets.fetch_add(1, std::memory_order_relaxed);
+    m_linkTimedOut = true;
 }
 
-bool CIec104Master::SyncClock(const SYSTEMTIME &time, WORD commonAddr)
+void CIec104Master::OnTestTimeout()
 {
-    if (!IsStarted())
+    // 测试帧发出后收到任何报文都会清除 m_testSentUs 并取消本定时器
+    if (m_testSentUs != 0)
     {
-        LogEvent(L"数据传输未启动，无法同步时钟");
-        return false;
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"测试帧确认超时(t1)，链路断开");
+        m_linkTimedOut = true;
     }
+}
 
-    // 构建时钟同步数据
-    BYTE data[IEC104_IOA_LEN + sizeof(Iec104CP56Time)]; // IOA + CP56Time2a
-    memset(data, 0, IEC104_IOA_LEN);                    // IOA=0 (3字节)
-
-    // CP56Time2a时间格式
-    Iec104CP56Time cp56Time = SystemTimeToCP56(time);
-    memcpy(&data[IEC104_IOA_LEN], &cp56Time, sizeof(cp56Time));
-
-    bool result = SendIFrame((BYTE)Iec104TypeId::C_CS_NA_1, 0x06, commonAddr, data, sizeof(data));
-    if (result)
+void CIec104Master::OnRecvAckTimeout()
+{
+    // t2 内没有可以捎带确认的I帧，单独发送S帧
+    if (m_unackedRx > 0)
     {
-        LogEvent(L"发送时钟同步命令");
+        m_unackedRx = 0;
+        SendSFrame();
     }
-
-    return result;
 }
 
-bool CIec104Master::SendApdu(const BYTE *data, int length)
+void CIec104Master::OnIdleTimeout()
 {
-    if (m_socket == INVALID_SOCKET)
+    // 接收时不重设定时器，到期时按最后接收时刻计算实际空闲时间
+    INT64 idleMs = (m_clock.NowUs() - m_lastRxUs) / 1000;
+    if (idleMs < (INT64)m_t3Ms)
     {
-        return false;
+        ArmLinkTimer(m_t3Timer, m_t3Ms - idleMs);
+        return;
     }
 
-    std::lock_guard<std::mutex> lock(m_socketMutex);
-    int sent = send(m_socket, (const char *)data, length, 0);
-
-    if (sent == length)
+    if (m_testSentUs == 0)
     {
-
-        // 记录发送的报文
-        std::wstring hexData = BytesToHexString(data, length);
-        LogEvent(L"发送报文: " + hexData);
-        m_sentFrames++;
-        return true;
+        IEC104_LOG(LOG_DEBUG, IEC104_LOG_LINK, L"链路空闲(t3)，发送TESTFR_ACT");
+        SendUFrame(Iec104UFunction::TESTFR_ACT);
+        m_testSentUs = m_clock.NowUs();
+        ArmLinkTimer(m_t1TestTimer, m_t1Ms);
     }
-
-    LogEvent(L"发送数据失败: " + GetLastErrorString());
-    return false;
+    ArmLinkTimer(m_t3Timer, m_t3Ms);
 }
 
-bool CIec104Master::SendIFrame(BYTE typeId, BYTE cot, WORD commonAddr, const BYTE *data, int dataLen)
+void CIec104Master::ChangeState(Iec104State state)
 {
-    if (!IsConnected())
+    if (m_state.exchange(state) == state)
     {
-        return false;
+        return;
     }
 
-    int totalLen = 6 + 6 + dataLen; // APCI(6) + ASDU头(6) + 数据
-    std::vector<BYTE> frame(totalLen);
-
-    // APCI
-    frame[0] = IEC104_START_BYTE;
-    frame[1] = totalLen - 2; // 除去起始字节和长度字节
-
-    // I帧控制域
-    WORD sendSeq = m_sendSeqNum.load();
-    WORD recvSeq = m_recvSeqNum.load();
-
-    frame[2] = (sendSeq << 1) & 0xFF;
-    frame[3] = (sendSeq >> 7) & 0xFF;
-    frame[4] = (recvSeq << 1) & 0xFF;
-    frame[5] = (recvSeq >> 7) & 0xFF;
-
-    // ASDU
-    frame[6] = typeId;
-    frame[7] = 0x01; // VSQ: 单个信息对象
-    frame[8] = cot;
-    frame[9] = 0x00; // COT高字节
-    frame[10] = commonAddr & 0xFF;
-    frame[11] = (commonAddr >> 8) & 0xFF;
-
-    // 数据
-    if (data && dataLen > 0)
+    // 空的加锁保证 Connect 中的等待不会错过通知
     {
-        memcpy(&frame[12], data, dataLen);
+        std::lock_guard<std::mutex> lock(m_stateMutex);
     }
+    m_stateChanged.notify_all();
 
-    bool result = SendApdu(frame.data(), totalLen);
-    if (result)
+    if (m_stateCallback)
     {
-        m_sendSeqNum = (sendSeq + 1) % 32768;
+        m_stateCallback(state);
     }
-
-    return result;
-}
-
-bool CIec104Master::SendUFrame(Iec104UFunction function)
-{
-    BYTE frame[6];
-    frame[0] = IEC104_START_BYTE;
-    frame[1] = 4; // 长度
-    frame[2] = (BYTE)function;
-    frame[3] = 0x00;
-    frame[4] = 0x00;
-    frame[5] = 0x00;
-
-    return SendApdu(frame, sizeof(frame));
 }
 
-void CIec104Master::ReceiveThreadProc()
+bool CIec104Master::ReadAvailable(BYTE *buffer, int capacity, int &buffered)
 {
-    BYTE buffer[1024];
-
-    while (!m_stopReceive && IsConnected())
+    // 非阻塞读取，直到内核缓冲区读空；TLS连接先读入密文缓冲，解密后再切分
+    BYTE cipher[4096];
+    bool tls = m_tls.IsEstablished();
+    for (;;)
     {
-        SOCKET currentSocket = INVALID_SOCKET;
-
-        // 获取当前socket（短时间持锁）
+        char *target = tls ? (char *)cipher : (char *)buffer + buffered;
+        int room = tls ? (int)sizeof(cipher) : capacity - buffered;
+        int received = recv(m_socket, target, room, 0);
+        if (received == 0)
+        {
+            return false;
+        }
+        if (received < 0)
         {
-            std::lock_guard<std::mutex> lock(m_socketMutex);
-            currentSocket = m_socket;
+            if (WSAGetLastError() == WSAEWOULDBLOCK)
+            {
+                return true;
+            }
+            IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"接收数据错误: " + GetLastErrorString());
+            return false;
         }
 
-        if (currentSocket == INVALID_SOCKET)
-            break;
+        INT64 rxTimeUs = Iec104UtcNowUs();
+        m_lastRxUs = m_clock.NowUs();
+        m_testSentUs = 0;
+        m_t1TestTimer.Cancel();
 
-        int received = recv(currentSocket, (char *)buffer, sizeof(buffer), 0);
+        if (!tls)
+        {
+            buffered += received;
+            SplitFrames(buffer, buffered, rxTimeUs);
+            continue;
+        }
 
-        if (received > 0)
+        m_tlsRxPlain.clear();
+        Iec104TlsStatus status = m_tls.Decrypt(cipher, received, m_tlsRxPlain);
+        size_t offset = 0;
+        while (offset < m_tlsRxPlain.size())
         {
-            m_receivedFrames++;
-            ProcessReceivedData(buffer, received);
+            // 切分后缓冲区只剩不足一帧的数据，总有空间
+            int chunk = (int)(std::min)((size_t)(capacity - buffered), m_tlsRxPlain.size() - offset);
+            memcpy(buffer + buffered, m_tlsRxPlain.data() + offset, chunk);
+            buffered += chunk;
+            offset += chunk;
+            SplitFrames(buffer, buffered, rxTimeUs);
         }
-        else if (received == 0)
+
+        if (status == Iec104TlsStatus::CLOSED)
         {
-            LogEvent(L"连接被远程关闭");
-            break;
+            IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"对端关闭TLS会话");
+            return false;
         }
-        else
+        if (status != Iec104TlsStatus::OK)
         {
-            int error = WSAGetLastError();
-            if (error != WSAETIMEDOUT)
-            {
-                LogEvent(L"接收数据错误: " + GetLastErrorString());
-                break;
-            }
+            IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, m_tls.GetErrorText());
+            return false;
+        }
+    }
+}
+
+void CIec104Master::SplitFrames(BYTE *buffer, int &buffered, INT64 rxTimeUs)
+{
+    int pos = 0;
+    while (buffered - pos >= 2)
+    {
+        if (buffer[pos] != IEC104_START_BYTE)
+        {
+            // 失步：丢弃到下一个启动字符
+            IEC104_LOG(LOG_WARNING, IEC104_LOG_FRAME, L"接收数据失步，丢弃字节: " + std::to_wstring(buffer[pos]));
+            ++pos;
+            continue;
+        }
+
+        int apduLen = buffer[pos + 1] + 2;
+        if (buffered - pos < apduLen)
+            break;
+
+        if (m_capture.IsOpen())
+        {
+            m_capture.Write(Iec104FrameDir::RX, &buffer[pos], apduLen, rxTimeUs);
         }
+        m_receivedFrames++;
+        ProcessReceivedData(&buffer[pos], apduLen);
+        pos += apduLen;
+    }
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    // 剩余的半个APDU移到缓冲区开头
+    if (pos > 0)
+    {
+        memmove(buffer, buffer + pos, buffered - pos);
+        buffered -= pos;
     }
 }
 
@@ -446,45 +1598,58 @@ bool CIec104Master::ProcessReceivedData(const BYTE *buffer, int length)
         result = ProcessUFrame(buffer, length);
     }
 
-    // 记录接收的报文
-    std::wstring hexData = BytesToHexString(buffer, length);
-    LogEvent(L"接收报文: " + hexData);
+    // 记录接收的报文（二进制写入报文环，读取时才格式化）
+    if (m_frameRecording)
+    {
+        m_frameRing.Record(Iec104FrameDir::RX, buffer, length);
+    }
 
     return result;
 }
 
 bool CIec104Master::ProcessIFrame(const BYTE *buffer, int length)
 {
-    if (length < 12) // I帧最小长度
+    if (length < 6 + m_codec->headerLen) // I帧最小长度：APCI + ASDU头
+    {
+        return false;
+    }
+
+    // 已判定序号错误，等待断开，后续报文不再处理
+    if (m_seqResetPending)
     {
         return false;
     }
 
-    // 提取序号
+    // 提取序号：N(S) 必须连续，N(R) 为捎带确认
     WORD sendSeq = ((WORD)buffer[3] << 7) | (buffer[2] >> 1);
     WORD recvSeq = ((WORD)buffer[5] << 7) | (buffer[4] >> 1);
+    if (!CheckReceiveSeq(sendSeq) || !AcknowledgeSent(recvSeq))
+    {
+        return false;
+    }
 
-    // 更新接收序号
-    m_recvSeqNum = (m_recvSeqNum.load() + 1) % 32768;
-
-    // 解析ASDU
-    BYTE typeId = buffer[6];
-    BYTE cot = buffer[8];
-    WORD commonAddr = ((WORD)buffer[11] << 8) | buffer[10];
+    m_recvSeqNum = (sendSeq + 1) % 32768;
+    m_seqIFrames.fetch_add(1, std::memory_order_relaxed);
 
-    LogEvent(L"收到I帧，类型: " + std::to_wstring(typeId) +
-             L", 原因: " + std::to_wstring(cot) +
-             L", 地址: " + std::to_wstring(commonAddr));
+    // 解析ASDU（按链路参数实例化的解码）
+    (this->*m_processAsdu)(&buffer[6], length - 6);
 
-    // 解析数据
-    if (length > 12)
+    // 接收确认：累计 w 个I帧立即确认，否则最迟 t2 后确认（回放时没有链路，不确认）
+    if (IsConnected())
     {
-        ParseAsduData(typeId, cot, &buffer[12], length - 12);
+        if (++m_unackedRx >= m_ackWindow)
+        {
+            // S帧的 N(R) 在发出时填写，同一批后续I帧一并被确认
+            m_unackedRx = 0;
+            m_t2Timer.Cancel();
+            SendSFrame();
+        }
+        else if (!m_t2Timer.IsArmed())
+        {
+            ArmLinkTimer(m_t2Timer, m_t2Ms);
+        }
     }
 
-    // 发送确认帧
-    SendSFrame();
-
     return true;
 }
 
@@ -500,26 +1665,26 @@ bool CIec104Master::ProcessUFrame(const BYTE *buffer, int length)
     switch (function)
     {
     case Iec104UFunction::STARTDT_CON:
-        LogEvent(L"收到STARTDT_CON，数据传输已启动");
-        m_state = Iec104State::STARTED;
+        IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"收到STARTDT_CON，数据传输已启动");
+        ChangeState(Iec104State::STARTED);
         break;
 
     case Iec104UFunction::STOPDT_CON:
-        LogEvent(L"收到STOPDT_CON");
-        m_state = Iec104State::CONNECTED;
+        IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"收到STOPDT_CON");
+        ChangeState(Iec104State::CONNECTED);
         break;
 
     case Iec104UFunction::TESTFR_CON:
-        LogEvent(L"收到TESTFR_CON");
+        IEC104_LOG(LOG_DEBUG, IEC104_LOG_LINK, L"收到TESTFR_CON");
         break;
 
     case Iec104UFunction::TESTFR_ACT:
-        LogEvent(L"收到TESTFR_ACT，回复TESTFR_CON");
+        IEC104_LOG(LOG_DEBUG, IEC104_LOG_LINK, L"收到TESTFR_ACT，回复TESTFR_CON");
         SendUFrame(Iec104UFunction::TESTFR_CON);
         break;
 
     default:
-        LogEvent(L"收到未知U帧: " + std::to_wstring((BYTE)function));
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"收到未知U帧: " + std::to_wstring((BYTE)function));
         break;
     }
 
@@ -534,72 +1699,396 @@ bool CIec104Master::ProcessSFrame(const BYTE *buffer, int length)
     }
 
     WORD recvSeq = ((WORD)buffer[5] << 7) | (buffer[4] >> 1);
-    LogEvent(L"收到S帧，接收序号: " + std::to_wstring(recvSeq));
+    IEC104_LOG(LOG_DEBUG, IEC104_LOG_FRAME, L"收到S帧，接收序号: " + std::to_wstring(recvSeq));
+
+    return AcknowledgeSent(recvSeq);
+}
+
+bool CIec104Master::CheckReceiveSeq(WORD sendSeq)
+{
+    // 回放的抓包可能从会话中途开始，以首个I帧同步
+    if (!m_rxSeqSynced)
+    {
+        m_recvSeqNum = sendSeq;
+        m_rxSeqSynced = true;
+    }
+
+    WORD expected = m_recvSeqNum.load();
+    if (sendSeq == expected)
+    {
+        return true;
+    }
+
+    // 落后期望值半个序号空间以内视为重复，否则为缺口
+    bool duplicate = ((expected - sendSeq) & 0x7FFF) < 16384;
+    (duplicate ? m_seqDuplicates : m_seqGaps).fetch_add(1, std::memory_order_relaxed);
+    IEC104_LOG(LOG_WARNING, IEC104_LOG_FRAME, std::wstring(duplicate ? L"收到重复I帧" : L"I帧序号缺口") + L"，期望 " + std::to_wstring(expected) +
+                                                 L"，收到 " + std::to_wstring(sendSeq));
+
+    if (m_replayTimeUs != 0)
+    {
+        // 回放没有链路可复位：重新同步后继续解析
+        m_recvSeqNum = sendSeq;
+        return true;
+    }
+    m_seqResetPending = true;
+    return false;
+}
+
+bool CIec104Master::AcknowledgeSent(WORD ackSeq)
+{
+    // 回放时确认序号对应的是抓包中主站的发送，与本对象无关
+    if (m_replayTimeUs != 0)
+    {
+        return true;
+    }
+
+    // 确认序号必须落在 [已确认, 已发送] 区间内
+    WORD acked = m_ackSeqNum.load(std::memory_order_relaxed);
+    WORD outstanding = (m_sendSeqNum.load(std::memory_order_relaxed) - acked) & 0x7FFF;
+    WORD count = (ackSeq - acked) & 0x7FFF;
+    if (count > outstanding)
+    {
+        m_seqInvalidAcks.fetch_add(1, std::memory_order_relaxed);
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_FRAME, L"收到非法确认序号 " + std::to_wstring(ackSeq) + L"，已确认 " + std::to_wstring(acked) + L"，未确认 " +
+                                                     std::to_wstring(outstanding));
+        m_seqResetPending = true;
+        return false;
+    }
+    if (count == 0)
+    {
+        return true;
+    }
 
+    // 确认时延：未确认的I帧不超过k，记录环中的发送时刻都未被覆盖
+    INT64 nowUs = m_clock.NowUs();
+    UINT64 totalUs = 0;
+    UINT64 maxUs = m_ackLagMaxUs.load(std::memory_order_relaxed);
+    for (WORD seq = acked; seq != ackSeq; seq = (seq + 1) & 0x7FFF)
+    {
+        UINT64 lagUs = (UINT64)(std::max)((INT64)0, nowUs - m_iSendTimesUs[seq % IEC104_ACK_RING]);
+        totalUs += lagUs;
+        maxUs = (std::max)(maxUs, lagUs);
+    }
+    m_ackLagTotalUs.fetch_add(totalUs, std::memory_order_relaxed);
+    m_ackLagMaxUs.store(maxUs, std::memory_order_relaxed);
+    m_ackedFrames.fetch_add(count, std::memory_order_relaxed);
+    m_ackSeqNum.store(ackSeq, std::memory_order_relaxed);
+
+    // 确认释放已发出的I帧、腾出k窗口：暂存的I帧在本轮接收处理结束时随发送队列发出（虚拟链路由唤醒回调安排）
+    EndWindowStall();
+    if (m_txHeldCount > 0)
+    {
+        WakeIoThread();
+    }
+    return true;
+}
+
+Iec104SequenceStats CIec104Master::GetSequenceStats() const
+{
+    Iec104SequenceStats stats;
+    stats.iFramesReceived = m_seqIFrames.load(std::memory_order_relaxed);
+    stats.gaps = m_seqGaps.load(std::memory_order_relaxed);
+    stats.duplicates = m_seqDuplicates.load(std::memory_order_relaxed);
+    stats.invalidAcks = m_seqInvalidAcks.load(std::memory_order_relaxed);
+    stats.ackTimeouts = m_seqAckTimeouts.load(std::memory_order_relaxed);
+    stats.linkResets = m_seqLinkResets.load(std::memory_order_relaxed);
+    stats.ackedFrames = m_ackedFrames.load(std::memory_order_relaxed);
+    stats.ackLagAvgUs = stats.ackedFrames ? m_ackLagTotalUs.load(std::memory_order_relaxed) / stats.ackedFrames : 0;
+    stats.ackLagMaxUs = m_ackLagMaxUs.load(std::memory_order_relaxed);
+    stats.windowStalls = m_windowStalls.load(std::memory_order_relaxed);
+    stats.windowBlockedUs = m_windowBlockedUs.load(std::memory_order_relaxed);
+    stats.unacked = (m_sendSeqNum.load(std::memory_order_relaxed) - m_ackSeqNum.load(std::memory_order_relaxed)) & 0x7FFF;
+    return stats;
+}
+
+bool CIec104Master::SetLinkProfile(const Iec104LinkProfile &profile)
+{
+    if (!profile.IsValid() || m_receiveThread.joinable())
+    {
+        return false;
+    }
+
+    m_codec = &Iec104GetCodec(profile);
+    m_processAsdu = Iec104DispatchProfile(profile, [](auto codec) { return &CIec104Master::ProcessAsdu<decltype(codec)>; });
     return true;
 }
 
-void CIec104Master::ParseAsduData(BYTE typeId, BYTE cot, const BYTE *data, int dataLen)
+template <class Codec>
+void CIec104Master::ProcessAsdu(const BYTE *asdu, int length)
 {
+    Iec104AsduHeader header;
+    Codec::GetHeader(asdu, header);
+    BYTE typeId = header.typeId;
+    BYTE cot = header.cot;
+
+    IEC104_LOG(LOG_DEBUG, IEC104_LOG_FRAME, L"收到I帧，类型: " + std::to_wstring(typeId) +
+             L", 原因: " + std::to_wstring(cot) +
+             L", 地址: " + std::to_wstring(header.commonAddr));
+
+    if (length <= Codec::HEADER_LEN)
+    {
+        return;
+    }
+    const BYTE *data = asdu + Codec::HEADER_LEN;
+    int dataLen = length - Codec::HEADER_LEN;
+
+    // 控制方向应答与已发送的命令关联
+    bool control = (typeId >= (BYTE)Iec104TypeId::C_SC_NA_1 && typeId <= (BYTE)Iec104TypeId::C_SE_NC_1) ||
+                   (typeId >= (BYTE)Iec104TypeId::C_IC_NA_1 && typeId <= (BYTE)Iec104TypeId::C_CD_NA_1);
+    if (control)
+    {
+        if (dataLen < Codec::IOA_LEN)
+        {
+            return;
+        }
+        HandleCommandResponse(header, Codec::GetIoa(data), data + Codec::IOA_LEN, dataLen - Codec::IOA_LEN);
+    }
+
     switch ((Iec104TypeId)typeId)
     {
     case Iec104TypeId::C_CS_NA_1:
         if (cot == 0x07) // 激活确认
         {
-            ParseClockData(L"时钟同步:", data, dataLen);
+            ParseClockData(L"时钟同步:", data + Codec::IOA_LEN, dataLen - Codec::IOA_LEN);
         }
         else if (cot == 0x05)
         {
-            ParseClockData(L"时钟读取:", data, dataLen);
+            ParseClockData(L"时钟读取:", data + Codec::IOA_LEN, dataLen - Codec::IOA_LEN);
         }
         break;
 
     case Iec104TypeId::C_IC_NA_1:
         if (cot == 0x07) // 激活确认
         {
-            LogEvent(L"总召激活确认");
+            IEC104_LOG(LOG_INFO, IEC104_LOG_CMD, L"总召激活确认");
         }
         else if (cot == 0x0A) // 激活终止
         {
-            LogEvent(L"总召激活终止");
+            IEC104_LOG(LOG_INFO, IEC104_LOG_CMD, L"总召激活终止，点库点数: " + std::to_wstring(m_pointDb->GetPointCount()));
         }
         break;
 
     default:
-        // 处理其他数据类型
-        LogEvent(L"收到数据，类型: " + std::to_wstring(typeId));
+        // 监视方向数据写入点库，其他类型仅记录
+        if (!ParseMonitorData<Codec>(header, data, dataLen))
+        {
+            IEC104_LOG(LOG_DEBUG, IEC104_LOG_DATA, L"收到数据，类型: " + std::to_wstring(typeId));
+        }
         break;
     }
 }
 
-void CIec104Master::ParseClockData(const std::wstring &logPrefix, const BYTE *data, int dataLen)
+template <class Codec>
+bool CIec104Master::ParseMonitorData(const Iec104AsduHeader &header, const BYTE *data, int dataLen)
+{
+    BYTE typeId = header.typeId;
+    BYTE vsq = header.vsq;
+    BYTE cot = header.cot;
+    WORD commonAddr = header.commonAddr;
+    int elemLen = 0;
+    bool hasTime = false;
+    if (!Iec104GetMonitorLayout(typeId, elemLen, hasTime))
+    {
+        return false;
+    }
+
+    int objLen = elemLen + (hasTime ? (int)sizeof(Iec104CP56Time) : 0);
+    int count = vsq & 0x7F;
+    bool sequence = (vsq & 0x80) != 0; // SQ=1：仅第一个信息对象带IOA，后续地址依次加1
+    int needed = sequence ? Codec::IOA_LEN + count * objLen : count * (Codec::IOA_LEN + objLen);
+    if (count == 0 || dataLen < needed)
+    {
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_DATA, L"信息体长度不足，类型: " + std::to_wstring(typeId) + L", 长度: " + std::to_wstring(dataLen));
+        return true;
+    }
+
+    // 回放时以抓包时标作为接收时间，保证回放结果可重复
+    SYSTEMTIME now;
+    if (m_replayTimeUs != 0)
+        now = Iec104UtcUsToLocalTime(m_replayTimeUs);
+    else
+        GetLocalTime(&now);
+    INT64 nowMs = SystemTimeToEpochMs(now);
+
+    // 有在途命令时才做关联，正常数据流不增加开销
+    bool trackCommands = m_commands->GetPendingCount() > 0;
+    bool readResponse = trackCommands && (cot & 0x3F) == (BYTE)Iec104Cot::REQUEST;
+
+    // 带时标的类型先批量换算全部时标：第一个时标在首个IOA与信息元素之后，SQ=0 时每个对象另有IOA
+    INT64 tags[CIec104PointBatch::MAX_POINTS];
+    if (hasTime)
+    {
+        int stride = sequence ? objLen : Codec::IOA_LEN + objLen;
+        Iec104DecodeCP56Times(data + Codec::IOA_LEN + elemLen, stride, count, tags);
+    }
+
+    m_dataBatch.Begin(commonAddr, typeId, cot & 0x3F);
+    m_pointDb->BeginBatch();
+    // 同一ASDU的公共地址与类型相同，订阅表每个ASDU定位一次
+    bool deliver = m_subscriptions->BeginAsdu(commonAddr, typeId);
+    CIec104IngestQueue *ingest = m_ingestQueue.get();
+    CIec104SharedPointWriter *shared = m_sharedPoints.get();
+
+    const BYTE *p = data;
+    DWORD ioa = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        if (!sequence || i == 0)
+        {
+            ioa = Codec::GetIoa(p);
+            p += Codec::IOA_LEN;
+        }
+        else
+        {
+            ioa = (ioa + 1) & Codec::IOA_MASK;
+        }
+
+        // 直接在批次中解码，不经过临时对象
+        Iec104DataPoint &point = m_dataBatch.Append();
+        point.ioa = ioa;
+        point.type = typeId;
+        point.quality = 0;
+        point.cot = cot & 0x3F;
+        point.commonAddr = commonAddr;
+        double value = 0.0;
+
+        switch ((Iec104TypeId)typeId)
+        {
+        case Iec104TypeId::M_SP_NA_1:
+        case Iec104TypeId::M_SP_TB_1:
+            point.quality = p[0] & 0xF0;
+            value = p[0] & 0x01;
+            break;
+
+        case Iec104TypeId::M_DP_NA_1:
+        case Iec104TypeId::M_DP_TB_1:
+            point.quality = p[0] & 0xF0;
+            value = p[0] & 0x03;
+            break;
+
+        case Iec104TypeId::M_ST_NA_1:
+        case Iec104TypeId::M_ST_TB_1:
+        {
+            // VTI：bit0-6为有符号步位置，bit7为瞬变状态
+            signed char step = (signed char)(p[0] << 1) >> 1;
+            point.quality = p[1];
+            value = step;
+            break;
+        }
+
+        case Iec104TypeId::M_ME_ND_1:
+        {
+            short nva = (short)((WORD)p[0] | ((WORD)p[1] << 8));
+            value = nva / 32768.0;
+            break;
+        }
+
+        case Iec104TypeId::M_ME_NA_1:
+        case Iec104TypeId::M_ME_TD_1:
+        {
+            short nva = (short)((WORD)p[0] | ((WORD)p[1] << 8));
+            point.quality = p[2];
+            value = nva / 32768.0;
+            break;
+        }
+
+        case Iec104TypeId::M_ME_NB_1:
+        case Iec104TypeId::M_ME_TE_1:
+        {
+            short sva = (short)((WORD)p[0] | ((WORD)p[1] << 8));
+            point.quality = p[2];
+            value = sva;
+            break;
+        }
+
+        case Iec104TypeId::M_ME_NC_1:
+        case Iec104TypeId::M_ME_TF_1:
+        {
+            float real;
+            memcpy(&real, p, sizeof(real));
+            point.quality = p[4];
+            value = real;
+            break;
+        }
+
+        case Iec104TypeId::M_IT_NA_1:
+        case Iec104TypeId::M_IT_TB_1:
+        {
+            // BCR：4字节计数值 + 顺序号字节(bit5 CY, bit6 CA, bit7 IV)
+            DWORD counter = (DWORD)p[0] | ((DWORD)p[1] << 8) | ((DWORD)p[2] << 16) | ((DWORD)p[3] << 24);
+            point.quality = p[4] & 0xE0;
+            value = (LONG)counter;
+            break;
+        }
+
+        default:
+            break;
+        }
+
+        // 非法时标以接收时刻代替
+        INT64 timestampMs = hasTime && tags[i] != 0 ? tags[i] : nowMs;
+        point.value = value;
+        point.timestampMs = timestampMs;
+
+        m_pointDb->Update(commonAddr, ioa, typeId, point.quality, value, timestampMs);
+        if (shared)
+        {
+            shared->Update(commonAddr, ioa, typeId, point.quality, value, timestampMs);
+        }
+        if (deliver || ingest)
+        {
+            Iec104PointUpdate update = { commonAddr, ioa, typeId, point.quality, value, timestampMs };
+            if (deliver)
+                m_subscriptions->Deliver(update);
+            if (ingest)
+                ingest->Push(update);
+        }
+        if (readResponse)
+        {
+            m_commands->OnReadResponse(typeId, commonAddr, ioa, point.quality, value, m_clock.NowUs(), m_commandDone);
+        }
+        p += objLen;
+    }
+
+    // 订阅分发在点库批次内结束：点库的写锁同样保证订阅表单写者（冗余组共用二者）
+    if (deliver)
+    {
+        m_subscriptions->EndAsdu();
+    }
+    m_pointDb->EndBatch();
+
+    // 召唤应答计入对应的召唤命令，读命令完成通知
+    if (trackCommands)
+    {
+        BYTE baseCot = cot & 0x3F;
+        if (baseCot >= (BYTE)Iec104Cot::INTERROGATED && baseCot <= (BYTE)Iec104Cot::COUNTER_INTERROGATED + 4)
+        {
+            m_commands->OnInterrogatedData(baseCot, commonAddr, (DWORD)count, m_clock.NowUs());
+        }
+        DispatchCommandCompletions(m_commandDone);
+    }
+
+    IEC104_LOG(LOG_DEBUG, IEC104_LOG_DATA, L"收到数据，类型: " + std::to_wstring(typeId) + L", 点数: " + std::to_wstring(count));
+
+    if (m_dataCallback)
+    {
+        m_dataCallback(m_dataBatch);
+    }
+
+    return true;
+}
+
+void CIec104Master::ParseClockData(const std::wstring &logPrefix, const BYTE *element, int elementLen)
 {
-    if (dataLen >= IEC104_IOA_LEN + sizeof(Iec104CP56Time)) // IOA + CP56Time2a
+    if (elementLen >= (int)sizeof(Iec104CP56Time)) // CP56Time2a
     {
         Iec104CP56Time cp56Time;
-        memcpy(&cp56Time, &data[IEC104_IOA_LEN], sizeof(cp56Time));
+        memcpy(&cp56Time, element, sizeof(cp56Time));
 
         SYSTEMTIME sysTime = CP56ToSystemTime(cp56Time);
-        
-        // 获取当前系统时间
-        SYSTEMTIME currentTime;
-        GetLocalTime(&currentTime);
-        
-        // 转换为FILETIME进行时间差计算
-        FILETIME ftParsed, ftCurrent;
-        SystemTimeToFileTime(&sysTime, &ftParsed);
-        SystemTimeToFileTime(&currentTime, &ftCurrent);
-        
-        // 计算时间差（毫秒）
-        ULARGE_INTEGER uliParsed, uliCurrent;
-        uliParsed.LowPart = ftParsed.dwLowDateTime;
-        uliParsed.HighPart = ftParsed.dwHighDateTime;
-        uliCurrent.LowPart = ftCurrent.dwLowDateTime;
-        uliCurrent.HighPart = ftCurrent.dwHighDateTime;
-        
-        // FILETIME的单位是100纳秒，转换为毫秒
-        __int64 diffMs = (__int64)(uliCurrent.QuadPart - uliParsed.QuadPart) / 10000;
-        
+
+        // 只记录子站时间：与本机时钟的偏差需要按往返补偿，由 Iec104MeasureClockOffset 给出（偏差 ± 不确定度）
         std::wstring timeStr = logPrefix +
                  std::to_wstring(sysTime.wYear) + L"-" +
                  std::to_wstring(sysTime.wMonth) + L"-" +
@@ -608,18 +2097,7 @@ void CIec104Master::ParseClockData(const std::wstring &logPrefix, const BYTE *da
                  std::to_wstring(sysTime.wMinute) + L":" +
                  std::to_wstring(sysTime.wSecond) + L"." +
                  std::to_wstring(sysTime.wMilliseconds);
-        
-        // 添加时间差信息
-        if (diffMs >= 0)
-        {
-            timeStr += L" (慢 " + std::to_wstring(diffMs/1000.0) + L"s)";
-        }
-        else
-        {
-            timeStr += L" (快 " + std::to_wstring(-diffMs/1000.0) + L"s)";
-        }
-        
-        LogEvent(timeStr);
+        IEC104_LOG(LOG_INFO, IEC104_LOG_CLOCK, timeStr);
 
         if (m_clockCallback)
         {
@@ -641,13 +2119,13 @@ Iec104CP56Time CIec104Master::SystemTimeToCP56(const SYSTEMTIME &st)
     // 小时（5位有效）
     cp56.hour = st.wHour & 0x1F;      // bit0-4为小时
     
-    // 日期（5位）+ 星期几（2位）
+    // 日期（5位）+ 星期几（3位）
     cp56.day = (st.wDay & 0x1F);      // bit0-4为日期
     // 添加星期几信息（1=周一，7=周日）
     if (st.wDayOfWeek == 0) // 周日
         cp56.day |= (7 << 5);
     else
-        cp56.day |= (st.wDayOfWeek << 5);  // bit5-6为星期
+        cp56.day |= (st.wDayOfWeek << 5);  // bit5-7为星期
     
     // 月份（4位有效）
     cp56.month = st.wMonth & 0x0F;    // bit0-3为月份
@@ -675,8 +2153,8 @@ SYSTEMTIME CIec104Master::CP56ToSystemTime(const Iec104CP56Time &cp56)
     // 提取日期（只取低5位）
     st.wDay = cp56.day & 0x1F;
     
-    // 提取星期几（bit5-6）
-    BYTE dayOfWeek = (cp56.day >> 5) & 0x03;
+    // 提取星期几（bit5-7，0表示未使用）
+    BYTE dayOfWeek = (cp56.day >> 5) & 0x07;
     st.wDayOfWeek = (dayOfWeek == 7) ? 0 : dayOfWeek;  // 7转换为0（周日）
     
     // 提取月份（只取低4位）
@@ -688,6 +2166,21 @@ SYSTEMTIME CIec104Master::CP56ToSystemTime(const Iec104CP56Time &cp56)
     return st;
 }
 
+INT64 CIec104Master::SystemTimeToEpochMs(const SYSTEMTIME &st)
+{
+    // 时标按本地时间处理（与CP56Time2a约定一致），非法时标返回0
+    FILETIME ft;
+    if (!SystemTimeToFileTime(&st, &ft))
+    {
+        return 0;
+    }
+
+    ULARGE_INTEGER uli;
+    uli.LowPart = ft.dwLowDateTime;
+    uli.HighPart = ft.dwHighDateTime;
+    return (INT64)(uli.QuadPart - FILETIME_UNIX_EPOCH) / 10000;
+}
+
 void CIec104Master::LogEvent(const std::wstring &message)
 {
     if (m_eventCallback)
@@ -723,21 +2216,3 @@ std::wstring CIec104Master::GetLastErrorString()
 
     return result;
 }
-
-std::wstring CIec104Master::BytesToHexString(const BYTE *data, int length)
-{
-    if (!data || length <= 0)
-        return L"";
-
-    std::wstringstream ss;
-    ss << std::hex << std::uppercase << std::setfill(L'0');
-
-    for (int i = 0; i < length; ++i)
-    {
-        if (i > 0)
-            ss << L" ";
-        ss << std::setw(2) << static_cast<int>(data[i]);
-    }
-
-    return ss.str();
-}
@@ -2,24 +2,41 @@
 #include <windows.h>
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <future>
+#include "Iec104Capture.h"
+#include "Iec104Log.h"
+#include "Iec104PointDb.h"
+#include "Iec104Profile.h"
+#include "Iec104Subscription.h"
+#include "Iec104IngestQueue.h"
+#include "Iec104SharedPoints.h"
+#include "Iec104Tls.h"
+#include "Iec104TxQueue.h"
+#include "TimerWheel.h"
 
 #pragma comment(lib, "ws2_32.lib")
 
 // IEC 104 协议常量
 constexpr BYTE IEC104_START_BYTE = 0x68;
 constexpr WORD IEC104_DEFAULT_PORT = 2404;
-constexpr int IEC104_IOA_LEN = 3;              // 信息体地址长度（3字节）
-constexpr DWORD IEC104_TIMEOUT_MS = 10000;
+constexpr int IEC104_MAX_ASDU_LEN = 249;       // APDU长度字节最大253，去掉4字节控制域
+constexpr DWORD IEC104_TIMEOUT_MS = 10000;        // 缺省连接时限
 constexpr DWORD IEC104_HEARTBEAT_MS = 15000;
 constexpr DWORD IEC104_T1_TIMEOUT_MS = 15000;  // 发送或测试APDU的超时
 constexpr DWORD IEC104_T2_TIMEOUT_MS = 10000;  // 确认收到APDU的超时
 constexpr DWORD IEC104_T3_TIMEOUT_MS = 20000;  // 发送测试帧的超时
+constexpr DWORD IEC104_IO_WAIT_MS = 1000;      // I/O线程等待网络事件的最长时间
+constexpr int IEC104_TX_BATCH = 32;            // 一次分散写最多合并的APDU数
+constexpr WORD IEC104_DEFAULT_K = 12;          // 未确认I帧数上限k
+constexpr WORD IEC104_ACK_RING = 256;          // 记录发送时刻的环，也是k的上限（未确认的I帧不会覆盖记录）
 
 // IEC 104 APCI类型
 enum class Iec104ApciType : BYTE
@@ -43,15 +60,57 @@ enum class Iec104UFunction : BYTE
 // IEC 104 ASDU类型标识
 enum class Iec104TypeId : BYTE
 {
+    C_SC_NA_1 = 45,       // 单点命令
+    C_DC_NA_1 = 46,       // 双点命令
+    C_SE_NA_1 = 48,       // 设点命令，归一化值
+    C_SE_NB_1 = 49,       // 设点命令，标度化值
+    C_SE_NC_1 = 50,       // 设点命令，短浮点数
     C_IC_NA_1 = 100,      // 站总召唤命令
+    C_CI_NA_1 = 101,      // 电能量召唤命令
+    C_RD_NA_1 = 102,      // 读命令
     C_CS_NA_1 = 103,      // 时钟同步命令
+    C_CD_NA_1 = 106,      // 延时获得命令
     M_SP_NA_1 = 1,        // 单点信息
     M_DP_NA_1 = 3,        // 双点信息
+    M_ST_NA_1 = 5,        // 步位置信息
     M_ME_NA_1 = 9,        // 测量值，归一化值
     M_ME_NB_1 = 11,       // 测量值，标度化值
-    M_ME_NC_1 = 13        // 测量值，短浮点数
+    M_ME_NC_1 = 13,       // 测量值，短浮点数
+    M_IT_NA_1 = 15,       // 累计量
+    M_ME_ND_1 = 21,       // 测量值，不带品质描述的归一化值
+    M_SP_TB_1 = 30,       // 带CP56Time2a时标的单点信息
+    M_DP_TB_1 = 31,       // 带CP56Time2a时标的双点信息
+    M_ST_TB_1 = 32,       // 带CP56Time2a时标的步位置信息
+    M_ME_TD_1 = 34,       // 带CP56Time2a时标的归一化值
+    M_ME_TE_1 = 35,       // 带CP56Time2a时标的标度化值
+    M_ME_TF_1 = 36,       // 带CP56Time2a时标的短浮点数
+    M_IT_TB_1 = 37        // 带CP56Time2a时标的累计量
 };
 
+// IEC 104 传送原因（低6位），bit6为否定确认，bit7为试验
+enum class Iec104Cot : BYTE
+{
+    PERIODIC = 1,             // 周期/循环
+    BACKGROUND = 2,           // 背景扫描
+    SPONTANEOUS = 3,          // 突发
+    INITIALIZED = 4,          // 初始化
+    REQUEST = 5,              // 请求或被请求
+    ACTIVATION = 6,           // 激活
+    ACTIVATION_CON = 7,       // 激活确认
+    DEACTIVATION = 8,         // 停止激活
+    DEACTIVATION_CON = 9,     // 停止激活确认
+    ACTIVATION_TERM = 10,     // 激活终止
+    INTERROGATED = 20,        // 响应站召唤（21-36为响应第1-16组召唤）
+    COUNTER_INTERROGATED = 37, // 响应电能量召唤（38-41为响应第1-4组）
+    UNKNOWN_TYPE = 44,        // 未知的类型标识
+    UNKNOWN_COT = 45,         // 未知的传送原因
+    UNKNOWN_CA = 46,          // 未知的公共地址
+    UNKNOWN_IOA = 47          // 未知的信息对象地址
+};
+
+constexpr BYTE IEC104_COT_NEGATIVE = 0x40;
+constexpr BYTE IEC104_COT_TEST = 0x80;
+
 // IEC 104 ASDU结构
 #pragma pack(push, 1)
 struct Iec104Apci
@@ -74,7 +133,7 @@ struct Iec104CP56Time
     WORD milliseconds;    // 毫秒和秒的组合：bit0-15为毫秒(0-59999)
     BYTE minute;          // 分钟：bit0-5为分(0-59)，bit6无效，bit7=IV(无效位)
     BYTE hour;            // 小时：bit0-4为时(0-23)，bit5-6无效，bit7=SU(夏令时)
-    BYTE day;             // 日：bit0-4为日(1-31)，bit5-6为星期(1-7)，bit7无效
+    BYTE day;             // 日：bit0-4为日(1-31)，bit5-7为星期(1-7，0表示未使用)
     BYTE month;           // 月：bit0-3为月(1-12)，bit4-7无效
     BYTE year;            // 年：bit0-6为年(0-99，相对于2000年)，bit7无效
 };
@@ -89,22 +148,64 @@ enum class Iec104State
     STARTED
 };
 
-// 数据点结构
+// 数据点（24字节）：IOA与类型共用一个32位字，时标为毫秒数，一次总召的数万个点连续紧凑存放
 struct Iec104DataPoint
 {
-    WORD address;         // 信息对象地址
-    BYTE type;           // 数据类型
-    BYTE quality;        // 品质描述
-    union
+    DWORD ioa : 24;       // 信息对象地址
+    DWORD type : 8;       // ASDU类型
+    BYTE quality;         // 品质描述
+    BYTE cot;             // 传送原因（不含P/N与试验位）
+    WORD commonAddr;      // 公共地址
+    double value;         // 与点库一致：单点/双点为状态值，步位置为有符号值，归一化值为 NVA/32768，累计量为计数值
+    INT64 timestampMs;    // 本地时间自1970-01-01起的毫秒数，不带时标的类型为接收时刻
+};
+static_assert(sizeof(Iec104DataPoint) == 24, "Iec104DataPoint 应为24字节");
+
+// 一个ASDU解码出的点（同一公共地址、类型与传送原因）
+// - 点存放在对象内的定长数组中（信息对象数不超过127），接收线程每个ASDU复用同一批次，稳态接收不分配内存
+// - 回调中只能在返回前访问，需要保留时复制出去
+class CIec104PointBatch
+{
+public:
+    static constexpr size_t MAX_POINTS = 127;
+
+    CIec104PointBatch() : m_commonAddr(0), m_type(0), m_cot(0), m_count(0) {}
+
+    void Begin(WORD commonAddr, BYTE type, BYTE cot)
     {
-        BOOL boolValue;
-        WORD wordValue;
-        DWORD dwordValue;
-        float floatValue;
-    } value;
-    SYSTEMTIME timestamp;
+        m_commonAddr = commonAddr;
+        m_type = type;
+        m_cot = cot;
+        m_count = 0;
+    }
+    // 追加一个点并返回其引用（调用者保证不超过 MAX_POINTS）
+    Iec104DataPoint& Append() { return m_points[m_count++]; }
+
+    WORD GetCommonAddr() const { return m_commonAddr; }
+    BYTE GetType() const { return m_type; }
+    BYTE GetCot() const { return m_cot; }
+
+    size_t size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+    const Iec104DataPoint& operator[](size_t index) const { return m_points[index]; }
+    const Iec104DataPoint* begin() const { return m_points; }
+    const Iec104DataPoint* end() const { return m_points + m_count; }
+
+private:
+    WORD m_commonAddr;
+    BYTE m_type;
+    BYTE m_cot;
+    size_t m_count;
+    Iec104DataPoint m_points[MAX_POINTS];
 };
 
+// 监视方向ASDU的信息元素布局：元素长度（不含IOA与时标）及是否带CP56Time2a时标
+bool Iec104GetMonitorLayout(BYTE typeId, int& elemLen, bool& hasTime);
+// 带时标类型对应的不带时标类型（召唤应答使用），其他类型原样返回
+BYTE Iec104GetUntimedType(BYTE typeId);
+// 编码信息元素（不含IOA与时标），数值与品质的含义同 Iec104DataPoint，返回写入的字节数，不支持的类型返回0
+int Iec104EncodeMonitorElement(BYTE typeId, BYTE quality, double value, BYTE* out);
+
 // 104通信结果
 struct Iec104Result
 {
@@ -116,17 +217,108 @@ struct Iec104Result
 
 // 事件回调函数类型
 using Iec104EventCallback = std::function<void(const std::wstring&)>;
-using Iec104DataCallback = std::function<void(const std::vector<Iec104DataPoint>&)>;
+using Iec104DataCallback = std::function<void(const CIec104PointBatch&)>;
 using Iec104ClockCallback = std::function<void(const SYSTEMTIME&)>;
+using Iec104StateCallback = std::function<void(Iec104State)>;
+
+// 控制方向命令
+// - C_SC/C_DC/C_SE_NA/NB/NC：value 为命令值（单点0/1，双点1分/2合，设点为数值），qualifier 为QU/QL
+// - C_IC/C_CI：qualifier 为QOI（默认20站召唤）/QCC（默认5总电能量）
+// - C_RD：仅IOA；C_CS：read=true 为读取时钟，否则以 time 同步
+struct Iec104Command
+{
+    Iec104TypeId type = Iec104TypeId::C_IC_NA_1;
+    WORD commonAddr = 1;
+    DWORD ioa = 0;
+    double value = 0.0;
+    BYTE qualifier = 0;
+    bool selectBeforeOperate = false;    // 先选择，收到肯定确认后自动执行
+    bool waitTermination = true;         // 执行类命令等待激活终止，否则以激活确认为完成
+    bool read = false;
+    SYSTEMTIME time{};                   // 时钟同步命令的时间，延时获得命令取其秒与毫秒
+    DWORD timeoutMs = IEC104_T1_TIMEOUT_MS;   // 每个阶段的等待时间，召唤期间收到数据会重新计时
+};
+
+enum class Iec104CommandStatus : BYTE
+{
+    PENDING,
+    COMPLETED,
+    NEGATIVE,             // 否定确认（P/N=1）
+    TIMEOUT,
+    FAILED                // 发送失败或连接断开
+};
+
+// 收发序号校验统计（跨重连累计）
+struct Iec104SequenceStats
+{
+    UINT64 iFramesReceived = 0;
+    UINT64 gaps = 0;              // N(S) 大于期望值：中间的I帧丢失
+    UINT64 duplicates = 0;        // N(S) 小于期望值：重复或乱序
+    UINT64 invalidAcks = 0;       // N(R) 不在 [已确认, 已发送] 区间内
+    UINT64 ackTimeouts = 0;       // 发出的I帧 t1 内未被确认
+    UINT64 linkResets = 0;        // 因以上错误断开链路的次数
+    UINT64 ackedFrames = 0;       // 被对端确认的I帧
+    UINT64 ackLagAvgUs = 0;       // I帧发出到被确认的平均与最大时延
+    UINT64 ackLagMaxUs = 0;
+    UINT64 windowStalls = 0;      // 未确认的I帧达到k、有I帧等待确认的次数
+    UINT64 windowBlockedUs = 0;   // 累计等待时长（到确认腾出窗口或链路断开）
+    WORD unacked = 0;             // 当前未确认的I帧数
+};
+
+// 命令结果，时刻为主站单调时钟（GetClock）的微秒
+struct Iec104CommandResult
+{
+    UINT64 id = 0;
+    Iec104Command command;
+    Iec104CommandStatus status = Iec104CommandStatus::PENDING;
+    BYTE cot = 0;                        // 最后一次应答的传送原因（含P/N位）
+    INT64 sentUs = 0;
+    INT64 selectedUs = 0;                // 选择被确认的时刻（仅先选择后执行）
+    INT64 confirmedUs = 0;
+    INT64 completedUs = 0;
+    DWORD points = 0;                    // 召唤期间收到的信息对象数
+    BYTE responseType = 0;               // 读命令应答的类型、品质与值
+    BYTE quality = 0;
+    double value = 0.0;
+    SYSTEMTIME clock{};                  // 时钟命令应答中的子站时间
+};
+
+using Iec104CommandCallback = std::function<void(const Iec104CommandResult&)>;
+
+class CIec104CommandTracker;
+struct Iec104CommandCompletion;
+struct Iec104CommandExecute;
 
 class CIec104Master
 {
+    friend class CIec104Replay;
+    friend class CIec104LinkSim;
+
 public:
     CIec104Master();
     ~CIec104Master();
 
-    // 连接管理
-    bool Connect(const std::wstring& ipAddress, WORD port = IEC104_DEFAULT_PORT);
+    // 连接管理：host 可为IPv4/IPv6地址或主机名
+    // ConnectAsync 立即返回，解析与连接在I/O线程中完成，结果通过状态回调（CONNECTED/DISCONNECTED）通知；
+    // Connect 等待其完成，不能在状态回调中调用
+    bool Connect(const std::wstring& host, WORD port = IEC104_DEFAULT_PORT);
+    bool ConnectAsync(const std::wstring& host, WORD port = IEC104_DEFAULT_PORT);
+    void SetConnectTimeout(DWORD timeoutMs) { m_connectTimeoutMs = timeoutMs; }
+
+    // TLS（IEC 62351-3，连接前设置）：credentials 为空时使用明文TCP；serverName 为空时取连接地址。
+    // 多条连接及重连共用同一凭据对象，重连时恢复TLS会话而不做完整握手
+    void SetTls(std::shared_ptr<CIec104TlsCredentials> credentials, const std::wstring& serverName = L"")
+    {
+        m_tlsCredentials = credentials;
+        m_tlsServerName = serverName;
+    }
+    bool IsTlsEnabled() const { return m_tlsCredentials != nullptr; }
+    bool IsTlsResumed() const { return m_tlsResumed; }     // 当前连接的TLS握手恢复了缓存的会话
+
+    // 链路参数（连接前设置）：传送原因/公共地址/信息对象地址字节数，缺省为标准的 2/2/3。
+    // 设置时选定对应的编解码器实例，接收解码不再按参数分支
+    bool SetLinkProfile(const Iec104LinkProfile& profile);
+    const Iec104LinkProfile& GetLinkProfile() const { return m_codec->profile; }
     void Disconnect();
     bool IsConnected() const { return m_state == Iec104State::CONNECTED || m_state == Iec104State::STARTED; }
     bool IsStarted() const { return m_state == Iec104State::STARTED; }
@@ -142,16 +334,87 @@ public:
     bool ReadClock(WORD commonAddr = 1);        // 读取时钟
     bool SyncClock(const SYSTEMTIME& time, WORD commonAddr = 1);  // 时钟同步
 
+    // 带应答跟踪的命令：可并发多条，按类型+公共地址+IOA与应答关联
+    // 回调在I/O线程中调用（发送失败时在调用线程中立即调用），返回命令号，失败返回0
+    UINT64 SendCommand(const Iec104Command& command, Iec104CommandCallback callback);
+    std::future<Iec104CommandResult> SendCommand(const Iec104Command& command);
+    size_t GetPendingCommands() const;
+
     // 回调设置
     void SetEventCallback(Iec104EventCallback callback) { m_eventCallback = callback; }
     void SetDataCallback(Iec104DataCallback callback) { m_dataCallback = callback; }
     void SetClockCallback(Iec104ClockCallback callback) { m_clockCallback = callback; }
+    // 状态变化（连接建立、STARTDT/STOPDT确认、链路断开），链路事件在I/O线程中回调
+    void SetStateCallback(Iec104StateCallback callback) { m_stateCallback = callback; }
+
+    // 链路监视（连接前设置）：空闲 t3 后发送测试帧，t1 内无任何接收即判定链路断开
+    void SetLinkTimers(DWORD t1Ms, DWORD t3Ms) { m_t1Ms = t1Ms; m_t3Ms = t3Ms; }
+    // 接收确认（连接前设置）：累计收到 w 个I帧或第一个未确认的I帧经过 t2 后发送S帧，
+    // 期间发出的I帧捎带确认；w 为1时每个I帧立即确认
+    void SetAckWindow(WORD w, DWORD t2Ms) { m_ackWindow = (std::max)(w, (WORD)1); m_t2Ms = t2Ms; }
+    // 发送窗口（连接前设置）：未确认的I帧达到 k 时暂停发送I帧，S帧与U帧照常发出，收到确认后继续；k 取 1..IEC104_ACK_RING
+    void SetSendWindow(WORD k) { m_sendWindow = (std::min)((std::max)(k, (WORD)1), IEC104_ACK_RING); }
+    // 链路定时器、确认时延与命令超时使用的单调时钟（连接前设置），缺省为系统时钟；
+    // 虚拟时钟只用于 CIec104LinkSim 驱动的虚拟链路，TCP连接与TLS握手的时限始终按系统时钟计算
+    void SetClock(const CMonotonicClock& clock) { m_clock = clock; }
+    // 命令结果中的各阶段时刻按此时钟记录
+    const CMonotonicClock& GetClock() const { return m_clock; }
 
     // 获取统计信息
     DWORD GetSentFrames() const { return m_sentFrames; }
     DWORD GetReceivedFrames() const { return m_receivedFrames; }
     WORD GetSendSeqNum() const { return m_sendSeqNum; }
     WORD GetRecvSeqNum() const { return m_recvSeqNum; }
+    DWORD GetTxSyscalls() const { return m_txSyscalls; }            // 发送系统调用次数（小于发送帧数说明发生了合并）
+    UINT64 GetTxDropped() const { return m_txQueue.GetDroppedCount(); }
+    // 序号校验：接收 N(S) 不连续（缺口或重复）、确认 N(R) 非法或I帧 t1 内未被确认时按规约断开链路
+    Iec104SequenceStats GetSequenceStats() const;
+
+    // 日志过滤：级别与类别在构造日志文本之前检查
+    void SetLogLevel(Iec104LogLevel level) { m_logLevel = level; }
+    void SetLogCategories(DWORD categories) { m_logCategories = categories; }
+    bool IsLogEnabled(Iec104LogLevel level, DWORD category) const
+    {
+        return (BYTE)level <= (BYTE)m_logLevel.load(std::memory_order_relaxed) &&
+               (m_logCategories.load(std::memory_order_relaxed) & category) != 0;
+    }
+
+    // 报文环：收发报文以二进制记录，由读取方按需格式化
+    void SetFrameRecording(bool enable) { m_frameRecording = enable; }
+    const CIec104FrameRing& GetFrameRing() const { return m_frameRing; }
+
+    // 抓包：收发报文连同接收时标写入pcap文件，供离线回放
+    bool StartCapture(const std::wstring& path, std::wstring* err = nullptr) { return m_capture.Open(path, err); }
+    void StopCapture() { m_capture.Close(); }
+    bool IsCapturing() const { return m_capture.IsOpen(); }
+    UINT64 GetCapturedFrames() const { return m_capture.GetFrameCount(); }
+
+    // 实时点库（接收线程写入，其他线程无锁读取）
+    const CIec104PointDb& GetPointDatabase() const { return *m_pointDb; }
+    // 连接前设置：冗余组的各连接共用一个点库，切换后点状态保持（同一时刻只有一个连接写入）
+    void SetPointDatabase(std::shared_ptr<CIec104PointDb> pointDb) { m_pointDb = pointDb; }
+
+    // 按点订阅（公共地址/类型/IOA区间）：回调在I/O线程中逐点调用，只收到符合条件的点，
+    // 任意线程可随时订阅与退订，Unsubscribe 返回后不再回调
+    UINT64 Subscribe(const Iec104SubscriptionFilter& filter, Iec104PointCallback callback)
+    {
+        return m_subscriptions->Subscribe(filter, std::move(callback));
+    }
+    bool Unsubscribe(UINT64 id) { return m_subscriptions->Unsubscribe(id); }
+    // 连接前设置：冗余组的各连接共用订阅表
+    void SetSubscriptions(std::shared_ptr<CIec104SubscriptionIndex> subscriptions) { m_subscriptions = subscriptions; }
+
+    // 连接前设置：每个点更新在写入点库后提交到该队列，由消费线程（如 CIec104IngestWorker）取走，
+    // 消费者处理慢时按队列的溢出策略合并、丢弃或使接收线程等待；为空表示不使用
+    void SetIngestQueue(std::shared_ptr<CIec104IngestQueue> queue) { m_ingestQueue = queue; }
+
+    // 连接前设置：每个点更新同时写入共享内存点表，供本机其他进程无锁读取；多个主站可共用一个写者
+    void SetSharedPoints(std::shared_ptr<CIec104SharedPointWriter> sharedPoints) { m_sharedPoints = sharedPoints; }
+
+    // 时标转换（CP56Time2a按本地时间处理）
+    static Iec104CP56Time SystemTimeToCP56(const SYSTEMTIME& st);
+    static SYSTEMTIME CP56ToSystemTime(const Iec104CP56Time& cp56);
+    static INT64 SystemTimeToEpochMs(const SYSTEMTIME& st);
 
 private:
     // 网络相关
@@ -163,46 +426,174 @@ private:
     // 序号管理
     std::atomic<WORD> m_sendSeqNum;
     std::atomic<WORD> m_recvSeqNum;
+    std::atomic<WORD> m_ackSeqNum;          // 对端已确认到的发送序号
+    bool m_rxSeqSynced;                     // 回放从抓包中的首个I帧同步接收序号
+    bool m_seqResetPending;                 // 序号错误，I/O线程在本轮结束时断开链路
+    INT64 m_iSendTimesUs[IEC104_ACK_RING];  // 按 N(S) 记录的发送时刻（仅I/O线程）
+
+    // 序号统计
+    std::atomic<UINT64> m_seqIFrames;
+    std::atomic<UINT64> m_seqGaps;
+    std::atomic<UINT64> m_seqDuplicates;
+    std::atomic<UINT64> m_seqInvalidAcks;
+    std::atomic<UINT64> m_seqAckTimeouts;
+    std::atomic<UINT64> m_seqLinkResets;
+    std::atomic<UINT64> m_ackedFrames;
+    std::atomic<UINT64> m_ackLagTotalUs;
+    std::atomic<UINT64> m_ackLagMaxUs;
+    std::atomic<UINT64> m_windowStalls;
+    std::atomic<UINT64> m_windowBlockedUs;
+    bool m_windowBlocked;                   // k窗口满、有I帧等待确认（仅I/O线程）
+    INT64 m_windowBlockedSinceUs;           // 开始等待的时刻（虚拟时钟可从0开始，不以0表示未阻塞）
     
     // 统计信息
     std::atomic<DWORD> m_sentFrames;
     std::atomic<DWORD> m_receivedFrames;
 
+    // 发送队列（任意线程入队，I/O线程合并发送）
+    CIec104TxQueue m_txQueue;
+    WSAEVENT m_netEvent;
+    WSAEVENT m_txEvent;
+    std::atomic<DWORD> m_ioThreadId;
+    std::atomic<bool> m_txWakePending;
+    DWORD m_txOffset;       // 队首帧已发出的字节数（仅I/O线程）
+    bool m_txBlocked;       // 等待FD_WRITE（仅I/O线程）
+    // k窗口满时移出队列暂存的I帧，先于队列中的I帧发出（仅I/O线程）；
+    // 与发送队列同容量的环，构造时一次分配，发送路径上不分配内存
+    std::unique_ptr<Iec104TxFrame[]> m_txHeld;
+    size_t m_txHeldMask;
+    size_t m_txHeldHead;
+    size_t m_txHeldCount;
+    bool m_txOffsetHeld;    // 只发出一部分的帧在暂存中（否则在队列中）
+    std::atomic<DWORD> m_txSyscalls;
+
     // 线程和同步
     std::thread m_receiveThread;
     std::atomic<bool> m_stopReceive;
+    DWORD m_connectTimeoutMs;
     mutable std::mutex m_socketMutex;
+    std::mutex m_stateMutex;
+    std::condition_variable m_stateChanged;
     mutable std::mutex m_seqMutex;
 
+    // TLS（会话与缓冲仅I/O线程使用）
+    std::shared_ptr<CIec104TlsCredentials> m_tlsCredentials;
+    std::wstring m_tlsServerName;
+    CIec104TlsSession m_tls;
+    std::vector<BYTE> m_tlsTx;              // 待发送的密文
+    size_t m_tlsTxSent;
+    std::vector<BYTE> m_tlsTxPlain;         // 合并加密前的明文
+    std::vector<BYTE> m_tlsRxPlain;
+    std::atomic<bool> m_tlsResumed;
+
+    // 链路监视（单调时钟微秒，仅I/O线程）
+    DWORD m_t1Ms;
+    DWORD m_t2Ms;
+    DWORD m_t3Ms;
+    WORD m_ackWindow;
+    WORD m_sendWindow;      // k
+    WORD m_unackedRx;       // 收到后尚未确认的I帧数
+    INT64 m_lastRxUs;
+    INT64 m_testSentUs;     // 0 表示没有未确认的测试帧
+    bool m_linkTimedOut;
+
+    // 链路定时器挂在I/O线程的时间轮上（单调时钟毫秒），到期检查实际状态，不满足时按剩余时间重新设置
+    CMonotonicClock m_clock;
+    CTimerWheel m_timers;
+    CWheelTimer m_t1AckTimer;       // 最早未确认的I帧
+    CWheelTimer m_t1TestTimer;      // 未确认的测试帧
+    CWheelTimer m_t2Timer;          // 收到后尚未确认的I帧
+    CWheelTimer m_t3Timer;          // 链路空闲
+
     // 回调函数
     Iec104EventCallback m_eventCallback;
     Iec104DataCallback m_dataCallback;
     Iec104ClockCallback m_clockCallback;
+    Iec104StateCallback m_stateCallback;
+
+    // 日志与报文记录
+    std::atomic<Iec104LogLevel> m_logLevel;
+    std::atomic<DWORD> m_logCategories;
+    std::atomic<bool> m_frameRecording;
+    CIec104FrameRing m_frameRing;
+    CIec104CaptureWriter m_capture;
+    INT64 m_replayTimeUs;   // 回放时使用抓包时标作为接收时间，0表示实时
+
+    // 虚拟链路（CIec104LinkSim）：不使用socket，发送队列中的报文交给该回调，由驱动线程兼作I/O线程；
+    // 驱动线程在服务链路之外（如调度器回调中）入队报文时调用 m_virtualWake，驱动方据此安排一次服务
+    std::function<void(const BYTE* data, int length)> m_virtualSend;
+    std::function<void()> m_virtualWake;
+    BYTE m_virtualRx[4096];
+    int m_virtualRxBuffered;
+
+    // 命令跟踪（完成通知与执行列表仅I/O线程使用，容量复用）
+    std::unique_ptr<CIec104CommandTracker> m_commands;
+    std::vector<Iec104CommandCompletion> m_commandDone;
+    std::vector<Iec104CommandExecute> m_commandExecutes;
+
+    // 链路参数对应的编解码器：编码经函数指针表，接收解码为按参数实例化的成员函数
+    const Iec104CodecOps* m_codec;
+    void (CIec104Master::*m_processAsdu)(const BYTE* asdu, int length);
+
+    // 实时点库与解码缓冲（仅接收线程使用，容量跨帧复用）
+    std::shared_ptr<CIec104PointDb> m_pointDb;
+    CIec104PointBatch m_dataBatch;
+    std::shared_ptr<CIec104SubscriptionIndex> m_subscriptions;
+    std::shared_ptr<CIec104IngestQueue> m_ingestQueue;
+    std::shared_ptr<CIec104SharedPointWriter> m_sharedPoints;
 
     // 内部方法
     static bool InitializeWinsock();
     static void CleanupWinsock();
     
-    bool SendApdu(const BYTE* data, int length);
-    bool SendIFrame(BYTE typeId, BYTE cot, WORD commonAddr, const BYTE* data = nullptr, int dataLen = 0);
+    bool SendApdu(const BYTE* data, int length, Iec104TxKind kind, UINT64 commandId = 0);
+    void WakeIoThread();
+    bool FlushTxQueue();
+    bool FlushTlsTxQueue();
+    bool FlushVirtualTxQueue();
+    size_t PeekTxFrames(Iec104TxFrame** frames, size_t& heldCount);
+    void PopTxFrames(size_t count, size_t heldCount);
+    void EndWindowStall();
+    void StampTxFrame(Iec104TxFrame& frame);
+    void OnFrameSent(const Iec104TxFrame& frame);
+    bool SendIFrame(BYTE typeId, BYTE cot, WORD commonAddr, DWORD ioa, const BYTE* element = nullptr, int elementLen = 0, UINT64 commandId = 0);
     bool SendUFrame(Iec104UFunction function);
     //bool SendSFrame();
     
     void ReceiveThreadProc();
+    void ResetLinkState();
+    bool ServiceLink(bool linkUp);
+    void FinishLink(bool linkUp);
+    bool ConnectVirtual(std::function<void(const BYTE* data, int length)> send, std::function<void()> wake);
+    void ReceiveVirtual(const BYTE* data, int length);
+    bool ServiceVirtualLink();
+    bool EstablishConnection();
+    bool TlsHandshake(SOCKET sock, INT64 deadlineUs);
+    SOCKET TryConnect(const ADDRINFOW* ai, const std::wstring& address, INT64 deadlineUs, bool& timedOut);
+    static std::wstring FormatAddress(const sockaddr* addr, DWORD addrLen);
+    bool ReadAvailable(BYTE* buffer, int capacity, int& buffered);
+    void SplitFrames(BYTE* buffer, int& buffered, INT64 rxTimeUs);
     bool ProcessReceivedData(const BYTE* buffer, int length);
     bool ProcessIFrame(const BYTE* buffer, int length);
     bool ProcessUFrame(const BYTE* buffer, int length);
     bool ProcessSFrame(const BYTE* buffer, int length);
+    bool CheckReceiveSeq(WORD sendSeq);
+    bool AcknowledgeSent(WORD ackSeq);
     
-    void ParseAsduData(BYTE typeId, BYTE cot, const BYTE* data, int dataLen);
-    void ParseClockData(const std::wstring& logPrefix, const BYTE* data, int dataLen);
+    template <class Codec> void ProcessAsdu(const BYTE* asdu, int length);
+    template <class Codec> bool ParseMonitorData(const Iec104AsduHeader& header, const BYTE* data, int dataLen);
+    void HandleCommandResponse(const Iec104AsduHeader& header, DWORD ioa, const BYTE* element, int elementLen);
+    void DispatchCommandCompletions(std::vector<Iec104CommandCompletion>& done);
+    void ParseClockData(const std::wstring& logPrefix, const BYTE* element, int elementLen);
+
+    void ChangeState(Iec104State state);
+    void ArmLinkTimers();
+    void ArmLinkTimer(CWheelTimer& timer, UINT64 delayMs);
+    void OnAckTimeout();
+    void OnTestTimeout();
+    void OnRecvAckTimeout();
+    void OnIdleTimeout();
 
-    static Iec104CP56Time SystemTimeToCP56(const SYSTEMTIME& st);
-    static SYSTEMTIME CP56ToSystemTime(const Iec104CP56Time& cp56);
-    
     void LogEvent(const std::wstring& message);
     std::wstring GetLastErrorString();
-    
-    // 报文日志辅助函数
-    static std::wstring BytesToHexString(const BYTE* data, int length);
 };
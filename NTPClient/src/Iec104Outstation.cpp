@@ -0,0 +1,1350 @@
+﻿#include "pch.h"
+#include "Iec104Outstation.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // FILETIME(1601-01-01) 与 1970-01-01 之间的100ns数
+    constexpr UINT64 FILETIME_UNIX_EPOCH = 116444736000000000ULL;
+
+    constexpr size_t TX_HIGH_WATER = 32 * 1024;                          // 发送缓冲积压超过此值时暂停生成报文
+    constexpr size_t REPLY_QUEUE_LEN = 16;
+    constexpr int POLL_TIMEOUT_MS = 5;
+    constexpr BYTE QOI_STATION = 20;                                     // 站召唤
+    constexpr BYTE QCC_GENERAL = 5;                                      // 总的电能量召唤
+
+    bool IsCounterType(BYTE type)
+    {
+        return type == (BYTE)Iec104TypeId::M_IT_NA_1 || type == (BYTE)Iec104TypeId::M_IT_TB_1;
+    }
+
+    void PutAsduHeader(const Iec104CodecOps &codec, BYTE *asdu, BYTE type, int count, bool sequence, BYTE cot, WORD commonAddr)
+    {
+        Iec104AsduHeader header;
+        header.typeId = type;
+        header.vsq = (BYTE)count | (sequence ? 0x80 : 0x00);
+        header.cot = cot;
+        header.commonAddr = commonAddr;
+        codec.putHeader(asdu, header);
+    }
+
+    // 突发变化：按类型给出下一个值
+    double NextValue(BYTE type, double value)
+    {
+        switch ((Iec104TypeId)type)
+        {
+        case Iec104TypeId::M_SP_NA_1:
+        case Iec104TypeId::M_SP_TB_1:
+            return value != 0.0 ? 0.0 : 1.0;
+
+        case Iec104TypeId::M_DP_NA_1:
+        case Iec104TypeId::M_DP_TB_1:
+            return value == 2.0 ? 1.0 : 2.0;      // 分(1)/合(2)交替
+
+        case Iec104TypeId::M_ST_NA_1:
+        case Iec104TypeId::M_ST_TB_1:
+            return value >= 63.0 ? -64.0 : value + 1.0;
+
+        case Iec104TypeId::M_ME_NA_1:
+        case Iec104TypeId::M_ME_TD_1:
+        case Iec104TypeId::M_ME_ND_1:
+            return value >= 0.99 ? -1.0 : value + 1.0 / 1024;
+
+        case Iec104TypeId::M_ME_NB_1:
+        case Iec104TypeId::M_ME_TE_1:
+            return value >= 32767.0 ? -32768.0 : value + 1.0;
+
+        case Iec104TypeId::M_IT_NA_1:
+        case Iec104TypeId::M_IT_TB_1:
+            return value >= 4294967295.0 ? 0.0 : value + 1.0;
+
+        default:
+            return value + 0.1;
+        }
+    }
+
+    std::wstring Trim(const std::wstring &text)
+    {
+        size_t begin = text.find_first_not_of(L" \t\r");
+        if (begin == std::wstring::npos)
+            return std::wstring();
+        size_t end = text.find_last_not_of(L" \t\r");
+        return text.substr(begin, end - begin + 1);
+    }
+}
+
+bool Iec104LoadSimScript(const std::wstring &path, std::vector<Iec104SimStep> &steps, std::wstring *err)
+{
+    steps.clear();
+
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        if (err)
+            *err = L"打开仿真脚本失败: " + path;
+        return false;
+    }
+
+    LARGE_INTEGER size = {};
+    GetFileSizeEx(file, &size);
+    std::string content((size_t)size.QuadPart, '\0');
+    DWORD read = 0;
+    bool ok = content.empty() || (ReadFile(file, &content[0], (DWORD)content.size(), &read, nullptr) && read == content.size());
+    CloseHandle(file);
+    if (!ok)
+    {
+        if (err)
+            *err = L"读取仿真脚本失败: " + path;
+        return false;
+    }
+
+    // 脚本只含ASCII关键字与数字，逐字节扩展即可（UTF-8注释不影响解析）
+    std::wstring text(content.begin(), content.end());
+    size_t start = 0;
+    int lineNo = 0;
+    while (start < text.size())
+    {
+        size_t end = text.find(L'\n', start);
+        if (end == std::wstring::npos)
+            end = text.size();
+        std::wstring line = Trim(text.substr(start, end - start));
+        start = end + 1;
+        ++lineNo;
+
+        size_t hash = line.find(L'#');
+        if (hash != std::wstring::npos)
+            line = Trim(line.substr(0, hash));
+        if (line.empty())
+            continue;
+
+        wchar_t action[16] = {};
+        unsigned int atMs = 0;
+        unsigned int count = 0;
+        int consumed = 0;
+        if (swscanf_s(line.c_str(), L"%u %15s %u%n", &atMs, action, (unsigned)_countof(action), &count, &consumed) != 3 ||
+            wcscmp(action, L"burst") != 0)
+        {
+            if (err)
+                *err = L"仿真脚本第" + std::to_wstring(lineNo) + L"行格式错误: " + line;
+            return false;
+        }
+
+        Iec104SimStep step;
+        step.atMs = atMs;
+        step.count = count;
+
+        // 可选参数 key=value
+        std::wstring rest = line.substr(consumed);
+        size_t pos = 0;
+        while (pos < rest.size())
+        {
+            size_t next = rest.find_first_of(L" \t", pos);
+            if (next == std::wstring::npos)
+                next = rest.size();
+            std::wstring option = rest.substr(pos, next - pos);
+            pos = next + 1;
+            if (option.empty())
+                continue;
+
+            size_t eq = option.find(L'=');
+            std::wstring key = option.substr(0, eq);
+            DWORD value = (eq == std::wstring::npos) ? 0 : (DWORD)_wtoi(option.c_str() + eq + 1);
+            if (key == L"ca")
+                step.commonAddr = (WORD)value;
+            else if (key == L"every")
+                step.intervalMs = value;
+            else if (key == L"repeat")
+                step.repeat = (std::max)((DWORD)1, value);
+            else
+            {
+                if (err)
+                    *err = L"仿真脚本第" + std::to_wstring(lineNo) + L"行未知参数: " + option;
+                return false;
+            }
+        }
+
+        steps.push_back(step);
+    }
+
+    return true;
+}
+
+CIec104Outstation::CIec104Outstation(const Iec104OutstationConfig &config)
+    : m_config(config), m_codec(&Iec104GetCodec(config.profile)), m_burstCursor(0), m_pendingBurst(0), m_spontHead(0), m_spontCount(0), m_replyHead(0), m_replyCount(0),
+      m_irActive(false), m_irCounters(false), m_irSelect(-1), m_irCot(0), m_irGroup(0), m_irMatched(0), m_irOffset(0),
+      m_listen(INVALID_SOCKET), m_session(INVALID_SOCKET), m_started(false), m_rxLength(0), m_txSent(0), m_tlsTxSent(0),
+      m_sendSeq(0), m_ackSeq(0), m_recvSeq(0), m_unackedRecv(0), m_lastRxMs(0), m_testSentMs(0), m_timers(nullptr),
+      m_clockOffsetMs(config.clockOffsetMs), m_logLevel(Iec104LogLevel::LOG_WARNING)
+{
+    m_config.k = (std::max)(1, (std::min)(m_config.k, 32767));
+    m_config.w = (std::max)(1, m_config.w);
+
+    // 点表按组展开，点数据只在此处分配
+    size_t total = 0;
+    for (const auto &group : m_config.groups)
+    {
+        int elemLen = 0;
+        bool hasTime = false;
+        if (Iec104GetMonitorLayout(group.type, elemLen, hasTime))
+            total += group.count;
+    }
+    m_points.reserve(total);
+
+    for (const auto &group : m_config.groups)
+    {
+        int elemLen = 0;
+        bool hasTime = false;
+        if (!Iec104GetMonitorLayout(group.type, elemLen, hasTime) || group.count == 0)
+            continue;
+
+        SimGroup simGroup;
+        simGroup.type = group.type;
+        simGroup.firstIndex = (DWORD)m_points.size();
+        simGroup.count = group.count;
+        m_groups.push_back(simGroup);
+
+        for (DWORD i = 0; i < group.count; ++i)
+        {
+            SimPoint point = {};
+            point.ioa = (group.firstIoa + i) & 0xFFFFFF;
+            point.type = group.type;
+            m_points.push_back(point);
+        }
+    }
+
+    m_spontQueue.resize((std::max)((size_t)1, m_points.size()));
+    m_replies.resize(REPLY_QUEUE_LEN);
+    m_sendTimes.resize(m_config.k);
+    m_txBuffer.reserve(TX_HIGH_WATER + 4 * IEC104_MAX_APDU_LEN);
+    m_irCommand.length = 0;
+
+    m_t1AckTimer.SetCallback([this] { OnAckTimeout(); });
+    m_t1TestTimer.SetCallback([this] { OnTestTimeout(); });
+    m_t2Timer.SetCallback([this] { OnRecvAckTimeout(); });
+    m_t3Timer.SetCallback([this] { OnIdleTimeout(); });
+}
+
+CIec104Outstation::~CIec104Outstation()
+{
+    Shutdown();
+}
+
+Iec104OutstationStats CIec104Outstation::GetStats() const
+{
+    Iec104OutstationStats stats;
+    stats.connections = m_counters.connections.load(std::memory_order_relaxed);
+    stats.iFramesSent = m_counters.iFramesSent.load(std::memory_order_relaxed);
+    stats.iFramesReceived = m_counters.iFramesReceived.load(std::memory_order_relaxed);
+    stats.pointsSent = m_counters.pointsSent.load(std::memory_order_relaxed);
+    stats.spontaneousPoints = m_counters.spontaneousPoints.load(std::memory_order_relaxed);
+    stats.interrogations = m_counters.interrogations.load(std::memory_order_relaxed);
+    stats.clockCommands = m_counters.clockCommands.load(std::memory_order_relaxed);
+    stats.controlCommands = m_counters.controlCommands.load(std::memory_order_relaxed);
+    stats.testFrames = m_counters.testFrames.load(std::memory_order_relaxed);
+    stats.timeouts = m_counters.timeouts.load(std::memory_order_relaxed);
+    stats.protocolErrors = m_counters.protocolErrors.load(std::memory_order_relaxed);
+    stats.tlsHandshakes = m_counters.tlsHandshakes.load(std::memory_order_relaxed);
+    stats.tlsResumed = m_counters.tlsResumed.load(std::memory_order_relaxed);
+    stats.tlsFailures = m_counters.tlsFailures.load(std::memory_order_relaxed);
+    return stats;
+}
+
+bool CIec104Outstation::Listen(std::wstring *err)
+{
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(m_config.port);
+    if (InetPtonW(AF_INET, m_config.bindAddress.c_str(), &addr.sin_addr) != 1)
+    {
+        if (err)
+            *err = L"无效的监听地址: " + m_config.bindAddress;
+        return false;
+    }
+
+    m_listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (m_listen == INVALID_SOCKET)
+    {
+        if (err)
+            *err = L"创建监听socket失败";
+        return false;
+    }
+
+    u_long nonBlocking = 1;
+    ioctlsocket(m_listen, FIONBIO, &nonBlocking);
+    if (bind(m_listen, (sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR || listen(m_listen, SOMAXCONN) == SOCKET_ERROR)
+    {
+        if (err)
+            *err = L"监听端口失败: " + m_config.bindAddress + L":" + std::to_wstring(m_config.port) + L"，错误码 " + std::to_wstring(WSAGetLastError());
+        closesocket(m_listen);
+        m_listen = INVALID_SOCKET;
+        return false;
+    }
+
+    return true;
+}
+
+int CIec104Outstation::FillPollFds(WSAPOLLFD *fds) const
+{
+    int count = 0;
+    if (m_listen != INVALID_SOCKET)
+    {
+        fds[count].fd = m_listen;
+        fds[count].events = POLLRDNORM;
+        fds[count].revents = 0;
+        ++count;
+    }
+    if (m_session != INVALID_SOCKET)
+    {
+        fds[count].fd = m_session;
+        fds[count].events = POLLRDNORM | (GetTxBacklog() > 0 ? POLLWRNORM : 0);
+        fds[count].revents = 0;
+        ++count;
+    }
+    return count;
+}
+
+void CIec104Outstation::Service(const WSAPOLLFD *fds, int count, ULONGLONG nowMs)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        if (fds[i].revents == 0)
+            continue;
+
+        if (fds[i].fd == m_listen)
+        {
+            Accept(nowMs);
+        }
+        else if (fds[i].fd == m_session && (fds[i].revents & (POLLRDNORM | POLLHUP | POLLERR)) && !ReadSession(nowMs))
+        {
+            CloseSession();
+        }
+    }
+
+    DWORD burst = m_pendingBurst.exchange(0, std::memory_order_relaxed);
+    if (burst > 0)
+    {
+        Burst(burst);
+    }
+
+    if (m_session == INVALID_SOCKET)
+        return;
+
+    Pump(nowMs);
+    if (!Flush())
+    {
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"子站 " + std::to_wstring(m_config.commonAddr) + L" 发送失败，关闭连接");
+        CloseSession();
+    }
+}
+
+void CIec104Outstation::Shutdown()
+{
+    CloseSession();
+    if (m_listen != INVALID_SOCKET)
+    {
+        closesocket(m_listen);
+        m_listen = INVALID_SOCKET;
+    }
+}
+
+void CIec104Outstation::Accept(ULONGLONG nowMs)
+{
+    SOCKET client = accept(m_listen, nullptr, nullptr);
+    if (client == INVALID_SOCKET)
+        return;
+
+    // 被控站同一时刻只服务一个主站连接，新连接替换旧连接
+    if (m_session != INVALID_SOCKET)
+    {
+        IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"子站 " + std::to_wstring(m_config.commonAddr) + L" 收到新连接，替换旧连接");
+        CloseSession();
+    }
+
+    u_long nonBlocking = 1;
+    ioctlsocket(client, FIONBIO, &nonBlocking);
+    BOOL noDelay = TRUE;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+
+    m_session = client;
+    m_lastRxMs = nowMs;
+    m_timers->Arm(m_t3Timer, m_config.t3Ms);
+    if (m_config.tls)
+    {
+        m_tls.Start(m_config.tls.get(), L"");
+    }
+    m_counters.connections.fetch_add(1, std::memory_order_relaxed);
+    IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"子站 " + std::to_wstring(m_config.commonAddr) + L" 接受主站连接");
+}
+
+void CIec104Outstation::CloseSession()
+{
+    if (m_session != INVALID_SOCKET)
+    {
+        closesocket(m_session);
+        m_session = INVALID_SOCKET;
+    }
+
+    // 链路状态随连接复位；点值保留，未发送的突发变化在下次总召中体现
+    m_started = false;
+    m_rxLength = 0;
+    m_txBuffer.clear();
+    m_txSent = 0;
+    m_tls.Reset();
+    m_tlsTx.clear();
+    m_tlsTxSent = 0;
+    m_sendSeq = 0;
+    m_ackSeq = 0;
+    m_recvSeq = 0;
+    m_unackedRecv = 0;
+    m_testSentMs = 0;
+    m_t1AckTimer.Cancel();
+    m_t1TestTimer.Cancel();
+    m_t2Timer.Cancel();
+    m_t3Timer.Cancel();
+    m_replyHead = 0;
+    m_replyCount = 0;
+    m_irActive = false;
+    while (m_spontCount > 0)
+    {
+        m_points[m_spontQueue[m_spontHead]].pending = false;
+        m_spontHead = (m_spontHead + 1) % m_spontQueue.size();
+        --m_spontCount;
+    }
+}
+
+bool CIec104Outstation::ReadSession(ULONGLONG nowMs)
+{
+    // TLS连接先读入密文缓冲，握手完成后解密再切分
+    BYTE cipher[4096];
+    bool tls = m_config.tls != nullptr;
+    for (;;)
+    {
+        char *target = tls ? (char *)cipher : (char *)m_rxBuffer + m_rxLength;
+        int room = tls ? (int)sizeof(cipher) : (int)sizeof(m_rxBuffer) - m_rxLength;
+        int received = recv(m_session, target, room, 0);
+        if (received == 0)
+        {
+            IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"子站 " + std::to_wstring(m_config.commonAddr) + L" 连接被主站关闭");
+            return false;
+        }
+        if (received < 0)
+        {
+            return WSAGetLastError() == WSAEWOULDBLOCK;
+        }
+
+        if (!tls)
+        {
+            m_rxLength += received;
+            if (!SplitFrames(nowMs))
+                return false;
+            continue;
+        }
+
+        if (!m_tls.IsEstablished())
+        {
+            Iec104TlsStatus status = m_tls.Handshake(cipher, received, m_tlsTx);
+            if (status == Iec104TlsStatus::FAILED)
+            {
+                m_counters.tlsFailures.fetch_add(1, std::memory_order_relaxed);
+                IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"子站 " + std::to_wstring(m_config.commonAddr) + L" " + m_tls.GetErrorText());
+                return false;
+            }
+            if (status == Iec104TlsStatus::PENDING)
+                continue;
+
+            m_counters.tlsHandshakes.fetch_add(1, std::memory_order_relaxed);
+            if (m_tls.IsResumed())
+                m_counters.tlsResumed.fetch_add(1, std::memory_order_relaxed);
+            // 握手记录之后的应用数据已留在会话中，下面以空输入解密
+            received = 0;
+        }
+
+        m_tlsRxPlain.clear();
+        Iec104TlsStatus status = m_tls.Decrypt(cipher, received, m_tlsRxPlain);
+        size_t offset = 0;
+        while (offset < m_tlsRxPlain.size())
+        {
+            size_t chunk = (std::min)(sizeof(m_rxBuffer) - m_rxLength, m_tlsRxPlain.size() - offset);
+            memcpy(m_rxBuffer + m_rxLength, m_tlsRxPlain.data() + offset, chunk);
+            m_rxLength += (int)chunk;
+            offset += chunk;
+            if (!SplitFrames(nowMs))
+                return false;
+        }
+
+        if (status == Iec104TlsStatus::CLOSED)
+        {
+            IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"子站 " + std::to_wstring(m_config.commonAddr) + L" TLS会话被主站关闭");
+            return false;
+        }
+        if (status != Iec104TlsStatus::OK)
+        {
+            IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"子站 " + std::to_wstring(m_config.commonAddr) + L" " + m_tls.GetErrorText());
+            return false;
+        }
+    }
+}
+
+bool CIec104Outstation::SplitFrames(ULONGLONG nowMs)
+{
+    int pos = 0;
+    while (m_rxLength - pos >= 2)
+    {
+        if (m_rxBuffer[pos] != IEC104_START_BYTE)
+        {
+            m_counters.protocolErrors.fetch_add(1, std::memory_order_relaxed);
+            IEC104_LOG(LOG_WARNING, IEC104_LOG_FRAME, L"子站 " + std::to_wstring(m_config.commonAddr) + L" 接收失步");
+            return false;
+        }
+
+        int apduLen = m_rxBuffer[pos + 1] + 2;
+        if (m_rxLength - pos < apduLen)
+            break;
+
+        if (!HandleFrame(&m_rxBuffer[pos], apduLen, nowMs))
+            return false;
+        pos += apduLen;
+    }
+
+    if (pos > 0)
+    {
+        memmove(m_rxBuffer, m_rxBuffer + pos, m_rxLength - pos);
+        m_rxLength -= pos;
+    }
+    return true;
+}
+
+bool CIec104Outstation::HandleFrame(const BYTE *frame, int length, ULONGLONG nowMs)
+{
+    if (length < 6)
+    {
+        m_counters.protocolErrors.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    m_lastRxMs = nowMs;
+    BYTE control0 = frame[2];
+
+    if ((control0 & 0x01) == 0)
+    {
+        // I帧：检查发送序号连续，处理捎带确认
+        WORD sendSeq = ((WORD)frame[3] << 7) | (frame[2] >> 1);
+        WORD ackSeq = ((WORD)frame[5] << 7) | (frame[4] >> 1);
+        if (sendSeq != m_recvSeq)
+        {
+            m_counters.protocolErrors.fetch_add(1, std::memory_order_relaxed);
+            IEC104_LOG(LOG_WARNING, IEC104_LOG_FRAME, L"子站 " + std::to_wstring(m_config.commonAddr) + L" 接收序号错误，期望 " +
+                                                         std::to_wstring(m_recvSeq) + L"，收到 " + std::to_wstring(sendSeq));
+            return false;
+        }
+        if (!Acknowledge(ackSeq))
+            return false;
+
+        m_recvSeq = (m_recvSeq + 1) % 32768;
+        if (m_unackedRecv++ == 0)
+            m_timers->Arm(m_t2Timer, m_config.t2Ms);
+        m_counters.iFramesReceived.fetch_add(1, std::memory_order_relaxed);
+
+        if (length > 6)
+            HandleAsdu(frame + 6, length - 6);
+
+        if (m_unackedRecv >= m_config.w)
+            SendSFrame();
+        return true;
+    }
+
+    if ((control0 & 0x03) == 0x01)
+    {
+        WORD ackSeq = ((WORD)frame[5] << 7) | (frame[4] >> 1);
+        return Acknowledge(ackSeq);
+    }
+
+    switch ((Iec104UFunction)control0)
+    {
+    case Iec104UFunction::STARTDT_ACT:
+        m_started = true;
+        SendUFrame(Iec104UFunction::STARTDT_CON);
+        IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"子站 " + std::to_wstring(m_config.commonAddr) + L" 数据传输已启动");
+        break;
+
+    case Iec104UFunction::STOPDT_ACT:
+        m_started = false;
+        SendUFrame(Iec104UFunction::STOPDT_CON);
+        break;
+
+    case Iec104UFunction::TESTFR_ACT:
+        m_counters.testFrames.fetch_add(1, std::memory_order_relaxed);
+        SendUFrame(Iec104UFunction::TESTFR_CON);
+        break;
+
+    case Iec104UFunction::TESTFR_CON:
+        m_testSentMs = 0;
+        m_t1TestTimer.Cancel();
+        break;
+
+    default:
+        m_counters.protocolErrors.fetch_add(1, std::memory_order_relaxed);
+        break;
+    }
+    return true;
+}
+
+bool CIec104Outstation::Acknowledge(WORD ackSeq)
+{
+    // 确认序号必须落在 [已确认, 已发送] 区间内
+    WORD outstanding = (m_sendSeq - m_ackSeq) & 0x7FFF;
+    WORD acked = (ackSeq - m_ackSeq) & 0x7FFF;
+    if (acked > outstanding)
+    {
+        m_counters.protocolErrors.fetch_add(1, std::memory_order_relaxed);
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_FRAME, L"子站 " + std::to_wstring(m_config.commonAddr) + L" 收到非法确认序号 " + std::to_wstring(ackSeq));
+        return false;
+    }
+
+    m_ackSeq = ackSeq;
+    return true;
+}
+
+void CIec104Outstation::HandleAsdu(const BYTE *asdu, int length)
+{
+    // 信息元素在ASDU中的偏移：头 + IOA
+    const int elementOffset = m_codec->headerLen + m_codec->ioaLen;
+    if (length < elementOffset)
+    {
+        m_counters.protocolErrors.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Iec104AsduHeader header;
+    m_codec->getHeader(asdu, header);
+    BYTE type = header.typeId;
+    BYTE cot = header.cot & 0x3F;
+
+    if (header.commonAddr != m_config.commonAddr && header.commonAddr != 0xFFFF)
+    {
+        QueueReply(asdu, length, (BYTE)Iec104Cot::UNKNOWN_CA | IEC104_COT_NEGATIVE);
+        return;
+    }
+
+    switch ((Iec104TypeId)type)
+    {
+    case Iec104TypeId::C_IC_NA_1:
+    {
+        BYTE qoi = length > elementOffset ? asdu[elementOffset] : QOI_STATION;
+        if (cot != (BYTE)Iec104Cot::ACTIVATION || qoi < QOI_STATION || qoi > QOI_STATION + 16)
+        {
+            QueueReply(asdu, length, (BYTE)Iec104Cot::UNKNOWN_COT | IEC104_COT_NEGATIVE);
+            break;
+        }
+        QueueReply(asdu, length, (BYTE)Iec104Cot::ACTIVATION_CON);
+        StartInterrogation(asdu, length, false, qoi == QOI_STATION ? -1 : qoi - QOI_STATION - 1, qoi);
+        break;
+    }
+
+    case Iec104TypeId::C_CI_NA_1:
+    {
+        BYTE rqt = length > elementOffset ? (asdu[elementOffset] & 0x3F) : QCC_GENERAL;
+        if (cot != (BYTE)Iec104Cot::ACTIVATION || rqt < 1 || rqt > QCC_GENERAL)
+        {
+            QueueReply(asdu, length, (BYTE)Iec104Cot::UNKNOWN_COT | IEC104_COT_NEGATIVE);
+            break;
+        }
+        QueueReply(asdu, length, (BYTE)Iec104Cot::ACTIVATION_CON);
+        StartInterrogation(asdu, length, true, rqt == QCC_GENERAL ? -1 : rqt - 1,
+                           (BYTE)Iec104Cot::COUNTER_INTERROGATED + (rqt == QCC_GENERAL ? 0 : rqt));
+        break;
+    }
+
+    case Iec104TypeId::C_CS_NA_1:
+    {
+        // 应答携带子站当前时钟
+        BYTE reply[IEC104_MAX_ASDU_LEN];
+        const int replyLen = elementOffset + (int)sizeof(Iec104CP56Time);
+        memcpy(reply, asdu, elementOffset);
+        if (cot == (BYTE)Iec104Cot::ACTIVATION && length >= replyLen)
+        {
+            Iec104CP56Time cp56;
+            memcpy(&cp56, asdu + elementOffset, sizeof(cp56));
+            INT64 targetMs = CIec104Master::SystemTimeToEpochMs(CIec104Master::CP56ToSystemTime(cp56));
+            if (targetMs == 0)
+            {
+                QueueReply(asdu, length, (BYTE)Iec104Cot::ACTIVATION_CON | IEC104_COT_NEGATIVE);
+                break;
+            }
+            m_clockOffsetMs = targetMs - LocalNowMs();
+            m_counters.clockCommands.fetch_add(1, std::memory_order_relaxed);
+            IEC104_LOG(LOG_DEBUG, IEC104_LOG_CLOCK, L"子站 " + std::to_wstring(m_config.commonAddr) + L" 时钟已设置，偏差 " + std::to_wstring(m_clockOffsetMs) + L"ms");
+            cot = (BYTE)Iec104Cot::ACTIVATION_CON;
+        }
+        else if (cot == (BYTE)Iec104Cot::REQUEST)
+        {
+            m_counters.clockCommands.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            QueueReply(asdu, length, (BYTE)Iec104Cot::UNKNOWN_COT | IEC104_COT_NEGATIVE);
+            break;
+        }
+
+        Iec104CP56Time now = CIec104Master::SystemTimeToCP56(GetStationTime());
+        memcpy(reply + elementOffset, &now, sizeof(now));
+        QueueReply(reply, replyLen, cot);
+        break;
+    }
+
+    case Iec104TypeId::C_SC_NA_1:
+    case Iec104TypeId::C_DC_NA_1:
+    case Iec104TypeId::C_SE_NA_1:
+    case Iec104TypeId::C_SE_NB_1:
+    case Iec104TypeId::C_SE_NC_1:
+        HandleControl(asdu, length, cot);
+        break;
+
+    case Iec104TypeId::C_RD_NA_1:
+        HandleRead(asdu, length, cot);
+        break;
+
+    case Iec104TypeId::C_CD_NA_1:
+        // 延时获得：激活时镜像确认（主站据此计算往返时间）；传送延时值（COT=3）只接收不应答
+        if (cot == (BYTE)Iec104Cot::ACTIVATION)
+        {
+            m_counters.clockCommands.fetch_add(1, std::memory_order_relaxed);
+            QueueReply(asdu, length, (BYTE)Iec104Cot::ACTIVATION_CON);
+        }
+        else if (cot != (BYTE)Iec104Cot::SPONTANEOUS)
+        {
+            QueueReply(asdu, length, (BYTE)Iec104Cot::UNKNOWN_COT | IEC104_COT_NEGATIVE);
+        }
+        break;
+
+    default:
+        QueueReply(asdu, length, (BYTE)Iec104Cot::UNKNOWN_TYPE | IEC104_COT_NEGATIVE);
+        break;
+    }
+}
+
+void CIec104Outstation::HandleControl(const BYTE *asdu, int length, BYTE cot)
+{
+    // 仿真子站接受任意IOA的控制命令：选择只确认，执行确认后立即终止
+    bool select = (asdu[length - 1] & 0x80) != 0;
+    if (cot == (BYTE)Iec104Cot::ACTIVATION)
+    {
+        m_counters.controlCommands.fetch_add(1, std::memory_order_relaxed);
+        QueueReply(asdu, length, (BYTE)Iec104Cot::ACTIVATION_CON);
+        if (!select)
+        {
+            QueueReply(asdu, length, (BYTE)Iec104Cot::ACTIVATION_TERM);
+        }
+    }
+    else if (cot == (BYTE)Iec104Cot::DEACTIVATION)
+    {
+        QueueReply(asdu, length, (BYTE)Iec104Cot::DEACTIVATION_CON);
+    }
+    else
+    {
+        QueueReply(asdu, length, (BYTE)Iec104Cot::UNKNOWN_COT | IEC104_COT_NEGATIVE);
+    }
+}
+
+void CIec104Outstation::HandleRead(const BYTE *asdu, int length, BYTE cot)
+{
+    if (cot != (BYTE)Iec104Cot::REQUEST)
+    {
+        QueueReply(asdu, length, (BYTE)Iec104Cot::UNKNOWN_COT | IEC104_COT_NEGATIVE);
+        return;
+    }
+
+    DWORD ioa = m_codec->getIoa(asdu + m_codec->headerLen);
+    int index = FindPoint(ioa);
+    if (index < 0)
+    {
+        QueueReply(asdu, length, (BYTE)Iec104Cot::UNKNOWN_IOA | IEC104_COT_NEGATIVE);
+        return;
+    }
+
+    // 以点的监视类型应答单个信息对象，传送原因为请求
+    const SimPoint &point = m_points[index];
+    int elemLen = 0;
+    bool hasTime = false;
+    Iec104GetMonitorLayout(point.type, elemLen, hasTime);
+
+    BYTE reply[IEC104_MAX_ASDU_LEN];
+    BYTE *p = reply + m_codec->headerLen;
+    m_codec->putIoa(p, ioa);
+    p += m_codec->ioaLen;
+    p += Iec104EncodeMonitorElement(point.type, point.quality, point.value, p);
+    if (hasTime)
+    {
+        Iec104CP56Time cp56 = CIec104Master::SystemTimeToCP56(GetStationTime());
+        memcpy(p, &cp56, sizeof(cp56));
+        p += sizeof(cp56);
+    }
+    PutAsduHeader(*m_codec, reply, point.type, 1, false, (BYTE)Iec104Cot::REQUEST, m_config.commonAddr);
+    m_counters.controlCommands.fetch_add(1, std::memory_order_relaxed);
+    QueueReply(reply, (int)(p - reply), (BYTE)Iec104Cot::REQUEST);
+}
+
+int CIec104Outstation::FindPoint(DWORD ioa) const
+{
+    // 组内IOA连续
+    for (const SimGroup &group : m_groups)
+    {
+        if (group.count == 0)
+            continue;
+        DWORD firstIoa = m_points[group.firstIndex].ioa;
+        if (ioa >= firstIoa && ioa - firstIoa < group.count)
+            return (int)(group.firstIndex + (ioa - firstIoa));
+    }
+    return -1;
+}
+
+void CIec104Outstation::OnAckTimeout()
+{
+    // t1：最早未确认I帧超时未被确认，关闭连接；期间有确认时按新的最早帧重新设置
+    if (m_sendSeq == m_ackSeq)
+        return;
+    ULONGLONG elapsedMs = m_timers->GetNowMs() - m_sendTimes[m_ackSeq % m_config.k];
+    if (elapsedMs < m_config.t1Ms)
+    {
+        m_timers->Arm(m_t1AckTimer, m_config.t1Ms - elapsedMs);
+        return;
+    }
+
+    m_counters.timeouts.fetch_add(1, std::memory_order_relaxed);
+    IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"子站 " + std::to_wstring(m_config.commonAddr) + L" t1超时：I帧未被确认");
+    CloseSession();
+}
+
+void CIec104Outstation::OnTestTimeout()
+{
+    if (m_testSentMs == 0)
+        return;
+
+    m_counters.timeouts.fetch_add(1, std::memory_order_relaxed);
+    IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"子站 " + std::to_wstring(m_config.commonAddr) + L" t1超时：测试帧未被确认");
+    CloseSession();
+}
+
+void CIec104Outstation::OnRecvAckTimeout()
+{
+    // t2：收到的I帧最迟在t2内确认，S帧随本轮 Service 发出
+    if (m_unackedRecv > 0)
+        SendSFrame();
+}
+
+void CIec104Outstation::OnIdleTimeout()
+{
+    // t3：接收时只记录时刻，到期时按实际空闲时间决定发送测试帧或顺延
+    ULONGLONG nowMs = m_timers->GetNowMs();
+    ULONGLONG idleMs = nowMs - m_lastRxMs;
+    if (idleMs < m_config.t3Ms)
+    {
+        m_timers->Arm(m_t3Timer, m_config.t3Ms - idleMs);
+        return;
+    }
+
+    if (m_testSentMs == 0)
+    {
+        SendUFrame(Iec104UFunction::TESTFR_ACT);
+        m_testSentMs = nowMs;
+        m_timers->Arm(m_t1TestTimer, m_config.t1Ms);
+    }
+    m_lastRxMs = nowMs;
+    m_timers->Arm(m_t3Timer, m_config.t3Ms);
+}
+
+void CIec104Outstation::Pump(ULONGLONG nowMs)
+{
+    // 按应答、召唤、突发的优先级生成I帧，受k窗口与发送缓冲积压限制
+    while (m_started && ((m_sendSeq - m_ackSeq) & 0x7FFF) < m_config.k && GetTxBacklog() < TX_HIGH_WATER)
+    {
+        if (m_replyCount > 0)
+        {
+            const PendingAsdu &reply = m_replies[m_replyHead];
+            SendIFrame(reply.data, reply.length, nowMs);
+            m_replyHead = (m_replyHead + 1) % m_replies.size();
+            --m_replyCount;
+        }
+        else if (m_irActive)
+        {
+            EmitInterrogation(nowMs);
+        }
+        else if (m_spontCount > 0)
+        {
+            EmitSpontaneous(nowMs);
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+bool CIec104Outstation::Flush()
+{
+    if (m_config.tls)
+    {
+        return FlushTls();
+    }
+
+    while (m_txSent < m_txBuffer.size())
+    {
+        int sent = send(m_session, (const char *)m_txBuffer.data() + m_txSent, (int)(m_txBuffer.size() - m_txSent), 0);
+        if (sent == SOCKET_ERROR)
+        {
+            return WSAGetLastError() == WSAEWOULDBLOCK;
+        }
+        m_txSent += sent;
+    }
+
+    m_txBuffer.clear();
+    m_txSent = 0;
+    return true;
+}
+
+bool CIec104Outstation::FlushTls()
+{
+    // 一次 Pump 生成的帧整批加密，合并为尽量少的TLS记录；握手完成前的帧留待握手后发送
+    if (m_tls.IsEstablished() && m_txSent < m_txBuffer.size())
+    {
+        if (m_tlsTxSent > 0)
+        {
+            m_tlsTx.erase(m_tlsTx.begin(), m_tlsTx.begin() + m_tlsTxSent);
+            m_tlsTxSent = 0;
+        }
+        if (!m_tls.Encrypt(m_txBuffer.data() + m_txSent, m_txBuffer.size() - m_txSent, m_tlsTx))
+        {
+            IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"子站 " + std::to_wstring(m_config.commonAddr) + L" " + m_tls.GetErrorText());
+            return false;
+        }
+        m_txBuffer.clear();
+        m_txSent = 0;
+    }
+
+    while (m_tlsTxSent < m_tlsTx.size())
+    {
+        int sent = send(m_session, (const char *)m_tlsTx.data() + m_tlsTxSent, (int)(m_tlsTx.size() - m_tlsTxSent), 0);
+        if (sent == SOCKET_ERROR)
+        {
+            return WSAGetLastError() == WSAEWOULDBLOCK;
+        }
+        m_tlsTxSent += sent;
+    }
+
+    m_tlsTx.clear();
+    m_tlsTxSent = 0;
+    return true;
+}
+
+void CIec104Outstation::AppendFrame(const BYTE *frame, int length)
+{
+    // 已发出部分较多时先压缩缓冲区，避免容量增长
+    if (m_txSent > 0 && m_txSent >= m_txBuffer.size() / 2)
+    {
+        m_txBuffer.erase(m_txBuffer.begin(), m_txBuffer.begin() + m_txSent);
+        m_txSent = 0;
+    }
+    m_txBuffer.insert(m_txBuffer.end(), frame, frame + length);
+}
+
+void CIec104Outstation::SendIFrame(const BYTE *asdu, int length, ULONGLONG nowMs)
+{
+    BYTE frame[IEC104_MAX_APDU_LEN];
+    frame[0] = IEC104_START_BYTE;
+    frame[1] = (BYTE)(length + 4);
+    frame[2] = (m_sendSeq << 1) & 0xFF;
+    frame[3] = (m_sendSeq >> 7) & 0xFF;
+    frame[4] = (m_recvSeq << 1) & 0xFF;
+    frame[5] = (m_recvSeq >> 7) & 0xFF;
+    memcpy(frame + 6, asdu, length);
+    AppendFrame(frame, length + 6);
+
+    // I帧捎带确认
+    m_sendTimes[m_sendSeq % m_config.k] = nowMs;
+    m_sendSeq = (m_sendSeq + 1) % 32768;
+    m_unackedRecv = 0;
+    m_t2Timer.Cancel();
+    if (!m_t1AckTimer.IsArmed())
+        m_timers->Arm(m_t1AckTimer, m_config.t1Ms);
+    m_counters.iFramesSent.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CIec104Outstation::SendSFrame()
+{
+    BYTE frame[6] = { IEC104_START_BYTE, 4, 0x01, 0x00, (BYTE)((m_recvSeq << 1) & 0xFF), (BYTE)((m_recvSeq >> 7) & 0xFF) };
+    AppendFrame(frame, sizeof(frame));
+    m_unackedRecv = 0;
+    m_t2Timer.Cancel();
+}
+
+void CIec104Outstation::SendUFrame(Iec104UFunction function)
+{
+    BYTE frame[6] = { IEC104_START_BYTE, 4, (BYTE)function, 0x00, 0x00, 0x00 };
+    AppendFrame(frame, sizeof(frame));
+}
+
+void CIec104Outstation::QueueReply(const BYTE *asdu, int length, BYTE cot)
+{
+    if (m_replyCount == m_replies.size() || length > IEC104_MAX_ASDU_LEN)
+    {
+        IEC104_LOG(LOG_WARNING, IEC104_LOG_CMD, L"子站 " + std::to_wstring(m_config.commonAddr) + L" 应答队列已满，丢弃应答");
+        return;
+    }
+
+    // 镜像命令ASDU，替换传送原因并填写本站公共地址（保留源发站地址）
+    PendingAsdu &reply = m_replies[(m_replyHead + m_replyCount) % m_replies.size()];
+    memcpy(reply.data, asdu, length);
+    Iec104AsduHeader header;
+    m_codec->getHeader(asdu, header);
+    header.cot = cot | (header.cot & IEC104_COT_TEST);
+    header.commonAddr = m_config.commonAddr;
+    m_codec->putHeader(reply.data, header);
+    reply.length = length;
+    ++m_replyCount;
+}
+
+void CIec104Outstation::StartInterrogation(const BYTE *asdu, int length, bool counters, int select, BYTE cot)
+{
+    // 新的召唤替换尚未完成的召唤
+    m_irActive = true;
+    m_irCounters = counters;
+    m_irSelect = select;
+    m_irCot = cot;
+    m_irGroup = 0;
+    m_irMatched = 0;
+    m_irOffset = 0;
+    memcpy(m_irCommand.data, asdu, length);
+    m_irCommand.length = length;
+    m_counters.interrogations.fetch_add(1, std::memory_order_relaxed);
+    IEC104_LOG(LOG_DEBUG, IEC104_LOG_CMD, L"子站 " + std::to_wstring(m_config.commonAddr) + L" 开始召唤，原因 " + std::to_wstring(cot));
+}
+
+void CIec104Outstation::EmitInterrogation(ULONGLONG nowMs)
+{
+    // 跳过不参与本次召唤的组：总召只含非计数量，电能量召唤只含计数量
+    while (m_irGroup < m_groups.size())
+    {
+        const SimGroup &group = m_groups[m_irGroup];
+        if (IsCounterType(group.type) == m_irCounters)
+        {
+            if (m_irSelect < 0 || (int)m_irMatched == m_irSelect)
+                break;
+            ++m_irMatched;
+        }
+        ++m_irGroup;
+        m_irOffset = 0;
+    }
+
+    if (m_irGroup >= m_groups.size())
+    {
+        m_irActive = false;
+        QueueReply(m_irCommand.data, m_irCommand.length, (BYTE)Iec104Cot::ACTIVATION_TERM);
+        return;
+    }
+
+    // 组内IOA连续，使用SQ=1顺序信息体
+    const SimGroup &group = m_groups[m_irGroup];
+    BYTE type = Iec104GetUntimedType(group.type);
+    int elemLen = 0;
+    bool hasTime = false;
+    Iec104GetMonitorLayout(type, elemLen, hasTime);
+    int objectsMaxLen = IEC104_MAX_ASDU_LEN - m_codec->headerLen;
+    DWORD count = (std::min)((DWORD)(std::min)(127, (objectsMaxLen - m_codec->ioaLen) / elemLen), group.count - m_irOffset);
+
+    BYTE asdu[IEC104_MAX_ASDU_LEN];
+    BYTE *p = asdu + m_codec->headerLen;
+    m_codec->putIoa(p, m_points[group.firstIndex + m_irOffset].ioa);
+    p += m_codec->ioaLen;
+    for (DWORD i = 0; i < count; ++i)
+    {
+        const SimPoint &point = m_points[group.firstIndex + m_irOffset + i];
+        p += Iec104EncodeMonitorElement(type, point.quality, point.value, p);
+    }
+    PutAsduHeader(*m_codec, asdu, type, count, true, m_irCot, m_config.commonAddr);
+    SendIFrame(asdu, (int)(p - asdu), nowMs);
+    m_counters.pointsSent.fetch_add(count, std::memory_order_relaxed);
+
+    m_irOffset += count;
+    if (m_irOffset >= group.count)
+    {
+        ++m_irMatched;
+        ++m_irGroup;
+        m_irOffset = 0;
+    }
+}
+
+void CIec104Outstation::EmitSpontaneous(ULONGLONG nowMs)
+{
+    // 队首连续的同类型变化打包为一个SQ=0的ASDU
+    BYTE type = m_points[m_spontQueue[m_spontHead]].type;
+    int elemLen = 0;
+    bool hasTime = false;
+    Iec104GetMonitorLayout(type, elemLen, hasTime);
+    int objLen = m_codec->ioaLen + elemLen + (hasTime ? (int)sizeof(Iec104CP56Time) : 0);
+    int maxCount = (std::min)(127, (IEC104_MAX_ASDU_LEN - m_codec->headerLen) / objLen);
+
+    Iec104CP56Time cp56 = {};
+    if (hasTime)
+        cp56 = CIec104Master::SystemTimeToCP56(GetStationTime());
+
+    BYTE asdu[IEC104_MAX_ASDU_LEN];
+    BYTE *p = asdu + m_codec->headerLen;
+    int count = 0;
+    while (m_spontCount > 0 && count < maxCount)
+    {
+        SimPoint &point = m_points[m_spontQueue[m_spontHead]];
+        if (point.type != type)
+            break;
+
+        m_codec->putIoa(p, point.ioa);
+        p += m_codec->ioaLen;
+        p += Iec104EncodeMonitorElement(type, point.quality, point.value, p);
+        if (hasTime)
+        {
+            memcpy(p, &cp56, sizeof(cp56));
+            p += sizeof(cp56);
+        }
+
+        point.pending = false;
+        m_spontHead = (m_spontHead + 1) % m_spontQueue.size();
+        --m_spontCount;
+        ++count;
+    }
+
+    PutAsduHeader(*m_codec, asdu, type, count, false, (BYTE)Iec104Cot::SPONTANEOUS, m_config.commonAddr);
+    SendIFrame(asdu, (int)(p - asdu), nowMs);
+    m_counters.pointsSent.fetch_add(count, std::memory_order_relaxed);
+    m_counters.spontaneousPoints.fetch_add(count, std::memory_order_relaxed);
+    if (m_sendHook)
+    {
+        m_sendHook(type, count);
+    }
+}
+
+void CIec104Outstation::Burst(DWORD count)
+{
+    if (m_points.empty())
+        return;
+
+    // 按点轮转改变数值；未启动数据传输时只改变数值，不产生突发报文
+    bool queue = m_started;
+    for (DWORD i = 0; i < count; ++i)
+    {
+        DWORD index = m_burstCursor;
+        m_burstCursor = (m_burstCursor + 1) % (DWORD)m_points.size();
+
+        SimPoint &point = m_points[index];
+        point.value = NextValue(point.type, point.value);
+        if (queue && !point.pending)
+        {
+            point.pending = true;
+            m_spontQueue[(m_spontHead + m_spontCount) % m_spontQueue.size()] = index;
+            ++m_spontCount;
+        }
+    }
+}
+
+SYSTEMTIME CIec104Outstation::GetStationTime() const
+{
+    FILETIME utc, local;
+    GetSystemTimePreciseAsFileTime(&utc);
+    FileTimeToLocalFileTime(&utc, &local);
+
+    ULARGE_INTEGER uli;
+    uli.LowPart = local.dwLowDateTime;
+    uli.HighPart = local.dwHighDateTime;
+    uli.QuadPart += m_clockOffsetMs * 10000;
+    local.dwLowDateTime = uli.LowPart;
+    local.dwHighDateTime = uli.HighPart;
+
+    SYSTEMTIME st = {};
+    FileTimeToSystemTime(&local, &st);
+    return st;
+}
+
+INT64 CIec104Outstation::LocalNowMs()
+{
+    FILETIME utc, local;
+    GetSystemTimePreciseAsFileTime(&utc);
+    FileTimeToLocalFileTime(&utc, &local);
+
+    ULARGE_INTEGER uli;
+    uli.LowPart = local.dwLowDateTime;
+    uli.HighPart = local.dwHighDateTime;
+    return (INT64)(uli.QuadPart - FILETIME_UNIX_EPOCH) / 10000;
+}
+
+void CIec104Outstation::LogEvent(const std::wstring &message)
+{
+    if (m_eventCallback)
+    {
+        m_eventCallback(message);
+    }
+}
+
+CIec104SimServer::CIec104SimServer()
+    : m_stop(false), m_logLevel(Iec104LogLevel::LOG_WARNING), m_winsockReady(false)
+{
+    WSADATA wsaData;
+    m_winsockReady = WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+}
+
+CIec104SimServer::~CIec104SimServer()
+{
+    Stop();
+    m_stations.clear();
+    if (m_winsockReady)
+    {
+        WSACleanup();
+    }
+}
+
+CIec104Outstation &CIec104SimServer::AddStation(const Iec104OutstationConfig &config)
+{
+    m_stations.emplace_back(new CIec104Outstation(config));
+    return *m_stations.back();
+}
+
+bool CIec104SimServer::Start(int threadCount, std::wstring *err)
+{
+    if (IsRunning() || m_stations.empty())
+    {
+        if (err)
+            *err = IsRunning() ? L"仿真服务已在运行" : L"没有配置仿真子站";
+        return false;
+    }
+
+    for (auto &station : m_stations)
+    {
+        station->SetEventCallback(m_eventCallback);
+        station->SetLogLevel(m_logLevel);
+        if (!station->Listen(err))
+        {
+            for (auto &opened : m_stations)
+                opened->Shutdown();
+            return false;
+        }
+    }
+
+    size_t workers = (std::max)((size_t)1, (std::min)((size_t)(std::max)(threadCount, 1), m_stations.size()));
+    m_stop = false;
+    for (size_t i = 0; i < workers; ++i)
+    {
+        m_workers.emplace_back(&CIec104SimServer::WorkerProc, this, i, workers);
+    }
+    return true;
+}
+
+void CIec104SimServer::Stop()
+{
+    m_stop = true;
+    for (auto &worker : m_workers)
+    {
+        if (worker.joinable())
+            worker.join();
+    }
+    m_workers.clear();
+}
+
+Iec104OutstationStats CIec104SimServer::GetTotals() const
+{
+    Iec104OutstationStats totals;
+    for (const auto &station : m_stations)
+    {
+        Iec104OutstationStats stats = station->GetStats();
+        totals.connections += stats.connections;
+        totals.iFramesSent += stats.iFramesSent;
+        totals.iFramesReceived += stats.iFramesReceived;
+        totals.pointsSent += stats.pointsSent;
+        totals.spontaneousPoints += stats.spontaneousPoints;
+        totals.interrogations += stats.interrogations;
+        totals.clockCommands += stats.clockCommands;
+        totals.controlCommands += stats.controlCommands;
+        totals.testFrames += stats.testFrames;
+        totals.timeouts += stats.timeouts;
+        totals.protocolErrors += stats.protocolErrors;
+        totals.tlsHandshakes += stats.tlsHandshakes;
+        totals.tlsResumed += stats.tlsResumed;
+        totals.tlsFailures += stats.tlsFailures;
+    }
+    return totals;
+}
+
+void CIec104SimServer::WorkerProc(size_t worker, size_t workerCount)
+{
+    // 子站按下标分配给工作线程，每个子站只由一个线程访问
+    std::vector<CIec104Outstation *> stations;
+    for (size_t i = worker; i < m_stations.size(); i += workerCount)
+    {
+        stations.push_back(m_stations[i].get());
+    }
+
+    std::vector<WSAPOLLFD> fds(stations.size() * 2);
+    std::vector<int> fdCounts(stations.size());
+    ULONGLONG startMs = GetTickCount64();
+
+    // 本线程子站的链路定时器与脚本步骤共用一个时间轮
+    CTimerWheel wheel(startMs);
+    for (auto *station : stations)
+    {
+        station->m_timers = &wheel;
+    }
+
+    // 脚本步骤按 atMs + n*intervalMs 的绝对时刻设置，执行慢时不累积误差
+    std::vector<std::unique_ptr<CWheelTimer>> stepTimers;
+    std::vector<DWORD> fired(m_script.size(), 0);
+    for (size_t s = 0; s < m_script.size(); ++s)
+    {
+        if (m_script[s].repeat == 0)
+            continue;
+        stepTimers.emplace_back(new CWheelTimer());
+        CWheelTimer *timer = stepTimers.back().get();
+        timer->SetCallback([this, s, timer, startMs, &wheel, &fired, &stations] {
+            const Iec104SimStep &step = m_script[s];
+            for (auto *station : stations)
+            {
+                if (step.commonAddr == 0 || step.commonAddr == station->GetCommonAddr())
+                    station->RequestBurst(step.count);
+            }
+            if (++fired[s] < step.repeat)
+                wheel.ArmAt(*timer, startMs + step.atMs + (ULONGLONG)fired[s] * step.intervalMs);
+        });
+        wheel.ArmAt(*timer, startMs + m_script[s].atMs);
+    }
+
+    while (!m_stop)
+    {
+        int total = 0;
+        for (size_t i = 0; i < stations.size(); ++i)
+        {
+            fdCounts[i] = stations[i]->FillPollFds(&fds[total]);
+            total += fdCounts[i];
+        }
+
+        // 突发请求由其他线程提交，不产生套接字事件，等待时长不超过 POLL_TIMEOUT_MS
+        int waitMs = (int)wheel.GetNextTimeoutMs(POLL_TIMEOUT_MS);
+        if (WSAPoll(fds.data(), total, waitMs) == SOCKET_ERROR)
+        {
+            Sleep(waitMs);
+        }
+
+        ULONGLONG nowMs = GetTickCount64();
+
+        // 到期的链路定时器（测试帧、S帧在随后的 Service 中发出）与脚本步骤
+        wheel.Advance(nowMs);
+
+        int offset = 0;
+        for (size_t i = 0; i < stations.size(); ++i)
+        {
+            stations[i]->Service(&fds[offset], fdCounts[i], nowMs);
+            offset += fdCounts[i];
+        }
+    }
+
+    for (auto *station : stations)
+    {
+        station->Shutdown();
+        station->m_timers = nullptr;
+    }
+}
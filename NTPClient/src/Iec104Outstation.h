@@ -0,0 +1,282 @@
+﻿#pragma once
+#include "Iec104Master.h"
+#include <memory>
+
+// 仿真点组：同一类型、IOA连续的一组点
+struct Iec104SimPointGroup
+{
+    BYTE type;
+    DWORD firstIoa;
+    DWORD count;
+};
+
+// 仿真子站配置
+struct Iec104OutstationConfig
+{
+    std::wstring bindAddress = L"127.0.0.1";
+    WORD port = IEC104_DEFAULT_PORT;
+    WORD commonAddr = 1;
+    Iec104LinkProfile profile;               // 传送原因/公共地址/IOA字节数，仿真非标准配置的网关
+    std::vector<Iec104SimPointGroup> groups;
+    int k = 12;                              // 未被确认的I帧上限
+    int w = 8;                               // 收到w个I帧后立即确认
+    DWORD t1Ms = IEC104_T1_TIMEOUT_MS;
+    DWORD t2Ms = IEC104_T2_TIMEOUT_MS;
+    DWORD t3Ms = IEC104_T3_TIMEOUT_MS;
+    INT64 clockOffsetMs = 0;                 // 子站时钟相对本机时钟的初始偏差
+    std::shared_ptr<CIec104TlsCredentials> tls;   // 服务端凭据，非空时只接受TLS连接（各子站可共用）
+};
+
+// 仿真子站统计
+struct Iec104OutstationStats
+{
+    UINT64 connections = 0;
+    UINT64 iFramesSent = 0;
+    UINT64 iFramesReceived = 0;
+    UINT64 pointsSent = 0;
+    UINT64 spontaneousPoints = 0;
+    UINT64 interrogations = 0;
+    UINT64 clockCommands = 0;
+    UINT64 controlCommands = 0;              // 遥控/设点/读命令
+    UINT64 testFrames = 0;
+    UINT64 timeouts = 0;                     // t1超时断开次数
+    UINT64 protocolErrors = 0;
+    UINT64 tlsHandshakes = 0;
+    UINT64 tlsResumed = 0;                   // 其中恢复缓存会话的简化握手
+    UINT64 tlsFailures = 0;
+};
+
+// 仿真脚本步骤：在 atMs 时刻向子站（commonAddr=0 表示全部）注入 count 个突发变化，
+// 可每隔 intervalMs 重复，共执行 repeat 次
+struct Iec104SimStep
+{
+    DWORD atMs = 0;
+    WORD commonAddr = 0;
+    DWORD count = 0;
+    DWORD intervalMs = 0;
+    DWORD repeat = 1;
+};
+
+// 突发ASDU生成回调（工作线程中调用）：类型、信息对象数
+using Iec104SimSendHook = std::function<void(BYTE type, int count)>;
+
+// 读取仿真脚本，每行格式：<时刻ms> burst <点数> [ca=<公共地址>] [every=<间隔ms>] [repeat=<次数>]，#开头为注释
+bool Iec104LoadSimScript(const std::wstring& path, std::vector<Iec104SimStep>& steps, std::wstring* err = nullptr);
+
+// IEC 104 仿真子站（被控站）
+// - 与主站共用 Iec104Master.h 中的APCI/ASDU定义
+// - 一个子站监听一个端口，同时只保持一个主站连接（新连接替换旧连接）
+// - 支持STARTDT/STOPDT/TESTFR、k/w窗口与t1/t2/t3、总召/分组召唤、电能量召唤、时钟同步与读取
+// - 网络处理由 CIec104SimServer 的工作线程驱动，子站本身不创建线程
+class CIec104Outstation
+{
+    friend class CIec104SimServer;
+
+public:
+    explicit CIec104Outstation(const Iec104OutstationConfig& config);
+    ~CIec104Outstation();
+
+    CIec104Outstation(const CIec104Outstation&) = delete;
+    CIec104Outstation& operator=(const CIec104Outstation&) = delete;
+
+    WORD GetCommonAddr() const { return m_config.commonAddr; }
+    WORD GetPort() const { return m_config.port; }
+    size_t GetPointCount() const { return m_points.size(); }
+    bool IsSessionStarted() const { return m_started.load(std::memory_order_relaxed); }
+
+    // 任意线程：请求注入 count 个突发变化（按点轮转），由工作线程执行
+    void RequestBurst(DWORD count) { m_pendingBurst.fetch_add(count, std::memory_order_relaxed); }
+
+    Iec104OutstationStats GetStats() const;
+
+    // 启动前设置：每个突发ASDU写入发送缓冲后回调，基准测试据此记录发送时刻
+    void SetSendHook(Iec104SimSendHook hook) { m_sendHook = hook; }
+
+    void SetEventCallback(Iec104EventCallback callback) { m_eventCallback = callback; }
+    void SetLogLevel(Iec104LogLevel level) { m_logLevel = level; }
+    bool IsLogEnabled(Iec104LogLevel level, DWORD /*category*/) const
+    {
+        return (BYTE)level <= (BYTE)m_logLevel.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct SimPoint
+    {
+        DWORD ioa;
+        BYTE type;
+        BYTE quality;
+        bool pending;         // 已在突发队列中（同一点多次变化只发送最新值）
+        double value;
+    };
+
+    struct SimGroup
+    {
+        BYTE type;
+        DWORD firstIndex;
+        DWORD count;
+    };
+
+    struct PendingAsdu
+    {
+        int length;
+        BYTE data[IEC104_MAX_ASDU_LEN];
+    };
+
+    struct Counters
+    {
+        std::atomic<UINT64> connections{ 0 };
+        std::atomic<UINT64> iFramesSent{ 0 };
+        std::atomic<UINT64> iFramesReceived{ 0 };
+        std::atomic<UINT64> pointsSent{ 0 };
+        std::atomic<UINT64> spontaneousPoints{ 0 };
+        std::atomic<UINT64> interrogations{ 0 };
+        std::atomic<UINT64> clockCommands{ 0 };
+        std::atomic<UINT64> controlCommands{ 0 };
+        std::atomic<UINT64> testFrames{ 0 };
+        std::atomic<UINT64> timeouts{ 0 };
+        std::atomic<UINT64> protocolErrors{ 0 };
+        std::atomic<UINT64> tlsHandshakes{ 0 };
+        std::atomic<UINT64> tlsResumed{ 0 };
+        std::atomic<UINT64> tlsFailures{ 0 };
+    };
+
+    // 工作线程接口
+    bool Listen(std::wstring* err);
+    int FillPollFds(WSAPOLLFD* fds) const;
+    void Service(const WSAPOLLFD* fds, int count, ULONGLONG nowMs);
+    void Shutdown();
+
+    // 会话
+    void Accept(ULONGLONG nowMs);
+    void CloseSession();
+    bool ReadSession(ULONGLONG nowMs);
+    bool SplitFrames(ULONGLONG nowMs);
+    bool HandleFrame(const BYTE* frame, int length, ULONGLONG nowMs);
+    bool Acknowledge(WORD ackSeq);
+    void HandleAsdu(const BYTE* asdu, int length);
+    void HandleControl(const BYTE* asdu, int length, BYTE cot);
+    void HandleRead(const BYTE* asdu, int length, BYTE cot);
+    int FindPoint(DWORD ioa) const;
+    void OnAckTimeout();
+    void OnTestTimeout();
+    void OnRecvAckTimeout();
+    void OnIdleTimeout();
+    void Pump(ULONGLONG nowMs);
+    bool Flush();
+    bool FlushTls();
+    size_t GetTxBacklog() const { return (m_txBuffer.size() - m_txSent) + (m_tlsTx.size() - m_tlsTxSent); }
+
+    // 报文生成
+    void AppendFrame(const BYTE* frame, int length);
+    void SendIFrame(const BYTE* asdu, int length, ULONGLONG nowMs);
+    void SendSFrame();
+    void SendUFrame(Iec104UFunction function);
+    void QueueReply(const BYTE* asdu, int length, BYTE cot);
+    void EmitSpontaneous(ULONGLONG nowMs);
+    void EmitInterrogation(ULONGLONG nowMs);
+    void StartInterrogation(const BYTE* asdu, int length, bool counters, int select, BYTE cot);
+    void Burst(DWORD count);
+
+    // 子站时钟
+    SYSTEMTIME GetStationTime() const;
+    static INT64 LocalNowMs();
+
+    void LogEvent(const std::wstring& message);
+
+    Iec104OutstationConfig m_config;
+    const Iec104CodecOps* m_codec;
+    std::vector<SimPoint> m_points;
+    std::vector<SimGroup> m_groups;
+    DWORD m_burstCursor;
+    std::atomic<DWORD> m_pendingBurst;
+
+    // 突发队列（点下标环形队列，容量等于点数）
+    std::vector<DWORD> m_spontQueue;
+    size_t m_spontHead;
+    size_t m_spontCount;
+
+    // 待发送的应答ASDU（激活确认/终止、时钟应答等）
+    std::vector<PendingAsdu> m_replies;
+    size_t m_replyHead;
+    size_t m_replyCount;
+
+    // 召唤进度
+    bool m_irActive;
+    bool m_irCounters;
+    int m_irSelect;            // -1 表示全部组，否则为符合条件的第几组
+    BYTE m_irCot;
+    size_t m_irGroup;
+    size_t m_irMatched;
+    DWORD m_irOffset;
+    PendingAsdu m_irCommand;   // 原始召唤命令，用于激活终止
+
+    // 网络与链路状态（仅工作线程访问）
+    SOCKET m_listen;
+    SOCKET m_session;
+    std::atomic<bool> m_started;
+    BYTE m_rxBuffer[4096];
+    int m_rxLength;
+    std::vector<BYTE> m_txBuffer;
+    size_t m_txSent;
+    CIec104TlsSession m_tls;
+    std::vector<BYTE> m_tlsTx;             // 已加密待发送（握手期间为握手报文）
+    size_t m_tlsTxSent;
+    std::vector<BYTE> m_tlsRxPlain;
+    WORD m_sendSeq;            // 下一个发送序号 N(S)
+    WORD m_ackSeq;             // 主站已确认到的序号
+    WORD m_recvSeq;            // 下一个期望接收序号 N(R)
+    int m_unackedRecv;         // 已收到未确认的I帧数
+    std::vector<ULONGLONG> m_sendTimes;   // 未确认I帧的发送时刻，按序号对k取模
+    ULONGLONG m_lastRxMs;
+    ULONGLONG m_testSentMs;    // 0 表示没有未确认的测试帧
+
+    // t1/t2/t3 挂在所属工作线程的时间轮上（GetTickCount64 毫秒），到期时检查实际状态
+    CTimerWheel* m_timers;
+    CWheelTimer m_t1AckTimer;
+    CWheelTimer m_t1TestTimer;
+    CWheelTimer m_t2Timer;
+    CWheelTimer m_t3Timer;
+    INT64 m_clockOffsetMs;
+
+    Counters m_counters;
+    Iec104SimSendHook m_sendHook;
+    Iec104EventCallback m_eventCallback;
+    std::atomic<Iec104LogLevel> m_logLevel;
+};
+
+// 仿真服务：在一个进程内运行多个仿真子站，由若干工作线程以 WSAPoll 驱动
+// - 每个工作线程有一个时间轮，承载其子站的链路定时器与脚本步骤，WSAPoll 等到最近的定时器到期
+class CIec104SimServer
+{
+public:
+    CIec104SimServer();
+    ~CIec104SimServer();
+
+    CIec104SimServer(const CIec104SimServer&) = delete;
+    CIec104SimServer& operator=(const CIec104SimServer&) = delete;
+
+    // 启动前配置
+    CIec104Outstation& AddStation(const Iec104OutstationConfig& config);
+    void SetScript(const std::vector<Iec104SimStep>& steps) { m_script = steps; }
+    void SetEventCallback(Iec104EventCallback callback) { m_eventCallback = callback; }
+    void SetLogLevel(Iec104LogLevel level) { m_logLevel = level; }
+
+    bool Start(int threadCount, std::wstring* err = nullptr);
+    void Stop();
+    bool IsRunning() const { return !m_workers.empty(); }
+
+    size_t GetStationCount() const { return m_stations.size(); }
+    CIec104Outstation& GetStation(size_t index) { return *m_stations[index]; }
+    Iec104OutstationStats GetTotals() const;
+
+private:
+    void WorkerProc(size_t worker, size_t workerCount);
+
+    std::vector<std::unique_ptr<CIec104Outstation>> m_stations;
+    std::vector<std::thread> m_workers;
+    std::atomic<bool> m_stop;
+    std::vector<Iec104SimStep> m_script;
+    Iec104EventCallback m_eventCallback;
+    Iec104LogLevel m_logLevel;
+    bool m_winsockReady;
+};
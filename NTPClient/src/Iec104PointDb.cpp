@@ -0,0 +1,266 @@
+﻿#include "pch.h"
+#include "Iec104PointDb.h"
+#include <cstring>
+#include <thread>
+
+namespace
+{
+    inline UINT64 DoubleToBits(double v)
+    {
+        UINT64 bits;
+        memcpy(&bits, &v, sizeof(bits));
+        return bits;
+    }
+
+    inline double BitsToDouble(UINT64 bits)
+    {
+        double v;
+        memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    inline size_t HashKey(UINT64 key)
+    {
+        // 64位混合（splitmix64 收尾步骤），IOA 连续分布时也能均匀散列
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return (size_t)key;
+    }
+}
+
+CIec104PointDb::CIec104PointDb(size_t capacity)
+    : m_capacity(capacity), m_hashMask(0), m_count(0), m_batchSeq(0), m_epoch(0), m_updates(0), m_dropped(0), m_sharedWriters(false)
+{
+    if (m_capacity == 0)
+        m_capacity = 1;
+
+    // 哈希表容量取不小于2倍点数的2的幂，保证负载因子不超过0.5
+    size_t hashSize = 1;
+    while (hashSize < m_capacity * 2)
+        hashSize <<= 1;
+    m_hashMask = hashSize - 1;
+
+    m_hashKeys.reset(new std::atomic<UINT64>[hashSize]);
+    m_hashSlots.reset(new std::atomic<DWORD>[hashSize]);
+    for (size_t i = 0; i < hashSize; ++i)
+    {
+        m_hashKeys[i].store(0, std::memory_order_relaxed);
+        m_hashSlots[i].store(0, std::memory_order_relaxed);
+    }
+
+    m_commonAddr.reset(new WORD[m_capacity]());
+    m_ioa.reset(new DWORD[m_capacity]());
+    m_seq.reset(new std::atomic<DWORD>[m_capacity]);
+    m_value.reset(new std::atomic<UINT64>[m_capacity]);
+    m_timestamp.reset(new std::atomic<INT64>[m_capacity]);
+    m_type.reset(new std::atomic<BYTE>[m_capacity]);
+    m_quality.reset(new std::atomic<BYTE>[m_capacity]);
+    m_changes.reset(new std::atomic<UINT64>[m_capacity]);
+    m_pointEpoch.reset(new std::atomic<UINT64>[m_capacity]);
+    for (size_t i = 0; i < m_capacity; ++i)
+    {
+        m_seq[i].store(0, std::memory_order_relaxed);
+        m_value[i].store(0, std::memory_order_relaxed);
+        m_timestamp[i].store(0, std::memory_order_relaxed);
+        m_type[i].store(0, std::memory_order_relaxed);
+        m_quality[i].store(0, std::memory_order_relaxed);
+        m_changes[i].store(0, std::memory_order_relaxed);
+        m_pointEpoch[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void CIec104PointDb::BeginBatch()
+{
+    if (m_sharedWriters)
+    {
+        m_writerMutex.lock();
+    }
+
+    // 批次序号变为奇数，读者据此判断整库快照是否跨越了写入
+    m_batchSeq.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void CIec104PointDb::EndBatch()
+{
+    m_epoch.store(m_epoch.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    m_batchSeq.fetch_add(1, std::memory_order_release);
+
+    if (m_sharedWriters)
+    {
+        m_writerMutex.unlock();
+    }
+}
+
+bool CIec104PointDb::Update(WORD commonAddr, DWORD ioa, BYTE type, BYTE quality, double value, INT64 timestampMs)
+{
+    UINT64 key = MakeKey(commonAddr, ioa);
+    DWORD slot = 0;
+    bool isNew = false;
+    if (!FindSlot(key, slot))
+    {
+        if (!InsertSlot(key, commonAddr, ioa, slot))
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        isNew = true;
+    }
+
+    UINT64 newBits = DoubleToBits(value);
+    bool changed = isNew ||
+                   m_value[slot].load(std::memory_order_relaxed) != newBits ||
+                   m_quality[slot].load(std::memory_order_relaxed) != quality;
+
+    // 单点序号锁：先置奇数，写完再置偶数
+    DWORD seq = m_seq[slot].load(std::memory_order_relaxed);
+    m_seq[slot].store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    m_value[slot].store(newBits, std::memory_order_relaxed);
+    m_timestamp[slot].store(timestampMs, std::memory_order_relaxed);
+    m_type[slot].store(type, std::memory_order_relaxed);
+    m_quality[slot].store(quality, std::memory_order_relaxed);
+    if (changed)
+    {
+        m_changes[slot].store(m_changes[slot].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    // 写入所属批次为“已提交纪元+1”，EndBatch 提交后对增量读取可见
+    m_pointEpoch[slot].store(m_epoch.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    m_seq[slot].store(seq + 2, std::memory_order_release);
+
+    m_updates.fetch_add(1, std::memory_order_relaxed);
+    return changed;
+}
+
+bool CIec104PointDb::FindSlot(UINT64 key, DWORD &slot) const
+{
+    size_t h = HashKey(key) & m_hashMask;
+    for (;;)
+    {
+        UINT64 stored = m_hashKeys[h].load(std::memory_order_acquire);
+        if (stored == 0)
+            return false;
+        if (stored == key + 1)
+        {
+            slot = m_hashSlots[h].load(std::memory_order_relaxed);
+            return true;
+        }
+        h = (h + 1) & m_hashMask;
+    }
+}
+
+bool CIec104PointDb::InsertSlot(UINT64 key, WORD commonAddr, DWORD ioa, DWORD &slot)
+{
+    size_t count = m_count.load(std::memory_order_relaxed);
+    if (count >= m_capacity)
+        return false;
+
+    slot = (DWORD)count;
+    m_commonAddr[slot] = commonAddr;
+    m_ioa[slot] = ioa & 0xFFFFFF;
+
+    size_t h = HashKey(key) & m_hashMask;
+    while (m_hashKeys[h].load(std::memory_order_relaxed) != 0)
+        h = (h + 1) & m_hashMask;
+
+    // 先写槽位号再发布键，读者看到键时槽位号和槽位静态字段都已可见
+    m_hashSlots[h].store(slot, std::memory_order_relaxed);
+    m_hashKeys[h].store(key + 1, std::memory_order_release);
+    m_count.store(count + 1, std::memory_order_release);
+    return true;
+}
+
+void CIec104PointDb::ReadSlot(DWORD slot, Iec104PointValue &out) const
+{
+    out.commonAddr = m_commonAddr[slot];
+    out.ioa = m_ioa[slot];
+
+    for (;;)
+    {
+        DWORD seq1 = m_seq[slot].load(std::memory_order_acquire);
+        if (seq1 & 1)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        UINT64 bits = m_value[slot].load(std::memory_order_relaxed);
+        out.timestampMs = m_timestamp[slot].load(std::memory_order_relaxed);
+        out.type = m_type[slot].load(std::memory_order_relaxed);
+        out.quality = m_quality[slot].load(std::memory_order_relaxed);
+        out.changeCount = m_changes[slot].load(std::memory_order_relaxed);
+        out.epoch = m_pointEpoch[slot].load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_seq[slot].load(std::memory_order_relaxed) == seq1)
+        {
+            out.value = BitsToDouble(bits);
+            return;
+        }
+    }
+}
+
+bool CIec104PointDb::Read(WORD commonAddr, DWORD ioa, Iec104PointValue &out) const
+{
+    DWORD slot = 0;
+    if (!FindSlot(MakeKey(commonAddr, ioa), slot))
+        return false;
+
+    ReadSlot(slot, out);
+    return true;
+}
+
+UINT64 CIec104PointDb::Snapshot(std::vector<Iec104PointValue> &out, bool *consistent) const
+{
+    UINT64 epoch = 0;
+    bool ok = false;
+
+    for (int attempt = 0; attempt < SNAPSHOT_RETRIES && !ok; ++attempt)
+    {
+        UINT64 batch1 = m_batchSeq.load(std::memory_order_acquire);
+        epoch = m_epoch.load(std::memory_order_acquire);
+        size_t count = m_count.load(std::memory_order_acquire);
+
+        out.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            ReadSlot((DWORD)i, out[i]);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        UINT64 batch2 = m_batchSeq.load(std::memory_order_relaxed);
+        ok = (batch1 & 1) == 0 && batch1 == batch2;
+    }
+
+    if (consistent)
+        *consistent = ok;
+    return epoch;
+}
+
+UINT64 CIec104PointDb::GetChangesSince(UINT64 sinceEpoch, std::vector<Iec104PointValue> &out) const
+{
+    out.clear();
+
+    // 只返回已提交纪元内的变化；正在写入批次中的点留到下一次读取
+    UINT64 epoch = m_epoch.load(std::memory_order_acquire);
+    size_t count = m_count.load(std::memory_order_acquire);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        UINT64 pointEpoch = m_pointEpoch[i].load(std::memory_order_relaxed);
+        if (pointEpoch <= sinceEpoch || pointEpoch > epoch)
+            continue;
+
+        Iec104PointValue v;
+        ReadSlot((DWORD)i, v);
+        if (v.epoch > sinceEpoch && v.epoch <= epoch)
+        {
+            out.push_back(v);
+        }
+    }
+
+    return epoch;
+}
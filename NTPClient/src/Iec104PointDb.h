@@ -0,0 +1,94 @@
+﻿#pragma once
+#include <windows.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// 点库中的一条点记录（读取端快照使用）
+struct Iec104PointValue
+{
+    WORD commonAddr;      // 公共地址
+    DWORD ioa;            // 信息对象地址（24位）
+    BYTE type;            // 最近一次更新的ASDU类型
+    BYTE quality;         // 品质描述
+    double value;         // 数值（单点/双点为状态值，遥测为工程值，累计量为计数值）
+    INT64 timestampMs;    // 时标：本地时间自1970-01-01起的毫秒数
+    UINT64 changeCount;   // 值或品质发生变化的累计次数
+    UINT64 epoch;         // 最后一次写入所在批次的纪元
+};
+
+// 实时点库
+// - 以(公共地址, IOA)为键，按结构数组(SoA)存放值/品质/时标/变化计数，便于顺序扫描
+// - 单写者：只有接收线程调用 BeginBatch/Update/EndBatch，原地写入，不分配内存；
+//   多条连接共用一个点库（冗余组）时设置 SetSharedWriters，BeginBatch 到 EndBatch 持有写锁，各接收线程的批次依次进行
+// - 多读者：任意线程无锁读取，每个点用序号锁(seqlock)保证一致，整库快照用批次序号校验，
+//   增量读取按纪元(epoch)返回自上次读取以来变化的点，读取永远不会阻塞写入
+class CIec104PointDb
+{
+public:
+    explicit CIec104PointDb(size_t capacity = 65536);
+
+    CIec104PointDb(const CIec104PointDb&) = delete;
+    CIec104PointDb& operator=(const CIec104PointDb&) = delete;
+
+    // 写入前设置：多个接收线程写入同一点库
+    void SetSharedWriters(bool shared) { m_sharedWriters = shared; }
+
+    // 写入端（仅接收线程），Update 必须位于 BeginBatch/EndBatch 之间
+    void BeginBatch();
+    bool Update(WORD commonAddr, DWORD ioa, BYTE type, BYTE quality, double value, INT64 timestampMs);
+    void EndBatch();
+
+    // 读取端（任意线程，无锁）
+    size_t GetCapacity() const { return m_capacity; }
+    size_t GetPointCount() const { return m_count.load(std::memory_order_acquire); }
+    UINT64 GetEpoch() const { return m_epoch.load(std::memory_order_acquire); }
+    UINT64 GetUpdateCount() const { return m_updates.load(std::memory_order_relaxed); }
+    UINT64 GetDroppedCount() const { return m_dropped.load(std::memory_order_relaxed); }
+
+    bool Read(WORD commonAddr, DWORD ioa, Iec104PointValue& out) const;
+
+    // 整库快照，返回快照对应的纪元；consistent 为 false 表示写入过于频繁，
+    // 快照只保证单点一致而不保证跨点处于同一批次
+    UINT64 Snapshot(std::vector<Iec104PointValue>& out, bool* consistent = nullptr) const;
+
+    // 返回纪元在 (sinceEpoch, 返回值] 区间内变化过的点，下次以返回值作为 sinceEpoch 调用
+    UINT64 GetChangesSince(UINT64 sinceEpoch, std::vector<Iec104PointValue>& out) const;
+
+    static UINT64 MakeKey(WORD commonAddr, DWORD ioa) { return ((UINT64)commonAddr << 24) | (ioa & 0xFFFFFF); }
+
+private:
+    static constexpr int SNAPSHOT_RETRIES = 4;
+
+    size_t m_capacity;
+    size_t m_hashMask;
+
+    // 键 -> 槽位 的开放寻址哈希表（只增不删，写者插入，读者无锁查找），键存 key+1，0 表示空
+    std::unique_ptr<std::atomic<UINT64>[]> m_hashKeys;
+    std::unique_ptr<std::atomic<DWORD>[]> m_hashSlots;
+
+    // 槽位数据（SoA）
+    std::unique_ptr<WORD[]> m_commonAddr;
+    std::unique_ptr<DWORD[]> m_ioa;
+    std::unique_ptr<std::atomic<DWORD>[]> m_seq;          // 单点序号锁，奇数表示正在写
+    std::unique_ptr<std::atomic<UINT64>[]> m_value;       // double 的位模式
+    std::unique_ptr<std::atomic<INT64>[]> m_timestamp;
+    std::unique_ptr<std::atomic<BYTE>[]> m_type;
+    std::unique_ptr<std::atomic<BYTE>[]> m_quality;
+    std::unique_ptr<std::atomic<UINT64>[]> m_changes;
+    std::unique_ptr<std::atomic<UINT64>[]> m_pointEpoch;
+
+    std::atomic<size_t> m_count;
+    std::atomic<UINT64> m_batchSeq;   // 批次序号锁，奇数表示批次写入中
+    std::atomic<UINT64> m_epoch;      // 已提交批次的纪元
+    std::atomic<UINT64> m_updates;
+    std::atomic<UINT64> m_dropped;    // 容量已满而丢弃的新点更新次数
+
+    bool m_sharedWriters;
+    std::mutex m_writerMutex;         // 多写者时 BeginBatch 加锁、EndBatch 解锁
+
+    bool FindSlot(UINT64 key, DWORD& slot) const;
+    bool InsertSlot(UINT64 key, WORD commonAddr, DWORD ioa, DWORD& slot);
+    void ReadSlot(DWORD slot, Iec104PointValue& out) const;
+};
@@ -0,0 +1,32 @@
+﻿#include "pch.h"
+#include "Iec104Profile.h"
+
+std::wstring Iec104FormatProfile(const Iec104LinkProfile &profile)
+{
+    return std::to_wstring(profile.cotSize) + L"/" + std::to_wstring(profile.caSize) + L"/" + std::to_wstring(profile.ioaSize);
+}
+
+bool Iec104ParseProfile(const std::wstring &text, Iec104LinkProfile &profile)
+{
+    // "COT/CA/IOA"，各字段为单个数字
+    if (text.size() != 5 || text[1] != L'/' || text[3] != L'/')
+        return false;
+
+    Iec104LinkProfile parsed;
+    parsed.cotSize = (BYTE)(text[0] - L'0');
+    parsed.caSize = (BYTE)(text[2] - L'0');
+    parsed.ioaSize = (BYTE)(text[4] - L'0');
+    if (!parsed.IsValid())
+        return false;
+
+    profile = parsed;
+    return true;
+}
+
+const Iec104CodecOps &Iec104GetCodec(const Iec104LinkProfile &profile)
+{
+    if (!profile.IsValid())
+        return Iec104CodecTable<Iec104StandardCodec>::ops;
+
+    return *Iec104DispatchProfile(profile, [](auto codec) { return &Iec104CodecTable<decltype(codec)>::ops; });
+}
@@ -0,0 +1,157 @@
+﻿#pragma once
+#include <windows.h>
+#include <string>
+
+// 链路参数：ASDU中传送原因、公共地址与信息对象地址的字节数
+// IEC 60870-5-104 标准为 2/2/3；部分老网关使用 101 风格的 1/1/2、1/2/2 等配置
+struct Iec104LinkProfile
+{
+    BYTE cotSize = 2;     // 1 或 2（第2字节为源发站地址）
+    BYTE caSize = 2;      // 1 或 2
+    BYTE ioaSize = 3;     // 1 至 3
+
+    bool IsValid() const
+    {
+        return cotSize >= 1 && cotSize <= 2 && caSize >= 1 && caSize <= 2 && ioaSize >= 1 && ioaSize <= 3;
+    }
+    bool operator==(const Iec104LinkProfile& other) const
+    {
+        return cotSize == other.cotSize && caSize == other.caSize && ioaSize == other.ioaSize;
+    }
+    bool operator!=(const Iec104LinkProfile& other) const { return !(*this == other); }
+};
+
+// 文本形式 "COT/CA/IOA"，如 "2/2/3"
+std::wstring Iec104FormatProfile(const Iec104LinkProfile& profile);
+bool Iec104ParseProfile(const std::wstring& text, Iec104LinkProfile& profile);
+
+// 解码后的ASDU头（与链路参数无关）
+struct Iec104AsduHeader
+{
+    BYTE typeId = 0;
+    BYTE vsq = 0;
+    BYTE cot = 0;         // 含P/N位与试验位
+    BYTE originator = 0;  // 源发站地址，传送原因为1字节时总为0
+    WORD commonAddr = 0;  // 1字节公共地址的广播地址 255 解码为 0xFFFF
+};
+
+// 小端定长整数，按字节数展开，无循环与分支
+template <int N>
+struct Iec104Le
+{
+    static void Put(BYTE* p, DWORD value)
+    {
+        p[0] = (BYTE)value;
+        Iec104Le<N - 1>::Put(p + 1, value >> 8);
+    }
+    static DWORD Get(const BYTE* p)
+    {
+        return (DWORD)p[0] | (Iec104Le<N - 1>::Get(p + 1) << 8);
+    }
+};
+
+template <>
+struct Iec104Le<0>
+{
+    static void Put(BYTE*, DWORD) {}
+    static DWORD Get(const BYTE*) { return 0; }
+};
+
+// 按链路参数特化的ASDU编解码：字段偏移与长度均为编译期常量
+template <int COT_LEN, int CA_LEN, int IOA_LEN_>
+struct Iec104Codec
+{
+    static_assert(COT_LEN >= 1 && COT_LEN <= 2, "传送原因为1或2字节");
+    static_assert(CA_LEN >= 1 && CA_LEN <= 2, "公共地址为1或2字节");
+    static_assert(IOA_LEN_ >= 1 && IOA_LEN_ <= 3, "信息对象地址为1至3字节");
+
+    static constexpr int COT_SIZE = COT_LEN;
+    static constexpr int CA_SIZE = CA_LEN;
+    static constexpr int IOA_LEN = IOA_LEN_;
+    static constexpr int HEADER_LEN = 2 + COT_LEN + CA_LEN;      // 类型+VSQ+COT+公共地址
+    static constexpr DWORD IOA_MASK = (DWORD)((1ULL << (8 * IOA_LEN_)) - 1);
+    static constexpr DWORD CA_MASK = (DWORD)((1UL << (8 * CA_LEN)) - 1);
+
+    static Iec104LinkProfile Profile()
+    {
+        Iec104LinkProfile profile;
+        profile.cotSize = COT_LEN;
+        profile.caSize = CA_LEN;
+        profile.ioaSize = IOA_LEN_;
+        return profile;
+    }
+
+    static void PutHeader(BYTE* asdu, const Iec104AsduHeader& header)
+    {
+        asdu[0] = header.typeId;
+        asdu[1] = header.vsq;
+        asdu[2] = header.cot;
+        Iec104Le<COT_LEN - 1>::Put(asdu + 3, header.originator);
+        Iec104Le<CA_LEN>::Put(asdu + 2 + COT_LEN, header.commonAddr);
+    }
+
+    static void GetHeader(const BYTE* asdu, Iec104AsduHeader& header)
+    {
+        header.typeId = asdu[0];
+        header.vsq = asdu[1];
+        header.cot = asdu[2];
+        header.originator = (BYTE)Iec104Le<COT_LEN - 1>::Get(asdu + 3);
+        DWORD ca = Iec104Le<CA_LEN>::Get(asdu + 2 + COT_LEN);
+        header.commonAddr = (WORD)(ca == CA_MASK ? 0xFFFF : ca);
+    }
+
+    static void PutIoa(BYTE* p, DWORD ioa) { Iec104Le<IOA_LEN_>::Put(p, ioa); }
+    static DWORD GetIoa(const BYTE* p) { return Iec104Le<IOA_LEN_>::Get(p); }
+};
+
+using Iec104StandardCodec = Iec104Codec<2, 2, 3>;
+
+// 按链路参数把调用分派到对应的编解码器实例：visitor(Iec104Codec<...>()) 的各实例返回类型须一致。
+// 每连接在配置时分派一次（取得函数指针或成员函数指针），收发路径上不再判断链路参数
+template <class Visitor>
+auto Iec104DispatchProfile(const Iec104LinkProfile& profile, Visitor&& visitor) -> decltype(visitor(Iec104StandardCodec()))
+{
+    switch ((profile.cotSize - 1) * 6 + (profile.caSize - 1) * 3 + (profile.ioaSize - 1))
+    {
+    case 0:  return visitor(Iec104Codec<1, 1, 1>());
+    case 1:  return visitor(Iec104Codec<1, 1, 2>());
+    case 2:  return visitor(Iec104Codec<1, 1, 3>());
+    case 3:  return visitor(Iec104Codec<1, 2, 1>());
+    case 4:  return visitor(Iec104Codec<1, 2, 2>());
+    case 5:  return visitor(Iec104Codec<1, 2, 3>());
+    case 6:  return visitor(Iec104Codec<2, 1, 1>());
+    case 7:  return visitor(Iec104Codec<2, 1, 2>());
+    case 8:  return visitor(Iec104Codec<2, 1, 3>());
+    case 9:  return visitor(Iec104Codec<2, 2, 1>());
+    case 10: return visitor(Iec104Codec<2, 2, 2>());
+    default: return visitor(Iec104StandardCodec());
+    }
+}
+
+// 编解码器的运行时接口（函数指针表），供不在热路径上的编码使用
+struct Iec104CodecOps
+{
+    Iec104LinkProfile profile;
+    int headerLen;
+    int ioaLen;
+    DWORD ioaMask;
+    void (*putHeader)(BYTE* asdu, const Iec104AsduHeader& header);
+    void (*getHeader)(const BYTE* asdu, Iec104AsduHeader& header);
+    void (*putIoa)(BYTE* p, DWORD ioa);
+    DWORD (*getIoa)(const BYTE* p);
+};
+
+template <class Codec>
+struct Iec104CodecTable
+{
+    static const Iec104CodecOps ops;
+};
+
+template <class Codec>
+const Iec104CodecOps Iec104CodecTable<Codec>::ops = {
+    Codec::Profile(), Codec::HEADER_LEN, Codec::IOA_LEN, Codec::IOA_MASK,
+    &Codec::PutHeader, &Codec::GetHeader, &Codec::PutIoa, &Codec::GetIoa
+};
+
+// 无效的链路参数返回标准配置
+const Iec104CodecOps& Iec104GetCodec(const Iec104LinkProfile& profile);
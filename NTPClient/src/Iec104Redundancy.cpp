@@ -0,0 +1,269 @@
+﻿#include "pch.h"
+#include "Iec104Redundancy.h"
+#include <chrono>
+
+CIec104RedundancyGroup::CIec104RedundancyGroup()
+    : m_pointDb(std::make_shared<CIec104PointDb>()), m_subscriptions(std::make_shared<CIec104SubscriptionIndex>()), m_active(-1), m_activeStarted(false), m_switchTarget(-1), m_failover(false),
+      m_failoverStartUs(0), m_stopping(false), m_stop(false), m_logLevel(Iec104LogLevel::LOG_INFO)
+{
+    // 切换期间新旧主用的接收线程可能同时处理数据（两个STARTED、STOPDT确认前的在途报文），点库与订阅分发按批次加锁
+    m_pointDb->SetSharedWriters(true);
+}
+
+CIec104RedundancyGroup::~CIec104RedundancyGroup()
+{
+    Stop();
+}
+
+bool CIec104RedundancyGroup::Start(const Iec104RedundancyConfig &config, std::wstring *err)
+{
+    if (IsRunning() || config.endpoints.empty())
+    {
+        if (err)
+            *err = IsRunning() ? L"冗余组已在运行" : L"没有配置连接";
+        return false;
+    }
+
+    m_config = config;
+    m_links.clear();
+    for (size_t i = 0; i < config.endpoints.size(); ++i)
+    {
+        std::unique_ptr<CIec104Master> link(new CIec104Master());
+        link->SetPointDatabase(m_pointDb);
+        link->SetSubscriptions(m_subscriptions);
+        link->SetIngestQueue(m_ingestQueue);
+        link->SetSharedPoints(m_sharedPoints);
+        link->SetLinkTimers(config.t1Ms, config.t3Ms);
+        link->SetLinkProfile(config.profile);
+        link->SetConnectTimeout(config.reconnectMs);
+        link->SetLogLevel(m_logLevel);
+        link->SetEventCallback(m_eventCallback);
+        link->SetDataCallback(m_dataCallback);
+        link->SetStateCallback([this, i](Iec104State state) { OnLinkState(i, state); });
+        m_links.push_back(std::move(link));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_active = -1;
+        m_activeStarted = false;
+        m_switchTarget = -1;
+        m_failover = false;
+        m_stats = Iec104RedundancyStats();
+        m_linkUp.assign(m_links.size(), false);
+        m_everConnected.assign(m_links.size(), false);
+        m_stopping = false;
+        m_stop = false;
+    }
+    m_supervisor = std::thread(&CIec104RedundancyGroup::SupervisorProc, this);
+    return true;
+}
+
+void CIec104RedundancyGroup::Stop()
+{
+    if (!m_supervisor.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    m_supervisor.join();
+
+    // 断开时的状态回调被忽略，不再触发切换
+    for (auto &link : m_links)
+    {
+        link->Disconnect();
+    }
+}
+
+bool CIec104RedundancyGroup::SwitchOver(size_t index)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (index >= m_links.size() || m_links[index]->GetState() != Iec104State::CONNECTED || (int)index == m_active)
+        return false;
+
+    ++m_stats.switchovers;
+    if (m_active < 0)
+        return PromoteLocked((int)index);
+
+    // 原主用停止数据传输，收到STOPDT_CON（状态回到CONNECTED）后再启动目标连接
+    m_switchTarget = (int)index;
+    IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"冗余组手动切换: 连接 " + std::to_wstring(m_active) + L" → " + std::to_wstring(index));
+    return m_links[m_active]->StopDataTransfer();
+}
+
+int CIec104RedundancyGroup::GetActiveIndex() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_activeStarted ? m_active : -1;
+}
+
+CIec104Master *CIec104RedundancyGroup::GetActiveLink()
+{
+    int active = GetActiveIndex();
+    return active >= 0 ? m_links[active].get() : nullptr;
+}
+
+Iec104RedundancyStats CIec104RedundancyGroup::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void CIec104RedundancyGroup::OnLinkState(size_t index, Iec104State state)
+{
+    bool interrogate = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping)
+            return;
+
+        int link = (int)index;
+        switch (state)
+        {
+        case Iec104State::STARTED:
+            if (link != m_active)
+            {
+                // 不应出现两个主用：多余的连接退回STOPDT
+                m_links[index]->StopDataTransfer();
+                break;
+            }
+            m_activeStarted = true;
+            if (m_failover)
+            {
+                m_stats.lastFailoverUs = Iec104MonotonicUs() - m_failoverStartUs;
+                m_failover = false;
+                interrogate = m_config.interrogateOnFailover;
+                IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"冗余组切换完成，主用连接 " + std::to_wstring(link) + L"，耗时 " +
+                                                         std::to_wstring(m_stats.lastFailoverUs) + L"us");
+            }
+            break;
+
+        case Iec104State::CONNECTED:
+            if (!m_linkUp[index])
+            {
+                // TCP连接新建立（而不是STOPDT确认）
+                if (m_everConnected[index])
+                {
+                    ++m_stats.reconnects;
+                }
+                m_linkUp[index] = true;
+                m_everConnected[index] = true;
+            }
+            if (link == m_active && m_activeStarted)
+            {
+                // 主用STOPDT确认（手动切换）
+                m_active = -1;
+                m_activeStarted = false;
+                int target = m_switchTarget;
+                m_switchTarget = -1;
+                PromoteLocked(target);
+            }
+            else if (m_active < 0)
+            {
+                // 新建立的连接，当前没有主用
+                PromoteLocked(link);
+            }
+            break;
+
+        case Iec104State::DISCONNECTED:
+            m_linkUp[index] = false;
+            if (link == m_active)
+            {
+                IEC104_LOG(LOG_WARNING, IEC104_LOG_LINK, L"冗余组主用连接 " + std::to_wstring(link) + L" 断开，切换到备用连接");
+                bool wasStarted = m_activeStarted;
+                m_active = -1;
+                m_activeStarted = false;
+                if (wasStarted)
+                {
+                    ++m_stats.failovers;
+                }
+                m_failover = true;
+                m_failoverStartUs = Iec104MonotonicUs();
+                if (!PromoteLocked(-1))
+                {
+                    IEC104_LOG(LOG_ERROR, IEC104_LOG_LINK, L"冗余组没有可用的备用连接");
+                }
+            }
+            if (link == m_switchTarget)
+            {
+                m_switchTarget = -1;
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    // 锁外发送总召（在新主用的I/O线程中，只是入队）
+    if (interrogate)
+    {
+        m_links[index]->SendGeneralCall(m_config.commonAddr);
+    }
+}
+
+bool CIec104RedundancyGroup::PromoteLocked(int preferred)
+{
+    // 优先使用指定连接，否则按配置顺序选第一条处于STOPDT的已建立连接
+    int chosen = -1;
+    if (preferred >= 0 && m_links[preferred]->GetState() == Iec104State::CONNECTED)
+    {
+        chosen = preferred;
+    }
+    for (size_t i = 0; chosen < 0 && i < m_links.size(); ++i)
+    {
+        if (m_links[i]->GetState() == Iec104State::CONNECTED)
+            chosen = (int)i;
+    }
+    if (chosen < 0)
+        return false;
+
+    m_active = chosen;
+    m_activeStarted = false;
+    if (!m_links[chosen]->StartDataTransfer())
+    {
+        m_active = -1;
+        return false;
+    }
+    IEC104_LOG(LOG_INFO, IEC104_LOG_LINK, L"冗余组启动连接 " + std::to_wstring(chosen) + L" (" + m_config.endpoints[chosen].host + L")");
+    return true;
+}
+
+void CIec104RedundancyGroup::SupervisorProc()
+{
+    for (;;)
+    {
+        // 断开的连接重新发起连接，各连接的解析与TCP握手在各自I/O线程中并行进行；
+        // 建立后保持STOPDT作为备用（状态回调决定是否启动）
+        for (size_t i = 0; i < m_links.size(); ++i)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_stop)
+                    return;
+            }
+            if (m_links[i]->GetState() != Iec104State::DISCONNECTED)
+                continue;
+
+            const Iec104Endpoint &endpoint = m_config.endpoints[i];
+            m_links[i]->ConnectAsync(endpoint.host, endpoint.port);
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait_for(lock, std::chrono::milliseconds(m_config.reconnectMs), [this] { return m_stop; });
+        if (m_stop)
+            return;
+    }
+}
+
+void CIec104RedundancyGroup::LogEvent(const std::wstring &message)
+{
+    if (m_eventCallback)
+    {
+        m_eventCallback(message);
+    }
+}
@@ -0,0 +1,113 @@
+﻿#pragma once
+#include "Iec104Master.h"
+#include <condition_variable>
+#include <memory>
+
+struct Iec104Endpoint
+{
+    std::wstring host;
+    WORD port = IEC104_DEFAULT_PORT;
+};
+
+struct Iec104RedundancyConfig
+{
+    std::vector<Iec104Endpoint> endpoints;   // 按优先级排列，同一子站的多个前置/通道
+    DWORD t1Ms = 3000;                       // 比缺省值短，尽快发现静默失效的连接
+    DWORD t3Ms = 2000;
+    DWORD reconnectMs = 5000;                // 断开的连接重连间隔（同时作为每次连接的时限）
+    bool interrogateOnFailover = true;       // 切换后总召，补齐切换期间可能遗漏的变化
+    WORD commonAddr = 1;                     // 总召使用的公共地址
+    Iec104LinkProfile profile;               // 各连接的链路参数（同一子站相同）
+};
+
+struct Iec104RedundancyStats
+{
+    UINT64 failovers = 0;                    // 主用连接断开后的自动切换
+    UINT64 switchovers = 0;                  // 手动切换
+    UINT64 reconnects = 0;
+    INT64 lastFailoverUs = 0;                // 最近一次切换：发现断开到新主用收到STARTDT_CON
+};
+
+// IEC 60870-5-104 冗余组（同一子站的多条连接）
+// - 所有连接保持TCP建立并处于STOPDT，只有一条发送STARTDT成为主用
+// - 主用断开（FD_CLOSE、接收错误或t1超时）时在其I/O线程中立即向备用连接发送STARTDT，
+//   不需要新的TCP握手
+// - 各连接共用一个点库（按批次加写锁，切换期间两条连接的写入依次进行），切换后点状态保持；每条连接维护自己的 N(S)/N(R)，
+//   备用连接在STOPDT期间仍以测试帧保持序号与链路状态有效
+class CIec104RedundancyGroup
+{
+public:
+    CIec104RedundancyGroup();
+    ~CIec104RedundancyGroup();
+
+    CIec104RedundancyGroup(const CIec104RedundancyGroup&) = delete;
+    CIec104RedundancyGroup& operator=(const CIec104RedundancyGroup&) = delete;
+
+    // 启动前设置，应用到所有连接
+    void SetEventCallback(Iec104EventCallback callback) { m_eventCallback = callback; }
+    void SetDataCallback(Iec104DataCallback callback) { m_dataCallback = callback; }
+    void SetLogLevel(Iec104LogLevel level) { m_logLevel = level; }
+
+    bool Start(const Iec104RedundancyConfig& config, std::wstring* err = nullptr);
+    void Stop();
+    bool IsRunning() const { return m_supervisor.joinable(); }
+
+    // 手动切换到指定连接：原主用STOPDT确认后新连接STARTDT
+    bool SwitchOver(size_t index);
+
+    int GetActiveIndex() const;
+    CIec104Master* GetActiveLink();          // 当前没有主用连接时返回空
+    size_t GetLinkCount() const { return m_links.size(); }
+    CIec104Master& GetLink(size_t index) { return *m_links[index]; }
+    const CIec104PointDb& GetPointDatabase() const { return *m_pointDb; }
+
+    // 按点订阅：各连接共用订阅表，切换后订阅继续有效
+    UINT64 Subscribe(const Iec104SubscriptionFilter& filter, Iec104PointCallback callback)
+    {
+        return m_subscriptions->Subscribe(filter, std::move(callback));
+    }
+    bool Unsubscribe(UINT64 id) { return m_subscriptions->Unsubscribe(id); }
+    // Start 前设置：各连接提交到同一个接入队列
+    void SetIngestQueue(std::shared_ptr<CIec104IngestQueue> queue) { m_ingestQueue = queue; }
+    // Start 前设置：各连接写入同一个共享内存点表
+    void SetSharedPoints(std::shared_ptr<CIec104SharedPointWriter> sharedPoints) { m_sharedPoints = sharedPoints; }
+    Iec104RedundancyStats GetStats() const;
+
+    bool IsLogEnabled(Iec104LogLevel level, DWORD /*category*/) const
+    {
+        return (BYTE)level <= (BYTE)m_logLevel.load(std::memory_order_relaxed);
+    }
+
+private:
+    void OnLinkState(size_t index, Iec104State state);
+    bool PromoteLocked(int preferred);
+    void SupervisorProc();
+
+    void LogEvent(const std::wstring& message);
+
+    Iec104RedundancyConfig m_config;
+    std::vector<std::unique_ptr<CIec104Master>> m_links;
+    std::shared_ptr<CIec104PointDb> m_pointDb;
+    std::shared_ptr<CIec104SubscriptionIndex> m_subscriptions;
+    std::shared_ptr<CIec104IngestQueue> m_ingestQueue;
+    std::shared_ptr<CIec104SharedPointWriter> m_sharedPoints;
+
+    mutable std::mutex m_mutex;              // 保护以下切换状态
+    int m_active;                            // 已STARTDT或正在STARTDT的连接，-1 表示无
+    bool m_activeStarted;
+    int m_switchTarget;                      // 手动切换目标，-1 表示无
+    bool m_failover;                         // 当前的STARTDT由故障切换发起
+    INT64 m_failoverStartUs;
+    Iec104RedundancyStats m_stats;
+    std::vector<bool> m_linkUp;              // 各连接的TCP是否已建立
+    std::vector<bool> m_everConnected;
+    bool m_stopping;
+
+    std::thread m_supervisor;
+    std::condition_variable m_wake;
+    bool m_stop;
+
+    Iec104EventCallback m_eventCallback;
+    Iec104DataCallback m_dataCallback;
+    std::atomic<Iec104LogLevel> m_logLevel;
+};
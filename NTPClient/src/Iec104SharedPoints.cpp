@@ -0,0 +1,282 @@
+﻿#include "pch.h"
+#include "Iec104SharedPoints.h"
+
+namespace
+{
+    constexpr BYTE QUALITY_INVALID = 0x80;   // IV
+
+    // 取得记录的序号锁：序号为偶数时CAS为奇数，返回取得前的序号
+    UINT32 LockRecord(Iec104SharedPointRecord &rec)
+    {
+        UINT32 seq = rec.seq.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            if (seq & 1)
+            {
+                std::this_thread::yield();
+                seq = rec.seq.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (rec.seq.compare_exchange_weak(seq, seq + 1, std::memory_order_relaxed))
+                break;
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        return seq;
+    }
+
+    inline void UnlockRecord(Iec104SharedPointRecord &rec, UINT32 seq)
+    {
+        rec.seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // 上一个写者进程是否已退出（在线状态但进程不存在，说明写者异常终止）
+    bool IsWriterGone(UINT32 pid)
+    {
+        if (pid == GetCurrentProcessId())
+            return false;
+        HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+        if (process == nullptr)
+            return GetLastError() == ERROR_INVALID_PARAMETER;
+        bool exited = WaitForSingleObject(process, 0) == WAIT_OBJECT_0;
+        CloseHandle(process);
+        return exited;
+    }
+}
+
+CIec104SharedPointWriter::CIec104SharedPointWriter()
+    : m_mapping(nullptr), m_view(nullptr), m_header(nullptr), m_entries(nullptr), m_records(nullptr), m_hashMask(0)
+{
+}
+
+CIec104SharedPointWriter::~CIec104SharedPointWriter()
+{
+    Close();
+}
+
+bool CIec104SharedPointWriter::Create(const std::wstring &name, size_t capacity, std::wstring *err)
+{
+    Close();
+    if (capacity == 0)
+        capacity = 1;
+    if (capacity > IEC104_SHM_MAX_CAPACITY)
+        capacity = IEC104_SHM_MAX_CAPACITY;
+
+    UINT32 hashSize = Iec104SharedPointLayout::HashSizeFor((UINT32)capacity);
+    UINT64 size = Iec104SharedPointLayout::SegmentSize((UINT32)capacity, hashSize);
+
+    // 页面文件支持的映射，新建时内容全为0
+    m_mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                   (DWORD)(size >> 32), (DWORD)(size & 0xFFFFFFFF), name.c_str());
+    if (m_mapping == nullptr)
+    {
+        if (err) *err = L"创建共享点表失败: " + name + L"，错误码 " + std::to_wstring(GetLastError());
+        return false;
+    }
+    bool existed = GetLastError() == ERROR_ALREADY_EXISTS;
+
+    m_view = MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (m_view == nullptr)
+    {
+        if (err) *err = L"映射共享点表失败，错误码 " + std::to_wstring(GetLastError());
+        Close();
+        return false;
+    }
+    m_header = static_cast<Iec104SharedPointHeader *>(m_view);
+
+    if (existed)
+    {
+        if (!Adopt(err))
+        {
+            // 段属于其他写者，不能在 Close 中改写它的状态
+            m_header = nullptr;
+            Close();
+            return false;
+        }
+    }
+    else
+    {
+        Initialize((UINT32)capacity, hashSize);
+    }
+    return true;
+}
+
+void CIec104SharedPointWriter::Initialize(UINT32 capacity, UINT32 hashSize)
+{
+    BYTE *base = static_cast<BYTE *>(m_view);
+    m_header->version = IEC104_SHM_VERSION;
+    m_header->headerSize = sizeof(Iec104SharedPointHeader);
+    m_header->recordSize = sizeof(Iec104SharedPointRecord);
+    m_header->capacity = capacity;
+    m_header->hashSize = hashSize;
+    m_header->writerPid = GetCurrentProcessId();
+    m_header->count.store(0, std::memory_order_relaxed);
+    m_header->generation.store(1, std::memory_order_relaxed);
+    m_header->state.store((UINT32)Iec104SharedPointState::ONLINE, std::memory_order_relaxed);
+
+    m_hashMask = hashSize - 1;
+    m_entries = reinterpret_cast<std::atomic<UINT64> *>(base + sizeof(Iec104SharedPointHeader));
+    m_records = reinterpret_cast<Iec104SharedPointRecord *>(base + Iec104SharedPointLayout::RecordOffset(hashSize));
+
+    // 读取方以魔数判断段已初始化完成
+    m_header->magic.store(IEC104_SHM_MAGIC, std::memory_order_release);
+}
+
+bool CIec104SharedPointWriter::Adopt(std::wstring *err)
+{
+    if (m_header->magic.load(std::memory_order_acquire) != IEC104_SHM_MAGIC ||
+        m_header->version != IEC104_SHM_VERSION ||
+        m_header->headerSize != sizeof(Iec104SharedPointHeader) ||
+        m_header->recordSize != sizeof(Iec104SharedPointRecord))
+    {
+        if (err) *err = L"同名共享点表正在初始化或版本不兼容";
+        return false;
+    }
+
+    // 已关闭的段直接接管；在线状态只有在原写者进程已退出时才接管
+    UINT32 state = (UINT32)Iec104SharedPointState::CLOSED;
+    if (!m_header->state.compare_exchange_strong(state, (UINT32)Iec104SharedPointState::INITIALIZING))
+    {
+        if (state != (UINT32)Iec104SharedPointState::ONLINE || !IsWriterGone(m_header->writerPid) ||
+            !m_header->state.compare_exchange_strong(state, (UINT32)Iec104SharedPointState::INITIALIZING))
+        {
+            if (err) *err = L"共享点表已有在线写者，进程号 " + std::to_wstring(m_header->writerPid);
+            return false;
+        }
+    }
+
+    // 段大小由首次创建时的容量决定，接管时沿用原容量
+    BYTE *base = static_cast<BYTE *>(m_view);
+    m_hashMask = m_header->hashSize - 1;
+    m_entries = reinterpret_cast<std::atomic<UINT64> *>(base + sizeof(Iec104SharedPointHeader));
+    m_records = reinterpret_cast<Iec104SharedPointRecord *>(base + Iec104SharedPointLayout::RecordOffset(m_header->hashSize));
+
+    // 原写者异常退出时可能停在写入中：序号补成偶数，点置IV直到重新收到数据
+    UINT32 count = m_header->count.load(std::memory_order_acquire);
+    for (UINT32 slot = 0; slot < count; ++slot)
+    {
+        Iec104SharedPointRecord &rec = m_records[slot];
+        UINT32 seq = rec.seq.load(std::memory_order_relaxed);
+        if (seq & 1)
+        {
+            rec.seq.store(seq + 1, std::memory_order_relaxed);
+        }
+        seq = LockRecord(rec);
+        rec.quality.store(rec.quality.load(std::memory_order_relaxed) | QUALITY_INVALID, std::memory_order_relaxed);
+        UnlockRecord(rec, seq);
+    }
+
+    m_header->writerPid = GetCurrentProcessId();
+    m_header->generation.fetch_add(1, std::memory_order_relaxed);
+    m_header->state.store((UINT32)Iec104SharedPointState::ONLINE, std::memory_order_release);
+    return true;
+}
+
+void CIec104SharedPointWriter::Close()
+{
+    if (m_header != nullptr && m_records != nullptr)
+    {
+        // 段对象在读取方仍打开时继续存在：全部点置IV，读取方据此得知数据已不再更新
+        UINT32 count = m_header->count.load(std::memory_order_acquire);
+        for (UINT32 slot = 0; slot < count; ++slot)
+        {
+            Iec104SharedPointRecord &rec = m_records[slot];
+            UINT32 seq = LockRecord(rec);
+            rec.quality.store(rec.quality.load(std::memory_order_relaxed) | QUALITY_INVALID, std::memory_order_relaxed);
+            UnlockRecord(rec, seq);
+        }
+        m_header->state.store((UINT32)Iec104SharedPointState::CLOSED, std::memory_order_release);
+    }
+
+    if (m_view != nullptr)
+        UnmapViewOfFile(m_view);
+    if (m_mapping != nullptr)
+        CloseHandle(m_mapping);
+    m_view = nullptr;
+    m_mapping = nullptr;
+    m_header = nullptr;
+    m_entries = nullptr;
+    m_records = nullptr;
+    m_hashMask = 0;
+}
+
+bool CIec104SharedPointWriter::Update(WORD commonAddr, DWORD ioa, BYTE type, BYTE quality, double value, INT64 timestampMs)
+{
+    if (m_header == nullptr)
+        return false;
+
+    UINT64 key = Iec104SharedPointLayout::MakeKey(commonAddr, ioa);
+    UINT32 slot = 0;
+    bool isNew = false;
+    if (!FindSlot(key, slot))
+    {
+        std::lock_guard<std::mutex> lock(m_insertMutex);
+        if (!FindSlot(key, slot))
+        {
+            if (!InsertSlot(key, commonAddr, ioa, slot))
+            {
+                m_header->dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            isNew = true;
+        }
+    }
+
+    Iec104SharedPointRecord &rec = m_records[slot];
+    UINT64 newBits;
+    memcpy(&newBits, &value, sizeof(newBits));
+
+    UINT32 seq = LockRecord(rec);
+    bool changed = isNew ||
+                   rec.value.load(std::memory_order_relaxed) != newBits ||
+                   rec.quality.load(std::memory_order_relaxed) != quality;
+    rec.value.store(newBits, std::memory_order_relaxed);
+    rec.timestampMs.store(timestampMs, std::memory_order_relaxed);
+    rec.type.store(type, std::memory_order_relaxed);
+    rec.quality.store(quality, std::memory_order_relaxed);
+    if (changed)
+    {
+        rec.changeCount.store(rec.changeCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    UnlockRecord(rec, seq);
+
+    m_header->updates.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool CIec104SharedPointWriter::FindSlot(UINT64 key, UINT32 &slot) const
+{
+    size_t h = Iec104SharedPointLayout::HashKey(key) & m_hashMask;
+    for (;;)
+    {
+        UINT64 entry = m_entries[h].load(std::memory_order_acquire);
+        if (entry == 0)
+            return false;
+        if (Iec104SharedPointLayout::EntryKey(entry) == key)
+        {
+            slot = Iec104SharedPointLayout::EntrySlot(entry);
+            return true;
+        }
+        h = (h + 1) & m_hashMask;
+    }
+}
+
+bool CIec104SharedPointWriter::InsertSlot(UINT64 key, WORD commonAddr, DWORD ioa, UINT32 &slot)
+{
+    UINT32 count = m_header->count.load(std::memory_order_relaxed);
+    if (count >= m_header->capacity)
+        return false;
+
+    slot = count;
+    Iec104SharedPointRecord &rec = m_records[slot];
+    rec.commonAddr = commonAddr;
+    rec.ioa = ioa & 0xFFFFFF;
+
+    size_t h = Iec104SharedPointLayout::HashKey(key) & m_hashMask;
+    while (m_entries[h].load(std::memory_order_relaxed) != 0)
+        h = (h + 1) & m_hashMask;
+
+    // 键与槽位号在同一个64位项中发布，读者看到该项时槽位的键字段已可见
+    m_entries[h].store(Iec104SharedPointLayout::MakeEntry(key, slot), std::memory_order_release);
+    m_header->count.store(count + 1, std::memory_order_release);
+    return true;
+}
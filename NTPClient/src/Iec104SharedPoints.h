@@ -0,0 +1,298 @@
+﻿#pragma once
+#include <windows.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstring>
+
+// 共享内存点表：把各点的当前值/品质/时标发布到命名的文件映射中，供本机其他进程（HMI、告警等）直接读取
+// - 固定布局：64字节段头 + 开放寻址哈希表（8字节/项）+ 点记录（32字节/点），32位与64位进程可共用
+// - 每条记录一个序号锁(seqlock)，读取方不加锁、不阻塞写入，也不经过主站复制
+// - 记录只增不删，槽位在段的生命周期内不变，读取方可缓存槽位号后直接按槽位读取
+// - 读取部分全部内联在本头文件中，其他进程只需包含本文件即可读取，写入部分由 Iec104SharedPoints.cpp 实现
+//
+// 段布局（偏移均为字节）：
+//   [0, 64)                          Iec104SharedPointHeader
+//   [64, 64 + hashSize * 8)          哈希项：高24位为槽位号+1，低40位为键(公共地址 << 24 | IOA)，0 表示空
+//   [recordOffset, + capacity * 32)  Iec104SharedPointRecord
+
+#define IEC104_SHARED_POINTS_NAME L"Local\\NTPTool.Iec104Points"
+
+constexpr UINT32 IEC104_SHM_MAGIC = 0x50343031;       // "104P"
+constexpr UINT32 IEC104_SHM_VERSION = 1;
+constexpr UINT32 IEC104_SHM_MAX_CAPACITY = 0xFFFFFF;  // 槽位号占哈希项的24位
+
+// 段状态
+enum class Iec104SharedPointState : UINT32
+{
+    INITIALIZING = 0,   // 写者正在初始化，读取方应稍后重试
+    ONLINE = 1,         // 写者在线
+    CLOSED = 2          // 写者已关闭，全部点已置无效(IV)，新的写者可接管该段
+};
+
+struct Iec104SharedPointHeader
+{
+    std::atomic<UINT32> magic;        // 初始化完成后最后写入
+    UINT32 version;
+    UINT32 headerSize;
+    UINT32 recordSize;
+    UINT32 capacity;
+    UINT32 hashSize;                  // 2的幂
+    std::atomic<UINT32> count;        // 已分配的槽位数
+    std::atomic<UINT32> state;        // Iec104SharedPointState
+    std::atomic<UINT32> generation;   // 写者每次创建或接管该段时加1
+    UINT32 writerPid;
+    alignas(8) std::atomic<UINT64> updates;
+    std::atomic<UINT64> dropped;      // 容量已满而丢弃的新点更新次数
+    UINT32 reserved[2];
+};
+
+struct Iec104SharedPointRecord
+{
+    std::atomic<UINT32> seq;          // 序号锁，奇数表示正在写
+    UINT32 ioa;                       // 键字段在槽位分配时写入，之后不变
+    UINT16 commonAddr;
+    std::atomic<BYTE> type;           // 最近一次更新的ASDU类型
+    std::atomic<BYTE> quality;
+    std::atomic<UINT32> changeCount;  // 值或品质变化的次数（32位回绕）
+    std::atomic<UINT64> value;        // double 的位模式
+    std::atomic<INT64> timestampMs;   // 本地时间自1970-01-01起的毫秒数
+};
+
+static_assert(sizeof(Iec104SharedPointHeader) == 64, "共享段头必须为64字节");
+static_assert(sizeof(Iec104SharedPointRecord) == 32, "共享点记录必须为32字节");
+
+// 读取结果
+struct Iec104SharedPointSample
+{
+    WORD commonAddr;
+    DWORD ioa;
+    BYTE type;
+    BYTE quality;
+    double value;
+    INT64 timestampMs;
+    UINT32 changeCount;
+};
+
+// 布局计算（写入与读取两端共用）
+namespace Iec104SharedPointLayout
+{
+    inline UINT32 HashSizeFor(UINT32 capacity)
+    {
+        // 不小于2倍点数的2的幂，负载因子不超过0.5
+        UINT32 hashSize = 8;
+        while (hashSize < capacity * 2)
+            hashSize <<= 1;
+        return hashSize;
+    }
+
+    inline size_t RecordOffset(UINT32 hashSize) { return sizeof(Iec104SharedPointHeader) + (size_t)hashSize * sizeof(UINT64); }
+    inline size_t SegmentSize(UINT32 capacity, UINT32 hashSize) { return RecordOffset(hashSize) + (size_t)capacity * sizeof(Iec104SharedPointRecord); }
+
+    inline UINT64 MakeKey(WORD commonAddr, DWORD ioa) { return ((UINT64)commonAddr << 24) | (ioa & 0xFFFFFF); }
+    inline UINT64 MakeEntry(UINT64 key, UINT32 slot) { return ((UINT64)(slot + 1) << 40) | key; }
+    inline UINT64 EntryKey(UINT64 entry) { return entry & 0xFFFFFFFFFFULL; }
+    inline UINT32 EntrySlot(UINT64 entry) { return (UINT32)(entry >> 40) - 1; }
+
+    inline size_t HashKey(UINT64 key)
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return (size_t)key;
+    }
+}
+
+// 读取库（任意进程、任意线程，无锁）
+// 写者在写入过程中异常退出时该记录的序号停在奇数，读取在重试 READ_RETRIES 次后返回 false 而不是一直等待
+class CIec104SharedPointReader
+{
+public:
+    CIec104SharedPointReader() : m_mapping(nullptr), m_view(nullptr), m_header(nullptr), m_entries(nullptr), m_records(nullptr), m_hashMask(0), m_capacity(0) {}
+    ~CIec104SharedPointReader() { Close(); }
+
+    CIec104SharedPointReader(const CIec104SharedPointReader&) = delete;
+    CIec104SharedPointReader& operator=(const CIec104SharedPointReader&) = delete;
+
+    bool Open(const std::wstring& name = IEC104_SHARED_POINTS_NAME, std::wstring* err = nullptr)
+    {
+        Close();
+        m_mapping = OpenFileMappingW(FILE_MAP_READ, FALSE, name.c_str());
+        if (m_mapping == nullptr)
+        {
+            if (err) *err = L"打开共享点表失败（写者未运行？）: " + name + L"，错误码 " + std::to_wstring(GetLastError());
+            return false;
+        }
+        m_view = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (m_view == nullptr)
+        {
+            if (err) *err = L"映射共享点表失败，错误码 " + std::to_wstring(GetLastError());
+            Close();
+            return false;
+        }
+
+        m_header = static_cast<const Iec104SharedPointHeader*>(m_view);
+        if (m_header->magic.load(std::memory_order_acquire) != IEC104_SHM_MAGIC ||
+            m_header->version != IEC104_SHM_VERSION ||
+            m_header->headerSize != sizeof(Iec104SharedPointHeader) ||
+            m_header->recordSize != sizeof(Iec104SharedPointRecord))
+        {
+            if (err) *err = L"共享点表未初始化或版本不兼容: " + name;
+            Close();
+            return false;
+        }
+        const BYTE* base = static_cast<const BYTE*>(m_view);
+        // 段头与写者的计数器同处一个缓存行，查找路径只使用这里缓存的布局参数
+        m_hashMask = m_header->hashSize - 1;
+        m_capacity = m_header->capacity;
+        m_entries = reinterpret_cast<const std::atomic<UINT64>*>(base + sizeof(Iec104SharedPointHeader));
+        m_records = reinterpret_cast<const Iec104SharedPointRecord*>(base + Iec104SharedPointLayout::RecordOffset(m_header->hashSize));
+        return true;
+    }
+
+    void Close()
+    {
+        if (m_view != nullptr)
+            UnmapViewOfFile(m_view);
+        if (m_mapping != nullptr)
+            CloseHandle(m_mapping);
+        m_view = nullptr;
+        m_mapping = nullptr;
+        m_header = nullptr;
+        m_entries = nullptr;
+        m_records = nullptr;
+    }
+
+    bool IsOpen() const { return m_header != nullptr; }
+    bool IsWriterOnline() const { return m_header->state.load(std::memory_order_acquire) == (UINT32)Iec104SharedPointState::ONLINE; }
+    UINT32 GetGeneration() const { return m_header->generation.load(std::memory_order_acquire); }
+    UINT32 GetCapacity() const { return m_capacity; }
+    UINT32 GetPointCount() const { return m_header->count.load(std::memory_order_acquire); }
+    UINT64 GetUpdateCount() const { return m_header->updates.load(std::memory_order_relaxed); }
+    UINT64 GetDroppedCount() const { return m_header->dropped.load(std::memory_order_relaxed); }
+
+    // 查找点的槽位号，槽位号在段的生命周期内不变（写者重启接管后也不变）
+    bool Find(WORD commonAddr, DWORD ioa, UINT32& slot) const
+    {
+        UINT64 key = Iec104SharedPointLayout::MakeKey(commonAddr, ioa);
+        size_t h = Iec104SharedPointLayout::HashKey(key) & m_hashMask;
+        for (size_t probes = 0; probes <= m_hashMask; ++probes)
+        {
+            UINT64 entry = m_entries[h].load(std::memory_order_acquire);
+            if (entry == 0)
+                return false;
+            if (Iec104SharedPointLayout::EntryKey(entry) == key)
+            {
+                slot = Iec104SharedPointLayout::EntrySlot(entry);
+                return slot < m_capacity;
+            }
+            h = (h + 1) & m_hashMask;
+        }
+        return false;
+    }
+
+    // 按槽位号读取，slot 必须小于 GetPointCount()
+    bool ReadSlot(UINT32 slot, Iec104SharedPointSample& out) const
+    {
+        const Iec104SharedPointRecord& rec = m_records[slot];
+        out.commonAddr = rec.commonAddr;
+        out.ioa = rec.ioa;
+        for (int retry = 0; retry < READ_RETRIES; ++retry)
+        {
+            UINT32 seq1 = rec.seq.load(std::memory_order_acquire);
+            if (seq1 & 1)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            UINT64 bits = rec.value.load(std::memory_order_relaxed);
+            out.timestampMs = rec.timestampMs.load(std::memory_order_relaxed);
+            out.type = rec.type.load(std::memory_order_relaxed);
+            out.quality = rec.quality.load(std::memory_order_relaxed);
+            out.changeCount = rec.changeCount.load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (rec.seq.load(std::memory_order_relaxed) == seq1)
+            {
+                memcpy(&out.value, &bits, sizeof(out.value));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Read(WORD commonAddr, DWORD ioa, Iec104SharedPointSample& out) const
+    {
+        UINT32 slot = 0;
+        return Find(commonAddr, ioa, slot) && ReadSlot(slot, out);
+    }
+
+    // 按槽位顺序读取全部点，返回读取成功的点数（各点单独一致，不保证跨点处于同一时刻）
+    size_t ReadAll(std::vector<Iec104SharedPointSample>& out) const
+    {
+        UINT32 count = GetPointCount();
+        out.resize(count);
+        size_t n = 0;
+        for (UINT32 slot = 0; slot < count; ++slot)
+        {
+            if (ReadSlot(slot, out[n]))
+                ++n;
+        }
+        out.resize(n);
+        return n;
+    }
+
+private:
+    static constexpr int READ_RETRIES = 1000;
+
+    HANDLE m_mapping;
+    void* m_view;
+    const Iec104SharedPointHeader* m_header;
+    const std::atomic<UINT64>* m_entries;
+    const Iec104SharedPointRecord* m_records;
+    size_t m_hashMask;
+    UINT32 m_capacity;
+};
+
+// 写入端：创建（或接管已关闭的）命名段，由主站接收线程调用 Update
+// - 同一进程内多个主站可共用一个写者：已有点的更新无锁，新点分配槽位时加进程内锁，
+//   每条记录的序号锁以CAS获取，两个连接同时写同一点也不会破坏记录
+// - 同名段只能有一个在线写者；写者关闭后段对象在仍有读取方打开时继续存在，全部点置IV，
+//   下一个写者接管时保留原有槽位，读取方缓存的槽位号仍然有效
+class CIec104SharedPointWriter
+{
+public:
+    CIec104SharedPointWriter();
+    ~CIec104SharedPointWriter();
+
+    CIec104SharedPointWriter(const CIec104SharedPointWriter&) = delete;
+    CIec104SharedPointWriter& operator=(const CIec104SharedPointWriter&) = delete;
+
+    bool Create(const std::wstring& name = IEC104_SHARED_POINTS_NAME, size_t capacity = 65536, std::wstring* err = nullptr);
+    void Close();
+    bool IsOpen() const { return m_header != nullptr; }
+
+    // 任意线程：写入一个点的当前值，返回 false 表示段已满而丢弃了新点
+    bool Update(WORD commonAddr, DWORD ioa, BYTE type, BYTE quality, double value, INT64 timestampMs);
+
+    UINT32 GetPointCount() const { return m_header ? m_header->count.load(std::memory_order_relaxed) : 0; }
+    UINT64 GetUpdateCount() const { return m_header ? m_header->updates.load(std::memory_order_relaxed) : 0; }
+    UINT64 GetDroppedCount() const { return m_header ? m_header->dropped.load(std::memory_order_relaxed) : 0; }
+
+private:
+    bool FindSlot(UINT64 key, UINT32& slot) const;
+    bool InsertSlot(UINT64 key, WORD commonAddr, DWORD ioa, UINT32& slot);
+    void Initialize(UINT32 capacity, UINT32 hashSize);
+    bool Adopt(std::wstring* err);
+
+    HANDLE m_mapping;
+    void* m_view;
+    Iec104SharedPointHeader* m_header;
+    std::atomic<UINT64>* m_entries;
+    Iec104SharedPointRecord* m_records;
+    size_t m_hashMask;
+    std::mutex m_insertMutex;    // 只在分配新点时使用
+};
@@ -0,0 +1,206 @@
+﻿#include "pch.h"
+#include "Iec104Subscription.h"
+#include <algorithm>
+#include <thread>
+
+CIec104SubscriptionIndex::CIec104SubscriptionIndex()
+    : m_nextId(1), m_count(0), m_index(std::make_shared<Index>()), m_activeCount(0), m_dispatchSeq(0), m_dispatchThread(0), m_asduDelivered(0),
+      m_delivered(0)
+{
+}
+
+UINT64 CIec104SubscriptionIndex::Subscribe(const Iec104SubscriptionFilter &filter, Iec104PointCallback callback)
+{
+    if (filter.ioaFirst > filter.ioaLast || filter.ioaFirst > 0xFFFFFF || !callback)
+        return 0;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::shared_ptr<Subscriber> subscriber = std::make_shared<Subscriber>();
+    subscriber->id = m_nextId++;
+    subscriber->filter = filter;
+    subscriber->filter.ioaLast = (std::min)(filter.ioaLast, (DWORD)0xFFFFFF);
+    subscriber->callback = std::move(callback);
+    subscriber->active = true;
+    m_subscribers.push_back(subscriber);
+    Rebuild();
+    return subscriber->id;
+}
+
+bool CIec104SubscriptionIndex::Unsubscribe(UINT64 id)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = std::find_if(m_subscribers.begin(), m_subscribers.end(),
+                               [id](const std::shared_ptr<Subscriber> &subscriber) { return subscriber->id == id; });
+        if (it == m_subscribers.end())
+            return false;
+
+        // 先停止回调，再发布不含该订阅的索引；接收线程手中的旧索引仍持有订阅者对象
+        (*it)->active.store(false);
+        m_subscribers.erase(it);
+        Rebuild();
+    }
+
+    // 接收线程正在分发时等待本ASDU结束，保证返回后不再回调
+    UINT64 seq = m_dispatchSeq.load();
+    if ((seq & 1) != 0 && m_dispatchThread.load() != GetCurrentThreadId())
+    {
+        while (m_dispatchSeq.load() == seq)
+        {
+            std::this_thread::yield();
+        }
+    }
+    return true;
+}
+
+void CIec104SubscriptionIndex::Rebuild()
+{
+    std::shared_ptr<Index> index = std::make_shared<Index>();
+    index->subscribers = m_subscribers;
+
+    // 按(公共地址, 类型)分组后逐桶构建
+    std::unordered_map<DWORD, std::vector<Subscriber *>> groups;
+    for (const auto &subscriber : m_subscribers)
+    {
+        const Iec104SubscriptionFilter &filter = subscriber->filter;
+        groups[MakeKey(filter.commonAddr, filter.type)].push_back(subscriber.get());
+        index->anyCa = index->anyCa || filter.commonAddr == IEC104_SUB_ANY_CA;
+        index->anyType = index->anyType || filter.type == IEC104_SUB_ANY_TYPE;
+    }
+    for (const auto &group : groups)
+    {
+        BuildBucket(group.second, index->buckets[group.first]);
+    }
+
+    m_count.store(m_subscribers.size(), std::memory_order_release);
+    std::atomic_store(&m_index, std::shared_ptr<const Index>(std::move(index)));
+}
+
+void CIec104SubscriptionIndex::BuildBucket(const std::vector<Subscriber *> &subscribers, Bucket &bucket)
+{
+    // 所有区间端点把IOA轴切分为互不重叠的区段，每个区段的订阅者集合固定
+    std::vector<UINT64> bounds;
+    bounds.reserve(subscribers.size() * 2);
+    for (const Subscriber *subscriber : subscribers)
+    {
+        bounds.push_back(subscriber->filter.ioaFirst);
+        bounds.push_back((UINT64)subscriber->filter.ioaLast + 1);
+    }
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+    for (size_t i = 0; i + 1 < bounds.size(); ++i)
+    {
+        Segment segment;
+        segment.first = (DWORD)bounds[i];
+        segment.last = (DWORD)(bounds[i + 1] - 1);
+        segment.begin = (DWORD)bucket.targets.size();
+        for (Subscriber *subscriber : subscribers)
+        {
+            if (subscriber->filter.ioaFirst <= segment.first && subscriber->filter.ioaLast >= segment.last)
+                bucket.targets.push_back(subscriber);
+        }
+        segment.end = (DWORD)bucket.targets.size();
+        if (segment.end != segment.begin)
+            bucket.segments.push_back(segment);
+    }
+
+    // 跨度不大时建直接查找表
+    if (bucket.segments.empty() || bucket.segments.size() >= 0xFFFF)
+        return;
+    DWORD base = bucket.segments.front().first;
+    DWORD span = bucket.segments.back().last - base + 1;
+    if (span > DIRECT_SPAN)
+        return;
+
+    bucket.directBase = base;
+    bucket.direct.assign(span, 0);
+    for (size_t i = 0; i < bucket.segments.size(); ++i)
+    {
+        const Segment &segment = bucket.segments[i];
+        std::fill(bucket.direct.begin() + (segment.first - base), bucket.direct.begin() + (segment.last - base + 1), (WORD)(i + 1));
+    }
+}
+
+const CIec104SubscriptionIndex::Segment *CIec104SubscriptionIndex::FindSegment(const Bucket &bucket, DWORD ioa)
+{
+    if (!bucket.direct.empty())
+    {
+        DWORD offset = ioa - bucket.directBase;   // 小于基址时回绕为大数
+        if (offset >= bucket.direct.size() || bucket.direct[offset] == 0)
+            return nullptr;
+        return &bucket.segments[bucket.direct[offset] - 1];
+    }
+
+    auto it = std::upper_bound(bucket.segments.begin(), bucket.segments.end(), ioa,
+                               [](DWORD value, const Segment &segment) { return value < segment.first; });
+    if (it == bucket.segments.begin())
+        return nullptr;
+    --it;
+    return ioa <= it->last ? &*it : nullptr;
+}
+
+bool CIec104SubscriptionIndex::BeginAsdu(WORD commonAddr, BYTE type)
+{
+    if (m_count.load(std::memory_order_acquire) == 0)
+        return false;
+
+    // 先标记分发开始再取索引，与 Unsubscribe 的等待配合
+    m_dispatchThread.store(GetCurrentThreadId(), std::memory_order_relaxed);
+    m_dispatchSeq.fetch_add(1);
+    m_current = std::atomic_load(&m_index);
+
+    // 精确键及通配键，最多4个桶
+    m_activeCount = 0;
+    const DWORD keys[4] = { MakeKey(commonAddr, type), MakeKey(commonAddr, IEC104_SUB_ANY_TYPE), MakeKey(IEC104_SUB_ANY_CA, type),
+                            MakeKey(IEC104_SUB_ANY_CA, IEC104_SUB_ANY_TYPE) };
+    const bool probe[4] = { true, m_current->anyType, m_current->anyCa, m_current->anyCa && m_current->anyType };
+    for (int i = 0; i < 4; ++i)
+    {
+        if (!probe[i] || (i > 0 && keys[i] == keys[0]))
+            continue;
+        auto it = m_current->buckets.find(keys[i]);
+        if (it != m_current->buckets.end())
+            m_active[m_activeCount++] = &it->second;
+    }
+
+    if (m_activeCount == 0)
+    {
+        EndAsdu();
+        return false;
+    }
+    return true;
+}
+
+void CIec104SubscriptionIndex::Deliver(const Iec104PointUpdate &update)
+{
+    for (int i = 0; i < m_activeCount; ++i)
+    {
+        const Bucket &bucket = *m_active[i];
+        const Segment *segment = FindSegment(bucket, update.ioa);
+        if (!segment)
+            continue;
+
+        for (DWORD t = segment->begin; t < segment->end; ++t)
+        {
+            Subscriber *subscriber = bucket.targets[t];
+            if (subscriber->active.load(std::memory_order_acquire))
+            {
+                subscriber->callback(update);
+                ++m_asduDelivered;
+            }
+        }
+    }
+}
+
+void CIec104SubscriptionIndex::EndAsdu()
+{
+    m_activeCount = 0;
+    m_current.reset();
+    if (m_asduDelivered != 0)
+    {
+        m_delivered.fetch_add(m_asduDelivered, std::memory_order_relaxed);
+        m_asduDelivered = 0;
+    }
+    m_dispatchSeq.fetch_add(1);
+}
@@ -0,0 +1,119 @@
+﻿#pragma once
+#include <windows.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+constexpr WORD IEC104_SUB_ANY_CA = 0xFFFF;      // 订阅任意公共地址
+constexpr BYTE IEC104_SUB_ANY_TYPE = 0;         // 订阅任意类型
+
+// 分发给订阅者的单点更新
+struct Iec104PointUpdate
+{
+    WORD commonAddr;
+    DWORD ioa;
+    BYTE type;
+    BYTE quality;
+    double value;
+    INT64 timestampMs;    // 本地时间自1970-01-01起的毫秒数
+};
+
+using Iec104PointCallback = std::function<void(const Iec104PointUpdate&)>;
+
+// 订阅条件：公共地址 + 类型 + IOA闭区间
+struct Iec104SubscriptionFilter
+{
+    WORD commonAddr = IEC104_SUB_ANY_CA;
+    BYTE type = IEC104_SUB_ANY_TYPE;
+    DWORD ioaFirst = 0;
+    DWORD ioaLast = 0xFFFFFF;
+};
+
+// 按点订阅与分发
+// - 订阅/退订在任意线程进行，每次变更重建一份只读分发索引并原子替换，接收线程不加锁
+// - 索引按(公共地址, 类型)分桶，桶内IOA区间拆分为互不重叠的区段，每个区段预先算好订阅者列表；
+//   IOA跨度不超过 DIRECT_SPAN 的桶另建直接查找表，单点分发为 O(1)，否则在区段上二分查找
+// - 接收线程每个ASDU调用一次 BeginAsdu 定位桶（公共地址与类型在ASDU内相同），逐点 Deliver
+// - 单写者（与点库相同）：同一时刻只有一个接收线程分发；冗余组的各连接共用时由点库的写锁（SetSharedWriters）保证
+// - Unsubscribe 返回后回调不再被调用：若接收线程正在分发，等待当前ASDU分发结束；
+//   在回调中退订（包括退订自身）立即返回
+class CIec104SubscriptionIndex
+{
+public:
+    static constexpr DWORD DIRECT_SPAN = 65536;
+
+    CIec104SubscriptionIndex();
+
+    CIec104SubscriptionIndex(const CIec104SubscriptionIndex&) = delete;
+    CIec104SubscriptionIndex& operator=(const CIec104SubscriptionIndex&) = delete;
+
+    // 返回订阅号，条件无效（IOA区间为空）返回0
+    UINT64 Subscribe(const Iec104SubscriptionFilter& filter, Iec104PointCallback callback);
+    bool Unsubscribe(UINT64 id);
+    size_t GetSubscriberCount() const { return m_count.load(std::memory_order_acquire); }
+
+    // 接收线程
+    bool BeginAsdu(WORD commonAddr, BYTE type);     // 没有相关订阅时返回 false，本ASDU无需 Deliver
+    void Deliver(const Iec104PointUpdate& update);
+    void EndAsdu();
+
+    UINT64 GetDeliveredCount() const { return m_delivered.load(std::memory_order_relaxed); }
+
+private:
+    struct Subscriber
+    {
+        UINT64 id;
+        Iec104SubscriptionFilter filter;
+        Iec104PointCallback callback;
+        std::atomic<bool> active;
+    };
+
+    // 区段 [first, last] 的订阅者为 targets[begin, end)
+    struct Segment
+    {
+        DWORD first;
+        DWORD last;
+        DWORD begin;
+        DWORD end;
+    };
+
+    struct Bucket
+    {
+        std::vector<Segment> segments;       // 按 first 升序
+        DWORD directBase = 0;
+        std::vector<WORD> direct;            // IOA-directBase → 区段下标+1，0 表示无订阅；为空时二分查找
+        std::vector<Subscriber*> targets;
+    };
+
+    // 只读索引快照，持有订阅者的引用
+    struct Index
+    {
+        std::vector<std::shared_ptr<Subscriber>> subscribers;
+        std::unordered_map<DWORD, Bucket> buckets;   // 键：公共地址<<8 | 类型（含通配）
+        bool anyCa = false;                          // 存在任意公共地址的订阅
+        bool anyType = false;
+    };
+
+    static DWORD MakeKey(WORD commonAddr, BYTE type) { return ((DWORD)commonAddr << 8) | type; }
+    static void BuildBucket(const std::vector<Subscriber*>& subscribers, Bucket& bucket);
+    void Rebuild();
+    static const Segment* FindSegment(const Bucket& bucket, DWORD ioa);
+
+    std::mutex m_mutex;                                  // 保护订阅表与重建
+    std::vector<std::shared_ptr<Subscriber>> m_subscribers;
+    UINT64 m_nextId;
+    std::atomic<size_t> m_count;
+    std::shared_ptr<const Index> m_index;                // 以 std::atomic_load/atomic_store 访问
+
+    // 接收线程状态
+    std::shared_ptr<const Index> m_current;
+    const Bucket* m_active[4];
+    int m_activeCount;
+    std::atomic<UINT64> m_dispatchSeq;                   // 奇数表示正在分发一个ASDU
+    std::atomic<DWORD> m_dispatchThread;
+    UINT64 m_asduDelivered;
+    std::atomic<UINT64> m_delivered;
+};
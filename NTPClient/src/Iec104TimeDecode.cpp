@@ -0,0 +1,186 @@
+﻿#include "pch.h"
+#include "Iec104TimeDecode.h"
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define IEC104_TIME_SSE2 1
+#endif
+
+namespace
+{
+    constexpr INT64 MS_PER_DAY = 86400000;
+    constexpr INT64 MS_PER_HOUR = 3600000;
+    constexpr int DAYS_1970_TO_2000 = 10957;
+
+    // CP56Time2a 的7位年（2000-2127）× 4位月编码，月编码0与13-15为非法
+    struct CalendarTables
+    {
+        INT32 daysBefore[128 * 16];     // 1970-01-01 到该年该月1日的天数
+        BYTE daysInMonth[128 * 16];     // 当月天数，非法月编码为0
+
+        CalendarTables()
+        {
+            static const BYTE MONTH_DAYS[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+            memset(daysBefore, 0, sizeof(daysBefore));
+            memset(daysInMonth, 0, sizeof(daysInMonth));
+
+            int days = DAYS_1970_TO_2000;
+            for (int year = 0; year < 128; ++year)
+            {
+                int y = 2000 + year;
+                bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+                for (int month = 1; month <= 12; ++month)
+                {
+                    int length = MONTH_DAYS[month - 1] + (month == 2 && leap ? 1 : 0);
+                    daysBefore[year * 16 + month] = days;
+                    daysInMonth[year * 16 + month] = (BYTE)length;
+                    days += length;
+                }
+            }
+        }
+    };
+
+    const CalendarTables g_calendar;
+
+    inline UINT32 LoadLe32(const BYTE* p)
+    {
+        UINT32 value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    inline UINT32 CalendarIndex(const BYTE* cp56)
+    {
+        return ((UINT32)(cp56[6] & 0x7F) << 4) | (cp56[5] & 0x0F);
+    }
+
+    inline INT64 DecodeOne(const BYTE* cp56)
+    {
+        UINT32 ms = (UINT32)cp56[0] | ((UINT32)cp56[1] << 8);
+        UINT32 minute = cp56[2] & 0x3F;
+        UINT32 hour = cp56[3] & 0x1F;
+        UINT32 day = cp56[4] & 0x1F;
+        UINT32 index = CalendarIndex(cp56);
+        if (ms >= 60000 || minute >= 60 || hour >= 24 || day == 0 || day > g_calendar.daysInMonth[index])
+        {
+            return 0;
+        }
+        return (INT64)(g_calendar.daysBefore[index] + (int)day - 1) * MS_PER_DAY + hour * MS_PER_HOUR + minute * 60000 + ms;
+    }
+}
+
+INT64 Iec104CP56ToEpochMs(const BYTE* cp56)
+{
+    return DecodeOne(cp56);
+}
+
+size_t Iec104DecodeCP56TimesScalar(const BYTE* first, size_t stride, size_t count, INT64* timestampsMs)
+{
+    size_t invalid = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        timestampsMs[i] = DecodeOne(first + i * stride);
+        invalid += timestampsMs[i] == 0;
+    }
+    return invalid;
+}
+
+size_t Iec104DecodeCP56Times(const BYTE* first, size_t stride, size_t count, INT64* timestampsMs)
+{
+#ifdef IEC104_TIME_SSE2
+    size_t invalid = 0;
+    size_t i = 0;
+    if (count >= 4)
+    {
+        // 4路有效掩码中置位的个数（POPCNT 不属于SSE2）
+        static const BYTE VALID_COUNT[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i mask16 = _mm_set1_epi32(0xFFFF);
+        const __m128i mask6 = _mm_set1_epi32(0x3F);
+        const __m128i mask5 = _mm_set1_epi32(0x1F);
+        const __m128i one = _mm_set1_epi32(1);
+        const __m128i msLimit = _mm_set1_epi32(60000);
+        const __m128i minuteLimit = _mm_set1_epi32(60);
+        const __m128i hourLimit = _mm_set1_epi32(24);
+        // 分、时的毫秒数拆成16位乘数与移位：60000 = 1875<<5，3600000 = 28125<<7
+        const __m128i minuteFactor = _mm_set1_epi32(1875);
+        const __m128i hourFactor = _mm_set1_epi32(28125);
+        const __m128i dayMs = _mm_set1_epi32((int)MS_PER_DAY);
+
+        for (; i + 4 <= count; i += 4)
+        {
+            const BYTE* t0 = first + i * stride;
+            const BYTE* t1 = t0 + stride;
+            const BYTE* t2 = t1 + stride;
+            const BYTE* t3 = t2 + stride;
+
+            // 每个字段读两个32位字（字节0-3与3-6），不越过7字节字段的末尾
+            __m128i lo = _mm_set_epi32((int)LoadLe32(t3), (int)LoadLe32(t2), (int)LoadLe32(t1), (int)LoadLe32(t0));
+            __m128i hi = _mm_set_epi32((int)LoadLe32(t3 + 3), (int)LoadLe32(t2 + 3), (int)LoadLe32(t1 + 3), (int)LoadLe32(t0 + 3));
+
+            // 年月查表（无SSE2聚集指令，逐个取）
+            UINT32 i0 = CalendarIndex(t0), i1 = CalendarIndex(t1), i2 = CalendarIndex(t2), i3 = CalendarIndex(t3);
+            __m128i before = _mm_set_epi32(g_calendar.daysBefore[i3], g_calendar.daysBefore[i2], g_calendar.daysBefore[i1], g_calendar.daysBefore[i0]);
+            __m128i monthDays = _mm_set_epi32(g_calendar.daysInMonth[i3], g_calendar.daysInMonth[i2], g_calendar.daysInMonth[i1], g_calendar.daysInMonth[i0]);
+
+            __m128i ms = _mm_and_si128(lo, mask16);
+            __m128i minute = _mm_and_si128(_mm_srli_epi32(lo, 16), mask6);
+            __m128i hour = _mm_and_si128(_mm_srli_epi32(lo, 24), mask5);
+            __m128i day = _mm_and_si128(_mm_srli_epi32(hi, 8), mask5);
+
+            // 范围校验：各项均非负，可用有符号比较；日 ≤ 当月天数 即 当月天数+1 > 日
+            __m128i valid = _mm_and_si128(_mm_cmplt_epi32(ms, msLimit), _mm_cmplt_epi32(minute, minuteLimit));
+            valid = _mm_and_si128(valid, _mm_cmplt_epi32(hour, hourLimit));
+            valid = _mm_and_si128(valid, _mm_cmpgt_epi32(day, zero));
+            valid = _mm_and_si128(valid, _mm_cmpgt_epi32(_mm_add_epi32(monthDays, one), day));
+
+            // 日内毫秒数（< 2^27，32位）
+            __m128i msOfDay = _mm_add_epi32(ms, _mm_slli_epi32(_mm_madd_epi16(minute, minuteFactor), 5));
+            msOfDay = _mm_add_epi32(msOfDay, _mm_slli_epi32(_mm_madd_epi16(hour, hourFactor), 7));
+            __m128i days = _mm_sub_epi32(_mm_add_epi32(before, day), one);
+
+            // 天数×86400000 需要64位：两路一组做32×32→64位乘法
+            __m128i daysLo = _mm_unpacklo_epi32(days, zero);
+            __m128i daysHi = _mm_unpackhi_epi32(days, zero);
+            __m128i resultLo = _mm_add_epi64(_mm_mul_epu32(daysLo, dayMs), _mm_unpacklo_epi32(msOfDay, zero));
+            __m128i resultHi = _mm_add_epi64(_mm_mul_epu32(daysHi, dayMs), _mm_unpackhi_epi32(msOfDay, zero));
+            resultLo = _mm_and_si128(resultLo, _mm_unpacklo_epi32(valid, valid));
+            resultHi = _mm_and_si128(resultHi, _mm_unpackhi_epi32(valid, valid));
+            _mm_storeu_si128((__m128i*)(timestampsMs + i), resultLo);
+            _mm_storeu_si128((__m128i*)(timestampsMs + i + 2), resultHi);
+
+            invalid += 4 - VALID_COUNT[_mm_movemask_ps(_mm_castsi128_ps(valid))];
+        }
+    }
+    return invalid + Iec104DecodeCP56TimesScalar(first + i * stride, stride, count - i, timestampsMs + i);
+#else
+    return Iec104DecodeCP56TimesScalar(first, stride, count, timestampsMs);
+#endif
+}
+
+size_t Iec104DecodeCP24Times(const BYTE* first, size_t stride, size_t count, INT64 referenceMs, INT64* timestampsMs)
+{
+    INT64 hourStartMs = referenceMs - referenceMs % MS_PER_HOUR;
+    size_t invalid = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const BYTE* cp24 = first + i * stride;
+        UINT32 ms = (UINT32)cp24[0] | ((UINT32)cp24[1] << 8);
+        UINT32 minute = cp24[2] & 0x3F;
+        if (ms >= 60000 || minute >= 60)
+        {
+            timestampsMs[i] = 0;
+            ++invalid;
+            continue;
+        }
+
+        INT64 value = hourStartMs + minute * 60000 + ms;
+        if (value > referenceMs + IEC104_CP24_FUTURE_TOLERANCE_MS)
+        {
+            value -= MS_PER_HOUR;
+        }
+        timestampsMs[i] = value;
+    }
+    return invalid;
+}
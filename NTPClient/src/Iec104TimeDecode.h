@@ -0,0 +1,25 @@
+﻿#pragma once
+#include <windows.h>
+
+// CP24Time2a 按参考时刻补全小时：结果晚于参考时刻超过此值时取前一小时
+constexpr INT64 IEC104_CP24_FUTURE_TOLERANCE_MS = 5 * 60 * 1000;
+
+// 批量时标解码：把报文中的 CP56Time2a/CP24Time2a 字段直接换算为毫秒时标
+// - 时标按本地时间处理，结果与 CIec104Master::SystemTimeToEpochMs(CP56ToSystemTime(...)) 相同，
+//   即把本地日期时间按日历换算为自1970-01-01起的毫秒数，不做时区转换
+// - first 指向第一个时标字段，stride 为相邻字段的间距（SQ=1 时为信息元素长度，SQ=0 时另加IOA长度）
+// - 非法时标（毫秒≥60000、分≥60、时≥24、月或日超出范围）输出0；IV等标志位不影响换算
+// - 年月按预先计算的表（2000-2127年×月）查出当月1日的天数，不逐个调用系统时间函数；
+//   x86/x64 上每次换算4个字段，字段拆分、范围校验与64位合成用SSE2完成
+// 返回非法时标的个数
+size_t Iec104DecodeCP56Times(const BYTE* first, size_t stride, size_t count, INT64* timestampsMs);
+
+// 同上，逐个字段的标量实现（非SSE2平台使用，也作为基准对照）
+size_t Iec104DecodeCP56TimesScalar(const BYTE* first, size_t stride, size_t count, INT64* timestampsMs);
+
+// CP24Time2a（毫秒+分）：日期与小时取自 referenceMs（通常为接收时刻，本地时间毫秒时标），
+// 结果晚于参考时刻超过 IEC104_CP24_FUTURE_TOLERANCE_MS 时视为上一小时的事件
+size_t Iec104DecodeCP24Times(const BYTE* first, size_t stride, size_t count, INT64 referenceMs, INT64* timestampsMs);
+
+// 单个 CP56Time2a 字段（7字节），非法时返回0
+INT64 Iec104CP56ToEpochMs(const BYTE* cp56);
@@ -0,0 +1,596 @@
+﻿#include "pch.h"
+#include "Iec104Tls.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    constexpr DWORD CLIENT_CONTEXT_FLAGS = ISC_REQ_SEQUENCE_DETECT | ISC_REQ_REPLAY_DETECT | ISC_REQ_CONFIDENTIALITY |
+                                           ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_STREAM | ISC_REQ_EXTENDED_ERROR;
+    constexpr DWORD SERVER_CONTEXT_FLAGS = ASC_REQ_SEQUENCE_DETECT | ASC_REQ_REPLAY_DETECT | ASC_REQ_CONFIDENTIALITY |
+                                           ASC_REQ_ALLOCATE_MEMORY | ASC_REQ_STREAM | ASC_REQ_EXTENDED_ERROR;
+    const wchar_t SELF_SIGNED_CONTAINER[] = L"NTPTool.Iec104.SelfSigned";
+
+    std::wstring FormatStatus(DWORD status)
+    {
+        wchar_t *buffer = nullptr;
+        FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, status,
+                       MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPWSTR)&buffer, 0, nullptr);
+
+        wchar_t code[16];
+        swprintf_s(code, L"0x%08X", status);
+        std::wstring result = code;
+        if (buffer)
+        {
+            result += L" ";
+            result += buffer;
+            LocalFree(buffer);
+            while (!result.empty() && (result.back() == L'\r' || result.back() == L'\n'))
+                result.pop_back();
+        }
+        return result;
+    }
+
+    PCCERT_CONTEXT FindCertificate(const std::wstring &subject, bool machineStore, std::wstring *err)
+    {
+        DWORD location = machineStore ? CERT_SYSTEM_STORE_LOCAL_MACHINE : CERT_SYSTEM_STORE_CURRENT_USER;
+        HCERTSTORE store = CertOpenStore(CERT_STORE_PROV_SYSTEM_W, 0, 0, location | CERT_STORE_READONLY_FLAG, L"MY");
+        if (!store)
+        {
+            if (err)
+                *err = L"打开证书存储失败: " + FormatStatus(GetLastError());
+            return nullptr;
+        }
+
+        PCCERT_CONTEXT cert = CertFindCertificateInStore(store, X509_ASN_ENCODING | PKCS_7_ASN_ENCODING, 0, CERT_FIND_SUBJECT_STR_W,
+                                                         subject.c_str(), nullptr);
+        if (!cert && err)
+        {
+            *err = L"未找到证书: " + subject;
+        }
+        CertCloseStore(store, 0);
+        return cert;
+    }
+}
+
+CIec104TlsCredentials::CIec104TlsCredentials()
+    : m_cert(nullptr), m_valid(false), m_server(false), m_verifyPeer(true)
+{
+    SecInvalidateHandle(&m_handle);
+}
+
+CIec104TlsCredentials::~CIec104TlsCredentials()
+{
+    Release();
+}
+
+bool CIec104TlsCredentials::InitClient(const Iec104TlsConfig &config, std::wstring *err)
+{
+    Release();
+    if (!config.certSubject.empty())
+    {
+        m_cert = FindCertificate(config.certSubject, config.machineStore, err);
+        if (!m_cert)
+            return false;
+    }
+    return Acquire(false, config, err);
+}
+
+bool CIec104TlsCredentials::InitServer(const Iec104TlsConfig &config, std::wstring *err)
+{
+    Release();
+    if (config.certSubject.empty())
+    {
+        if (err)
+            *err = L"服务端必须配置证书";
+        return false;
+    }
+    m_cert = FindCertificate(config.certSubject, config.machineStore, err);
+    if (!m_cert)
+        return false;
+    return Acquire(true, config, err);
+}
+
+bool CIec104TlsCredentials::InitServer(PCCERT_CONTEXT cert, const Iec104TlsConfig &config, std::wstring *err)
+{
+    Release();
+    if (!cert)
+    {
+        if (err)
+            *err = L"服务端必须配置证书";
+        return false;
+    }
+    m_cert = CertDuplicateCertificateContext(cert);
+    return Acquire(true, config, err);
+}
+
+bool CIec104TlsCredentials::Acquire(bool server, const Iec104TlsConfig &config, std::wstring *err)
+{
+    // IEC 62351-3 要求 TLS 1.2 及以上；只启用 TLS 1.2，不启用重协商以外的扩展配置
+    SCHANNEL_CRED cred = {};
+    cred.dwVersion = SCHANNEL_CRED_VERSION;
+    cred.grbitEnabledProtocols = server ? SP_PROT_TLS1_2_SERVER : SP_PROT_TLS1_2_CLIENT;
+    cred.dwSessionLifespan = config.sessionLifetimeMs;
+    if (m_cert)
+    {
+        cred.cCreds = 1;
+        cred.paCred = &m_cert;
+    }
+
+    if (!server)
+    {
+        // 不自动挑选客户端证书；服务器证书由 Schannel 按 serverName 校验，或由调用方自行处理
+        cred.dwFlags = SCH_CRED_NO_DEFAULT_CREDS;
+        cred.dwFlags |= config.verifyPeer ? SCH_CRED_AUTO_CRED_VALIDATION : SCH_CRED_MANUAL_CRED_VALIDATION;
+    }
+    if (config.verifyPeer && config.checkRevocation)
+    {
+        cred.dwFlags |= SCH_CRED_REVOCATION_CHECK_CHAIN_EXCLUDE_ROOT;
+    }
+
+    TimeStamp expiry;
+    SECURITY_STATUS status = AcquireCredentialsHandleW(nullptr, (LPWSTR)UNISP_NAME_W, server ? SECPKG_CRED_INBOUND : SECPKG_CRED_OUTBOUND,
+                                                       nullptr, &cred, nullptr, nullptr, &m_handle, &expiry);
+    if (status != SEC_E_OK)
+    {
+        if (err)
+            *err = L"获取TLS凭据失败: " + FormatStatus((DWORD)status);
+        Release();
+        return false;
+    }
+
+    m_valid = true;
+    m_server = server;
+    m_verifyPeer = config.verifyPeer;
+    return true;
+}
+
+void CIec104TlsCredentials::Release()
+{
+    if (m_valid)
+    {
+        FreeCredentialsHandle(&m_handle);
+        SecInvalidateHandle(&m_handle);
+        m_valid = false;
+    }
+    if (m_cert)
+    {
+        CertFreeCertificateContext(m_cert);
+        m_cert = nullptr;
+    }
+}
+
+CIec104TlsSession::CIec104TlsSession()
+    : m_credentials(nullptr), m_hasContext(false), m_established(false), m_resumed(false), m_sizes{}, m_lastStatus(SEC_E_OK)
+{
+    SecInvalidateHandle(&m_context);
+}
+
+CIec104TlsSession::~CIec104TlsSession()
+{
+    Reset();
+}
+
+void CIec104TlsSession::Start(CIec104TlsCredentials *credentials, const std::wstring &serverName)
+{
+    Reset();
+    m_credentials = credentials;
+    m_serverName = serverName;
+}
+
+void CIec104TlsSession::Reset()
+{
+    if (m_hasContext)
+    {
+        DeleteSecurityContext(&m_context);
+        SecInvalidateHandle(&m_context);
+        m_hasContext = false;
+    }
+    m_established = false;
+    m_resumed = false;
+    m_input.clear();
+    m_lastStatus = SEC_E_OK;
+    m_lastError.clear();
+}
+
+Iec104TlsStatus CIec104TlsSession::Handshake(const BYTE *input, int inputLen, std::vector<BYTE> &output)
+{
+    if (!m_credentials || !m_credentials->IsValid())
+    {
+        Fail(SEC_E_NO_CREDENTIALS, L"TLS凭据无效");
+        return Iec104TlsStatus::FAILED;
+    }
+    if (m_established)
+    {
+        return Iec104TlsStatus::OK;
+    }
+    if (inputLen > 0)
+    {
+        m_input.insert(m_input.end(), input, input + inputLen);
+    }
+
+    bool server = m_credentials->IsServer();
+    for (;;)
+    {
+        // 服务端与客户端的后续调用都需要对端数据
+        if ((server || m_hasContext) && m_input.empty())
+        {
+            return Iec104TlsStatus::PENDING;
+        }
+
+        SecBuffer inBuffers[2] = {};
+        inBuffers[0].BufferType = SECBUFFER_TOKEN;
+        inBuffers[0].pvBuffer = m_input.data();
+        inBuffers[0].cbBuffer = (ULONG)m_input.size();
+        inBuffers[1].BufferType = SECBUFFER_EMPTY;
+        SecBufferDesc inDesc = { SECBUFFER_VERSION, 2, inBuffers };
+
+        SecBuffer outBuffers[2] = {};
+        outBuffers[0].BufferType = SECBUFFER_TOKEN;
+        outBuffers[1].BufferType = SECBUFFER_ALERT;
+        SecBufferDesc outDesc = { SECBUFFER_VERSION, 2, outBuffers };
+
+        ULONG attributes = 0;
+        bool continuing = m_hasContext;
+        SECURITY_STATUS status;
+        if (server)
+        {
+            ULONG flags = SERVER_CONTEXT_FLAGS | (m_credentials->VerifyPeer() ? ASC_REQ_MUTUAL_AUTH : 0);
+            status = AcceptSecurityContext(m_credentials->GetHandle(), m_hasContext ? &m_context : nullptr, &inDesc, flags, 0,
+                                           &m_context, &outDesc, &attributes, nullptr);
+        }
+        else
+        {
+            ULONG flags = CLIENT_CONTEXT_FLAGS | (m_credentials->VerifyPeer() ? 0 : ISC_REQ_MANUAL_CRED_VALIDATION);
+            status = InitializeSecurityContextW(m_credentials->GetHandle(), m_hasContext ? &m_context : nullptr,
+                                                (SEC_WCHAR *)m_serverName.c_str(), flags, 0, 0, m_hasContext ? &inDesc : nullptr, 0,
+                                                &m_context, &outDesc, &attributes, nullptr);
+        }
+
+        if (status == SEC_E_INCOMPLETE_MESSAGE)
+        {
+            // 握手记录尚未收全
+            return Iec104TlsStatus::PENDING;
+        }
+
+        // 握手报文（失败时可能是告警）照常发出
+        for (SecBuffer &buffer : outBuffers)
+        {
+            if (buffer.pvBuffer)
+            {
+                const BYTE *data = (const BYTE *)buffer.pvBuffer;
+                output.insert(output.end(), data, data + buffer.cbBuffer);
+                FreeContextBuffer(buffer.pvBuffer);
+            }
+        }
+
+        if (FAILED(status))
+        {
+            Fail(status, L"TLS握手失败");
+            return Iec104TlsStatus::FAILED;
+        }
+        m_hasContext = true;
+        if (status == SEC_I_INCOMPLETE_CREDENTIALS)
+        {
+            Fail(status, L"服务端要求客户端证书，但没有配置");
+            return Iec104TlsStatus::FAILED;
+        }
+
+        // 本次调用未用完的数据（下一条握手记录或握手后的应用数据）；客户端首次调用没有输入
+        bool consumed = server || continuing;
+        if (consumed && inBuffers[1].BufferType == SECBUFFER_EXTRA && inBuffers[1].cbBuffer > 0)
+        {
+            size_t extra = inBuffers[1].cbBuffer;
+            memmove(m_input.data(), m_input.data() + m_input.size() - extra, extra);
+            m_input.resize(extra);
+        }
+        else if (consumed)
+        {
+            m_input.clear();
+        }
+
+        if (status == SEC_E_OK)
+        {
+            return OnEstablished() ? Iec104TlsStatus::OK : Iec104TlsStatus::FAILED;
+        }
+        if (status != SEC_I_CONTINUE_NEEDED)
+        {
+            Fail(status, L"TLS握手返回不支持的状态");
+            return Iec104TlsStatus::FAILED;
+        }
+    }
+}
+
+bool CIec104TlsSession::OnEstablished()
+{
+    SECURITY_STATUS status = QueryContextAttributesW(&m_context, SECPKG_ATTR_STREAM_SIZES, &m_sizes);
+    if (status != SEC_E_OK)
+    {
+        Fail(status, L"查询TLS记录尺寸失败");
+        return false;
+    }
+
+    // 服务端对客户端证书的链校验不由 Schannel 自动完成
+    if (m_credentials->IsServer() && m_credentials->VerifyPeer() && !VerifyClientCertificate())
+    {
+        return false;
+    }
+
+    SecPkgContext_SessionInfo info = {};
+    if (QueryContextAttributesW(&m_context, SECPKG_ATTR_SESSION_INFO, &info) == SEC_E_OK)
+    {
+        m_resumed = (info.dwFlags & SSL_SESSION_RECONNECT) != 0;
+    }
+    m_established = true;
+    return true;
+}
+
+bool CIec104TlsSession::VerifyClientCertificate()
+{
+    PCCERT_CONTEXT cert = nullptr;
+    SECURITY_STATUS status = QueryContextAttributesW(&m_context, SECPKG_ATTR_REMOTE_CERT_CONTEXT, &cert);
+    if (status != SEC_E_OK || !cert)
+    {
+        Fail(status != SEC_E_OK ? status : SEC_E_NO_CREDENTIALS, L"客户端未提供证书");
+        return false;
+    }
+
+    CERT_CHAIN_PARA chainPara = {};
+    chainPara.cbSize = sizeof(chainPara);
+    PCCERT_CHAIN_CONTEXT chain = nullptr;
+    DWORD error = 0;
+    if (!CertGetCertificateChain(nullptr, cert, nullptr, cert->hCertStore, &chainPara, 0, nullptr, &chain))
+    {
+        error = GetLastError();
+    }
+    else
+    {
+        SSL_EXTRA_CERT_CHAIN_POLICY_PARA ssl = {};
+        ssl.cbSize = sizeof(ssl);
+        ssl.dwAuthType = AUTHTYPE_CLIENT;
+        CERT_CHAIN_POLICY_PARA policy = {};
+        policy.cbSize = sizeof(policy);
+        policy.pvExtraPolicyPara = &ssl;
+        CERT_CHAIN_POLICY_STATUS policyStatus = {};
+        policyStatus.cbSize = sizeof(policyStatus);
+        if (!CertVerifyCertificateChainPolicy(CERT_CHAIN_POLICY_SSL, chain, &policy, &policyStatus))
+            error = GetLastError();
+        else
+            error = policyStatus.dwError;
+        CertFreeCertificateChain(chain);
+    }
+    CertFreeCertificateContext(cert);
+
+    if (error != 0)
+    {
+        Fail((SECURITY_STATUS)error, L"客户端证书校验失败");
+        return false;
+    }
+    return true;
+}
+
+Iec104TlsStatus CIec104TlsSession::Decrypt(const BYTE *input, int inputLen, std::vector<BYTE> &plain)
+{
+    if (!m_established)
+    {
+        return Iec104TlsStatus::FAILED;
+    }
+    if (inputLen > 0)
+    {
+        m_input.insert(m_input.end(), input, input + inputLen);
+    }
+
+    while (!m_input.empty())
+    {
+        // 原地解密：明文与剩余密文都指向 m_input
+        SecBuffer buffers[4] = {};
+        buffers[0].BufferType = SECBUFFER_DATA;
+        buffers[0].pvBuffer = m_input.data();
+        buffers[0].cbBuffer = (ULONG)m_input.size();
+        buffers[1].BufferType = SECBUFFER_EMPTY;
+        buffers[2].BufferType = SECBUFFER_EMPTY;
+        buffers[3].BufferType = SECBUFFER_EMPTY;
+        SecBufferDesc desc = { SECBUFFER_VERSION, 4, buffers };
+
+        SECURITY_STATUS status = DecryptMessage(&m_context, &desc, 0, nullptr);
+        if (status == SEC_E_INCOMPLETE_MESSAGE)
+        {
+            return Iec104TlsStatus::OK;
+        }
+        if (status == SEC_I_CONTEXT_EXPIRED)
+        {
+            m_input.clear();
+            return Iec104TlsStatus::CLOSED;
+        }
+        if (status != SEC_E_OK)
+        {
+            Fail(status, status == SEC_I_RENEGOTIATE ? L"对端请求重协商，不支持" : L"TLS解密失败");
+            return Iec104TlsStatus::FAILED;
+        }
+
+        size_t extra = 0;
+        for (int i = 1; i < 4; ++i)
+        {
+            if (buffers[i].BufferType == SECBUFFER_DATA)
+            {
+                const BYTE *data = (const BYTE *)buffers[i].pvBuffer;
+                plain.insert(plain.end(), data, data + buffers[i].cbBuffer);
+            }
+            else if (buffers[i].BufferType == SECBUFFER_EXTRA)
+            {
+                extra = buffers[i].cbBuffer;
+            }
+        }
+
+        // 明文已取出，剩余的下一条记录移到缓冲区开头
+        if (extra > 0)
+        {
+            memmove(m_input.data(), m_input.data() + m_input.size() - extra, extra);
+        }
+        m_input.resize(extra);
+    }
+    return Iec104TlsStatus::OK;
+}
+
+bool CIec104TlsSession::Encrypt(const BYTE *plain, size_t length, std::vector<BYTE> &output)
+{
+    if (!m_established)
+    {
+        return false;
+    }
+
+    while (length > 0)
+    {
+        ULONG chunk = (ULONG)(std::min)(length, (size_t)m_sizes.cbMaximumMessage);
+        size_t base = output.size();
+        output.resize(base + m_sizes.cbHeader + chunk + m_sizes.cbTrailer);
+        BYTE *record = output.data() + base;
+        memcpy(record + m_sizes.cbHeader, plain, chunk);
+
+        SecBuffer buffers[4] = {};
+        buffers[0].BufferType = SECBUFFER_STREAM_HEADER;
+        buffers[0].pvBuffer = record;
+        buffers[0].cbBuffer = m_sizes.cbHeader;
+        buffers[1].BufferType = SECBUFFER_DATA;
+        buffers[1].pvBuffer = record + m_sizes.cbHeader;
+        buffers[1].cbBuffer = chunk;
+        buffers[2].BufferType = SECBUFFER_STREAM_TRAILER;
+        buffers[2].pvBuffer = record + m_sizes.cbHeader + chunk;
+        buffers[2].cbBuffer = m_sizes.cbTrailer;
+        buffers[3].BufferType = SECBUFFER_EMPTY;
+        SecBufferDesc desc = { SECBUFFER_VERSION, 4, buffers };
+
+        SECURITY_STATUS status = EncryptMessage(&m_context, 0, &desc, 0);
+        if (status != SEC_E_OK)
+        {
+            output.resize(base);
+            Fail(status, L"TLS加密失败");
+            return false;
+        }
+
+        // 实际的记录尾长度可能小于最大值
+        output.resize(base + buffers[0].cbBuffer + buffers[1].cbBuffer + buffers[2].cbBuffer);
+        plain += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+void CIec104TlsSession::Shutdown(std::vector<BYTE> &output)
+{
+    if (!m_established)
+    {
+        return;
+    }
+
+    DWORD type = SCHANNEL_SHUTDOWN;
+    SecBuffer control = { sizeof(type), SECBUFFER_TOKEN, &type };
+    SecBufferDesc controlDesc = { SECBUFFER_VERSION, 1, &control };
+    if (ApplyControlToken(&m_context, &controlDesc) != SEC_E_OK)
+    {
+        return;
+    }
+
+    SecBuffer outBuffer = { 0, SECBUFFER_TOKEN, nullptr };
+    SecBufferDesc outDesc = { SECBUFFER_VERSION, 1, &outBuffer };
+    ULONG attributes = 0;
+    SECURITY_STATUS status;
+    if (m_credentials->IsServer())
+    {
+        status = AcceptSecurityContext(m_credentials->GetHandle(), &m_context, nullptr, SERVER_CONTEXT_FLAGS, 0, &m_context, &outDesc,
+                                       &attributes, nullptr);
+    }
+    else
+    {
+        status = InitializeSecurityContextW(m_credentials->GetHandle(), &m_context, (SEC_WCHAR *)m_serverName.c_str(), CLIENT_CONTEXT_FLAGS,
+                                            0, 0, nullptr, 0, &m_context, &outDesc, &attributes, nullptr);
+    }
+
+    if (outBuffer.pvBuffer)
+    {
+        if (!FAILED(status))
+        {
+            const BYTE *data = (const BYTE *)outBuffer.pvBuffer;
+            output.insert(output.end(), data, data + outBuffer.cbBuffer);
+        }
+        FreeContextBuffer(outBuffer.pvBuffer);
+    }
+    m_established = false;
+}
+
+std::wstring CIec104TlsSession::GetErrorText() const
+{
+    if (m_lastStatus == SEC_E_OK)
+        return m_lastError;
+    return m_lastError + L": " + FormatStatus((DWORD)m_lastStatus);
+}
+
+void CIec104TlsSession::Fail(SECURITY_STATUS status, const std::wstring &message)
+{
+    m_lastStatus = status;
+    m_lastError = message;
+}
+
+PCCERT_CONTEXT Iec104TlsCreateSelfSignedCert(const std::wstring &subject, std::wstring *err)
+{
+    // 密钥交换用 RSA 密钥（AT_KEYEXCHANGE），容器已存在时复用其中的密钥
+    HCRYPTPROV provider = 0;
+    if (!CryptAcquireContextW(&provider, SELF_SIGNED_CONTAINER, MS_ENH_RSA_AES_PROV_W, PROV_RSA_AES, 0) &&
+        !CryptAcquireContextW(&provider, SELF_SIGNED_CONTAINER, MS_ENH_RSA_AES_PROV_W, PROV_RSA_AES, CRYPT_NEWKEYSET))
+    {
+        if (err)
+            *err = L"打开密钥容器失败: " + FormatStatus(GetLastError());
+        return nullptr;
+    }
+
+    HCRYPTKEY key = 0;
+    if (!CryptGetUserKey(provider, AT_KEYEXCHANGE, &key) && !CryptGenKey(provider, AT_KEYEXCHANGE, (2048 << 16), &key))
+    {
+        if (err)
+            *err = L"生成密钥失败: " + FormatStatus(GetLastError());
+        CryptReleaseContext(provider, 0);
+        return nullptr;
+    }
+    CryptDestroyKey(key);
+
+    std::wstring x500 = L"CN=" + subject;
+    DWORD nameLen = 0;
+    std::vector<BYTE> name;
+    if (CertStrToNameW(X509_ASN_ENCODING, x500.c_str(), CERT_X500_NAME_STR, nullptr, nullptr, &nameLen, nullptr))
+    {
+        name.resize(nameLen);
+        CertStrToNameW(X509_ASN_ENCODING, x500.c_str(), CERT_X500_NAME_STR, nullptr, name.data(), &nameLen, nullptr);
+    }
+    if (name.empty())
+    {
+        if (err)
+            *err = L"证书主题无效: " + subject;
+        CryptReleaseContext(provider, 0);
+        return nullptr;
+    }
+    CERT_NAME_BLOB nameBlob = { nameLen, name.data() };
+
+    CRYPT_KEY_PROV_INFO keyInfo = {};
+    keyInfo.pwszContainerName = (LPWSTR)SELF_SIGNED_CONTAINER;
+    keyInfo.pwszProvName = (LPWSTR)MS_ENH_RSA_AES_PROV_W;
+    keyInfo.dwProvType = PROV_RSA_AES;
+    keyInfo.dwKeySpec = AT_KEYEXCHANGE;
+
+    CRYPT_ALGORITHM_IDENTIFIER algorithm = {};
+    algorithm.pszObjId = (LPSTR)szOID_RSA_SHA256RSA;
+
+    // 有效期一年（2月29日顺延到28日）
+    SYSTEMTIME expiry;
+    GetSystemTime(&expiry);
+    expiry.wYear += 1;
+    if (expiry.wMonth == 2 && expiry.wDay == 29)
+        expiry.wDay = 28;
+
+    PCCERT_CONTEXT cert = CertCreateSelfSignCertificate(provider, &nameBlob, 0, &keyInfo, &algorithm, nullptr, &expiry, nullptr);
+    if (!cert && err)
+    {
+        *err = L"创建自签名证书失败: " + FormatStatus(GetLastError());
+    }
+    CryptReleaseContext(provider, 0);
+    return cert;
+}
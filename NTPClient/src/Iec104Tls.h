@@ -0,0 +1,112 @@
+﻿#pragma once
+#include <windows.h>
+#define SECURITY_WIN32
+#include <security.h>
+#include <schannel.h>
+#include <wincrypt.h>
+#include <string>
+#include <vector>
+
+#pragma comment(lib, "secur32.lib")
+#pragma comment(lib, "crypt32.lib")
+
+// IEC 62351-3 TLS 配置
+struct Iec104TlsConfig
+{
+    std::wstring certSubject;            // 本端证书主题（MY 存储）；客户端为空时不提供客户端证书
+    bool machineStore = false;           // 在本机而不是当前用户的证书存储中查找
+    bool verifyPeer = true;              // 客户端：校验服务器证书链与名称；服务端：要求并校验客户端证书
+    bool checkRevocation = false;        // 校验证书吊销状态（需要能访问CRL/OCSP）
+    DWORD sessionLifetimeMs = 0;         // 会话缓存有效期，0 为系统缺省
+};
+
+enum class Iec104TlsStatus : BYTE
+{
+    OK,                // 握手完成 / 解密完成
+    PENDING,           // 握手需要更多数据
+    CLOSED,            // 对端发送 close_notify
+    FAILED
+};
+
+// TLS 凭据（Schannel）
+// Schannel 按凭据句柄维护会话缓存：同一凭据上的重连使用简化握手（会话恢复），
+// 不再做证书校验与密钥交换的非对称运算。多条连接与重连应共用一个凭据对象
+class CIec104TlsCredentials
+{
+public:
+    CIec104TlsCredentials();
+    ~CIec104TlsCredentials();
+
+    CIec104TlsCredentials(const CIec104TlsCredentials&) = delete;
+    CIec104TlsCredentials& operator=(const CIec104TlsCredentials&) = delete;
+
+    bool InitClient(const Iec104TlsConfig& config, std::wstring* err = nullptr);
+    bool InitServer(const Iec104TlsConfig& config, std::wstring* err = nullptr);
+    // 服务端使用现有证书（须带私钥），取得证书的一个引用
+    bool InitServer(PCCERT_CONTEXT cert, const Iec104TlsConfig& config, std::wstring* err = nullptr);
+
+    bool IsValid() const { return m_valid; }
+    bool IsServer() const { return m_server; }
+    bool VerifyPeer() const { return m_verifyPeer; }
+    CredHandle* GetHandle() { return &m_handle; }
+
+private:
+    bool Acquire(bool server, const Iec104TlsConfig& config, std::wstring* err);
+    void Release();
+
+    CredHandle m_handle;
+    PCCERT_CONTEXT m_cert;
+    bool m_valid;
+    bool m_server;
+    bool m_verifyPeer;
+};
+
+// 单条连接的 TLS 会话
+// 本身不做网络I/O：收到的密文交给 Handshake/Decrypt，产生的密文追加到输出缓冲由调用方发送。
+// 握手完成时可能已收到对端的应用数据，调用方应随后以空输入调用一次 Decrypt
+class CIec104TlsSession
+{
+public:
+    CIec104TlsSession();
+    ~CIec104TlsSession();
+
+    CIec104TlsSession(const CIec104TlsSession&) = delete;
+    CIec104TlsSession& operator=(const CIec104TlsSession&) = delete;
+
+    // 开始新会话：客户端 serverName 用于SNI、证书名称校验与会话缓存查找
+    void Start(CIec104TlsCredentials* credentials, const std::wstring& serverName);
+    void Reset();
+
+    // 客户端首次调用传空输入以产生 ClientHello
+    Iec104TlsStatus Handshake(const BYTE* input, int inputLen, std::vector<BYTE>& output);
+    bool IsEstablished() const { return m_established; }
+    bool IsResumed() const { return m_resumed; }     // 本次握手恢复了缓存的会话
+
+    // 解出的明文追加到 plain；记录不完整时保留到下次
+    Iec104TlsStatus Decrypt(const BYTE* input, int inputLen, std::vector<BYTE>& plain);
+    // 按最大记录长度分段加密，密文追加到 output
+    bool Encrypt(const BYTE* plain, size_t length, std::vector<BYTE>& output);
+    // 产生 close_notify
+    void Shutdown(std::vector<BYTE>& output);
+
+    std::wstring GetErrorText() const;
+
+private:
+    bool OnEstablished();
+    bool VerifyClientCertificate();
+    void Fail(SECURITY_STATUS status, const std::wstring& message);
+
+    CIec104TlsCredentials* m_credentials;
+    std::wstring m_serverName;
+    CtxtHandle m_context;
+    bool m_hasContext;
+    bool m_established;
+    bool m_resumed;
+    SecPkgContext_StreamSizes m_sizes;
+    std::vector<BYTE> m_input;           // 尚未处理的密文
+    SECURITY_STATUS m_lastStatus;
+    std::wstring m_lastError;
+};
+
+// 生成自签名证书（RSA 2048，私钥保存在固定名称的密钥容器中，可重复使用），供仿真与测试
+PCCERT_CONTEXT Iec104TlsCreateSelfSignedCert(const std::wstring& subject, std::wstring* err = nullptr);
@@ -0,0 +1,100 @@
+﻿#include "pch.h"
+#include "Iec104TxQueue.h"
+#include <cstring>
+
+CIec104TxQueue::CIec104TxQueue(size_t capacity)
+    : m_mask(0), m_tail(0), m_head(0), m_dropped(0)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    m_mask = size - 1;
+
+    m_cells.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i)
+    {
+        // 槽位序号等于可写入的位置时表示空闲
+        m_cells[i].seq.store(i, std::memory_order_relaxed);
+        m_cells[i].frame.length = 0;
+        m_cells[i].frame.stamped = false;
+        m_cells[i].frame.commandId = 0;
+    }
+}
+
+bool CIec104TxQueue::Push(Iec104TxKind kind, const BYTE *data, int length, UINT64 commandId)
+{
+    if (!data || length <= 0 || length > IEC104_MAX_APDU_LEN)
+        return false;
+
+    size_t pos = m_tail.load(std::memory_order_relaxed);
+    Cell *cell = nullptr;
+    for (;;)
+    {
+        cell = &m_cells[pos & m_mask];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // 队列已满
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->frame.kind = kind;
+    cell->frame.stamped = false;
+    cell->frame.commandId = commandId;
+    cell->frame.length = (BYTE)length;
+    memcpy(cell->frame.data, data, length);
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+size_t CIec104TxQueue::Peek(Iec104TxFrame **frames, size_t maxCount)
+{
+    size_t count = 0;
+    while (count < maxCount)
+    {
+        size_t pos = m_head + count;
+        Cell &cell = m_cells[pos & m_mask];
+        if (cell.seq.load(std::memory_order_acquire) != pos + 1)
+            break;
+        frames[count++] = &cell.frame;
+    }
+    return count;
+}
+
+void CIec104TxQueue::Pop(size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        Cell &cell = m_cells[m_head & m_mask];
+        cell.seq.store(m_head + m_mask + 1, std::memory_order_release);
+        ++m_head;
+    }
+}
+
+void CIec104TxQueue::Clear()
+{
+    Iec104TxFrame *frames[64];
+    size_t n;
+    while ((n = Peek(frames, 64)) > 0)
+    {
+        Pop(n);
+    }
+}
+
+bool CIec104TxQueue::IsEmpty() const
+{
+    const Cell &cell = m_cells[m_head & m_mask];
+    return cell.seq.load(std::memory_order_acquire) != m_head + 1;
+}
@@ -0,0 +1,61 @@
+﻿#pragma once
+#include <windows.h>
+#include <atomic>
+#include <memory>
+#include "Iec104Log.h"
+
+// 待发送报文类型：I帧与S帧的序号在真正发送时由I/O线程填写
+enum class Iec104TxKind : BYTE
+{
+    I_FRAME,
+    S_FRAME,
+    U_FRAME
+};
+
+// 预分配的发送帧
+struct Iec104TxFrame
+{
+    Iec104TxKind kind;
+    bool stamped;         // 序号是否已填写（仅I/O线程访问）
+    UINT64 commandId;     // 命令的首帧记录命令序号，填写序号时记为命令的发送时刻；其他帧为0
+    BYTE length;
+    BYTE data[IEC104_MAX_APDU_LEN];
+};
+
+// 每连接发送队列：固定容量的多生产者/单消费者环形队列
+// - 帧缓冲随队列一次性分配，入队只做一次拷贝，不加锁、不分配内存、不阻塞
+// - 消费者（I/O线程）一次取出队首连续多帧，用一次分散写系统调用发出，发完再归还槽位
+class CIec104TxQueue
+{
+public:
+    explicit CIec104TxQueue(size_t capacity = 1024);
+
+    CIec104TxQueue(const CIec104TxQueue&) = delete;
+    CIec104TxQueue& operator=(const CIec104TxQueue&) = delete;
+
+    // 生产者（任意线程），队列满时返回 false
+    bool Push(Iec104TxKind kind, const BYTE* data, int length, UINT64 commandId = 0);
+
+    // 消费者（I/O线程）
+    size_t Peek(Iec104TxFrame** frames, size_t maxCount);
+    void Pop(size_t count);
+    void Clear();
+    bool IsEmpty() const;
+    size_t GetCapacity() const { return m_mask + 1; }
+
+    UINT64 GetDroppedCount() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        Iec104TxFrame frame;
+    };
+
+    size_t m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+    std::atomic<size_t> m_tail;   // 生产者
+    char m_pad[64];               // 生产者与消费者位置分处不同缓存行
+    size_t m_head;                // 消费者
+    std::atomic<UINT64> m_dropped;
+};
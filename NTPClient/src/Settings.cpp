@@ -40,7 +40,16 @@ void CAppSettings::Load() {
     Iec104CommonAddress = (unsigned short)GetPrivateProfileIntW(L"IEC104", L"CommonAddress", Iec104CommonAddress, ini.c_str());
     Iec104AutoConnect = GetPrivateProfileIntW(L"IEC104", L"AutoConnect", Iec104AutoConnect ? 1 : 0, ini.c_str()) != 0;
     Iec104AutoGeneralCall = GetPrivateProfileIntW(L"IEC104", L"AutoGeneralCall", Iec104AutoGeneralCall ? 1 : 0, ini.c_str()) != 0;
+    Iec104GiPeriodSeconds = (unsigned int)GetPrivateProfileIntW(L"IEC104", L"GiPeriodSeconds", Iec104GiPeriodSeconds, ini.c_str());
+    Iec104CounterPeriodSeconds = (unsigned int)GetPrivateProfileIntW(L"IEC104", L"CounterPeriodSeconds", Iec104CounterPeriodSeconds, ini.c_str());
     Iec104HeartbeatSeconds = (unsigned int)GetPrivateProfileIntW(L"IEC104", L"HeartbeatSeconds", Iec104HeartbeatSeconds, ini.c_str());
+    Iec104LogLevel = (int)GetPrivateProfileIntW(L"IEC104", L"LogLevel", Iec104LogLevel, ini.c_str());
+    Iec104ShowFrames = GetPrivateProfileIntW(L"IEC104", L"ShowFrames", Iec104ShowFrames ? 1 : 0, ini.c_str()) != 0;
+    GetPrivateProfileStringW(L"IEC104", L"CaptureFile", Iec104CaptureFile.c_str(), buf, 256, ini.c_str());
+    Iec104CaptureFile = buf;
+    Iec104ClockSyncSeconds = (unsigned int)GetPrivateProfileIntW(L"IEC104", L"ClockSyncSeconds", Iec104ClockSyncSeconds, ini.c_str());
+    GetPrivateProfileStringW(L"IEC104", L"LinkProfile", Iec104LinkProfile.c_str(), buf, 256, ini.c_str());
+    Iec104LinkProfile = buf;
     
     // 验证参数有效性
     if (Version != 3 && Version != 4) Version = 4;
@@ -48,6 +57,10 @@ void CAppSettings::Load() {
     if (Iec104Port == 0) Iec104Port = 2404;
     if (Iec104CommonAddress == 0) Iec104CommonAddress = 1;
     if (Iec104HeartbeatSeconds < 5) Iec104HeartbeatSeconds = 15;
+    if (Iec104LogLevel < 0 || Iec104LogLevel > 4) Iec104LogLevel = 2;
+    if (Iec104ClockSyncSeconds != 0 && Iec104ClockSyncSeconds < 10) Iec104ClockSyncSeconds = 10;
+    if (Iec104GiPeriodSeconds != 0 && Iec104GiPeriodSeconds < 60) Iec104GiPeriodSeconds = 60;
+    if (Iec104CounterPeriodSeconds != 0 && Iec104CounterPeriodSeconds < 60) Iec104CounterPeriodSeconds = 60;
 }
 
 void CAppSettings::Save() const {
@@ -67,5 +80,12 @@ void CAppSettings::Save() const {
     _itow_s(Iec104CommonAddress, buf, 10); WritePrivateProfileStringW(L"IEC104", L"CommonAddress", buf, ini.c_str());
     WritePrivateProfileStringW(L"IEC104", L"AutoConnect", Iec104AutoConnect ? L"1" : L"0", ini.c_str());
     WritePrivateProfileStringW(L"IEC104", L"AutoGeneralCall", Iec104AutoGeneralCall ? L"1" : L"0", ini.c_str());
+    _itow_s((int)Iec104GiPeriodSeconds, buf, 10); WritePrivateProfileStringW(L"IEC104", L"GiPeriodSeconds", buf, ini.c_str());
+    _itow_s((int)Iec104CounterPeriodSeconds, buf, 10); WritePrivateProfileStringW(L"IEC104", L"CounterPeriodSeconds", buf, ini.c_str());
     _itow_s((int)Iec104HeartbeatSeconds, buf, 10); WritePrivateProfileStringW(L"IEC104", L"HeartbeatSeconds", buf, ini.c_str());
+    _itow_s(Iec104LogLevel, buf, 10); WritePrivateProfileStringW(L"IEC104", L"LogLevel", buf, ini.c_str());
+    WritePrivateProfileStringW(L"IEC104", L"ShowFrames", Iec104ShowFrames ? L"1" : L"0", ini.c_str());
+    WritePrivateProfileStringW(L"IEC104", L"CaptureFile", Iec104CaptureFile.c_str(), ini.c_str());
+    _itow_s((int)Iec104ClockSyncSeconds, buf, 10); WritePrivateProfileStringW(L"IEC104", L"ClockSyncSeconds", buf, ini.c_str());
+    WritePrivateProfileStringW(L"IEC104", L"LinkProfile", Iec104LinkProfile.c_str(), ini.c_str());
 }
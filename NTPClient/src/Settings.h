@@ -16,7 +16,14 @@ struct CAppSettings {
     unsigned short Iec104CommonAddress = 1;
     bool Iec104AutoConnect = false;
     bool Iec104AutoGeneralCall = false;
+    unsigned int Iec104GiPeriodSeconds = 0;      // 周期总召，0=关闭（最小 60）
+    unsigned int Iec104CounterPeriodSeconds = 0; // 周期电能量召唤，0=关闭（最小 60）
     unsigned int Iec104HeartbeatSeconds = 15;
+    int Iec104LogLevel = 2;          // 0=错误 1=警告 2=信息 3=调试 4=跟踪
+    bool Iec104ShowFrames = true;    // 在日志中显示收发报文
+    std::wstring Iec104CaptureFile;  // 非空时连接期间抓包到该pcap文件
+    unsigned int Iec104ClockSyncSeconds = 0; // 按NTP时间周期下发时钟（含延时补偿），0=关闭
+    std::wstring Iec104LinkProfile = L"2/2/3"; // 传送原因/公共地址/IOA字节数
 
     std::wstring IniPath() const;
     void Load();
@@ -0,0 +1,429 @@
+﻿#include "pch.h"
+#include "TimerWheel.h"
+#include <algorithm>
+#include <cstring>
+#include <intrin.h>
+
+namespace
+{
+    // 非零64位值最低置位的位置
+    inline int LowestBit(UINT64 x)
+    {
+        unsigned long index;
+#if defined(_M_X64) || defined(_M_ARM64)
+        _BitScanForward64(&index, x);
+        return (int)index;
+#else
+        if (_BitScanForward(&index, (unsigned long)x))
+            return (int)index;
+        _BitScanForward(&index, (unsigned long)(x >> 32));
+        return 32 + (int)index;
+#endif
+    }
+
+    inline void InitList(TimerWheelLink& head)
+    {
+        head.prev = &head;
+        head.next = &head;
+    }
+
+    inline bool IsListEmpty(const TimerWheelLink& head)
+    {
+        return head.next == &head;
+    }
+
+    inline void Unlink(TimerWheelLink& link)
+    {
+        link.prev->next = link.next;
+        link.next->prev = link.prev;
+        link.prev = nullptr;
+        link.next = nullptr;
+    }
+
+    inline void PushBack(TimerWheelLink& head, TimerWheelLink& link)
+    {
+        link.prev = head.prev;
+        link.next = &head;
+        head.prev->next = &link;
+        head.prev = &link;
+    }
+
+    constexpr UINT64 SLOT_MASK = CTimerWheel::SLOTS - 1;
+    // 最高级能表示的最大间隔
+    constexpr UINT64 MAX_SPAN = (1ULL << (CTimerWheel::SLOT_BITS * CTimerWheel::LEVELS)) - 1;
+}
+
+void CWheelTimer::Cancel()
+{
+    if (m_wheel)
+    {
+        m_wheel->Remove(*this);
+    }
+}
+
+CTimerWheel::CTimerWheel(UINT64 nowMs)
+    : m_occupied(), m_nextTick(nowMs + 1), m_armed(0)
+{
+    for (auto& level : m_slots)
+    {
+        for (auto& head : level)
+        {
+            InitList(head);
+        }
+    }
+}
+
+CTimerWheel::~CTimerWheel()
+{
+    Reset(0);
+}
+
+void CTimerWheel::Reset(UINT64 nowMs)
+{
+    for (int level = 0; level < LEVELS; ++level)
+    {
+        for (int slot = 0; slot < SLOTS; ++slot)
+        {
+            TimerWheelLink& head = m_slots[level][slot];
+            while (!IsListEmpty(head))
+            {
+                CWheelTimer* timer = ToTimer(head.next);
+                Unlink(*head.next);
+                timer->m_wheel = nullptr;
+            }
+        }
+    }
+    memset(m_occupied, 0, sizeof(m_occupied));
+    m_armed = 0;
+    m_nextTick = nowMs + 1;
+}
+
+void CTimerWheel::Arm(CWheelTimer& timer, UINT64 delayMs)
+{
+    ArmAt(timer, GetNowMs() + delayMs);
+}
+
+void CTimerWheel::ArmAt(CWheelTimer& timer, UINT64 expiryMs)
+{
+    if (timer.m_wheel)
+    {
+        timer.m_wheel->Remove(timer);
+    }
+    // 已过去的时刻在下一格到期
+    timer.m_expiryMs = (std::max)(expiryMs, m_nextTick);
+    timer.m_wheel = this;
+    ++m_armed;
+    Insert(timer);
+}
+
+void CTimerWheel::Insert(CWheelTimer& timer)
+{
+    // 按与下一格的距离选择级别：距离 < 256^(level+1) 的放在 level 级
+    UINT64 delta = timer.m_expiryMs - m_nextTick;
+    UINT64 expiry = timer.m_expiryMs;
+    if (delta > MAX_SPAN)
+    {
+        // 超出范围的先放在最高级的最远处，下放时按真实到期时刻重新插入
+        delta = MAX_SPAN;
+        expiry = m_nextTick + MAX_SPAN;
+    }
+
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1))))
+    {
+        ++level;
+    }
+    int slot = (int)((expiry >> (SLOT_BITS * level)) & SLOT_MASK);
+    timer.m_slot = (WORD)(level * SLOTS + slot);
+    PushBack(m_slots[level][slot], timer);
+    m_occupied[level][slot / 64] |= 1ULL << (slot % 64);
+}
+
+void CTimerWheel::Remove(CWheelTimer& timer)
+{
+    // 定时器可能在 Advance 摘下的临时链表中，只在原槽位确实为空时清除位图
+    int level = timer.m_slot / SLOTS;
+    int slot = timer.m_slot % SLOTS;
+    Unlink(timer);
+    timer.m_wheel = nullptr;
+    --m_armed;
+    if (IsListEmpty(m_slots[level][slot]))
+    {
+        m_occupied[level][slot / 64] &= ~(1ULL << (slot % 64));
+    }
+}
+
+void CTimerWheel::TakeSlot(int level, int slot, TimerWheelLink& list)
+{
+    // 把整个槽位链表移到 list（哨兵）上，槽位清空
+    TimerWheelLink& head = m_slots[level][slot];
+    InitList(list);
+    if (!IsListEmpty(head))
+    {
+        list.next = head.next;
+        list.prev = head.prev;
+        list.next->prev = &list;
+        list.prev->next = &list;
+        InitList(head);
+    }
+    m_occupied[level][slot / 64] &= ~(1ULL << (slot % 64));
+}
+
+void CTimerWheel::Cascade(int level)
+{
+    // level-1 级刚转完一圈：把 level 级当前槽位下放；该槽位下标为0时继续下放更高一级
+    int slot = (int)((m_nextTick >> (SLOT_BITS * level)) & SLOT_MASK);
+    TimerWheelLink list;
+    TakeSlot(level, slot, list);
+    while (!IsListEmpty(list))
+    {
+        TimerWheelLink* link = list.next;
+        Unlink(*link);
+        Insert(*ToTimer(link));
+    }
+
+    if (slot == 0 && level + 1 < LEVELS)
+    {
+        Cascade(level + 1);
+    }
+}
+
+int CTimerWheel::FindSlot(int level, int from) const
+{
+    // from 及之后第一个非空槽位，没有时返回 -1
+    for (int word = from / 64; word < SLOTS / 64; ++word)
+    {
+        UINT64 bits = m_occupied[level][word];
+        if (word == from / 64)
+        {
+            bits &= ~0ULL << (from % 64);
+        }
+        if (bits)
+        {
+            return word * 64 + LowestBit(bits);
+        }
+    }
+    return -1;
+}
+
+size_t CTimerWheel::Advance(UINT64 nowMs)
+{
+    size_t fired = 0;
+    while (m_nextTick <= nowMs)
+    {
+        if (m_armed == 0)
+        {
+            m_nextTick = nowMs + 1;
+            break;
+        }
+
+        int index = (int)(m_nextTick & SLOT_MASK);
+        if (index == 0)
+        {
+            Cascade(1);
+        }
+
+        // 本圈剩余的0级槽位为空时跳到下一个256毫秒边界（需要在边界处下放）
+        int slot = FindSlot(0, index);
+        if (slot < 0)
+        {
+            m_nextTick = (std::min)((m_nextTick | SLOT_MASK) + 1, nowMs + 1);
+            continue;
+        }
+        UINT64 tick = (m_nextTick & ~SLOT_MASK) + slot;
+        if (tick > nowMs)
+        {
+            m_nextTick = nowMs + 1;
+            break;
+        }
+
+        // 先推进时钟再执行回调：回调中设置的定时器从下一格起算，不会落入正在处理的槽位
+        m_nextTick = tick + 1;
+        TimerWheelLink list;
+        TakeSlot(0, slot, list);
+        while (!IsListEmpty(list))
+        {
+            CWheelTimer* timer = ToTimer(list.next);
+            Unlink(*list.next);
+            timer->m_wheel = nullptr;
+            --m_armed;
+            ++fired;
+            if (timer->m_callback)
+            {
+                timer->m_callback();
+            }
+        }
+    }
+    return fired;
+}
+
+DWORD CTimerWheel::GetNextTimeoutMs(DWORD maxMs) const
+{
+    if (m_armed == 0)
+    {
+        return maxMs;
+    }
+
+    // 本圈内最近的0级槽位；没有时醒来处理下一个256毫秒边界的下放
+    // 下一格正好是边界时高级别的槽位尚未下放，其中可能有更早到期的定时器
+    UINT64 now = GetNowMs();
+    int index = (int)(m_nextTick & SLOT_MASK);
+    if (index == 0)
+    {
+        return (std::min)(maxMs, (DWORD)1);
+    }
+    int slot = FindSlot(0, index);
+    UINT64 tick = slot >= 0 ? (m_nextTick & ~SLOT_MASK) + slot : (m_nextTick | SLOT_MASK) + 1;
+    return (DWORD)(std::min)((UINT64)maxMs, tick - now);
+}
+
+CTimerWheelThread::CTimerWheelThread(const CMonotonicClock &clock)
+    : m_clock(clock), m_wheel(clock.NowMs()), m_stop(false), m_virtualRunning(false)
+{
+}
+
+CTimerWheelThread::~CTimerWheelThread()
+{
+    Stop();
+}
+
+bool CTimerWheelThread::Start()
+{
+    if (IsRunning())
+    {
+        return true;
+    }
+    m_stop = false;
+    m_wheel.Reset(m_clock.NowMs());
+    if (m_clock.IsVirtual())
+    {
+        // 虚拟时钟由驱动方调用 RunDue 推进，不需要线程
+        m_virtualRunning = true;
+        return true;
+    }
+    m_thread = std::thread(&CTimerWheelThread::ThreadProc, this);
+    return true;
+}
+
+void CTimerWheelThread::Stop()
+{
+    if (!IsRunning())
+    {
+        return;
+    }
+    if (m_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+    }
+    m_virtualRunning = false;
+
+    // 线程已退出，剩余的定时器在这里摘下，之后可以安全销毁
+    m_tasks.clear();
+    m_wheel.Reset(m_clock.NowMs());
+}
+
+void CTimerWheelThread::Arm(CWheelTimer& timer, UINT64 delayMs)
+{
+    CWheelTimer* target = &timer;
+    Post([target, delayMs](CTimerWheel& wheel) { wheel.Arm(*target, delayMs); });
+}
+
+void CTimerWheelThread::Cancel(CWheelTimer& timer)
+{
+    CWheelTimer* target = &timer;
+    Post([target](CTimerWheel&) { target->Cancel(); });
+}
+
+void CTimerWheelThread::Post(std::function<void(CTimerWheel&)> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_wake.notify_one();
+}
+
+void CTimerWheelThread::ThreadProc()
+{
+    // 任务与定时器回调都在不持锁时执行，回调中可以再次调用 Arm/Post
+    std::vector<std::function<void(CTimerWheel&)>> tasks;
+    DWORD waitMs = INFINITE;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto ready = [this] { return m_stop || !m_tasks.empty(); };
+            if (waitMs == INFINITE)
+            {
+                m_wake.wait(lock, ready);
+            }
+            else
+            {
+                m_wake.wait_for(lock, std::chrono::milliseconds(waitMs), ready);
+            }
+            if (m_stop)
+            {
+                break;
+            }
+            tasks.swap(m_tasks);
+        }
+
+        // 先把时间轮推进到当前时刻，再执行任务：任务中 Arm 的延时从时间轮的当前时刻算起，
+        // 空闲（无定时器时无限等待）之后提交的 Arm 否则会从上次推进的时刻起算而立即到期
+        m_wheel.Advance(m_clock.NowMs());
+        RunTasks(tasks);
+        waitMs = m_wheel.GetNextTimeoutMs(INFINITE);
+    }
+}
+
+void CTimerWheelThread::RunTasks(std::vector<std::function<void(CTimerWheel&)>>& tasks)
+{
+    for (auto& task : tasks)
+    {
+        task(m_wheel);
+    }
+    tasks.clear();
+}
+
+size_t CTimerWheelThread::RunDue()
+{
+    if (!m_virtualRunning)
+    {
+        return 0;
+    }
+
+    // 与 ThreadProc 相同先推进再执行任务；任务与回调中提交的任务在同一轮中执行，直到没有新任务为止
+    std::vector<std::function<void(CTimerWheel&)>> tasks;
+    size_t fired = 0;
+    for (;;)
+    {
+        fired += m_wheel.Advance(m_clock.NowMs());
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            tasks.swap(m_tasks);
+        }
+        if (tasks.empty())
+        {
+            break;
+        }
+        RunTasks(tasks);
+    }
+    return fired;
+}
+
+DWORD CTimerWheelThread::GetNextTimeoutMs(DWORD maxMs)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_tasks.empty())
+        {
+            return 0;
+        }
+    }
+    return m_wheel.GetNextTimeoutMs(maxMs);
+}
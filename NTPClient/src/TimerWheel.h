@@ -0,0 +1,142 @@
+﻿#pragma once
+#include <windows.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "VirtualTime.h"
+
+class CTimerWheel;
+
+// 时间轮槽位中的双向链表节点
+struct TimerWheelLink
+{
+    TimerWheelLink* prev = nullptr;
+    TimerWheelLink* next = nullptr;
+};
+
+// 挂在时间轮上的定时器，通常作为所属对象的成员
+// - 回调在驱动时间轮的线程（CTimerWheel::Advance 中）执行，可以重新设置或取消任何定时器
+// - 析构时自动取消；定时器与时间轮只能在时间轮的所属线程中操作
+class CWheelTimer : private TimerWheelLink
+{
+public:
+    CWheelTimer() = default;
+    explicit CWheelTimer(std::function<void()> callback) : m_callback(std::move(callback)) {}
+    ~CWheelTimer() { Cancel(); }
+
+    CWheelTimer(const CWheelTimer&) = delete;
+    CWheelTimer& operator=(const CWheelTimer&) = delete;
+
+    void SetCallback(std::function<void()> callback) { m_callback = std::move(callback); }
+    bool IsArmed() const { return m_wheel != nullptr; }
+    // 到期时刻（时间轮的毫秒时钟），未设置时无意义
+    UINT64 GetExpiryMs() const { return m_expiryMs; }
+    void Cancel();
+
+private:
+    friend class CTimerWheel;
+
+    CTimerWheel* m_wheel = nullptr;
+    UINT64 m_expiryMs = 0;
+    WORD m_slot = 0;          // 级别*256+槽位
+    std::function<void()> m_callback;
+};
+
+// 分级时间轮：4级×256槽，1毫秒一格，覆盖约49天（更远的到期时刻按49天处理，到时重新计算）
+// - Arm/Cancel 为O(1)：定时器按到期时刻挂入对应级别的槽位链表，取消只需从链表摘下
+// - 高一级的槽位在低一级转完一圈时下放（cascade），每个定时器最多下放3次
+// - Advance 推进到当前时刻并执行到期回调；时间轮为空或当前级的剩余槽位为空时直接跳过，
+//   长时间空闲后推进的开销与经过的256毫秒边界数成正比
+// - GetNextTimeoutMs 返回距最近一个可能到期的槽位的毫秒数，供事件循环作为等待时长
+// - 不加锁，只能由一个线程（拥有它的事件循环）使用；跨线程使用 CTimerWheelThread
+class CTimerWheel
+{
+public:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 8;
+    static constexpr int SLOTS = 1 << SLOT_BITS;
+
+    explicit CTimerWheel(UINT64 nowMs = 0);
+    ~CTimerWheel();
+
+    CTimerWheel(const CTimerWheel&) = delete;
+    CTimerWheel& operator=(const CTimerWheel&) = delete;
+
+    // 取消全部定时器并把时钟设为 nowMs
+    void Reset(UINT64 nowMs);
+
+    // delayMs 毫秒后到期（至少下一格）；已设置的定时器改为新的到期时刻
+    void Arm(CWheelTimer& timer, UINT64 delayMs);
+    void ArmAt(CWheelTimer& timer, UINT64 expiryMs);
+
+    // 推进到 nowMs 并执行到期回调，返回执行的回调数
+    size_t Advance(UINT64 nowMs);
+
+    // 距下一个可能到期的时刻的毫秒数，不超过 maxMs；没有定时器时返回 maxMs
+    DWORD GetNextTimeoutMs(DWORD maxMs) const;
+
+    UINT64 GetNowMs() const { return m_nextTick - 1; }
+    size_t GetArmedCount() const { return m_armed; }
+
+private:
+    friend class CWheelTimer;
+
+    static CWheelTimer* ToTimer(TimerWheelLink* link) { return static_cast<CWheelTimer*>(link); }
+
+    void Insert(CWheelTimer& timer);
+    void Remove(CWheelTimer& timer);
+    void TakeSlot(int level, int slot, TimerWheelLink& list);
+    void Cascade(int level);
+    int FindSlot(int level, int from) const;
+
+    TimerWheelLink m_slots[LEVELS][SLOTS];     // 每个槽位一个带哨兵的循环链表
+    UINT64 m_occupied[LEVELS][SLOTS / 64];     // 非空槽位位图
+    UINT64 m_nextTick;                         // 下一个待处理的格（= 当前时刻 + 1）
+    size_t m_armed;
+};
+
+// 拥有一个时间轮的线程，供没有自己事件循环的使用者（如对话框）共享
+// - 定时器回调在本线程执行，需要回到界面线程时由回调自行 PostMessage
+// - Arm/Cancel 可在任意线程调用，转交本线程执行；Stop 之后定时器对象才能销毁
+// - 以虚拟时钟构造时不创建线程：由驱动方推进虚拟时钟后在自己的线程中调用 RunDue，
+//   GetNextTimeoutMs 给出下一次需要调用的时刻，空闲时间直接跳过（确定性测试与基准）
+class CTimerWheelThread
+{
+public:
+    explicit CTimerWheelThread(const CMonotonicClock& clock = CMonotonicClock());
+    ~CTimerWheelThread();
+
+    CTimerWheelThread(const CTimerWheelThread&) = delete;
+    CTimerWheelThread& operator=(const CTimerWheelThread&) = delete;
+
+    bool Start();
+    void Stop();
+    bool IsRunning() const { return m_thread.joinable() || m_virtualRunning; }
+
+    void Arm(CWheelTimer& timer, UINT64 delayMs);
+    void Cancel(CWheelTimer& timer);
+    // 在本线程中执行任意操作（参数为本线程的时间轮）
+    void Post(std::function<void(CTimerWheel&)> task);
+    // 时间轮使用的时钟（毫秒），与 Arm 的延时同一时基
+    UINT64 GetNowMs() const { return m_clock.NowMs(); }
+
+    // 仅虚拟时钟：执行已提交的任务与到期的定时器，返回执行的定时器回调数
+    size_t RunDue();
+    // 仅虚拟时钟，与 RunDue 在同一线程调用：距下一个定时器的毫秒数，有待执行的任务时为0
+    DWORD GetNextTimeoutMs(DWORD maxMs);
+
+private:
+    void ThreadProc();
+    void RunTasks(std::vector<std::function<void(CTimerWheel&)>>& tasks);
+
+    CMonotonicClock m_clock;
+    CTimerWheel m_wheel;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::vector<std::function<void(CTimerWheel&)>> m_tasks;
+    bool m_stop;
+    bool m_virtualRunning;
+};
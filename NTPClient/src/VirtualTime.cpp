@@ -0,0 +1,15 @@
+﻿#include "pch.h"
+#include "VirtualTime.h"
+
+INT64 CMonotonicClock::SystemNowUs()
+{
+    static const INT64 frequency = []() {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        return freq.QuadPart;
+    }();
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (now.QuadPart / frequency) * 1000000 + (now.QuadPart % frequency) * 1000000 / frequency;
+}
@@ -0,0 +1,46 @@
+﻿#pragma once
+#include <windows.h>
+#include <atomic>
+
+// 虚拟时钟：只在调用 AdvanceTo/AdvanceBy 时前进，供确定性测试与基准以远快于实时的速度运行定时器逻辑
+class CVirtualClock
+{
+public:
+    explicit CVirtualClock(INT64 startUs = 0) : m_nowUs(startUs) {}
+
+    CVirtualClock(const CVirtualClock&) = delete;
+    CVirtualClock& operator=(const CVirtualClock&) = delete;
+
+    INT64 NowUs() const { return m_nowUs.load(std::memory_order_acquire); }
+    UINT64 NowMs() const { return (UINT64)(NowUs() / 1000); }
+
+    // 只前进不后退，早于当前时刻的目标被忽略
+    void AdvanceTo(INT64 us)
+    {
+        if (us > m_nowUs.load(std::memory_order_relaxed))
+            m_nowUs.store(us, std::memory_order_release);
+    }
+    void AdvanceBy(INT64 us) { AdvanceTo(NowUs() + us); }
+
+private:
+    std::atomic<INT64> m_nowUs;
+};
+
+// 可注入的单调时钟（微秒）：默认读取系统高精度计数器，指向虚拟时钟时读取虚拟时间
+// 按值保存与传递；指向的虚拟时钟必须比使用它的对象存在得更久
+class CMonotonicClock
+{
+public:
+    CMonotonicClock() : m_virtual(nullptr) {}
+    explicit CMonotonicClock(const CVirtualClock* virtualClock) : m_virtual(virtualClock) {}
+
+    INT64 NowUs() const { return m_virtual ? m_virtual->NowUs() : SystemNowUs(); }
+    UINT64 NowMs() const { return (UINT64)(NowUs() / 1000); }
+    bool IsVirtual() const { return m_virtual != nullptr; }
+
+    // 系统单调时钟（QueryPerformanceCounter）
+    static INT64 SystemNowUs();
+
+private:
+    const CVirtualClock* m_virtual;
+};